@@ -0,0 +1,273 @@
+#include "binned_builder.hpp"
+#include "utilities/memory.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Rabbit
+{
+
+BinnedBVHBuilder::BinnedBVHBuilder(const BVHConfig& config)
+    : configuration{ config }, triangles_info{ nullptr },
+      scratch_nodes{ nullptr }, scratch_capacity{ 0 }, next_node{ 0 },
+      buckets(3 * config.num_buckets), backward_scan(config.num_buckets), peak_memory_bytes{ 0 }
+{}
+
+LinearBVHNode* BinnedBVHBuilder::Build(std::vector<TriangleInfo>& triangle_info, unsigned int root_depth,
+                                       unsigned int& total_nodes)
+{
+    // Start with room for a tree with full leafs, the scratch memory grows if the tree needs more nodes
+    const unsigned int num_triangles{ static_cast<unsigned int>(triangle_info.size()) };
+    scratch_capacity = 2 * DivideUp(num_triangles, configuration.max_triangles_in_leaf) - 1;
+    scratch_nodes = AllocateAligned<LinearBVHNode>(scratch_capacity);
+    triangles_info = triangle_info.data();
+    next_node = 0;
+    peak_memory_bytes = scratch_capacity * sizeof(LinearBVHNode);
+
+    // Compute bounds for the root
+    Geometry::BBox root_bounds;
+    Geometry::BBox root_centroids_bounds;
+    for (const TriangleInfo& info : triangle_info)
+    {
+        root_bounds = Union(root_bounds, info.bounds);
+        root_centroids_bounds = Union(root_centroids_bounds, info.centroid);
+    }
+
+    // Build tree
+    BuildNode(0, num_triangles, root_depth, root_bounds, root_centroids_bounds);
+    total_nodes = next_node;
+
+    // Copy nodes to an array of the right size
+    LinearBVHNode* nodes{ AllocateAligned<LinearBVHNode>(total_nodes) };
+    std::memcpy(nodes, scratch_nodes, total_nodes * sizeof(LinearBVHNode));
+    peak_memory_bytes = std::max(peak_memory_bytes, (scratch_capacity + total_nodes) * sizeof(LinearBVHNode));
+    FreeAligned(scratch_nodes);
+    scratch_nodes = nullptr;
+    triangles_info = nullptr;
+
+    peak_memory_bytes += (buckets.size() + backward_scan.size()) * sizeof(BinnedBucket);
+
+    return nodes;
+}
+
+unsigned int BinnedBVHBuilder::AllocateNode()
+{
+    if (next_node == scratch_capacity)
+    {
+        // Double the scratch memory
+        const unsigned int new_capacity{ 2 * scratch_capacity };
+        LinearBVHNode* new_scratch_nodes{ AllocateAligned<LinearBVHNode>(new_capacity) };
+        std::memcpy(new_scratch_nodes, scratch_nodes, scratch_capacity * sizeof(LinearBVHNode));
+        FreeAligned(scratch_nodes);
+        peak_memory_bytes = std::max(peak_memory_bytes, (scratch_capacity + new_capacity) * sizeof(LinearBVHNode));
+        scratch_nodes = new_scratch_nodes;
+        scratch_capacity = new_capacity;
+    }
+
+    return next_node++;
+}
+
+unsigned int BinnedBVHBuilder::BuildNode(unsigned int start, unsigned int end, unsigned int depth,
+                                         const Geometry::BBox& node_bounds,
+                                         const Geometry::BBox& centroids_bounds) noexcept
+{
+    // Get node for the range, the scratch memory can be reallocated by the children so the node is always accessed
+    // through its index
+    const unsigned int node_index{ AllocateNode() };
+    scratch_nodes[node_index].bounds = node_bounds;
+
+    // Create leaf if we have few enough triangles
+    const unsigned int num_triangles{ end - start };
+    if (num_triangles <= configuration.max_triangles_in_leaf)
+    {
+        MakeLeaf(node_index, start, num_triangles);
+        return node_index;
+    }
+
+    // Fill buckets and find the split with the lowest cost over all the axis
+    FillBuckets(start, end, centroids_bounds);
+    const Geometry::Vector3f centroids_bounds_diagonal{ centroids_bounds.Diagonal() };
+    const float inv_node_bounds_area{ 1.f / node_bounds.Surface() };
+    const unsigned int scan_size{ configuration.num_buckets - 1 };
+    unsigned int best_axis{ 3 };
+    unsigned int best_bucket{ 0 };
+    float best_cost{ std::numeric_limits<float>::max() };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        if (centroids_bounds_diagonal[axis] <= 0.f)
+        {
+            continue;
+        }
+        const BinnedBucket* axis_buckets{ buckets.data() + axis * configuration.num_buckets };
+
+        // Backward scan, entry i contains the union of the buckets from i + 1 to the end
+        backward_scan[scan_size - 1] = axis_buckets[scan_size];
+        for (unsigned int i = scan_size - 1; i-- > 0;)
+        {
+            backward_scan[i].num_triangles = backward_scan[i + 1].num_triangles + axis_buckets[i + 1].num_triangles;
+            backward_scan[i].bounds = Union(backward_scan[i + 1].bounds, axis_buckets[i + 1].bounds);
+        }
+
+        // Forward scan evaluating the cost of splitting after each bucket
+        unsigned int left_num_triangles{ 0 };
+        Geometry::BBox left_bounds;
+        for (unsigned int i = 0; i != scan_size; i++)
+        {
+            left_num_triangles += axis_buckets[i].num_triangles;
+            left_bounds = Union(left_bounds, axis_buckets[i].bounds);
+
+            // Evaluate SAH
+            const float split_cost{ configuration.bbox_intersect_cost +
+                                    configuration.triangle_intersect_cost *
+                                    (left_num_triangles * left_bounds.Surface() +
+                                     backward_scan[i].num_triangles * backward_scan[i].bounds.Surface()) *
+                                    inv_node_bounds_area };
+            if (split_cost < best_cost)
+            {
+                best_cost = split_cost;
+                best_axis = axis;
+                best_bucket = i;
+            }
+        }
+    }
+
+    // Check if splitting is better than creating a leaf, ranges too large for a leaf are split anyway
+    const float leaf_cost{ num_triangles * configuration.triangle_intersect_cost };
+    const bool sah_split{ best_axis != 3 && best_cost < leaf_cost };
+    if (!sah_split && num_triangles <= MAX_LEAF_TRIANGLES)
+    {
+        MakeLeaf(node_index, start, num_triangles);
+        return node_index;
+    }
+
+    // Compute bounds and size of the children from the buckets
+    Geometry::BBox left_bounds, right_bounds;
+    unsigned int left_num_triangles{ 0 };
+    if (sah_split)
+    {
+        const BinnedBucket* axis_buckets{ buckets.data() + best_axis * configuration.num_buckets };
+        for (unsigned int i = 0; i != configuration.num_buckets; i++)
+        {
+            if (i <= best_bucket)
+            {
+                left_bounds = Union(left_bounds, axis_buckets[i].bounds);
+                left_num_triangles += axis_buckets[i].num_triangles;
+            }
+            else
+            {
+                right_bounds = Union(right_bounds, axis_buckets[i].bounds);
+            }
+        }
+    }
+
+    // Fall back to the middle along the largest axis of the centroids if there is no split or if the larger child
+    // could not be split down to single triangles within the traversal stack
+    Geometry::BBox left_centroids_bounds, right_centroids_bounds;
+    unsigned int mid_index{ start };
+    if (!sah_split ||
+        depth + 1 + MedianSplitLevels(std::max(left_num_triangles, num_triangles - left_num_triangles)) >=
+        BVH_STACK_SIZE)
+    {
+        best_axis = centroids_bounds.LargestDimension();
+        mid_index = start + num_triangles / 2;
+        std::nth_element(triangles_info + start, triangles_info + mid_index, triangles_info + end,
+                         [best_axis](const TriangleInfo& first, const TriangleInfo& second) -> bool
+                         {
+                             return first.centroid[best_axis] < second.centroid[best_axis];
+                         });
+        left_bounds = Geometry::BBox{};
+        right_bounds = Geometry::BBox{};
+        RangeBounds(start, mid_index, left_bounds, left_centroids_bounds);
+        RangeBounds(mid_index, end, right_bounds, right_centroids_bounds);
+    }
+    else
+    {
+        // Partition triangles, the bounds of the centroids of the children are computed while moving the triangles
+        const float axis_reciprocal_diagonal{ 1.f / (centroids_bounds.PMax()[best_axis] -
+                                                     centroids_bounds.PMin()[best_axis]) };
+        const auto is_left = [this, &centroids_bounds, axis_reciprocal_diagonal,
+            best_axis, best_bucket](const TriangleInfo& info) -> bool
+        {
+            return BucketIndex(info.centroid, centroids_bounds, axis_reciprocal_diagonal, best_axis) <= best_bucket;
+        };
+        unsigned int right_index{ end };
+        while (true)
+        {
+            while (mid_index != right_index && is_left(triangles_info[mid_index]))
+            {
+                left_centroids_bounds = Union(left_centroids_bounds, triangles_info[mid_index].centroid);
+                mid_index++;
+            }
+            while (mid_index != right_index && !is_left(triangles_info[right_index - 1]))
+            {
+                right_index--;
+                right_centroids_bounds = Union(right_centroids_bounds, triangles_info[right_index].centroid);
+            }
+            if (mid_index == right_index)
+            {
+                break;
+            }
+            // Both elements are on the wrong side, swap them
+            right_index--;
+            std::swap(triangles_info[mid_index], triangles_info[right_index]);
+            left_centroids_bounds = Union(left_centroids_bounds, triangles_info[mid_index].centroid);
+            right_centroids_bounds = Union(right_centroids_bounds, triangles_info[right_index].centroid);
+            mid_index++;
+        }
+    }
+
+    // Create interior node, the first child is placed right after the node
+    scratch_nodes[node_index].num_triangles = 0;
+    scratch_nodes[node_index].split_axis = static_cast<uint8_t>(best_axis);
+    BuildNode(start, mid_index, depth + 1, left_bounds, left_centroids_bounds);
+    const unsigned int second_child_offset{ BuildNode(mid_index, end, depth + 1, right_bounds,
+                                                      right_centroids_bounds) };
+    scratch_nodes[node_index].second_child_offset = second_child_offset;
+
+    return node_index;
+}
+
+void BinnedBVHBuilder::RangeBounds(unsigned int start, unsigned int end, Geometry::BBox& bounds,
+                                   Geometry::BBox& centroids_bounds) const noexcept
+{
+    for (unsigned int i = start; i != end; i++)
+    {
+        bounds = Union(bounds, triangles_info[i].bounds);
+        centroids_bounds = Union(centroids_bounds, triangles_info[i].centroid);
+    }
+}
+
+void BinnedBVHBuilder::FillBuckets(unsigned int start, unsigned int end,
+                                   const Geometry::BBox& centroids_bounds) noexcept
+{
+    std::fill(buckets.begin(), buckets.end(), BinnedBucket{});
+
+    // Compute reciprocal of the diagonal for the non degenerate axis
+    const Geometry::Vector3f centroids_bounds_diagonal{ centroids_bounds.Diagonal() };
+    std::array<float, 3> axis_reciprocal_diagonal{};
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        if (centroids_bounds_diagonal[axis] > 0.f)
+        {
+            axis_reciprocal_diagonal[axis] = 1.f / (centroids_bounds.PMax()[axis] - centroids_bounds.PMin()[axis]);
+        }
+    }
+
+    for (unsigned int i = start; i != end; i++)
+    {
+        const TriangleInfo& info{ triangles_info[i] };
+        for (unsigned int axis = 0; axis != 3; axis++)
+        {
+            if (centroids_bounds_diagonal[axis] > 0.f)
+            {
+                BinnedBucket& bucket{
+                    buckets[axis * configuration.num_buckets +
+                            BucketIndex(info.centroid, centroids_bounds, axis_reciprocal_diagonal[axis], axis)] };
+                bucket.num_triangles++;
+                bucket.bounds = Union(bucket.bounds, info.bounds);
+            }
+        }
+    }
+}
+
+} // Rabbit namespace
@@ -0,0 +1,101 @@
+#ifndef RABBIT2_BINNED_BUILDER_HPP
+#define RABBIT2_BINNED_BUILDER_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Bucket used by the binned builder
+struct BinnedBucket
+{
+    BinnedBucket() noexcept
+        : num_triangles{ 0 }
+    {}
+
+    // Number of triangles in the bucket
+    unsigned int num_triangles;
+    // Bounds of the triangles in the bucket
+    Geometry::BBox bounds;
+};
+
+// Binned SAH builder working on preallocated scratch memory. The nodes are written directly in depth first order,
+// the buckets for the three axis are filled in a single pass over the triangles and the bounds needed by the children
+// are computed from the buckets and while partitioning, so each node goes over its triangles only twice
+class BinnedBVHBuilder
+{
+public:
+    explicit BinnedBVHBuilder(const BVHConfig& config);
+
+    // Build tree for the given triangles with its root at the given depth, the triangle information is reordered
+    // such that leafs reference contiguous ranges. Returns the nodes allocated with AllocateAligned and sets the
+    // number of nodes
+    LinearBVHNode* Build(std::vector<TriangleInfo>& triangle_info, unsigned int root_depth, unsigned int& total_nodes);
+
+    // Peak of the memory allocated by the last build, without the triangle information
+    size_t PeakMemoryBytes() const noexcept
+    {
+        return peak_memory_bytes;
+    }
+
+private:
+    // Get index of a new node, growing the scratch memory if needed
+    unsigned int AllocateNode();
+
+    // Fill node as leaf for the given range of triangles
+    void MakeLeaf(unsigned int node_index, unsigned int start, unsigned int num_triangles) noexcept
+    {
+        LinearBVHNode& node{ scratch_nodes[node_index] };
+        node.triangle_offset = start;
+        node.num_triangles = static_cast<uint16_t>(num_triangles);
+        node.split_axis = 3;
+    }
+
+    // Build node at the given depth for the given range and bounds, returns the index of the node. Ranges are split
+    // in the middle where needed to keep the tree within the traversal stack and the leafs within MAX_LEAF_TRIANGLES
+    unsigned int BuildNode(unsigned int start, unsigned int end, unsigned int depth,
+                           const Geometry::BBox& node_bounds, const Geometry::BBox& centroids_bounds) noexcept;
+
+    // Extend the bounds and the bounds of the centroids with the triangles of the range
+    void RangeBounds(unsigned int start, unsigned int end, Geometry::BBox& bounds,
+                     Geometry::BBox& centroids_bounds) const noexcept;
+
+    // Fill buckets for the three axis in a single pass over the range
+    void FillBuckets(unsigned int start, unsigned int end, const Geometry::BBox& centroids_bounds) noexcept;
+
+    // Compute bucket index for a centroid given the bounds of the centroids and the reciprocal of the diagonal
+    unsigned int BucketIndex(const Geometry::Point3f& centroid, const Geometry::BBox& centroids_bounds,
+                             float axis_reciprocal_diagonal, unsigned int axis) const noexcept
+    {
+        unsigned int bucket_index{
+            static_cast<unsigned int>(
+                configuration.num_buckets * (centroid[axis] - centroids_bounds.PMin()[axis]) *
+                axis_reciprocal_diagonal
+            )
+        };
+
+        // Check if we are on the end of the bounds and fix index in that case
+        if (bucket_index == configuration.num_buckets)
+        {
+            bucket_index = configuration.num_buckets - 1;
+        }
+
+        return bucket_index;
+    }
+
+    const BVHConfig configuration;
+    // Triangles information for the current build
+    TriangleInfo* triangles_info;
+    // Scratch memory for the nodes and for the buckets
+    LinearBVHNode* scratch_nodes;
+    unsigned int scratch_capacity;
+    unsigned int next_node;
+    std::vector<BinnedBucket> buckets;
+    std::vector<BinnedBucket> backward_scan;
+    // Peak memory of the last build
+    size_t peak_memory_bytes;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_BINNED_BUILDER_HPP
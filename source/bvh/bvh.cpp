@@ -3,13 +3,191 @@
 //
 
 #include "bvh.hpp"
+#include "binned_builder.hpp"
+#include "linear_builder.hpp"
+#include "treelet_optimizer.hpp"
+#include "node_layout.hpp"
+#include "bvh_cache.hpp"
 #include "utilities/memory.hpp"
+#include "utilities/thread_pool.hpp"
+#include "utilities/simd.hpp"
 
 #include <iostream>
+#include <mutex>
+#include <chrono>
+#include <queue>
 
 namespace Rabbit
 {
 
+// Number of triangles processed by each task in the parallel passes over the triangles
+constexpr unsigned int PARALLEL_PASS_GRAIN_SIZE{ 1u << 16u };
+
+// Depth of the roots of the subtrees refitted in parallel, the nodes above them are refitted by the calling thread
+constexpr unsigned int REFIT_SUBTREE_DEPTH{ 6 };
+
+// Spatial splits are tried only when the halves of the best object split overlap by more than this fraction of the
+// surface of the root
+constexpr float SPATIAL_SPLIT_OVERLAP_THRESHOLD{ 1e-5f };
+
+// Depth below which only object splits are used, the references are duplicated in the top levels of the tree only
+constexpr unsigned int MAX_SPATIAL_SPLIT_DEPTH{ 48 };
+
+namespace
+{
+
+// Check that bounds are not empty
+constexpr bool IsValidBounds(const Geometry::BBox& bounds) noexcept
+{
+    return bounds.PMin().x <= bounds.PMax().x && bounds.PMin().y <= bounds.PMax().y &&
+           bounds.PMin().z <= bounds.PMax().z;
+}
+
+// Bounds of the part of the triangle between two planes orthogonal to the axis, empty if the triangle does not
+// cross the slab
+const Geometry::BBox ClipTriangleBounds(const PrecomputedTriangle& triangle, unsigned int axis,
+                                        float plane_min, float plane_max) noexcept
+{
+    const Geometry::Point3f vertices[3]{ triangle.v0, triangle.v1, triangle.v2 };
+    Geometry::BBox bounds;
+    for (unsigned int i = 0; i != 3; i++)
+    {
+        const Geometry::Point3f& v0{ vertices[i] };
+        const Geometry::Point3f& v1{ vertices[(i + 1) % 3] };
+        if (v0[axis] >= plane_min && v0[axis] <= plane_max)
+        {
+            bounds = Union(bounds, v0);
+        }
+
+        // Add the points where the edge crosses the planes, placed exactly on them
+        for (const float plane : { plane_min, plane_max })
+        {
+            if ((v0[axis] < plane && v1[axis] > plane) || (v0[axis] > plane && v1[axis] < plane))
+            {
+                const Geometry::Point3f p{ v0 + ((plane - v0[axis]) / (v1[axis] - v0[axis])) * (v1 - v0) };
+                float coordinates[3]{ p.x, p.y, p.z };
+                coordinates[axis] = plane;
+                bounds = Union(bounds, Geometry::Point3f{ coordinates[0], coordinates[1], coordinates[2] });
+            }
+        }
+    }
+
+    return bounds;
+}
+
+// Area of the part of the triangle inside the bounds, the triangle is clipped against each of the six planes of the
+// bounds in turn and every clip adds at most one vertex to the polygon
+float ClippedTriangleArea(const PrecomputedTriangle& triangle, const Geometry::BBox& bounds) noexcept
+{
+    Geometry::Point3f polygon[9]{ triangle.v0, triangle.v1, triangle.v2 };
+    unsigned int num_vertices{ 3 };
+    for (unsigned int plane_index = 0; plane_index != 6 && num_vertices != 0; plane_index++)
+    {
+        const unsigned int axis{ plane_index / 2 };
+        const bool is_min_plane{ plane_index % 2 == 0 };
+        const float plane{ is_min_plane ? bounds.PMin()[axis] : bounds.PMax()[axis] };
+        Geometry::Point3f clipped_polygon[9];
+        unsigned int num_clipped_vertices{ 0 };
+        for (unsigned int i = 0; i != num_vertices; i++)
+        {
+            const Geometry::Point3f& v0{ polygon[i] };
+            const Geometry::Point3f& v1{ polygon[(i + 1) % num_vertices] };
+            const float d0{ is_min_plane ? v0[axis] - plane : plane - v0[axis] };
+            const float d1{ is_min_plane ? v1[axis] - plane : plane - v1[axis] };
+            if (d0 >= 0.f)
+            {
+                clipped_polygon[num_clipped_vertices++] = v0;
+            }
+            if ((d0 < 0.f && d1 > 0.f) || (d0 > 0.f && d1 < 0.f))
+            {
+                clipped_polygon[num_clipped_vertices++] = v0 + (d0 / (d0 - d1)) * (v1 - v0);
+            }
+        }
+        std::copy(clipped_polygon, clipped_polygon + num_clipped_vertices, polygon);
+        num_vertices = num_clipped_vertices;
+    }
+
+    // The polygon is convex, sum the areas of the triangles of a fan from its first vertex
+    Geometry::Vector3f area_vector{ 0.f };
+    for (unsigned int i = 1; i + 1 < num_vertices; i++)
+    {
+        area_vector += Geometry::Cross(polygon[i] - polygon[0], polygon[i + 1] - polygon[0]);
+    }
+
+    return 0.5f * Geometry::Norm(area_vector);
+}
+
+} // anonymous namespace
+
+// Rays of a packet in SoA form for the bounds tests, the unused slots have an empty interval and never hit
+template <unsigned int PacketSize>
+struct PacketTraversalRays
+{
+    static_assert(PacketSize % SIMD::NATIVE_WIDTH == 0 && PacketSize <= 32,
+                  "Packet size must be a multiple of the vector width and fit the masks");
+
+    PacketTraversalRays(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                        unsigned int num_rays) noexcept
+    {
+        for (unsigned int i = 0; i != PacketSize; i++)
+        {
+            const bool is_used{ i < num_rays };
+            const Geometry::Vector3f reciprocal_dir{
+                is_used ? rays[i].ReciprocalDirection() : Geometry::Vector3f{ 1.f } };
+            for (unsigned int axis = 0; axis != 3; axis++)
+            {
+                origin[axis][i] = is_used ? rays[i].Origin()[axis] : 0.f;
+                reciprocal_direction[axis][i] = reciprocal_dir[axis];
+            }
+            t_start[i] = is_used ? intervals[i].Start() : std::numeric_limits<float>::max();
+            t_end[i] = is_used ? intervals[i].End() : std::numeric_limits<float>::lowest();
+        }
+    }
+
+    // Test bounds against all the rays, returns the mask of the rays that hit
+    unsigned int Intersect(const Geometry::BBox& bounds) const noexcept
+    {
+        using Vector = SIMD::FloatVector<SIMD::NATIVE_WIDTH>;
+
+        Vector bounds_min[3], bounds_max[3];
+        for (unsigned int axis = 0; axis != 3; axis++)
+        {
+            bounds_min[axis] = Vector{ bounds.PMin()[axis] };
+            bounds_max[axis] = Vector{ bounds.PMax()[axis] };
+        }
+
+        unsigned int hit_mask{ 0 };
+        for (unsigned int first = 0; first != PacketSize; first += SIMD::NATIVE_WIDTH)
+        {
+            Vector t_near{ Vector::Load(t_start + first) };
+            Vector t_far{ Vector::Load(t_end + first) };
+            for (unsigned int axis = 0; axis != 3; axis++)
+            {
+                const Vector ray_origin{ Vector::Load(origin[axis] + first) };
+                const Vector ray_reciprocal_direction{ Vector::Load(reciprocal_direction[axis] + first) };
+                const Vector t0{ (bounds_min[axis] - ray_origin) * ray_reciprocal_direction };
+                const Vector t1{ (bounds_max[axis] - ray_origin) * ray_reciprocal_direction };
+                t_near = Max(t_near, Min(t0, t1));
+                t_far = Min(t_far, Max(t0, t1));
+            }
+            hit_mask |= (t_near <= t_far).Bits() << first;
+        }
+
+        return hit_mask;
+    }
+
+    alignas(32) float origin[3][PacketSize];
+    alignas(32) float reciprocal_direction[3][PacketSize];
+    alignas(32) float t_start[PacketSize];
+    alignas(32) float t_end[PacketSize];
+};
+
+// Mask with the first num_rays bits set
+constexpr unsigned int RaysMask(unsigned int num_rays) noexcept
+{
+    return num_rays >= 32 ? ~0u : (1u << num_rays) - 1u;
+}
+
 // BVH building node
 struct BVHBuildNode
 {
@@ -36,34 +214,98 @@ struct BVHBuildNode
 };
 
 BVH::BVH(const BVHConfig& config, const std::vector<Triangle>& tr)
-    : configuration{ config }, triangles{ tr }, total_nodes{ 0 }, flat_tree_nodes{ nullptr }
+    : configuration{ config }, triangles{ tr },
+      num_precomputed_triangles{ 0 }, precomputed_triangles{ nullptr },
+      triangle_packets4{ nullptr }, triangle_packets8{ nullptr }, total_nodes{ 0 }, flat_tree_nodes{ nullptr },
+      node_layout{ BVHNodeLayout::DEPTH_FIRST }
 {
-    Build();
+    Build(true);
 }
 
 BVH::BVH(const BVHConfig& config, std::vector<Triangle>&& tr)
-    : configuration{ config }, triangles{ std::move(tr) }, total_nodes{ 0 }, flat_tree_nodes{ nullptr }
+    : configuration{ config }, triangles{ std::move(tr) },
+      num_precomputed_triangles{ 0 }, precomputed_triangles{ nullptr },
+      triangle_packets4{ nullptr }, triangle_packets8{ nullptr }, total_nodes{ 0 }, flat_tree_nodes{ nullptr },
+      node_layout{ BVHNodeLayout::DEPTH_FIRST }
+{
+    Build(true);
+}
+
+// The data of the cache is only read, the refit copies it before modifying it
+BVH::BVH(const BVHConfig& config, std::vector<Triangle>&& tr, std::shared_ptr<const BVHCache> bvh_cache)
+    : configuration{ config }, triangles{ std::move(tr) },
+      num_precomputed_triangles{ bvh_cache->NumPrecomputedTriangles() },
+      precomputed_triangles{ const_cast<PrecomputedTriangle*>(bvh_cache->PrecomputedTriangles()) },
+      triangle_packets4{ const_cast<TrianglePacket4*>(bvh_cache->TrianglePackets4()) },
+      triangle_packets8{ const_cast<TrianglePacket8*>(bvh_cache->TrianglePackets8()) },
+      total_nodes{ bvh_cache->NumNodes() }, flat_tree_nodes{ const_cast<LinearBVHNode*>(bvh_cache->Nodes()) },
+      node_layout{ bvh_cache->NodeLayout() }, build_statistics{ bvh_cache->BuildStatistics() },
+      subtree_build_costs{ bvh_cache->SubtreeBuildCosts() }, cache{ std::move(bvh_cache) }
 {
-    Build();
+    if (triangles.size() != cache->NumTriangles())
+    {
+        throw std::runtime_error("The triangles do not match the ones of the BVH cache\n");
+    }
+    if (node_layout != configuration.node_layout ||
+        (configuration.leaf_format == BVHLeafFormat::PACKETS4) != (triangle_packets4 != nullptr) ||
+        (configuration.leaf_format == BVHLeafFormat::PACKETS8) != (triangle_packets8 != nullptr))
+    {
+        throw std::runtime_error("The BVH cache was built with a different configuration\n");
+    }
+    if (subtree_build_costs.size() != RefitSubtreeRoots().size())
+    {
+        throw std::runtime_error("The BVH cache is corrupted\n");
+    }
 }
 
 BVH::BVH(BVH&& other) noexcept
     : configuration{ other.configuration }, triangles{ std::move(other.triangles) },
-      total_nodes{ other.total_nodes }, flat_tree_nodes{ nullptr }
+      num_precomputed_triangles{ other.num_precomputed_triangles }, precomputed_triangles{ nullptr },
+      triangle_packets4{ other.triangle_packets4 }, triangle_packets8{ other.triangle_packets8 },
+      total_nodes{ other.total_nodes }, flat_tree_nodes{ nullptr }, node_layout{ other.node_layout },
+      build_statistics{ other.build_statistics },
+      subtree_build_costs{ std::move(other.subtree_build_costs) }, cache{ std::move(other.cache) }
 {
-    // Take ownership of nodes
+    // Take ownership of nodes and precomputed triangles
     flat_tree_nodes = other.flat_tree_nodes;
+    precomputed_triangles = other.precomputed_triangles;
     other.flat_tree_nodes = nullptr;
     other.total_nodes = 0;
+    other.precomputed_triangles = nullptr;
+    other.num_precomputed_triangles = 0;
+    other.triangle_packets4 = nullptr;
+    other.triangle_packets8 = nullptr;
 }
 
 BVH::~BVH() noexcept
 {
-    FreeAligned(flat_tree_nodes);
+    // Data used from the cache is released with it
+    if (cache == nullptr)
+    {
+        FreeAligned(flat_tree_nodes);
+        FreeAligned(precomputed_triangles);
+        FreeAligned(triangle_packets4);
+        FreeAligned(triangle_packets8);
+    }
 }
 
 bool BVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
                     Geometry::TriangleIntersection& intersection) const noexcept
+{
+    // If we did hit something, fill the intersection and return true
+    if (IntersectClosest(ray, interval, intersection))
+    {
+        intersection.hit_triangle->ComputeIntersectionGeometry(ray, interval.End(), intersection);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool BVH::IntersectClosest(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                           Geometry::TriangleIntersection& intersection) const noexcept
 {
 #ifndef NDEBUG
     if (triangles.empty())
@@ -74,12 +316,13 @@ bool BVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
 
     // Compute values needed for traversal
     const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    const WatertightRay watertight_ray{ ray };
     const std::array<bool, 3> dir_is_neg{ reciprocal_dir.x < 0.f, reciprocal_dir.y < 0.f, reciprocal_dir.z < 0.f };
 
     // Follow ray through BVH
     unsigned int to_visit_offset{ 0 };
     unsigned int current_node_index{ 0 };
-    unsigned int nodes_to_visit[64];
+    unsigned int nodes_to_visit[BVH_STACK_SIZE];
     while (true)
     {
         // Get current node
@@ -90,11 +333,9 @@ bool BVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
             // Check for leaf or interior
             if (current_node.num_triangles != 0)
             {
-                for (unsigned int i = 0; i != current_node.num_triangles; i++)
-                {
-                    // Intersect ray with triangles in leaf
-                    triangles[current_node.triangle_offset + i].Intersect(ray, interval, intersection);
-                }
+                // Intersect ray with triangles in leaf
+                IntersectLeaf(watertight_ray, current_node.triangle_offset, current_node.num_triangles,
+                              interval, intersection);
                 // Check if we still have node to visit
                 if (to_visit_offset == 0)
                 {
@@ -105,15 +346,16 @@ bool BVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
             else
             {
                 // Put far node on stack and visit closest one
+                const unsigned int first_child_index{ FirstChildIndex(current_node_index, current_node) };
                 if (dir_is_neg[current_node.split_axis])
                 {
-                    nodes_to_visit[to_visit_offset++] = current_node_index + 1;
+                    nodes_to_visit[to_visit_offset++] = first_child_index;
                     current_node_index = current_node.second_child_offset;
                 }
                 else
                 {
                     nodes_to_visit[to_visit_offset++] = current_node.second_child_offset;
-                    current_node_index++;
+                    current_node_index = first_child_index;
                 }
             }
         }
@@ -128,16 +370,7 @@ bool BVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
         }
     }
 
-    // If we did hit something, fill the intersection and return true
-    if (intersection.IsValid())
-    {
-        intersection.hit_triangle->ComputeIntersectionGeometry(ray, interval.End(), intersection);
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return intersection.IsValid();
 }
 
 bool BVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
@@ -151,12 +384,13 @@ bool BVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& int
 
     // Compute values needed for traversal
     const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    const WatertightRay watertight_ray{ ray };
     const std::array<bool, 3> dir_is_neg{ reciprocal_dir.x < 0.f, reciprocal_dir.y < 0.f, reciprocal_dir.z < 0.f };
 
     // Follow ray through BVH
     unsigned int to_visit_offset{ 0 };
     unsigned int current_node_index{ 0 };
-    unsigned int nodes_to_visit[64];
+    unsigned int nodes_to_visit[BVH_STACK_SIZE];
     while (true)
     {
         // Get current node
@@ -167,14 +401,11 @@ bool BVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& int
             // Check for leaf or interior
             if (current_node.num_triangles != 0)
             {
-                for (unsigned int i = 0; i != current_node.num_triangles; i++)
+                if (IntersectLeafTest(watertight_ray, current_node.triangle_offset, current_node.num_triangles,
+                                      interval))
                 {
-                    const unsigned int triangle_index{ current_node.triangle_offset + i };
-                    if (triangles[triangle_index].IntersectTest(ray, interval))
-                    {
-                        // As soon as we hit something, return true
-                        return true;
-                    }
+                    // As soon as we hit something, return true
+                    return true;
                 }
                 // Check if we still have node to visit
                 if (to_visit_offset == 0)
@@ -186,15 +417,16 @@ bool BVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& int
             else
             {
                 // Put far node on stack and visit closest one
+                const unsigned int first_child_index{ FirstChildIndex(current_node_index, current_node) };
                 if (dir_is_neg[current_node.split_axis])
                 {
-                    nodes_to_visit[to_visit_offset++] = current_node_index + 1;
+                    nodes_to_visit[to_visit_offset++] = first_child_index;
                     current_node_index = current_node.second_child_offset;
                 }
                 else
                 {
                     nodes_to_visit[to_visit_offset++] = current_node.second_child_offset;
-                    current_node_index++;
+                    current_node_index = first_child_index;
                 }
             }
         }
@@ -213,7 +445,7 @@ bool BVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& int
     return false;
 }
 
-void BVH::Build()
+void BVH::Build(bool reorder_triangles)
 {
     // Check that the list of triangles is not empty
     if (triangles.empty())
@@ -222,245 +454,1537 @@ void BVH::Build()
     }
 
     // Create list with information for each triangle
-    std::vector<TriangleInfo> triangle_info;
-    triangle_info.reserve(triangles.size());
-    for (unsigned int i = 0; i != triangles.size(); i++)
+    const auto build_start{ std::chrono::high_resolution_clock::now() };
+    const unsigned int num_triangles{ static_cast<unsigned int>(triangles.size()) };
+    std::vector<TriangleInfo> triangle_info(num_triangles);
+    const auto fill_triangle_info = [this, &triangle_info](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int i = start; i != end; i++)
+        {
+            triangle_info[i] = TriangleInfo{ i, triangles[i].Bounds() };
+        }
+    };
+    if (IsParallelRange(num_triangles, num_triangles))
+    {
+        ThreadPool::Global().ParallelFor(0, num_triangles, PARALLEL_PASS_GRAIN_SIZE, fill_triangle_info);
+    }
+    else
+    {
+        fill_triangle_info(0, num_triangles);
+    }
+
+    // Split triangles with loose bounds before building
+    if (configuration.pre_split_budget > 0.f)
+    {
+        PreSplitTriangles(triangle_info);
+    }
+
+    // The spatial splits clip the triangles against the split planes
+    std::vector<PrecomputedTriangle> vertices;
+    if (configuration.build_method == BVHBuildMethod::SPATIAL)
+    {
+        vertices.reserve(num_triangles);
+        for (unsigned int i = 0; i != num_triangles; i++)
+        {
+            vertices.push_back(triangles[i].Precompute(i));
+        }
+    }
+
+    // Build the tree with the requested method, all of them leave the triangle information in leaf order
+    size_t builder_memory_bytes{ 0 };
+    flat_tree_nodes = BuildNodes(triangle_info, vertices.data(), 0, total_nodes, builder_memory_bytes);
+    builder_memory_bytes += vertices.size() * sizeof(PrecomputedTriangle);
+    vertices = std::vector<PrecomputedTriangle>{};
+
+    // Restructure the tree to lower its cost, the triangle information follows the new leafs
+    build_statistics.optimization_time_ms = 0.f;
+    build_statistics.num_optimization_passes = 0;
+    if (configuration.optimization_time_budget_ms > 0.f)
     {
-        triangle_info.emplace_back(i, triangles[i].Bounds());
+        const auto optimization_start{ std::chrono::high_resolution_clock::now() };
+        TreeletOptimizer optimizer{ configuration };
+        LinearBVHNode* optimized_nodes{ optimizer.Optimize(flat_tree_nodes, total_nodes, triangle_info,
+                                                           configuration.optimization_time_budget_ms) };
+        FreeAligned(flat_tree_nodes);
+        flat_tree_nodes = optimized_nodes;
+        builder_memory_bytes = std::max(builder_memory_bytes, optimizer.PeakMemoryBytes());
+        build_statistics.optimization_time_ms = std::chrono::duration<float, std::milli>(
+            std::chrono::high_resolution_clock::now() - optimization_start).count();
+        build_statistics.num_optimization_passes = optimizer.NumPasses();
     }
 
     // The building process has the freedom of swapping the triangles around such that triangles in the same leaf
-    // are also close in memory
-    std::vector<Triangle> ordered_triangles;
-    ordered_triangles.reserve(triangles.size());
+    // are also close in memory, the leafs reference the triangles in the final order of triangle_info. A triangle
+    // referenced by several leafs is stored once, in the position of its first reference
+    if (reorder_triangles)
+    {
+        std::vector<Triangle> ordered_triangles;
+        ordered_triangles.reserve(triangles.size());
+        std::vector<unsigned int> new_indices(triangles.size(),
+                                              static_cast<unsigned int>(PrecomputedTriangle::EMPTY_INDEX));
+        for (TriangleInfo& info : triangle_info)
+        {
+            unsigned int& new_index{ new_indices[info.triangle_index] };
+            if (new_index == PrecomputedTriangle::EMPTY_INDEX)
+            {
+                ordered_triangles.push_back(triangles[info.triangle_index]);
+                new_index = static_cast<unsigned int>(ordered_triangles.size() - 1);
+            }
+            info.triangle_index = new_index;
+        }
+        assert(ordered_triangles.size() == triangles.size());
 
-    // Start building
-    const std::unique_ptr<BVHBuildNode> root{ RecursiveBuild(triangle_info,
-                                                             0, static_cast<unsigned int>(triangle_info.size()),
-                                                             ordered_triangles) };
+        // Move the content of the ordered_triangles in the local triangles
+        triangles = std::move(ordered_triangles);
+    }
 
-    // Move the content of the ordered_triangles in the local triangles
-    triangles = std::move(ordered_triangles);
+    // Precompute the data used by the intersection kernels
+    BuildLeafData(triangle_info);
 
-    // Bring tree into flat representation
-    unsigned int offset{ 0 };
-    flat_tree_nodes = AllocateAligned<LinearBVHNode>(total_nodes);
-    FlattenTree(root, offset);
-    assert(offset == total_nodes);
-}
+    // Reorder the nodes for the traversal, the triangles stay in depth first order
+    SwitchNodeLayout(false);
+    const auto build_end{ std::chrono::high_resolution_clock::now() };
 
-std::unique_ptr<BVHBuildNode> BVH::RecursiveBuild(std::vector<TriangleInfo>& triangle_info,
-                                                  unsigned int start, unsigned int end,
-                                                  std::vector<Triangle>& ordered_triangles) noexcept
-{
-    // Increase by 1 the number of created nodes
-    total_nodes++;
+    size_t packets_bytes{ 0 };
+    if (configuration.leaf_format == BVHLeafFormat::PACKETS4)
+    {
+        packets_bytes = num_precomputed_triangles / 4 * sizeof(TrianglePacket4);
+    }
+    else if (configuration.leaf_format == BVHLeafFormat::PACKETS8)
+    {
+        packets_bytes = num_precomputed_triangles / 8 * sizeof(TrianglePacket8);
+    }
 
-    // First thing we do is compute the BBox of all the triangles in this node
-    Geometry::BBox node_bounds;
-    for (unsigned int i = start; i != end; i++)
+    // Store statistics, the peak is reached either while building or while reordering the triangles and the nodes.
+    // Reordering the nodes in a layout other than depth first keeps two copies of them
+    const size_t nodes_bytes{ total_nodes * sizeof(LinearBVHNode) *
+                              (configuration.node_layout != BVHNodeLayout::DEPTH_FIRST ? 2 : 1) };
+    build_statistics.build_time_ms = std::chrono::duration<float, std::milli>(build_end - build_start).count();
+    build_statistics.builder_peak_memory_bytes = builder_memory_bytes;
+    build_statistics.num_references = static_cast<unsigned int>(triangle_info.size());
+    build_statistics.peak_memory_bytes = triangle_info.size() * sizeof(TriangleInfo) +
+                                         std::max(builder_memory_bytes,
+                                                  nodes_bytes +
+                                                  triangles.size() * sizeof(Triangle) +
+                                                  num_precomputed_triangles * sizeof(PrecomputedTriangle) +
+                                                  packets_bytes);
+
+    // Keep the costs the refit quality is compared to
+    build_statistics.sah_cost = SAHCost();
+    subtree_build_costs.clear();
+    for (const unsigned int root_index : RefitSubtreeRoots())
     {
-        node_bounds = Union(node_bounds, triangle_info[i].bounds);
+        subtree_build_costs.push_back(SAHCost(root_index));
     }
+}
 
-    // Compute number of triangles for this node
-    const unsigned int num_triangles{ end - start };
+void BVH::PreSplitTriangles(std::vector<TriangleInfo>& triangle_info) const
+{
+    const unsigned int num_triangles{ static_cast<unsigned int>(triangle_info.size()) };
+    unsigned int remaining_budget{ static_cast<unsigned int>(configuration.pre_split_budget * num_triangles) };
+    triangle_info.reserve(num_triangles + remaining_budget);
 
-    // If there are less triangles than the maximum, create leaf
-    if (num_triangles <= configuration.max_triangles_in_leaf)
+    // Queue the references with loose bounds, the one with the largest bounds on top
+    std::priority_queue<std::pair<float, unsigned int>> split_queue;
+    const auto queue_if_loose = [this, &split_queue](const Geometry::BBox& bounds, float area,
+                                                     unsigned int reference_index) -> void
     {
-        const unsigned int first_triangle_offset{ static_cast<unsigned int>(ordered_triangles.size()) };
-        for (unsigned int i = start; i != end; i++)
+        const float surface{ bounds.Surface() };
+        if (surface > configuration.pre_split_surface_ratio * area)
         {
-            const unsigned int triangle_index{ triangle_info[i].triangle_index };
-            ordered_triangles.push_back(triangles[triangle_index]);
+            split_queue.emplace(surface, reference_index);
         }
-
-        return std::make_unique<BVHBuildNode>(first_triangle_offset, num_triangles, node_bounds);
+    };
+    for (unsigned int i = 0; i != num_triangles; i++)
+    {
+        const unsigned int triangle_index{ triangle_info[i].triangle_index };
+        const PrecomputedTriangle triangle{ triangles[triangle_index].Precompute(triangle_index) };
+        const float area{
+            0.5f * Geometry::Norm(Geometry::Cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0)) };
+        queue_if_loose(triangle_info[i].bounds, area, i);
     }
-    else
+
+    // Each split replaces a reference with the parts of the triangle in the two halves of its bounds, cut along
+    // the largest dimension. The halves are split again while their bounds are still loose compared to the area of
+    // the part of the triangle they hold
+    while (remaining_budget != 0 && !split_queue.empty())
     {
-        // Split triangles
-        PartitionResult partition_result;
-        if (PartitionTriangles(triangle_info, start, end, node_bounds, partition_result))
+        const unsigned int reference_index{ split_queue.top().second };
+        split_queue.pop();
+        const TriangleInfo reference{ triangle_info[reference_index] };
+        const unsigned int split_axis{ reference.bounds.LargestDimension() };
+        const float position{ reference.bounds.Centroid()[split_axis] };
+        const PrecomputedTriangle triangle{
+            triangles[reference.triangle_index].Precompute(reference.triangle_index) };
+        const Geometry::BBox left_bounds{
+            Geometry::Intersection(ClipTriangleBounds(triangle, split_axis,
+                                                      std::numeric_limits<float>::lowest(), position),
+                                   reference.bounds) };
+        const Geometry::BBox right_bounds{
+            Geometry::Intersection(ClipTriangleBounds(triangle, split_axis,
+                                                      position, std::numeric_limits<float>::max()),
+                                   reference.bounds) };
+        if (!IsValidBounds(left_bounds) || !IsValidBounds(right_bounds))
         {
-            // Recursively build tree
-            return std::make_unique<BVHBuildNode>(partition_result.split_axis,
-                                                  RecursiveBuild(triangle_info, start, partition_result.mid_index,
-                                                                 ordered_triangles),
-                                                  RecursiveBuild(triangle_info, partition_result.mid_index, end,
-                                                                 ordered_triangles));
+            continue;
         }
-        else
-        {
-            // Create leaf node
-            const unsigned int first_triangle_offset{ static_cast<unsigned int>(ordered_triangles.size()) };
-            for (unsigned int i = start; i != end; i++)
-            {
-                const unsigned int triangle_index{ triangle_info[i].triangle_index };
-                ordered_triangles.push_back(triangles[triangle_index]);
-            }
 
-            return std::make_unique<BVHBuildNode>(first_triangle_offset, num_triangles, node_bounds);
-        }
+        triangle_info[reference_index] = TriangleInfo{ reference.triangle_index, left_bounds };
+        triangle_info.emplace_back(reference.triangle_index, right_bounds);
+        remaining_budget--;
+        queue_if_loose(left_bounds, ClippedTriangleArea(triangle, left_bounds), reference_index);
+        queue_if_loose(right_bounds, ClippedTriangleArea(triangle, right_bounds),
+                       static_cast<unsigned int>(triangle_info.size() - 1));
     }
 }
 
-// Helper struct to compute the cost of each bucket
-struct BucketInfo
+LinearBVHNode* BVH::BuildNodes(std::vector<TriangleInfo>& triangle_info, const PrecomputedTriangle* vertices,
+                               unsigned int root_depth, unsigned int& num_nodes, size_t& builder_memory_bytes)
 {
-    BucketInfo() noexcept
-        : num_triangles{ 0 }
-    {}
+    if (configuration.build_method == BVHBuildMethod::BINNED)
+    {
+        BinnedBVHBuilder builder{ configuration };
+        LinearBVHNode* nodes{ builder.Build(triangle_info, root_depth, num_nodes) };
+        builder_memory_bytes = builder.PeakMemoryBytes();
 
-    // Number of triangles in the bucket
-    unsigned int num_triangles;
-    // Bounds of the bucket
-    Geometry::BBox bounds;
-};
+        return nodes;
+    }
+    if (configuration.build_method == BVHBuildMethod::LINEAR ||
+        configuration.build_method == BVHBuildMethod::LINEAR_SAH)
+    {
+        LinearBVHBuilder builder{ configuration };
+        LinearBVHNode* nodes{ builder.Build(triangle_info, root_depth, num_nodes) };
+        builder_memory_bytes = builder.PeakMemoryBytes();
 
-bool BVH::PartitionTriangles(std::vector<TriangleInfo>& triangle_info,
-                             unsigned int start, unsigned int end,
-                             const Geometry::BBox& node_bounds,
-                             PartitionResult& partition_result) const noexcept
-{
-    // Compute bounds of the centroids of the triangles
-    Geometry::BBox centroids_bounds;
-    for (unsigned int i = start; i != end; i++)
+        return nodes;
+    }
+
+    std::unique_ptr<BVHBuildNode> root;
+    size_t references_bytes{ 0 };
+    if (configuration.build_method == BVHBuildMethod::SPATIAL)
+    {
+        // The references of each node are split in new lists for the children, the leafs collect them in order
+        const unsigned int num_triangles{ static_cast<unsigned int>(triangle_info.size()) };
+        unsigned int remaining_budget{ static_cast<unsigned int>(configuration.spatial_split_budget * num_triangles) };
+        std::vector<TriangleInfo> leaf_references;
+        leaf_references.reserve(num_triangles + remaining_budget);
+        const Geometry::BBox root_bounds{ ComputeRangeBounds(triangle_info, 0, num_triangles, false, false) };
+        unsigned int created_nodes{ 0 };
+        root = SpatialSplitBuild(triangle_info, root_bounds, vertices, root_bounds.Surface(), root_depth,
+                                 remaining_budget, leaf_references, created_nodes);
+        num_nodes = created_nodes;
+        references_bytes = leaf_references.capacity() * sizeof(TriangleInfo);
+        triangle_info = std::move(leaf_references);
+    }
+    else
     {
-        centroids_bounds = Union(centroids_bounds, triangle_info[i].centroid);
+        std::atomic_uint created_nodes{ 0 };
+        root = RecursiveBuild(triangle_info, 0, static_cast<unsigned int>(triangle_info.size()), root_depth,
+                              created_nodes);
+        num_nodes = created_nodes;
     }
-    const Geometry::Vector3f centroids_bounds_diagonal{ centroids_bounds.Diagonal() };
 
-    // Loop over the 3 axis and compute SAH
-    std::array<std::pair<unsigned int, float>, 3> sah_axis;
-    for (unsigned int split_axis = 0; split_axis != 3; split_axis++)
+    // Bring tree into flat representation
+    unsigned int offset{ 0 };
+    LinearBVHNode* nodes{ AllocateAligned<LinearBVHNode>(num_nodes) };
+    FlattenTree(root, nodes, offset);
+    assert(offset == num_nodes);
+    builder_memory_bytes = num_nodes * (sizeof(BVHBuildNode) + sizeof(LinearBVHNode)) + references_bytes;
+
+    return nodes;
+}
+
+void BVH::BuildLeafData(const std::vector<TriangleInfo>& triangle_info)
+{
+    const unsigned int num_triangles{ static_cast<unsigned int>(triangle_info.size()) };
+    if (configuration.leaf_format == BVHLeafFormat::TRIANGLES)
     {
-        if (centroids_bounds_diagonal[split_axis] > 0.f)
+        // References are already in leaf order, precompute the world space vertices in the same order
+        num_precomputed_triangles = num_triangles;
+        precomputed_triangles = AllocateAligned<PrecomputedTriangle>(num_precomputed_triangles);
+        const auto fill_precomputed_triangles = [this, &triangle_info](unsigned int start, unsigned int end) -> void
         {
-            // Compute buckets for SAH unless bounds on that dimension are degenerate
-            const std::vector<BucketInfo> buckets{ ComputeBucketsInfo(triangle_info,
-                                                                      start, end,
-                                                                      centroids_bounds,
-                                                                      split_axis) };
-
-            sah_axis[split_axis] = FindBestBucketIndex(buckets, node_bounds);
+            for (unsigned int i = start; i != end; i++)
+            {
+                const unsigned int triangle_index{ triangle_info[i].triangle_index };
+                precomputed_triangles[i] = triangles[triangle_index].Precompute(triangle_index);
+            }
+        };
+        if (IsParallelRange(num_triangles, num_triangles))
+        {
+            ThreadPool::Global().ParallelFor(0, num_triangles, PARALLEL_PASS_GRAIN_SIZE, fill_precomputed_triangles);
         }
         else
         {
-            sah_axis[split_axis].second = std::numeric_limits<float>::max();
+            fill_precomputed_triangles(0, num_triangles);
         }
+        return;
     }
 
-    // Find best split axis
-    std::pair<unsigned int, float> sah_result{ sah_axis[0] };
-    partition_result.split_axis = 0;
-    for (unsigned int i = 1; i != 3; i++)
+    // Each leaf starts a new packet, the tail of its last packet is filled with empty entries
+    const unsigned int packet_width{ configuration.leaf_format == BVHLeafFormat::PACKETS4 ? 4u : 8u };
+    const PrecomputedTriangle empty_triangle{ Geometry::Point3f{}, Geometry::Point3f{}, Geometry::Point3f{},
+                                              PrecomputedTriangle::EMPTY_INDEX };
+    num_precomputed_triangles = 0;
+    for (unsigned int node_index = 0; node_index != total_nodes; node_index++)
+    {
+        num_precomputed_triangles += LeafEntries(flat_tree_nodes[node_index].num_triangles);
+    }
+    precomputed_triangles = AllocateAligned<PrecomputedTriangle>(num_precomputed_triangles);
+    unsigned int packed_offset{ 0 };
+    for (unsigned int node_index = 0; node_index != total_nodes; node_index++)
     {
-        if (sah_axis[i].second < sah_result.second)
+        LinearBVHNode& node{ flat_tree_nodes[node_index] };
+        if (node.num_triangles == 0)
         {
-            sah_result = sah_axis[i];
-            partition_result.split_axis = i;
+            continue;
         }
+        for (unsigned int i = 0; i != node.num_triangles; i++)
+        {
+            const unsigned int triangle_index{ triangle_info[node.triangle_offset + i].triangle_index };
+            precomputed_triangles[packed_offset + i] = triangles[triangle_index].Precompute(triangle_index);
+        }
+        std::fill(precomputed_triangles + packed_offset + node.num_triangles,
+                  precomputed_triangles + packed_offset + LeafEntries(node.num_triangles), empty_triangle);
+        node.triangle_offset = packed_offset;
+        packed_offset += LeafEntries(node.num_triangles);
     }
 
-    // Check if splitting for the selected axis is better than creating a leaf
-    const float leaf_cost{ (end - start) * configuration.triangle_intersect_cost };
-    if (sah_result.second < leaf_cost)
+    if (packet_width == 4)
     {
-        const float split_axis_reciprocal_diagonal{ 1.f / centroids_bounds_diagonal[partition_result.split_axis] };
-        const auto mid{ std::partition(triangle_info.begin() + start,
-                                       triangle_info.begin() + end,
-                                       [this, split_axis_reciprocal_diagonal, &sah_result,
-                                           &centroids_bounds, &partition_result](const TriangleInfo& triangle_info)
-                                       {
-                                           // Compute index of the bucket where the triangle centroid is
-                                           unsigned int bucket_index{
-                                               static_cast<unsigned int>(
-                                                   configuration.num_buckets *
-                                                   (triangle_info.centroid[partition_result.split_axis] -
-                                                    centroids_bounds.PMin()[partition_result.split_axis]) *
-                                                   split_axis_reciprocal_diagonal
-                                               )
-                                           };
-
-                                           // Check if we are on the end of the bounds and fix index in that case
-                                           if (bucket_index == configuration.num_buckets)
-                                           {
-                                               bucket_index = configuration.num_buckets - 1;
-                                           }
-
-                                           return bucket_index <= sah_result.first;
-                                       }) };
-        partition_result.mid_index = static_cast<unsigned int>(std::distance(triangle_info.begin(), mid));
-
-        return true;
+        triangle_packets4 = BuildTrianglePackets<4>();
     }
     else
     {
-        // Split is not worth it, create leaf
-        return false;
+        triangle_packets8 = BuildTrianglePackets<8>();
     }
 }
 
-const std::vector<BucketInfo> BVH::ComputeBucketsInfo(const std::vector<TriangleInfo>& triangle_info,
-                                                      unsigned int start, unsigned int end,
-                                                      const Geometry::BBox& centroids_bounds,
-                                                      unsigned int split_axis) const noexcept
+template <unsigned int Width>
+TrianglePacket<Width>* BVH::BuildTrianglePackets() const
 {
-    std::vector<BucketInfo> buckets(configuration.num_buckets);
-    const float split_axis_reciprocal_diagonal{ 1.f /
-                                                (centroids_bounds.PMax()[split_axis] -
-                                                 centroids_bounds.PMin()[split_axis]) };
-    for (unsigned int i = start; i != end; i++)
-    {
-        // Compute index of the bucket where the triangle centroid is
-        unsigned int bucket_index{
-            static_cast<unsigned int>(
-                configuration.num_buckets *
-                (triangle_info[i].centroid[split_axis] - centroids_bounds.PMin()[split_axis]) *
-                split_axis_reciprocal_diagonal
-            )
-        };
+    const unsigned int num_packets{ num_precomputed_triangles / Width };
+    TrianglePacket<Width>* packets{ AllocateAligned<TrianglePacket<Width>>(num_packets) };
+    for (unsigned int p = 0; p != num_packets; p++)
+    {
+        // Leafs start at the beginning of a packet, so the first entry is never empty
+        const PrecomputedTriangle* packet_triangles{ precomputed_triangles + p * Width };
+        unsigned int num_packet_triangles{ 0 };
+        while (num_packet_triangles != Width &&
+               packet_triangles[num_packet_triangles].triangle_index != PrecomputedTriangle::EMPTY_INDEX)
+        {
+            num_packet_triangles++;
+        }
+        packets[p].Fill(packet_triangles, num_packet_triangles);
+    }
+
+    return packets;
+}
+
+template <unsigned int Width>
+void BVH::FillTrianglePackets(TrianglePacket<Width>* packets, unsigned int triangle_offset,
+                              unsigned int num_triangles) const noexcept
+{
+    const unsigned int first_packet{ triangle_offset / Width };
+    for (unsigned int p = 0; p != DivideUp(num_triangles, Width); p++)
+    {
+        packets[first_packet + p].Fill(precomputed_triangles + triangle_offset + p * Width,
+                                       std::min(Width, num_triangles - p * Width));
+    }
+}
+
+const BVHRefitStatistics BVH::Refit(const BVHRefitConfig& config)
+{
+    BVHRefitStatistics statistics;
+
+    // Refit the subtrees in parallel, then the nodes above them. The subtrees need to be contiguous, so the other
+    // layouts go through the depth first one
+    const auto refit_start{ std::chrono::high_resolution_clock::now() };
+    ReleaseCache();
+    SwitchNodeLayout(true);
+    const std::vector<unsigned int> subtree_roots{ RefitSubtreeRoots() };
+    const auto refit_subtrees = [this, &subtree_roots](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int i = start; i != end; i++)
+        {
+            RefitSubtree(subtree_roots[i]);
+        }
+    };
+    const unsigned int num_subtrees{ static_cast<unsigned int>(subtree_roots.size()) };
+    if (triangles.size() >= PARALLEL_PASS_GRAIN_SIZE)
+    {
+        ThreadPool::Global().ParallelFor(0, num_subtrees, 1, refit_subtrees);
+    }
+    else
+    {
+        refit_subtrees(0, num_subtrees);
+    }
+    RefitTopNodes(0, 0);
+    const auto refit_end{ std::chrono::high_resolution_clock::now() };
+    statistics.refit_time_ms = std::chrono::duration<float, std::milli>(refit_end - refit_start).count();
 
-        // Check if we are on the end of the bounds and fix index in that case
-        if (bucket_index == configuration.num_buckets)
+    // Compare the quality of the tree with the one it had when it was built
+    statistics.sah_cost_ratio = build_statistics.sah_cost > 0.f ? SAHCost() / build_statistics.sah_cost : 1.f;
+    if (config.rebuild_cost_ratio > 0.f && statistics.sah_cost_ratio > config.rebuild_cost_ratio)
+    {
+        Rebuild();
+        statistics.full_rebuild = true;
+    }
+    else if (config.subtree_rebuild_cost_ratio > 0.f)
+    {
+        std::vector<unsigned int> degraded_subtrees;
+        for (unsigned int i = 0; i != num_subtrees; i++)
         {
-            bucket_index = configuration.num_buckets - 1;
+            if (SAHCost(subtree_roots[i]) > config.subtree_rebuild_cost_ratio * subtree_build_costs[i])
+            {
+                degraded_subtrees.push_back(i);
+            }
         }
+        if (!degraded_subtrees.empty())
+        {
+            std::vector<unsigned int> degraded_roots;
+            for (const unsigned int i : degraded_subtrees)
+            {
+                degraded_roots.push_back(subtree_roots[i]);
+            }
+            RebuildSubtrees(degraded_roots);
 
-        // Increase count and compute bounds for the bucket
-        buckets[bucket_index].num_triangles++;
-        buckets[bucket_index].bounds = Union(buckets[bucket_index].bounds, triangle_info[i].bounds);
+            // The nodes above the subtrees are not rebuilt, so the subtrees are the same ones at new indices
+            const std::vector<unsigned int> new_subtree_roots{ RefitSubtreeRoots() };
+            for (const unsigned int i : degraded_subtrees)
+            {
+                subtree_build_costs[i] = SAHCost(new_subtree_roots[i]);
+            }
+            statistics.num_rebuilt_subtrees = static_cast<unsigned int>(degraded_subtrees.size());
+        }
     }
+    SwitchNodeLayout(false);
+    statistics.rebuild_time_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - refit_end).count();
+
+    return statistics;
+}
+
+float BVH::SAHCost(unsigned int node_index) const noexcept
+{
+    const float root_surface{ flat_tree_nodes[node_index].bounds.Surface() };
+    if (root_surface <= 0.f)
+    {
+        return 0.f;
+    }
+
+    // The nodes of the subtree are contiguous only in the depth first layout, so they are visited from the root
+    float cost{ 0.f };
+    std::vector<unsigned int> to_visit{ node_index };
+    while (!to_visit.empty())
+    {
+        const unsigned int visited_index{ to_visit.back() };
+        to_visit.pop_back();
+        const LinearBVHNode& node{ flat_tree_nodes[visited_index] };
+        if (node.num_triangles != 0)
+        {
+            cost += node.bounds.Surface() * configuration.triangle_intersect_cost * node.num_triangles;
+        }
+        else
+        {
+            cost += node.bounds.Surface() * configuration.bbox_intersect_cost;
+            to_visit.push_back(node.second_child_offset);
+            to_visit.push_back(FirstChildIndex(visited_index, node));
+        }
+    }
+
+    return cost / root_surface;
+}
+
+unsigned int BVH::LeafEntries(unsigned int num_triangles) const noexcept
+{
+    switch (configuration.leaf_format)
+    {
+        case BVHLeafFormat::PACKETS4:
+            return DivideUp(num_triangles, 4u) * 4u;
+        case BVHLeafFormat::PACKETS8:
+            return DivideUp(num_triangles, 8u) * 8u;
+        default:
+            return num_triangles;
+    }
+}
+
+unsigned int BVH::SubtreeEnd(unsigned int node_index) const noexcept
+{
+    // The last node of a subtree is the last leaf reached following the second children
+    while (flat_tree_nodes[node_index].num_triangles == 0)
+    {
+        node_index = flat_tree_nodes[node_index].second_child_offset;
+    }
+
+    return node_index + 1;
+}
+
+const std::vector<unsigned int> BVH::RefitSubtreeRoots() const
+{
+    // Visit the top levels depth first so that the roots are sorted by index
+    std::vector<unsigned int> roots;
+    std::vector<std::pair<unsigned int, unsigned int>> to_visit{ { 0, 0 } };
+    while (!to_visit.empty())
+    {
+        const unsigned int node_index{ to_visit.back().first };
+        const unsigned int depth{ to_visit.back().second };
+        to_visit.pop_back();
+
+        const LinearBVHNode& node{ flat_tree_nodes[node_index] };
+        if (node.num_triangles != 0 || depth == REFIT_SUBTREE_DEPTH)
+        {
+            roots.push_back(node_index);
+        }
+        else
+        {
+            to_visit.emplace_back(node.second_child_offset, depth + 1);
+            to_visit.emplace_back(FirstChildIndex(node_index, node), depth + 1);
+        }
+    }
+
+    return roots;
+}
+
+void BVH::RefitSubtree(unsigned int root_index) noexcept
+{
+    // Children are stored after their parent, so going backwards updates them before the parent
+    for (unsigned int node_index = SubtreeEnd(root_index); node_index-- != root_index;)
+    {
+        LinearBVHNode& node{ flat_tree_nodes[node_index] };
+        if (node.num_triangles == 0)
+        {
+            node.bounds = Geometry::Union(flat_tree_nodes[node_index + 1].bounds,
+                                          flat_tree_nodes[node.second_child_offset].bounds);
+            continue;
+        }
+
+        // Move the vertices of the triangles in the leaf and its packets
+        Geometry::BBox bounds;
+        for (unsigned int i = node.triangle_offset; i != node.triangle_offset + node.num_triangles; i++)
+        {
+            PrecomputedTriangle& triangle{ precomputed_triangles[i] };
+            triangle = triangles[triangle.triangle_index].Precompute(triangle.triangle_index);
+            bounds = Geometry::Union(bounds, Geometry::BBox{ triangle.v0, triangle.v1, triangle.v2 });
+        }
+        node.bounds = bounds;
+        if (configuration.leaf_format == BVHLeafFormat::PACKETS4)
+        {
+            FillTrianglePackets(triangle_packets4, node.triangle_offset, node.num_triangles);
+        }
+        else if (configuration.leaf_format == BVHLeafFormat::PACKETS8)
+        {
+            FillTrianglePackets(triangle_packets8, node.triangle_offset, node.num_triangles);
+        }
+    }
+}
+
+const Geometry::BBox BVH::RefitTopNodes(unsigned int node_index, unsigned int depth) noexcept
+{
+    LinearBVHNode& node{ flat_tree_nodes[node_index] };
+    if (node.num_triangles == 0 && depth != REFIT_SUBTREE_DEPTH)
+    {
+        node.bounds = Geometry::Union(RefitTopNodes(node_index + 1, depth + 1),
+                                      RefitTopNodes(node.second_child_offset, depth + 1));
+    }
+
+    return node.bounds;
+}
+
+void BVH::RebuildSubtrees(const std::vector<unsigned int>& root_indices)
+{
+    // Build the new subtrees, their leafs reference the triangle information left in leaf order
+    const unsigned int num_subtrees{ static_cast<unsigned int>(root_indices.size()) };
+    std::vector<unsigned int> old_node_ends(num_subtrees), first_entries(num_subtrees), old_entry_ends(num_subtrees);
+    std::vector<std::vector<PrecomputedTriangle>> subtree_triangles(num_subtrees);
+    std::vector<std::vector<TriangleInfo>> subtree_triangle_info(num_subtrees);
+    std::vector<LinearBVHNode*> subtree_nodes(num_subtrees);
+    std::vector<unsigned int> num_subtree_nodes(num_subtrees);
+    unsigned int new_total_nodes{ total_nodes };
+    for (unsigned int k = 0; k != num_subtrees; k++)
+    {
+        // Leafs are stored in depth first order, so the precomputed triangles of a subtree are contiguous
+        old_node_ends[k] = SubtreeEnd(root_indices[k]);
+        first_entries[k] = std::numeric_limits<unsigned int>::max();
+        old_entry_ends[k] = 0;
+        for (unsigned int node_index = root_indices[k]; node_index != old_node_ends[k]; node_index++)
+        {
+            const LinearBVHNode& node{ flat_tree_nodes[node_index] };
+            if (node.num_triangles == 0)
+            {
+                continue;
+            }
+            first_entries[k] = std::min(first_entries[k], node.triangle_offset);
+            old_entry_ends[k] = std::max(old_entry_ends[k], node.triangle_offset + LeafEntries(node.num_triangles));
+            subtree_triangles[k].insert(subtree_triangles[k].end(),
+                                        precomputed_triangles + node.triangle_offset,
+                                        precomputed_triangles + node.triangle_offset + node.num_triangles);
+        }
+
+        // Triangles referenced by several leafs of the subtree are built from a single reference
+        std::sort(subtree_triangles[k].begin(), subtree_triangles[k].end(),
+                  [](const PrecomputedTriangle& t0, const PrecomputedTriangle& t1) -> bool
+                  {
+                      return t0.triangle_index < t1.triangle_index;
+                  });
+        subtree_triangles[k].erase(std::unique(subtree_triangles[k].begin(), subtree_triangles[k].end(),
+                                               [](const PrecomputedTriangle& t0, const PrecomputedTriangle& t1) -> bool
+                                               {
+                                                   return t0.triangle_index == t1.triangle_index;
+                                               }), subtree_triangles[k].end());
+        for (const PrecomputedTriangle& triangle : subtree_triangles[k])
+        {
+            subtree_triangle_info[k].emplace_back(static_cast<unsigned int>(subtree_triangle_info[k].size()),
+                                                  Geometry::BBox{ triangle.v0, triangle.v1, triangle.v2 });
+        }
+
+        size_t builder_memory_bytes{ 0 };
+        // The roots are at most REFIT_SUBTREE_DEPTH levels below the root of the tree
+        subtree_nodes[k] = BuildNodes(subtree_triangle_info[k], subtree_triangles[k].data(), REFIT_SUBTREE_DEPTH,
+                                      num_subtree_nodes[k], builder_memory_bytes);
+        new_total_nodes = new_total_nodes - (old_node_ends[k] - root_indices[k]) + num_subtree_nodes[k];
+    }
+
+    // Lay out the nodes and the precomputed triangles replacing the ones of each subtree
+    const PrecomputedTriangle empty_triangle{ Geometry::Point3f{}, Geometry::Point3f{}, Geometry::Point3f{},
+                                              PrecomputedTriangle::EMPTY_INDEX };
+    LinearBVHNode* new_nodes{ AllocateAligned<LinearBVHNode>(new_total_nodes) };
+    std::vector<PrecomputedTriangle> new_precomputed_triangles;
+    new_precomputed_triangles.reserve(num_precomputed_triangles);
+    std::vector<unsigned int> new_root_indices(num_subtrees), new_node_ends(num_subtrees), new_entry_ends(num_subtrees);
+    unsigned int num_new_nodes{ 0 };
+    unsigned int copied_nodes_end{ 0 };
+    unsigned int copied_entries_end{ 0 };
+    for (unsigned int k = 0; k != num_subtrees; k++)
+    {
+        // Copy what is between the previous subtree and this one
+        std::copy(flat_tree_nodes + copied_nodes_end, flat_tree_nodes + root_indices[k], new_nodes + num_new_nodes);
+        num_new_nodes += root_indices[k] - copied_nodes_end;
+        new_precomputed_triangles.insert(new_precomputed_triangles.end(),
+                                         precomputed_triangles + copied_entries_end,
+                                         precomputed_triangles + first_entries[k]);
+
+        new_root_indices[k] = num_new_nodes;
+        for (unsigned int node_index = 0; node_index != num_subtree_nodes[k]; node_index++)
+        {
+            LinearBVHNode& node{ new_nodes[num_new_nodes++] };
+            node = subtree_nodes[k][node_index];
+            if (node.num_triangles == 0)
+            {
+                node.second_child_offset += new_root_indices[k];
+                continue;
+            }
+            const unsigned int leaf_offset{ static_cast<unsigned int>(new_precomputed_triangles.size()) };
+            for (unsigned int i = 0; i != node.num_triangles; i++)
+            {
+                new_precomputed_triangles.push_back(
+                    subtree_triangles[k][subtree_triangle_info[k][node.triangle_offset + i].triangle_index]);
+            }
+            new_precomputed_triangles.resize(leaf_offset + LeafEntries(node.num_triangles), empty_triangle);
+            node.triangle_offset = leaf_offset;
+        }
+        FreeAligned(subtree_nodes[k]);
+
+        new_node_ends[k] = num_new_nodes;
+        new_entry_ends[k] = static_cast<unsigned int>(new_precomputed_triangles.size());
+        copied_nodes_end = old_node_ends[k];
+        copied_entries_end = old_entry_ends[k];
+    }
+    std::copy(flat_tree_nodes + copied_nodes_end, flat_tree_nodes + total_nodes, new_nodes + num_new_nodes);
+    new_precomputed_triangles.insert(new_precomputed_triangles.end(),
+                                     precomputed_triangles + copied_entries_end,
+                                     precomputed_triangles + num_precomputed_triangles);
+
+    // Indices outside the replaced ranges move with the end of the last range before them
+    const auto map_index = [](unsigned int index, const std::vector<unsigned int>& old_ends,
+                              const std::vector<unsigned int>& new_ends) -> unsigned int
+    {
+        const auto range = std::upper_bound(old_ends.begin(), old_ends.end(), index);
+        if (range == old_ends.begin())
+        {
+            return index;
+        }
+        const auto k{ std::distance(old_ends.begin(), range) - 1 };
+
+        return index - old_ends[k] + new_ends[k];
+    };
+
+    // Move the offsets of the nodes that were copied, the ones of the rebuilt subtrees are already final
+    unsigned int next_subtree{ 0 };
+    for (unsigned int node_index = 0; node_index != new_total_nodes; node_index++)
+    {
+        if (next_subtree != num_subtrees && node_index == new_root_indices[next_subtree])
+        {
+            node_index = new_node_ends[next_subtree++] - 1;
+            continue;
+        }
+        LinearBVHNode& node{ new_nodes[node_index] };
+        if (node.num_triangles == 0)
+        {
+            node.second_child_offset = map_index(node.second_child_offset, old_node_ends, new_node_ends);
+        }
+        else
+        {
+            node.triangle_offset = map_index(node.triangle_offset, old_entry_ends, new_entry_ends);
+        }
+    }
+    FreeAligned(flat_tree_nodes);
+    flat_tree_nodes = new_nodes;
+    total_nodes = new_total_nodes;
+    FreeAligned(precomputed_triangles);
+    num_precomputed_triangles = static_cast<unsigned int>(new_precomputed_triangles.size());
+    precomputed_triangles = AllocateAligned<PrecomputedTriangle>(num_precomputed_triangles);
+    std::copy(new_precomputed_triangles.begin(), new_precomputed_triangles.end(), precomputed_triangles);
+
+    // The packets follow the precomputed triangles
+    if (configuration.leaf_format == BVHLeafFormat::PACKETS4)
+    {
+        FreeAligned(triangle_packets4);
+        triangle_packets4 = BuildTrianglePackets<4>();
+    }
+    else if (configuration.leaf_format == BVHLeafFormat::PACKETS8)
+    {
+        FreeAligned(triangle_packets8);
+        triangle_packets8 = BuildTrianglePackets<8>();
+    }
+}
+
+void BVH::Rebuild()
+{
+    FreeAligned(flat_tree_nodes);
+    FreeAligned(precomputed_triangles);
+    FreeAligned(triangle_packets4);
+    FreeAligned(triangle_packets8);
+    flat_tree_nodes = nullptr;
+    precomputed_triangles = nullptr;
+    triangle_packets4 = nullptr;
+    triangle_packets8 = nullptr;
+    total_nodes = 0;
+    num_precomputed_triangles = 0;
+    node_layout = BVHNodeLayout::DEPTH_FIRST;
+
+    // Keep the order of the triangles, the lights and the intersections reference them
+    Build(false);
+}
+
+void BVH::SwitchNodeLayout(bool to_depth_first)
+{
+    const BVHNodeLayout new_layout{ to_depth_first ? BVHNodeLayout::DEPTH_FIRST : configuration.node_layout };
+    if (new_layout == node_layout)
+    {
+        return;
+    }
+
+    LinearBVHNode* new_nodes{ new_layout == BVHNodeLayout::DEPTH_FIRST ?
+                              DepthFirstNodes(flat_tree_nodes, total_nodes) :
+                              LayoutNodes(flat_tree_nodes, total_nodes, new_layout) };
+    FreeAligned(flat_tree_nodes);
+    flat_tree_nodes = new_nodes;
+    node_layout = new_layout;
+}
+
+void BVH::ReleaseCache()
+{
+    if (cache == nullptr)
+    {
+        return;
+    }
+
+    flat_tree_nodes = CopyAligned(flat_tree_nodes, total_nodes);
+    precomputed_triangles = CopyAligned(precomputed_triangles, num_precomputed_triangles);
+    if (triangle_packets4 != nullptr)
+    {
+        triangle_packets4 = CopyAligned(triangle_packets4, num_precomputed_triangles / 4);
+    }
+    if (triangle_packets8 != nullptr)
+    {
+        triangle_packets8 = CopyAligned(triangle_packets8, num_precomputed_triangles / 8);
+    }
+    cache.reset();
+}
+
+template <unsigned int PacketSize>
+unsigned int BVH::IntersectPacket(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                                  Geometry::TriangleIntersection* intersections,
+                                  unsigned int num_rays) const noexcept
+{
+    assert(num_rays <= PacketSize);
+
+    // Compute values needed for traversal
+    PacketTraversalRays<PacketSize> packet{ rays, intervals, num_rays };
+    WatertightRay watertight_rays[PacketSize];
+    for (unsigned int i = 0; i != num_rays; i++)
+    {
+        watertight_rays[i] = WatertightRay{ rays[i] };
+    }
+
+    // Follow packet through BVH, each node on the stack keeps the mask of the rays that hit its parent
+    struct StackEntry
+    {
+        unsigned int node_index;
+        unsigned int active_mask;
+    };
+    unsigned int to_visit_offset{ 0 };
+    unsigned int current_node_index{ 0 };
+    unsigned int active_mask{ RaysMask(num_rays) };
+    StackEntry nodes_to_visit[BVH_STACK_SIZE];
+    while (true)
+    {
+        const LinearBVHNode& current_node{ flat_tree_nodes[current_node_index] };
+        unsigned int hit_mask{ packet.Intersect(current_node.bounds) & active_mask };
+        if (hit_mask != 0)
+        {
+            if (current_node.num_triangles == 0)
+            {
+                // Order children using the direction of the first active ray
+                const unsigned int first_ray{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+                const unsigned int first_child_index{ FirstChildIndex(current_node_index, current_node) };
+                if (packet.reciprocal_direction[current_node.split_axis][first_ray] < 0.f)
+                {
+                    nodes_to_visit[to_visit_offset++] = StackEntry{ first_child_index, hit_mask };
+                    current_node_index = current_node.second_child_offset;
+                }
+                else
+                {
+                    nodes_to_visit[to_visit_offset++] = StackEntry{ current_node.second_child_offset, hit_mask };
+                    current_node_index = first_child_index;
+                }
+                active_mask = hit_mask;
+                continue;
+            }
+
+            // Intersect the rays that hit the leaf with its triangles
+            while (hit_mask != 0)
+            {
+                const unsigned int i{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+                hit_mask &= hit_mask - 1;
+                IntersectLeaf(watertight_rays[i], current_node.triangle_offset, current_node.num_triangles,
+                              intervals[i], intersections[i]);
+                packet.t_end[i] = intervals[i].End();
+            }
+        }
+
+        // Check if we still have node to visit
+        if (to_visit_offset == 0)
+        {
+            break;
+        }
+        to_visit_offset--;
+        current_node_index = nodes_to_visit[to_visit_offset].node_index;
+        active_mask = nodes_to_visit[to_visit_offset].active_mask;
+    }
+
+    // Fill the intersections of the rays that did hit something
+    unsigned int hits_mask{ 0 };
+    for (unsigned int i = 0; i != num_rays; i++)
+    {
+        if (intersections[i].IsValid())
+        {
+            intersections[i].hit_triangle->ComputeIntersectionGeometry(rays[i], intervals[i].End(), intersections[i]);
+            hits_mask |= 1u << i;
+        }
+    }
+
+    return hits_mask;
+}
+
+template <unsigned int PacketSize>
+unsigned int BVH::IntersectPacketTest(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                                      unsigned int num_rays) const noexcept
+{
+    assert(num_rays <= PacketSize);
+
+    // Compute values needed for traversal
+    const PacketTraversalRays<PacketSize> packet{ rays, intervals, num_rays };
+    WatertightRay watertight_rays[PacketSize];
+    for (unsigned int i = 0; i != num_rays; i++)
+    {
+        watertight_rays[i] = WatertightRay{ rays[i] };
+    }
+
+    // Follow packet through BVH, rays leave the packet as soon as they hit something
+    struct StackEntry
+    {
+        unsigned int node_index;
+        unsigned int active_mask;
+    };
+    const unsigned int rays_mask{ RaysMask(num_rays) };
+    unsigned int occluded_mask{ 0 };
+    unsigned int to_visit_offset{ 0 };
+    unsigned int current_node_index{ 0 };
+    unsigned int active_mask{ rays_mask };
+    StackEntry nodes_to_visit[BVH_STACK_SIZE];
+    while (true)
+    {
+        const LinearBVHNode& current_node{ flat_tree_nodes[current_node_index] };
+        unsigned int hit_mask{ packet.Intersect(current_node.bounds) & active_mask & ~occluded_mask };
+        if (hit_mask != 0)
+        {
+            if (current_node.num_triangles == 0)
+            {
+                // Order children using the direction of the first active ray
+                const unsigned int first_ray{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+                const unsigned int first_child_index{ FirstChildIndex(current_node_index, current_node) };
+                if (packet.reciprocal_direction[current_node.split_axis][first_ray] < 0.f)
+                {
+                    nodes_to_visit[to_visit_offset++] = StackEntry{ first_child_index, hit_mask };
+                    current_node_index = current_node.second_child_offset;
+                }
+                else
+                {
+                    nodes_to_visit[to_visit_offset++] = StackEntry{ current_node.second_child_offset, hit_mask };
+                    current_node_index = first_child_index;
+                }
+                active_mask = hit_mask;
+                continue;
+            }
+
+            while (hit_mask != 0)
+            {
+                const unsigned int i{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+                hit_mask &= hit_mask - 1;
+                if (IntersectLeafTest(watertight_rays[i], current_node.triangle_offset, current_node.num_triangles,
+                                      intervals[i]))
+                {
+                    occluded_mask |= 1u << i;
+                }
+            }
+            // As soon as all the rays hit something, stop
+            if (occluded_mask == rays_mask)
+            {
+                break;
+            }
+        }
+
+        // Check if we still have node to visit
+        if (to_visit_offset == 0)
+        {
+            break;
+        }
+        to_visit_offset--;
+        current_node_index = nodes_to_visit[to_visit_offset].node_index;
+        active_mask = nodes_to_visit[to_visit_offset].active_mask;
+    }
+
+    return occluded_mask;
+}
+
+// Instantiate packet traversal for the supported sizes
+template unsigned int BVH::IntersectPacket<8>(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                                              Geometry::TriangleIntersection* intersections,
+                                              unsigned int num_rays) const noexcept;
+template unsigned int BVH::IntersectPacket<16>(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                                               Geometry::TriangleIntersection* intersections,
+                                               unsigned int num_rays) const noexcept;
+template unsigned int BVH::IntersectPacketTest<8>(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                                                  unsigned int num_rays) const noexcept;
+template unsigned int BVH::IntersectPacketTest<16>(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                                                   unsigned int num_rays) const noexcept;
+
+std::unique_ptr<BVHBuildNode> BVH::RecursiveBuild(std::vector<TriangleInfo>& triangle_info,
+                                                  unsigned int start, unsigned int end, unsigned int depth,
+                                                  std::atomic_uint& created_nodes) noexcept
+{
+    // Increase by 1 the number of created nodes
+    created_nodes++;
+
+    // Compute number of triangles for this node
+    const unsigned int num_triangles{ end - start };
+    const bool parallel_range{
+        IsParallelRange(num_triangles, static_cast<unsigned int>(triangle_info.size())) };
+
+    // First thing we do is compute the BBox of all the triangles in this node
+    const Geometry::BBox node_bounds{ ComputeRangeBounds(triangle_info, start, end, false, parallel_range) };
+
+    // If there are less triangles than the maximum, create leaf
+    if (num_triangles <= configuration.max_triangles_in_leaf)
+    {
+        return std::make_unique<BVHBuildNode>(start, num_triangles, node_bounds);
+    }
+
+    // Split triangles, falling back to the median if a leaf would reference too many triangles or if the larger
+    // half could not be split down to single triangles within the traversal stack
+    PartitionResult partition_result;
+    const bool sah_split{ PartitionTriangles(triangle_info, start, end, node_bounds, partition_result) };
+    if (sah_split ?
+        depth + 1 + MedianSplitLevels(std::max(partition_result.mid_index - start, end - partition_result.mid_index)) >=
+        BVH_STACK_SIZE :
+        num_triangles > MAX_LEAF_TRIANGLES)
+    {
+        PartitionMedian(triangle_info, start, end, partition_result);
+    }
+    else if (!sah_split)
+    {
+        // Create leaf node
+        return std::make_unique<BVHBuildNode>(start, num_triangles, node_bounds);
+    }
+
+    // Large nodes build the first child on the pool while the current thread builds the second one, the two ranges
+    // are disjoint so the result does not depend on the order of execution
+    if (configuration.parallel_build_threshold != 0 && num_triangles >= configuration.parallel_build_threshold)
+    {
+        ThreadPool& pool{ ThreadPool::Global() };
+        std::future<std::unique_ptr<BVHBuildNode>> first_child{
+            pool.Submit([this, &triangle_info, start, depth, &partition_result, &created_nodes]()
+                            -> std::unique_ptr<BVHBuildNode>
+                        {
+                            return RecursiveBuild(triangle_info, start, partition_result.mid_index, depth + 1,
+                                                  created_nodes);
+                        }) };
+        std::unique_ptr<BVHBuildNode> second_child{
+            RecursiveBuild(triangle_info, partition_result.mid_index, end, depth + 1, created_nodes) };
+
+        return std::make_unique<BVHBuildNode>(partition_result.split_axis,
+                                              pool.Wait(first_child), std::move(second_child));
+    }
+
+    // Recursively build tree
+    return std::make_unique<BVHBuildNode>(partition_result.split_axis,
+                                          RecursiveBuild(triangle_info, start, partition_result.mid_index,
+                                                         depth + 1, created_nodes),
+                                          RecursiveBuild(triangle_info, partition_result.mid_index, end,
+                                                         depth + 1, created_nodes));
+}
+
+bool BVH::IsParallelRange(unsigned int num_range_triangles, unsigned int num_total_triangles) const noexcept
+{
+    // Passes are split only in the top levels of the tree, where there are less subtrees than threads to keep busy
+    if (configuration.parallel_build_threshold == 0 || num_range_triangles < configuration.parallel_build_threshold)
+    {
+        return false;
+    }
+
+    return static_cast<uint64_t>(num_range_triangles) * (ThreadPool::Global().NumThreads() + 1) >=
+           num_total_triangles;
+}
+
+const Geometry::BBox BVH::ComputeRangeBounds(const std::vector<TriangleInfo>& triangle_info,
+                                             unsigned int start, unsigned int end,
+                                             bool centroids, bool parallel) const noexcept
+{
+    const auto range_bounds = [&triangle_info, centroids](unsigned int range_start,
+                                                          unsigned int range_end) -> Geometry::BBox
+    {
+        Geometry::BBox bounds;
+        for (unsigned int i = range_start; i != range_end; i++)
+        {
+            bounds = centroids ? Union(bounds, triangle_info[i].centroid) : Union(bounds, triangle_info[i].bounds);
+        }
+
+        return bounds;
+    };
+
+    if (!parallel)
+    {
+        return range_bounds(start, end);
+    }
+
+    // Union of bounds is exact, so the order of the reduction does not change the result
+    Geometry::BBox bounds;
+    std::mutex bounds_mutex;
+    ThreadPool::Global().ParallelFor(start, end, PARALLEL_PASS_GRAIN_SIZE,
+                                     [&range_bounds, &bounds, &bounds_mutex](unsigned int chunk_start,
+                                                                             unsigned int chunk_end) -> void
+                                     {
+                                         const Geometry::BBox chunk_bounds{ range_bounds(chunk_start, chunk_end) };
+                                         std::lock_guard<std::mutex> lock{ bounds_mutex };
+                                         bounds = Union(bounds, chunk_bounds);
+                                     });
+
+    return bounds;
+}
+
+// Helper struct to compute the cost of each bucket
+struct BucketInfo
+{
+    BucketInfo() noexcept
+        : num_triangles{ 0 }
+    {}
+
+    // Number of triangles in the bucket
+    unsigned int num_triangles;
+    // Bounds of the bucket
+    Geometry::BBox bounds;
+};
+
+// Best object split of a range of triangles
+struct ObjectSplit
+{
+    ObjectSplit() noexcept
+        : split_axis{ 3 }, split_bucket{ 0 }, cost{ std::numeric_limits<float>::max() }
+    {}
+
+    // Split axis and last bucket of the first half, the axis is 3 if no split was found
+    unsigned int split_axis;
+    unsigned int split_bucket;
+    // SAH cost of the split
+    float cost;
+    // Bounds of the centroids the buckets are computed from
+    Geometry::BBox centroids_bounds;
+    // Bounds of the two halves
+    Geometry::BBox left_bounds;
+    Geometry::BBox right_bounds;
+};
+
+// Best spatial split of a list of triangle references
+struct SpatialSplit
+{
+    SpatialSplit() noexcept
+        : split_axis{ 3 }, position{ 0.f }, cost{ std::numeric_limits<float>::max() }
+    {}
+
+    // Split axis, 3 if no split was found
+    unsigned int split_axis;
+    // Position of the split plane along the axis
+    float position;
+    // SAH cost of the split
+    float cost;
+};
+
+bool BVH::PartitionTriangles(std::vector<TriangleInfo>& triangle_info,
+                             unsigned int start, unsigned int end,
+                             const Geometry::BBox& node_bounds,
+                             PartitionResult& partition_result) const noexcept
+{
+    const bool parallel_range{ IsParallelRange(end - start, static_cast<unsigned int>(triangle_info.size())) };
+    const ObjectSplit split{ FindObjectSplit(triangle_info, start, end, node_bounds, parallel_range) };
+
+    // Check if splitting for the selected axis is better than creating a leaf
+    const float leaf_cost{ (end - start) * configuration.triangle_intersect_cost };
+    if (split.cost < leaf_cost)
+    {
+        partition_result.split_axis = split.split_axis;
+        partition_result.mid_index = PartitionObjectSplit(triangle_info, start, end, split);
+
+        return true;
+    }
+    else
+    {
+        // Split is not worth it, create leaf
+        return false;
+    }
+}
+
+const ObjectSplit BVH::FindObjectSplit(const std::vector<TriangleInfo>& triangle_info,
+                                       unsigned int start, unsigned int end,
+                                       const Geometry::BBox& node_bounds, bool parallel) const noexcept
+{
+    // Compute bounds of the centroids of the triangles
+    ObjectSplit split;
+    split.centroids_bounds = ComputeRangeBounds(triangle_info, start, end, true, parallel);
+    const Geometry::Vector3f centroids_bounds_diagonal{ split.centroids_bounds.Diagonal() };
+
+    // Loop over the 3 axis and keep the split with the lowest SAH
+    for (unsigned int split_axis = 0; split_axis != 3; split_axis++)
+    {
+        // Compute buckets for SAH unless bounds on that dimension are degenerate
+        if (centroids_bounds_diagonal[split_axis] > 0.f)
+        {
+            const std::vector<BucketInfo> buckets{ ComputeBucketsInfo(triangle_info,
+                                                                      start, end,
+                                                                      split.centroids_bounds,
+                                                                      split_axis, parallel) };
+            const std::pair<unsigned int, float> sah_result{ FindBestBucketIndex(buckets, buckets, node_bounds) };
+            if (sah_result.second < split.cost)
+            {
+                split.split_axis = split_axis;
+                split.split_bucket = sah_result.first;
+                split.cost = sah_result.second;
+                split.left_bounds = Geometry::BBox{};
+                split.right_bounds = Geometry::BBox{};
+                for (unsigned int b = 0; b != configuration.num_buckets; b++)
+                {
+                    Geometry::BBox& half_bounds{ b <= split.split_bucket ? split.left_bounds : split.right_bounds };
+                    half_bounds = Union(half_bounds, buckets[b].bounds);
+                }
+            }
+        }
+    }
+
+    return split;
+}
+
+unsigned int BVH::PartitionObjectSplit(std::vector<TriangleInfo>& triangle_info,
+                                       unsigned int start, unsigned int end,
+                                       const ObjectSplit& split) const noexcept
+{
+    const float split_axis_reciprocal_diagonal{ 1.f / split.centroids_bounds.Diagonal()[split.split_axis] };
+    const auto mid{ std::partition(triangle_info.begin() + start,
+                                   triangle_info.begin() + end,
+                                   [this, split_axis_reciprocal_diagonal, &split](const TriangleInfo& triangle_info)
+                                   {
+                                       // Compute index of the bucket where the triangle centroid is
+                                       unsigned int bucket_index{
+                                           static_cast<unsigned int>(
+                                               configuration.num_buckets *
+                                               (triangle_info.centroid[split.split_axis] -
+                                                split.centroids_bounds.PMin()[split.split_axis]) *
+                                               split_axis_reciprocal_diagonal
+                                           )
+                                       };
+
+                                       // Check if we are on the end of the bounds and fix index in that case
+                                       if (bucket_index == configuration.num_buckets)
+                                       {
+                                           bucket_index = configuration.num_buckets - 1;
+                                       }
+
+                                       return bucket_index <= split.split_bucket;
+                                   }) };
+
+    return static_cast<unsigned int>(std::distance(triangle_info.begin(), mid));
+}
+
+void BVH::PartitionMedian(std::vector<TriangleInfo>& triangle_info, unsigned int start, unsigned int end,
+                          PartitionResult& partition_result) const noexcept
+{
+    const bool parallel_range{ IsParallelRange(end - start, static_cast<unsigned int>(triangle_info.size())) };
+    const unsigned int split_axis{
+        ComputeRangeBounds(triangle_info, start, end, true, parallel_range).LargestDimension() };
+    partition_result.split_axis = split_axis;
+    partition_result.mid_index = start + (end - start) / 2;
+    std::nth_element(triangle_info.begin() + start, triangle_info.begin() + partition_result.mid_index,
+                     triangle_info.begin() + end,
+                     [split_axis](const TriangleInfo& first, const TriangleInfo& second) -> bool
+                     {
+                         return first.centroid[split_axis] < second.centroid[split_axis];
+                     });
+}
+
+const SpatialSplit BVH::FindSpatialSplit(const std::vector<TriangleInfo>& references,
+                                         const Geometry::BBox& node_bounds,
+                                         const PrecomputedTriangle* vertices) const noexcept
+{
+    SpatialSplit split;
+    const Geometry::Vector3f node_diagonal{ node_bounds.Diagonal() };
+    for (unsigned int split_axis = 0; split_axis != 3; split_axis++)
+    {
+        if (node_diagonal[split_axis] <= 0.f)
+        {
+            continue;
+        }
+
+        // The buckets split the node in slabs of the same size
+        const float axis_min{ node_bounds.PMin()[split_axis] };
+        const float bucket_size{ node_diagonal[split_axis] / configuration.num_buckets };
+        const auto bucket_plane = [&node_bounds, axis_min, bucket_size, split_axis, this](unsigned int b) -> float
+        {
+            return b == configuration.num_buckets ? node_bounds.PMax()[split_axis] : axis_min + b * bucket_size;
+        };
+        const auto bucket_index = [axis_min, bucket_size, this](float p) -> unsigned int
+        {
+            return std::min(static_cast<unsigned int>(std::max(0.f, (p - axis_min) / bucket_size)),
+                            configuration.num_buckets - 1);
+        };
+
+        // The buckets are corrected against the planes themselves to follow the partition of the references, a
+        // reference goes to the left of a plane if it ends on or before it and to the right if it starts on or after it
+        const auto exit_bucket = [&bucket_index, &bucket_plane, this](float p) -> unsigned int
+        {
+            unsigned int b{ bucket_index(p) };
+            while (b != 0 && p <= bucket_plane(b))
+            {
+                b--;
+            }
+            while (b + 1 != configuration.num_buckets && p > bucket_plane(b + 1))
+            {
+                b++;
+            }
+            return b;
+        };
+        const auto entry_bucket = [&bucket_index, &bucket_plane, this](float p) -> unsigned int
+        {
+            unsigned int b{ bucket_index(p) };
+            while (b != 0 && p < bucket_plane(b))
+            {
+                b--;
+            }
+            while (b + 1 != configuration.num_buckets && p >= bucket_plane(b + 1))
+            {
+                b++;
+            }
+            return b;
+        };
+
+        // References are counted in the bucket where they start for the left side of the splits and in the one
+        // where they end for the right side, their bounds are clipped to each bucket they cross. A flat reference
+        // lying on a plane goes to the left of it
+        std::vector<BucketInfo> entry_buckets(configuration.num_buckets);
+        std::vector<BucketInfo> exit_buckets(configuration.num_buckets);
+        for (const TriangleInfo& reference : references)
+        {
+            const unsigned int last_bucket{ exit_bucket(reference.bounds.PMax()[split_axis]) };
+            const unsigned int first_bucket{ std::min(entry_bucket(reference.bounds.PMin()[split_axis]),
+                                                      last_bucket) };
+            entry_buckets[first_bucket].num_triangles++;
+            exit_buckets[last_bucket].num_triangles++;
+            if (first_bucket == last_bucket)
+            {
+                entry_buckets[first_bucket].bounds = Union(entry_buckets[first_bucket].bounds, reference.bounds);
+                continue;
+            }
+            for (unsigned int b = first_bucket; b <= last_bucket; b++)
+            {
+                const Geometry::BBox clipped_bounds{
+                    Geometry::Intersection(ClipTriangleBounds(vertices[reference.triangle_index], split_axis,
+                                                              bucket_plane(b), bucket_plane(b + 1)),
+                                           reference.bounds) };
+                if (IsValidBounds(clipped_bounds))
+                {
+                    entry_buckets[b].bounds = Union(entry_buckets[b].bounds, clipped_bounds);
+                }
+            }
+        }
+        for (unsigned int b = 0; b != configuration.num_buckets; b++)
+        {
+            exit_buckets[b].bounds = entry_buckets[b].bounds;
+        }
+
+        const std::pair<unsigned int, float> sah_result{ FindBestBucketIndex(entry_buckets, exit_buckets,
+                                                                             node_bounds) };
+        if (sah_result.second < split.cost)
+        {
+            split.split_axis = split_axis;
+            split.position = bucket_plane(sah_result.first + 1);
+            split.cost = sah_result.second;
+        }
+    }
+
+    return split;
+}
+
+std::unique_ptr<BVHBuildNode> BVH::SpatialSplitBuild(std::vector<TriangleInfo>& references,
+                                                     const Geometry::BBox& node_bounds,
+                                                     const PrecomputedTriangle* vertices, float root_surface,
+                                                     unsigned int depth, unsigned int& remaining_budget,
+                                                     std::vector<TriangleInfo>& leaf_references,
+                                                     unsigned int& created_nodes)
+{
+    created_nodes++;
+    const unsigned int num_references{ static_cast<unsigned int>(references.size()) };
+    const auto make_leaf = [&references, &node_bounds, &leaf_references, num_references]()
+        -> std::unique_ptr<BVHBuildNode>
+    {
+        const unsigned int first_reference{ static_cast<unsigned int>(leaf_references.size()) };
+        leaf_references.insert(leaf_references.end(), references.begin(), references.end());
+
+        return std::make_unique<BVHBuildNode>(first_reference, num_references, node_bounds);
+    };
+
+    // If there are less references than the maximum, create leaf
+    if (num_references <= configuration.max_triangles_in_leaf)
+    {
+        return make_leaf();
+    }
+
+    // Spatial splits only pay off where the two halves of the object split overlap
+    const ObjectSplit object_split{ FindObjectSplit(references, 0, num_references, node_bounds, false) };
+    SpatialSplit spatial_split;
+    if (remaining_budget != 0 && depth < MAX_SPATIAL_SPLIT_DEPTH)
+    {
+        const Geometry::BBox overlap{ Geometry::Intersection(object_split.left_bounds, object_split.right_bounds) };
+        if (object_split.split_axis == 3 ||
+            (IsValidBounds(overlap) && overlap.Surface() > SPATIAL_SPLIT_OVERLAP_THRESHOLD * root_surface))
+        {
+            spatial_split = FindSpatialSplit(references, node_bounds, vertices);
+        }
+    }
+
+    const float leaf_cost{ num_references * configuration.triangle_intersect_cost };
+    std::vector<TriangleInfo> left_references, right_references;
+    unsigned int split_axis{ 3 };
+    unsigned int added_references{ 0 };
+    if (spatial_split.cost < object_split.cost && spatial_split.cost < leaf_cost)
+    {
+        // References crossing the plane are clipped and go to both sides, unless the clipped triangle falls on
+        // one side only
+        split_axis = spatial_split.split_axis;
+        const float position{ spatial_split.position };
+        for (const TriangleInfo& reference : references)
+        {
+            if (reference.bounds.PMax()[split_axis] <= position)
+            {
+                left_references.push_back(reference);
+            }
+            else if (reference.bounds.PMin()[split_axis] >= position)
+            {
+                right_references.push_back(reference);
+            }
+            else
+            {
+                const PrecomputedTriangle& triangle{ vertices[reference.triangle_index] };
+                const Geometry::BBox left_bounds{
+                    Geometry::Intersection(ClipTriangleBounds(triangle, split_axis,
+                                                              std::numeric_limits<float>::lowest(), position),
+                                           reference.bounds) };
+                const Geometry::BBox right_bounds{
+                    Geometry::Intersection(ClipTriangleBounds(triangle, split_axis,
+                                                              position, std::numeric_limits<float>::max()),
+                                           reference.bounds) };
+                if (IsValidBounds(left_bounds) && IsValidBounds(right_bounds))
+                {
+                    left_references.emplace_back(reference.triangle_index, left_bounds);
+                    right_references.emplace_back(reference.triangle_index, right_bounds);
+                }
+                else if (reference.centroid[split_axis] < position)
+                {
+                    left_references.push_back(reference);
+                }
+                else
+                {
+                    right_references.push_back(reference);
+                }
+            }
+        }
+
+        // Fall back to the object split if the budget is not enough or the split left one side empty
+        added_references = static_cast<unsigned int>(left_references.size() + right_references.size()) -
+                           num_references;
+        if (left_references.empty() || right_references.empty() || added_references > remaining_budget)
+        {
+            left_references.clear();
+            right_references.clear();
+            added_references = 0;
+        }
+        else
+        {
+            remaining_budget -= added_references;
+        }
+    }
+    if (left_references.empty() && object_split.cost < leaf_cost)
+    {
+        split_axis = object_split.split_axis;
+        const unsigned int mid_index{ PartitionObjectSplit(references, 0, num_references, object_split) };
+        left_references.assign(references.begin(), references.begin() + mid_index);
+        right_references.assign(references.begin() + mid_index, references.end());
+    }
+
+    // Fall back to the median along the largest axis of the centroids if a leaf would reference too many triangles
+    // or if the larger child could not be split down to single references within the traversal stack
+    if (left_references.empty() ?
+        num_references > MAX_LEAF_TRIANGLES :
+        depth + 1 + MedianSplitLevels(static_cast<unsigned int>(std::max(left_references.size(),
+                                                                         right_references.size()))) >=
+        BVH_STACK_SIZE)
+    {
+        remaining_budget += added_references;
+        PartitionResult partition_result;
+        PartitionMedian(references, 0, num_references, partition_result);
+        split_axis = partition_result.split_axis;
+        left_references.assign(references.begin(), references.begin() + partition_result.mid_index);
+        right_references.assign(references.begin() + partition_result.mid_index, references.end());
+    }
+    else if (left_references.empty())
+    {
+        return make_leaf();
+    }
+
+    // The references of the node are not needed anymore, free them before going down the tree
+    references = std::vector<TriangleInfo>{};
+    const Geometry::BBox left_bounds{ ComputeRangeBounds(left_references, 0,
+                                                         static_cast<unsigned int>(left_references.size()),
+                                                         false, false) };
+    const Geometry::BBox right_bounds{ ComputeRangeBounds(right_references, 0,
+                                                          static_cast<unsigned int>(right_references.size()),
+                                                          false, false) };
+    std::unique_ptr<BVHBuildNode> first_child{
+        SpatialSplitBuild(left_references, left_bounds, vertices, root_surface, depth + 1, remaining_budget,
+                          leaf_references, created_nodes) };
+
+    return std::make_unique<BVHBuildNode>(split_axis, std::move(first_child),
+                                          SpatialSplitBuild(right_references, right_bounds, vertices, root_surface,
+                                                            depth + 1, remaining_budget, leaf_references,
+                                                            created_nodes));
+}
+
+const std::vector<BucketInfo> BVH::ComputeBucketsInfo(const std::vector<TriangleInfo>& triangle_info,
+                                                      unsigned int start, unsigned int end,
+                                                      const Geometry::BBox& centroids_bounds,
+                                                      unsigned int split_axis, bool parallel) const noexcept
+{
+    const float split_axis_reciprocal_diagonal{ 1.f /
+                                                (centroids_bounds.PMax()[split_axis] -
+                                                 centroids_bounds.PMin()[split_axis]) };
+    const auto fill_buckets = [this, &triangle_info, &centroids_bounds, split_axis, split_axis_reciprocal_diagonal](
+        std::vector<BucketInfo>& buckets, unsigned int range_start, unsigned int range_end) -> void
+    {
+        for (unsigned int i = range_start; i != range_end; i++)
+        {
+            // Compute index of the bucket where the triangle centroid is
+            unsigned int bucket_index{
+                static_cast<unsigned int>(
+                    configuration.num_buckets *
+                    (triangle_info[i].centroid[split_axis] - centroids_bounds.PMin()[split_axis]) *
+                    split_axis_reciprocal_diagonal
+                )
+            };
+
+            // Check if we are on the end of the bounds and fix index in that case
+            if (bucket_index == configuration.num_buckets)
+            {
+                bucket_index = configuration.num_buckets - 1;
+            }
+
+            // Increase count and compute bounds for the bucket
+            buckets[bucket_index].num_triangles++;
+            buckets[bucket_index].bounds = Union(buckets[bucket_index].bounds, triangle_info[i].bounds);
+        }
+    };
+
+    std::vector<BucketInfo> buckets(configuration.num_buckets);
+    if (!parallel)
+    {
+        fill_buckets(buckets, start, end);
+        return buckets;
+    }
+
+    // Each chunk fills its own buckets that are then merged, counts and bounds unions are exact so the result
+    // matches the serial one
+    std::mutex buckets_mutex;
+    ThreadPool::Global().ParallelFor(start, end, PARALLEL_PASS_GRAIN_SIZE,
+                                     [this, &fill_buckets, &buckets, &buckets_mutex](unsigned int chunk_start,
+                                                                                     unsigned int chunk_end) -> void
+                                     {
+                                         std::vector<BucketInfo> chunk_buckets(configuration.num_buckets);
+                                         fill_buckets(chunk_buckets, chunk_start, chunk_end);
+
+                                         std::lock_guard<std::mutex> lock{ buckets_mutex };
+                                         for (unsigned int b = 0; b != configuration.num_buckets; b++)
+                                         {
+                                             buckets[b].num_triangles += chunk_buckets[b].num_triangles;
+                                             buckets[b].bounds = Union(buckets[b].bounds, chunk_buckets[b].bounds);
+                                         }
+                                     });
 
     return buckets;
 }
 
-std::pair<unsigned int, float> BVH::FindBestBucketIndex(const std::vector<BucketInfo>& buckets,
+std::pair<unsigned int, float> BVH::FindBestBucketIndex(const std::vector<BucketInfo>& left_buckets,
+                                                        const std::vector<BucketInfo>& right_buckets,
                                                         const Geometry::BBox& node_bounds) const noexcept
 {
     const unsigned int scan_size{ configuration.num_buckets - 1 };
 
     // Forward scan
     std::vector<BucketInfo> forward_scan(scan_size);
-    forward_scan[0].bounds = buckets[0].bounds;
-    forward_scan[0].num_triangles = buckets[0].num_triangles;
+    forward_scan[0].bounds = left_buckets[0].bounds;
+    forward_scan[0].num_triangles = left_buckets[0].num_triangles;
     for (unsigned int i = 1; i < scan_size; i++)
     {
-        forward_scan[i].bounds = Union(forward_scan[i - 1].bounds, buckets[i].bounds);
-        forward_scan[i].num_triangles = forward_scan[i - 1].num_triangles + buckets[i].num_triangles;
+        forward_scan[i].bounds = Union(forward_scan[i - 1].bounds, left_buckets[i].bounds);
+        forward_scan[i].num_triangles = forward_scan[i - 1].num_triangles + left_buckets[i].num_triangles;
     }
 
     // Backward scan
     std::vector<BucketInfo> backward_scan(scan_size);
-    backward_scan[0].bounds = buckets[scan_size].bounds;
-    backward_scan[0].num_triangles = buckets[scan_size].num_triangles;
+    backward_scan[0].bounds = right_buckets[scan_size].bounds;
+    backward_scan[0].num_triangles = right_buckets[scan_size].num_triangles;
     for (unsigned int i = 1; i < scan_size; i++)
     {
         const unsigned int bucket_index{ scan_size - i };
-        backward_scan[i].bounds = Union(backward_scan[i - 1].bounds, buckets[bucket_index].bounds);
-        backward_scan[i].num_triangles = backward_scan[i - 1].num_triangles + buckets[bucket_index].num_triangles;
+        backward_scan[i].bounds = Union(backward_scan[i - 1].bounds, right_buckets[bucket_index].bounds);
+        backward_scan[i].num_triangles = backward_scan[i - 1].num_triangles +
+                                         right_buckets[bucket_index].num_triangles;
     }
 
     // Evaluate cost for splitting after each bucket
@@ -494,13 +2018,14 @@ std::pair<unsigned int, float> BVH::FindBestBucketIndex(const std::vector<Bucket
     return sah_result;
 }
 
-unsigned int BVH::FlattenTree(const std::unique_ptr<BVHBuildNode>& node, unsigned int& offset) noexcept
+unsigned int BVH::FlattenTree(const std::unique_ptr<BVHBuildNode>& node, LinearBVHNode* nodes,
+                              unsigned int& offset) noexcept
 {
     // Store current offset
     const unsigned int my_offset{ offset++ };
 
     // Get reference to the node we use
-    LinearBVHNode& linear_node = flat_tree_nodes[my_offset];
+    LinearBVHNode& linear_node = nodes[my_offset];
     // Set the bounds of the node
     linear_node.bounds = node->bounds;
 
@@ -519,9 +2044,9 @@ unsigned int BVH::FlattenTree(const std::unique_ptr<BVHBuildNode>& node, unsigne
         linear_node.split_axis = static_cast<uint8_t>(node->split_axis);
         linear_node.num_triangles = 0;
         // Recursively call the flatten procedure on the first child
-        FlattenTree(node->children[0], offset);
+        FlattenTree(node->children[0], nodes, offset);
         // Recursively call the flatten procedure on the second child and store his offset
-        linear_node.second_child_offset = FlattenTree(node->children[1], offset);
+        linear_node.second_child_offset = FlattenTree(node->children[1], nodes, offset);
     }
 
     return my_offset;
@@ -6,8 +6,11 @@
 #define RABBIT2_BVH_HPP
 
 #include "mesh/mesh.hpp"
+#include "triangle_packet.hpp"
+#include "utilities/utilities.hpp"
 
 #include <memory>
+#include <atomic>
 
 namespace Rabbit
 {
@@ -15,6 +18,10 @@ namespace Rabbit
 // Information of a triangle for building
 struct TriangleInfo
 {
+    constexpr TriangleInfo() noexcept
+        : triangle_index{ 0 }
+    {}
+
     constexpr TriangleInfo(unsigned int index, const Geometry::BBox& b) noexcept
         : triangle_index{ index }, bounds{ b }, centroid{ bounds.Centroid() }
     {}
@@ -25,7 +32,8 @@ struct TriangleInfo
     Geometry::Point3f centroid;
 };
 
-// Linear BVH node with 32 byte size for optimal cache performance
+// Linear BVH node with 32 byte size for optimal cache performance. The first child of an interior node follows it in
+// the depth first layout and precedes the second child in the other layouts
 struct alignas(32) LinearBVHNode
 {
     Geometry::BBox bounds;              // 24 bytes
@@ -39,17 +47,71 @@ struct alignas(32) LinearBVHNode
     uint8_t padding[1];                 // 1 byte padding to ensure alignment
 };
 
+// Size of the traversal stacks of the binary BVH, each interior node on the path to a node pushes at most one entry
+constexpr unsigned int BVH_STACK_SIZE{ 64 };
+
+// Largest number of triangles a leaf can reference
+constexpr unsigned int MAX_LEAF_TRIANGLES{ 0xFFFF };
+
+// Number of levels of median splits needed to reduce a range of num_items to a single item
+inline unsigned int MedianSplitLevels(unsigned int num_items) noexcept
+{
+    return num_items > 1 ? Log2Int(num_items - 1) + 1 : 0;
+}
+
+// Algorithm used to build the BVH
+enum class BVHBuildMethod
+{
+    RECURSIVE,
+    BINNED,
+    SPATIAL,    // Serial recursive build also considering spatial splits that duplicate the triangles they cut
+    LINEAR,     // Parallel build following the Morton codes of the centroids (LBVH)
+    LINEAR_SAH  // Parallel build following the Morton codes with the top levels built with SAH (HLBVH)
+};
+
+// Format of the triangles referenced by the leafs
+enum class BVHLeafFormat
+{
+    TRIANGLES,  // Triangles tested one after the other
+    PACKETS4,   // Triangles packed in groups of 4 and tested with SSE
+    PACKETS8    // Triangles packed in groups of 8 and tested with AVX
+};
+
+// Order of the nodes in memory
+enum class BVHNodeLayout
+{
+    DEPTH_FIRST,        // Nodes of a subtree are contiguous
+    SUBTREE_CLUSTERS,   // Sibling pairs grouped in page sized blocks following the most likely paths from their root
+    VAN_EMDE_BOAS       // Sibling pairs in cache oblivious order, the tree is recursively cut at half its height
+};
+
 // Configuration of the BVH
 struct BVHConfig
 {
     constexpr explicit BVHConfig(unsigned int max_triangles_in_leaf = 4,
                                  float triangle_intersect_cost = 1.f,
                                  float bbox_intersect_cost = 0.2f,
-                                 unsigned int num_buckets = 12) noexcept
+                                 unsigned int num_buckets = 12,
+                                 unsigned int parallel_build_threshold = 0,
+                                 BVHBuildMethod build_method = BVHBuildMethod::RECURSIVE,
+                                 BVHLeafFormat leaf_format = BVHLeafFormat::TRIANGLES,
+                                 float spatial_split_budget = 0.25f,
+                                 float pre_split_budget = 0.f,
+                                 float pre_split_surface_ratio = 16.f,
+                                 float optimization_time_budget_ms = 0.f,
+                                 BVHNodeLayout node_layout = BVHNodeLayout::DEPTH_FIRST) noexcept
         : max_triangles_in_leaf{ std::min(255u, max_triangles_in_leaf) },
           triangle_intersect_cost{ triangle_intersect_cost },
           bbox_intersect_cost{ bbox_intersect_cost },
-          num_buckets{ std::max(2u, num_buckets) }
+          num_buckets{ std::max(2u, num_buckets) },
+          parallel_build_threshold{ parallel_build_threshold },
+          build_method{ build_method },
+          leaf_format{ leaf_format },
+          spatial_split_budget{ std::max(0.f, spatial_split_budget) },
+          pre_split_budget{ std::max(0.f, pre_split_budget) },
+          pre_split_surface_ratio{ pre_split_surface_ratio },
+          optimization_time_budget_ms{ std::max(0.f, optimization_time_budget_ms) },
+          node_layout{ node_layout }
     {}
 
     // Maximum number of triangles in leaf node
@@ -60,6 +122,84 @@ struct BVHConfig
     const float bbox_intersect_cost;
     // Number of buckets to use to evaluate SAH
     const unsigned int num_buckets;
+    // Minimum number of triangles in a node to build its subtrees in parallel, 0 disables the parallel build
+    const unsigned int parallel_build_threshold;
+    // Method used to build the tree
+    const BVHBuildMethod build_method;
+    // Format of the triangles in the leafs
+    const BVHLeafFormat leaf_format;
+    // Maximum number of references added by the spatial splits, relative to the number of triangles
+    const float spatial_split_budget;
+    // Maximum number of references added by splitting triangles before the build, relative to the number of
+    // triangles. 0 disables the pre-splitting
+    const float pre_split_budget;
+    // Triangles are pre-split only if the surface of their bounds is larger than their area by this factor
+    const float pre_split_surface_ratio;
+    // Time given to the restructuring of treelets after the build to lower the SAH cost, 0 disables the
+    // optimization. Full rebuilds after a refit pay it again
+    const float optimization_time_budget_ms;
+    // Order of the nodes, the layouts other than depth first keep the two children of a node in the same cache line.
+    // Refits go through the depth first layout
+    const BVHNodeLayout node_layout;
+};
+
+// Statistics collected while building the BVH
+struct BVHBuildStatistics
+{
+    BVHBuildStatistics() noexcept
+        : build_time_ms{ 0.f }, peak_memory_bytes{ 0 }, builder_peak_memory_bytes{ 0 }, sah_cost{ 0.f },
+          num_references{ 0 }, optimization_time_ms{ 0.f }, num_optimization_passes{ 0 }
+    {}
+
+    // Time spent building the tree
+    float build_time_ms;
+    // Peak of the memory allocated by the build on top of the input triangles
+    size_t peak_memory_bytes;
+    // Peak of the memory used by the builder for the nodes and its scratch data
+    size_t builder_peak_memory_bytes;
+    // SAH cost of the built tree
+    float sah_cost;
+    // Number of triangle references in the leafs, more than the triangles if spatial splits duplicated some
+    unsigned int num_references;
+    // Time spent restructuring treelets, included in the build time, and number of passes over the tree
+    float optimization_time_ms;
+    unsigned int num_optimization_passes;
+};
+
+// Configuration of the quality monitor run after a refit
+struct BVHRefitConfig
+{
+    constexpr explicit BVHRefitConfig(float rebuild_cost_ratio = 0.f,
+                                      float subtree_rebuild_cost_ratio = 0.f) noexcept
+        : rebuild_cost_ratio{ rebuild_cost_ratio },
+          subtree_rebuild_cost_ratio{ subtree_rebuild_cost_ratio }
+    {}
+
+    // Ratio between the SAH cost of the refitted tree and the one of the last build above which the whole tree is
+    // rebuilt, 0 disables the check
+    const float rebuild_cost_ratio;
+    // Same ratio for the subtrees under the top levels of the tree, which are rebuilt in place. 0 disables the check
+    const float subtree_rebuild_cost_ratio;
+};
+
+// Statistics of a refit
+struct BVHRefitStatistics
+{
+    BVHRefitStatistics() noexcept
+        : refit_time_ms{ 0.f }, rebuild_time_ms{ 0.f }, sah_cost_ratio{ 1.f },
+          num_rebuilt_subtrees{ 0 }, full_rebuild{ false }
+    {}
+
+    // Time spent updating the bounds
+    float refit_time_ms;
+    // Time spent rebuilding the degraded parts of the tree
+    float rebuild_time_ms;
+    // Ratio between the SAH cost of the refitted tree and the one of the last build
+    float sah_cost_ratio;
+    // Number of subtrees rebuilt in place
+    unsigned int num_rebuilt_subtrees;
+    // True if the whole tree was rebuilt
+    bool full_rebuild;
 };
 
 // Output of the PartitionTriangles function
@@ -78,6 +218,9 @@ struct PartitionResult
 // Forward declare build node struct
 struct BVHBuildNode;
 struct BucketInfo;
+struct ObjectSplit;
+struct SpatialSplit;
+class BVHCache;
 
 class BVH
 {
@@ -86,6 +229,10 @@ public:
 
     BVH(const BVHConfig& config, std::vector<Triangle>&& tr);
 
+    // Use the tree stored in a cache, the triangles are the ones created by the cache in the order of the tree. The
+    // nodes, the precomputed triangles and the packets are used in place from the mapped file, a refit copies them
+    BVH(const BVHConfig& config, std::vector<Triangle>&& tr, std::shared_ptr<const BVHCache> bvh_cache);
+
     // We allow move construction
     BVH(BVH&& other) noexcept;
 
@@ -100,23 +247,130 @@ public:
     bool Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
                    Geometry::TriangleIntersection& intersection) const noexcept;
 
+    // Find closest hit setting only the hit triangle and the barycentric coordinates of the intersection, used when
+    // the geometry is computed by the caller
+    bool IntersectClosest(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                          Geometry::TriangleIntersection& intersection) const noexcept;
+
     // Check for intersection
     bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
 
+    // Update the bounds of the tree after the vertices of the meshes moved, the topology is kept. The config decides
+    // if the whole tree or some of its subtrees are rebuilt when their quality degraded too much. The list of
+    // triangles is never reordered, so pointers to them stay valid. Refitted leafs bound the whole triangles they
+    // reference, so trees with spatial splits lose quality faster
+    const BVHRefitStatistics Refit(const BVHRefitConfig& config = BVHRefitConfig{});
+
+    // SAH cost of the subtree with the given root, relative to the surface area of the root
+    float SAHCost(unsigned int node_index = 0) const noexcept;
+
+    // Intersect up to PacketSize rays traversing the tree together, the bounds of each node are tested against all
+    // the rays at once and only the rays that hit the parent are tested against the children. Returns the mask of
+    // the rays that hit something
+    template <unsigned int PacketSize>
+    unsigned int IntersectPacket(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                                 Geometry::TriangleIntersection* intersections,
+                                 unsigned int num_rays) const noexcept;
+
+    // Check for intersection for up to PacketSize rays, returns the mask of the rays that hit something
+    template <unsigned int PacketSize>
+    unsigned int IntersectPacketTest(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                                     unsigned int num_rays) const noexcept;
+
+    // Intersect ray with the triangles of a leaf
+    void IntersectLeaf(const WatertightRay& ray, unsigned int triangle_offset, unsigned int num_triangles,
+                       Geometry::Intervalf& interval, Geometry::TriangleIntersection& intersection) const noexcept;
+
+    // Check for intersection with the triangles of a leaf
+    bool IntersectLeafTest(const WatertightRay& ray, unsigned int triangle_offset, unsigned int num_triangles,
+                           const Geometry::Intervalf& interval) const noexcept;
+
     // Access list of triangle in the BVH
     const std::vector<Triangle>& Triangles() const noexcept
     {
         return triangles;
     }
 
+    // Access intersection ready triangles, stored in the order referenced by the leafs. With packed leafs each leaf
+    // starts at a multiple of the packet width and the unused entries reference no triangle
+    const PrecomputedTriangle* PrecomputedTriangles() const noexcept
+    {
+        return precomputed_triangles;
+    }
+
+    unsigned int NumPrecomputedTriangles() const noexcept
+    {
+        return num_precomputed_triangles;
+    }
+
+    // Number of nodes in the tree
+    unsigned int NumNodes() const noexcept
+    {
+        return total_nodes;
+    }
+
+    // Access nodes of the tree in the configured layout, the root is the first one
+    const LinearBVHNode* Nodes() const noexcept
+    {
+        return flat_tree_nodes;
+    }
+
+    // Index of the first child of an interior node
+    unsigned int FirstChildIndex(unsigned int node_index, const LinearBVHNode& node) const noexcept
+    {
+        return node_layout == BVHNodeLayout::DEPTH_FIRST ? node_index + 1 : node.second_child_offset - 1;
+    }
+
+    // Access statistics of the build
+    const BVHBuildStatistics& BuildStatistics() const noexcept
+    {
+        return build_statistics;
+    }
+
 private:
-    // Build tree
-    void Build();
+    // The cache writes the tree as it is in memory
+    friend class BVHCache;
+
+    // Build tree, the triangles are sorted in leaf order if requested
+    void Build(bool reorder_triangles);
+
+    // Replace the references to triangles with loose bounds by several references with tighter bounds, the largest
+    // bounds are split first until the pre-split budget is used. The builders see them as separate triangles
+    void PreSplitTriangles(std::vector<TriangleInfo>& triangle_info) const;
 
-    // Recursively build a subpart of the tree for the given range of triangles start to end (not included)
+    // Build the nodes for the given triangles with the configured method, the leafs reference the triangle
+    // information that is left in leaf order. The vertices of the triangles are only used by the spatial splits,
+    // which can add references to the same triangle. The depth of the root in the whole tree counts against the
+    // traversal stack
+    LinearBVHNode* BuildNodes(std::vector<TriangleInfo>& triangle_info, const PrecomputedTriangle* vertices,
+                              unsigned int root_depth, unsigned int& num_nodes, size_t& builder_memory_bytes);
+
+    // Recursively build a subpart of the tree at the given depth for the given range of triangles start to end (not
+    // included). Leafs reference the triangles in the range directly, so after the build the order of triangle_info
+    // is the order of the triangles in the leafs. Ranges are split at the median where needed to keep the tree
+    // within the traversal stack and the leafs within MAX_LEAF_TRIANGLES
     std::unique_ptr<BVHBuildNode> RecursiveBuild(std::vector<TriangleInfo>& triangle_info,
-                                                 unsigned int start, unsigned int end,
-                                                 std::vector<Triangle>& ordered_triangles) noexcept;
+                                                 unsigned int start, unsigned int end, unsigned int depth,
+                                                 std::atomic_uint& created_nodes) noexcept;
+
+    // Recursively build the subtree for the given triangle references considering both object and spatial splits.
+    // References cut by a spatial split go to both children with clipped bounds while the budget of added
+    // references allows it. The references are split at the median where needed to keep the tree within the
+    // traversal stack and the leafs within MAX_LEAF_TRIANGLES. Leafs append their references to leaf_references
+    std::unique_ptr<BVHBuildNode> SpatialSplitBuild(std::vector<TriangleInfo>& references,
+                                                    const Geometry::BBox& node_bounds,
+                                                    const PrecomputedTriangle* vertices, float root_surface,
+                                                    unsigned int depth, unsigned int& remaining_budget,
+                                                    std::vector<TriangleInfo>& leaf_references,
+                                                    unsigned int& created_nodes);
+
+    // Check if the passes over a range of triangles during the build should be split between threads
+    bool IsParallelRange(unsigned int num_range_triangles, unsigned int num_total_triangles) const noexcept;
+
+    // Compute bounds of the triangles or of their centroids in the given range
+    const Geometry::BBox ComputeRangeBounds(const std::vector<TriangleInfo>& triangle_info,
+                                            unsigned int start, unsigned int end,
+                                            bool centroids, bool parallel) const noexcept;
 
     // Partition triangles in current range, the two partitions are going to be [start, mid) and [mid, end)
     bool PartitionTriangles(std::vector<TriangleInfo>& triangle_info,
@@ -124,27 +378,199 @@ private:
                             const Geometry::BBox& node_bounds,
                             PartitionResult& partition_result) const noexcept;
 
+    // Find the split of the centroids with the lowest SAH cost over the three axis
+    const ObjectSplit FindObjectSplit(const std::vector<TriangleInfo>& triangle_info,
+                                      unsigned int start, unsigned int end,
+                                      const Geometry::BBox& node_bounds, bool parallel) const noexcept;
+
+    // Partition the range for the given object split, returns the index of the first triangle of the second half
+    unsigned int PartitionObjectSplit(std::vector<TriangleInfo>& triangle_info,
+                                      unsigned int start, unsigned int end,
+                                      const ObjectSplit& split) const noexcept;
+
+    // Partition the range in two halves of the same size at the median centroid along the largest axis of the
+    // centroids
+    void PartitionMedian(std::vector<TriangleInfo>& triangle_info, unsigned int start, unsigned int end,
+                         PartitionResult& partition_result) const noexcept;
+
+    // Find the plane with the lowest SAH cost when the references are clipped against it
+    const SpatialSplit FindSpatialSplit(const std::vector<TriangleInfo>& references,
+                                        const Geometry::BBox& node_bounds,
+                                        const PrecomputedTriangle* vertices) const noexcept;
+
     // Compute buckets information for SAH
     const std::vector<BucketInfo> ComputeBucketsInfo(const std::vector<TriangleInfo>& triangle_info,
                                                      unsigned int start, unsigned int end,
                                                      const Geometry::BBox& centroids_bounds,
-                                                     unsigned int split_axis) const noexcept;
+                                                     unsigned int split_axis, bool parallel) const noexcept;
 
-    // Find index of the best bucket to split with the cost
-    std::pair<unsigned int, float> FindBestBucketIndex(const std::vector<BucketInfo>& buckets,
+    // Find index of the best bucket to split with the cost. The left side of a split counts the triangles of
+    // left_buckets and the right side the ones of right_buckets, they differ for spatial splits where a triangle
+    // spans several buckets
+    std::pair<unsigned int, float> FindBestBucketIndex(const std::vector<BucketInfo>& left_buckets,
+                                                       const std::vector<BucketInfo>& right_buckets,
                                                        const Geometry::BBox& node_bounds) const noexcept;
 
+    // Fill the precomputed triangles in leaf order and the packets if needed, triangle_info is in leaf order
+    void BuildLeafData(const std::vector<TriangleInfo>& triangle_info);
+
+    // Number of precomputed triangles used by a leaf, including the empty entries that pad its last packet
+    unsigned int LeafEntries(unsigned int num_triangles) const noexcept;
+
+    // Index one past the last node of the subtree with the given root, in the depth first layout where the nodes of a
+    // subtree are contiguous
+    unsigned int SubtreeEnd(unsigned int node_index) const noexcept;
+
+    // Roots of the subtrees refitted in parallel, these are the nodes at a fixed depth or the leafs above it
+    const std::vector<unsigned int> RefitSubtreeRoots() const;
+
+    // Update vertices and bounds of the subtree with the given root
+    void RefitSubtree(unsigned int root_index) noexcept;
+
+    // Update bounds of the nodes above the refitted subtrees, returns the bounds of the node
+    const Geometry::BBox RefitTopNodes(unsigned int node_index, unsigned int depth) noexcept;
+
+    // Rebuild the subtrees with the given roots in place, sorted by index. The nodes and precomputed triangles after
+    // each subtree are moved
+    void RebuildSubtrees(const std::vector<unsigned int>& root_indices);
+
+    // Free nodes and packets and build the tree again from the triangles
+    void Rebuild();
+
+    // Reorder the nodes from the depth first layout to the configured one, or back if to_depth_first is true
+    void SwitchNodeLayout(bool to_depth_first);
+
+    // Copy the data used in place from the cache in memory owned by the tree, such that it can be modified
+    void ReleaseCache();
+
+    // Pack the precomputed triangles in groups of Width
+    template <unsigned int Width>
+    TrianglePacket<Width>* BuildTrianglePackets() const;
+
+    // Fill the packets of a leaf from its precomputed triangles
+    template <unsigned int Width>
+    void FillTrianglePackets(TrianglePacket<Width>* packets, unsigned int triangle_offset,
+                             unsigned int num_triangles) const noexcept;
+
+    // Test a range of packets
+    template <unsigned int Width>
+    void IntersectPackets(const TrianglePacket<Width>* packets, const WatertightRay& ray,
+                          unsigned int triangle_offset, unsigned int num_triangles,
+                          Geometry::Intervalf& interval, Geometry::TriangleIntersection& intersection) const noexcept;
+
+    template <unsigned int Width>
+    bool IntersectPacketsTest(const TrianglePacket<Width>* packets, const WatertightRay& ray,
+                              unsigned int triangle_offset, unsigned int num_triangles,
+                              const Geometry::Intervalf& interval) const noexcept;
+
     // Flatten out tree
-    unsigned int FlattenTree(const std::unique_ptr<BVHBuildNode>& node, unsigned int& offset) noexcept;
+    static unsigned int FlattenTree(const std::unique_ptr<BVHBuildNode>& node, LinearBVHNode* nodes,
+                                    unsigned int& offset) noexcept;
 
     // BVH members
     const BVHConfig configuration;
     std::vector<Triangle> triangles;
+    // Intersection ready triangles in leaf order, the triangles list is only accessed for shading
+    unsigned int num_precomputed_triangles;
+    PrecomputedTriangle* precomputed_triangles;
+    // Precomputed triangles packed for the SIMD test, only the ones matching the leaf format are allocated
+    TrianglePacket4* triangle_packets4;
+    TrianglePacket8* triangle_packets8;
     // Nodes representing the flat tree
     unsigned int total_nodes;
     LinearBVHNode* flat_tree_nodes;
+    // Current order of the nodes, the refits go through the depth first layout
+    BVHNodeLayout node_layout;
+    // Build statistics
+    BVHBuildStatistics build_statistics;
+    // SAH cost of the subtrees returned by RefitSubtreeRoots when they were last built
+    std::vector<float> subtree_build_costs;
+    // Cache the nodes, the precomputed triangles and the packets point to, they are owned by the tree if null
+    std::shared_ptr<const BVHCache> cache;
 };
 
+inline void BVH::IntersectLeaf(const WatertightRay& ray, unsigned int triangle_offset, unsigned int num_triangles,
+                              Geometry::Intervalf& interval,
+                              Geometry::TriangleIntersection& intersection) const noexcept
+{
+    switch (configuration.leaf_format)
+    {
+        case BVHLeafFormat::PACKETS4:
+            IntersectPackets(triangle_packets4, ray, triangle_offset, num_triangles, interval, intersection);
+            break;
+        case BVHLeafFormat::PACKETS8:
+            IntersectPackets(triangle_packets8, ray, triangle_offset, num_triangles, interval, intersection);
+            break;
+        default:
+            for (unsigned int i = 0; i != num_triangles; i++)
+            {
+                const PrecomputedTriangle& triangle{ precomputed_triangles[triangle_offset + i] };
+                if (triangle.Intersect(ray, interval, intersection.barycentric_coordinates))
+                {
+                    intersection.hit_triangle = &triangles[triangle.triangle_index];
+                }
+            }
+            break;
+    }
+}
+
+inline bool BVH::IntersectLeafTest(const WatertightRay& ray, unsigned int triangle_offset, unsigned int num_triangles,
+                                   const Geometry::Intervalf& interval) const noexcept
+{
+    switch (configuration.leaf_format)
+    {
+        case BVHLeafFormat::PACKETS4:
+            return IntersectPacketsTest(triangle_packets4, ray, triangle_offset, num_triangles, interval);
+        case BVHLeafFormat::PACKETS8:
+            return IntersectPacketsTest(triangle_packets8, ray, triangle_offset, num_triangles, interval);
+        default:
+            for (unsigned int i = 0; i != num_triangles; i++)
+            {
+                if (precomputed_triangles[triangle_offset + i].IntersectTest(ray, interval))
+                {
+                    return true;
+                }
+            }
+            return false;
+    }
+}
+
+template <unsigned int Width>
+inline void BVH::IntersectPackets(const TrianglePacket<Width>* packets, const WatertightRay& ray,
+                                  unsigned int triangle_offset, unsigned int num_triangles,
+                                  Geometry::Intervalf& interval,
+                                  Geometry::TriangleIntersection& intersection) const noexcept
+{
+    const unsigned int first_packet{ triangle_offset / Width };
+    const unsigned int last_packet{ first_packet + DivideUp(num_triangles, Width) };
+    for (unsigned int p = first_packet; p != last_packet; p++)
+    {
+        const unsigned int lane{ packets[p].Intersect(ray, interval, intersection.barycentric_coordinates) };
+        if (lane != Width)
+        {
+            intersection.hit_triangle = &triangles[packets[p].triangle_index[lane]];
+        }
+    }
+}
+
+template <unsigned int Width>
+inline bool BVH::IntersectPacketsTest(const TrianglePacket<Width>* packets, const WatertightRay& ray,
+                                      unsigned int triangle_offset, unsigned int num_triangles,
+                                      const Geometry::Intervalf& interval) const noexcept
+{
+    const unsigned int first_packet{ triangle_offset / Width };
+    const unsigned int last_packet{ first_packet + DivideUp(num_triangles, Width) };
+    for (unsigned int p = first_packet; p != last_packet; p++)
+    {
+        if (packets[p].IntersectTest(ray, interval))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 } // Rabbit namespace
 
 #endif //RABBIT2_BVH_HPP
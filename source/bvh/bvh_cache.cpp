@@ -0,0 +1,520 @@
+#include "bvh_cache.hpp"
+#include "utilities/content_hash.hpp"
+#include "utilities/memory.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace Rabbit
+{
+
+// Range of elements stored in the file
+struct BVHCacheSection
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+// Buffers of a mesh
+struct BVHCacheMesh
+{
+    BVHCacheSection vertices;
+    BVHCacheSection normals;
+    BVHCacheSection uvs;
+    BVHCacheSection triangles;
+};
+
+// Triangle of the tree, identified by its mesh and its description in the mesh
+struct BVHCacheTriangle
+{
+    uint32_t mesh_index;
+    uint32_t triangle_index;
+};
+
+struct BVHCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_layout;
+    uint64_t key;
+    BVHBuildStatistics build_statistics;
+    BVHCacheSection meshes;
+    BVHCacheSection triangles;
+    BVHCacheSection nodes;
+    BVHCacheSection precomputed_triangles;
+    BVHCacheSection triangle_packets4;
+    BVHCacheSection triangle_packets8;
+    BVHCacheSection subtree_build_costs;
+};
+
+namespace
+{
+
+constexpr char BVH_CACHE_MAGIC[8]{ 'R', 'A', 'B', 'B', 'V', 'H', 'C', '\0' };
+// Sections start at multiples of the cache line size in the file. The mapping starts at a page, so the data is
+// aligned as if it was allocated with AllocateAligned
+constexpr uint64_t BVH_CACHE_ALIGNMENT{ CACHE_LINE_SIZE };
+
+// Write elements at the next aligned offset of the file, returns their section
+template <typename T>
+const BVHCacheSection WriteSection(std::ofstream& file, const T* elements, size_t count)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable data can be cached");
+
+    const char padding[BVH_CACHE_ALIGNMENT]{};
+    const uint64_t position{ static_cast<uint64_t>(file.tellp()) };
+    const uint64_t offset{ DivideUp(position, BVH_CACHE_ALIGNMENT) * BVH_CACHE_ALIGNMENT };
+    file.write(padding, offset - position);
+    file.write(reinterpret_cast<const char*>(elements), count * sizeof(T));
+
+    return { offset, count };
+}
+
+// Check that an index references one of num_elements, or is the given empty value
+bool ValidIndex(uint64_t index, uint64_t num_elements, uint64_t empty_index) noexcept
+{
+    return index < num_elements || index == empty_index;
+}
+
+} // anonymous namespace
+
+template <typename T>
+const T* BVHCache::SectionData(const BVHCacheSection& section) const noexcept
+{
+    return section.count != 0 ? reinterpret_cast<const T*>(file.Data() + section.offset) : nullptr;
+}
+
+template <typename T>
+void BVHCache::ValidateSection(const BVHCacheSection& section) const
+{
+    if (section.offset % BVH_CACHE_ALIGNMENT != 0 || section.offset > file.Size() ||
+        section.count > (file.Size() - section.offset) / sizeof(T))
+    {
+        throw std::runtime_error("The BVH cache is corrupted\n");
+    }
+}
+
+BVHCache::BVHCache(const std::string& filename)
+    : file{ filename }, header{ nullptr }
+{
+    Validate();
+    header = reinterpret_cast<const BVHCacheHeader*>(file.Data());
+}
+
+std::shared_ptr<const BVHCache> BVHCache::Open(const std::string& filename, uint64_t key) noexcept
+{
+    try
+    {
+        std::shared_ptr<const BVHCache> cache{ std::make_shared<const BVHCache>(filename) };
+        if (cache->Key() == key)
+        {
+            return cache;
+        }
+    }
+    catch (const std::exception&)
+    {
+        // A missing or invalid cache is rebuilt
+    }
+
+    return nullptr;
+}
+
+void BVHCache::Write(const std::string& filename, uint64_t key, const std::vector<const Mesh*>& meshes,
+                     const BVH& bvh)
+{
+    // Find the mesh of each triangle, all the triangles of a mesh are created with the same transform and material
+    std::unordered_map<const Mesh*, uint32_t> mesh_indices;
+    for (uint32_t mesh_index = 0; mesh_index != meshes.size(); mesh_index++)
+    {
+        mesh_indices.emplace(meshes[mesh_index], mesh_index);
+    }
+    std::vector<const Triangle*> mesh_first_triangles(meshes.size(), nullptr);
+    std::vector<BVHCacheTriangle> cache_triangles;
+    cache_triangles.reserve(bvh.triangles.size());
+    for (const Triangle& triangle : bvh.triangles)
+    {
+        const auto mesh_index = mesh_indices.find(&triangle.TriangleMesh());
+        if (mesh_index == mesh_indices.end())
+        {
+            throw std::runtime_error("The BVH references a mesh that is not cached\n");
+        }
+        const Triangle*& first_triangle{ mesh_first_triangles[mesh_index->second] };
+        if (first_triangle == nullptr)
+        {
+            first_triangle = &triangle;
+        }
+        else if (first_triangle->material != triangle.material ||
+                 first_triangle->Transformation() != triangle.Transformation())
+        {
+            throw std::runtime_error("The triangles of a cached mesh need the same transform and material\n");
+        }
+        const TriangleDescription* descriptions{ triangle.TriangleMesh().TriangleDescriptions().data() };
+        cache_triangles.push_back({ mesh_index->second,
+                                    static_cast<uint32_t>(&triangle.Description() - descriptions) });
+    }
+
+    // Write the sections after the header, which is written last
+    const std::string temporary_filename{ filename + ".tmp" };
+    {
+        std::ofstream file{ temporary_filename, std::ios::binary };
+        if (!file.is_open())
+        {
+            std::ostringstream error_string;
+            error_string << "Could not open file: " << temporary_filename << "\n";
+            throw std::runtime_error(error_string.str());
+        }
+
+        BVHCacheHeader cache_header{};
+        file.write(reinterpret_cast<const char*>(&cache_header), sizeof(BVHCacheHeader));
+
+        std::vector<BVHCacheMesh> cache_meshes;
+        for (const Mesh* mesh : meshes)
+        {
+            cache_meshes.push_back({ WriteSection(file, mesh->Vertices().data(), mesh->Vertices().size()),
+                                     WriteSection(file, mesh->Normals().data(), mesh->Normals().size()),
+                                     WriteSection(file, mesh->UVs().data(), mesh->UVs().size()),
+                                     WriteSection(file, mesh->TriangleDescriptions().data(),
+                                                  mesh->TriangleDescriptions().size()) });
+        }
+        std::memcpy(cache_header.magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC));
+        cache_header.version = BVH_CACHE_VERSION;
+        cache_header.node_layout = static_cast<uint32_t>(bvh.node_layout);
+        cache_header.key = key;
+        cache_header.build_statistics = bvh.build_statistics;
+        cache_header.meshes = WriteSection(file, cache_meshes.data(), cache_meshes.size());
+        cache_header.triangles = WriteSection(file, cache_triangles.data(), cache_triangles.size());
+        cache_header.nodes = WriteSection(file, bvh.flat_tree_nodes, bvh.total_nodes);
+        cache_header.precomputed_triangles = WriteSection(file, bvh.precomputed_triangles,
+                                                          bvh.num_precomputed_triangles);
+        if (bvh.triangle_packets4 != nullptr)
+        {
+            cache_header.triangle_packets4 = WriteSection(file, bvh.triangle_packets4,
+                                                          bvh.num_precomputed_triangles / 4);
+        }
+        if (bvh.triangle_packets8 != nullptr)
+        {
+            cache_header.triangle_packets8 = WriteSection(file, bvh.triangle_packets8,
+                                                          bvh.num_precomputed_triangles / 8);
+        }
+        cache_header.subtree_build_costs = WriteSection(file, bvh.subtree_build_costs.data(),
+                                                        bvh.subtree_build_costs.size());
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&cache_header), sizeof(BVHCacheHeader));
+        if (!file)
+        {
+            std::ostringstream error_string;
+            error_string << "Error writing file: " << temporary_filename << "\n";
+            throw std::runtime_error(error_string.str());
+        }
+    }
+
+    // Replace the cache at once, mappings of the old file stay valid
+    if (std::rename(temporary_filename.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(temporary_filename.c_str());
+        std::ostringstream error_string;
+        error_string << "Could not write file: " << filename << "\n";
+        throw std::runtime_error(error_string.str());
+    }
+}
+
+uint64_t BVHCache::ComputeKey(const BVHConfig& config, uint64_t meshes_hash,
+                              const std::vector<std::shared_ptr<const Geometry::Transform>>& transforms,
+                              const std::vector<std::shared_ptr<const MaterialInterface>>& materials) noexcept
+{
+    // The data is stored as it is in memory, so its layout is part of the key
+    ContentHash hash;
+    hash.Add(BVH_CACHE_VERSION);
+    hash.Add(sizeof(BVHCacheHeader));
+    hash.Add(sizeof(LinearBVHNode));
+    hash.Add(sizeof(PrecomputedTriangle));
+    hash.Add(sizeof(TrianglePacket4));
+    hash.Add(sizeof(TrianglePacket8));
+    hash.Add(sizeof(TriangleDescription));
+
+    hash.Add(config.max_triangles_in_leaf);
+    hash.Add(config.triangle_intersect_cost);
+    hash.Add(config.bbox_intersect_cost);
+    hash.Add(config.num_buckets);
+    hash.Add(config.parallel_build_threshold);
+    hash.Add(config.build_method);
+    hash.Add(config.leaf_format);
+    hash.Add(config.spatial_split_budget);
+    hash.Add(config.pre_split_budget);
+    hash.Add(config.pre_split_surface_ratio);
+    hash.Add(config.optimization_time_budget_ms);
+    hash.Add(config.node_layout);
+    hash.Add(meshes_hash);
+
+    // The triangles are stored transformed to world space
+    for (const auto& transform : transforms)
+    {
+        for (unsigned int row = 0; row != 4; row++)
+        {
+            for (unsigned int column = 0; column != 4; column++)
+            {
+                hash.Add(transform->LocalToWorld()(row, column));
+            }
+        }
+    }
+
+    // Materials are identified by their type and by the first mesh using them
+    for (size_t i = 0; i != materials.size(); i++)
+    {
+        const char* type_name{ typeid(*materials[i]).name() };
+        hash.AddBytes(type_name, std::strlen(type_name));
+        hash.Add(static_cast<uint64_t>(std::find(materials.begin(), materials.end(), materials[i]) -
+                                       materials.begin()));
+    }
+
+    return hash.Value();
+}
+
+uint64_t BVHCache::Key() const noexcept
+{
+    return header->key;
+}
+
+std::vector<Mesh> BVHCache::LoadMeshes() const
+{
+    const BVHCacheMesh* cache_meshes{ SectionData<BVHCacheMesh>(header->meshes) };
+    std::vector<Mesh> meshes;
+    meshes.reserve(header->meshes.count);
+    for (uint64_t mesh_index = 0; mesh_index != header->meshes.count; mesh_index++)
+    {
+        const BVHCacheMesh& cache_mesh{ cache_meshes[mesh_index] };
+        const Geometry::Point3f* vertices{ SectionData<Geometry::Point3f>(cache_mesh.vertices) };
+        const Geometry::Vector3f* normals{ SectionData<Geometry::Vector3f>(cache_mesh.normals) };
+        const Geometry::Vector2f* uvs{ SectionData<Geometry::Vector2f>(cache_mesh.uvs) };
+        const TriangleDescription* triangles{ SectionData<TriangleDescription>(cache_mesh.triangles) };
+
+        // The normals and UVs are only referenced when the mesh has them
+        const uint64_t num_vertices{ cache_mesh.vertices.count };
+        const uint64_t num_normals{ cache_mesh.normals.count != 0 ? cache_mesh.normals.count :
+                                    std::numeric_limits<uint64_t>::max() };
+        const uint64_t num_uvs{ cache_mesh.uvs.count != 0 ? cache_mesh.uvs.count :
+                                std::numeric_limits<uint64_t>::max() };
+        for (uint64_t i = 0; i != cache_mesh.triangles.count; i++)
+        {
+            const TriangleDescription& triangle{ triangles[i] };
+            if (triangle.v0 >= num_vertices || triangle.v1 >= num_vertices || triangle.v2 >= num_vertices ||
+                triangle.n0 >= num_normals || triangle.n1 >= num_normals || triangle.n2 >= num_normals ||
+                triangle.uv0 >= num_uvs || triangle.uv1 >= num_uvs || triangle.uv2 >= num_uvs)
+            {
+                throw std::runtime_error("The BVH cache is corrupted\n");
+            }
+        }
+
+        meshes.emplace_back(std::vector<Geometry::Point3f>(vertices, vertices + cache_mesh.vertices.count),
+                            std::vector<Geometry::Vector3f>(normals, normals + cache_mesh.normals.count),
+                            std::vector<Geometry::Vector2f>(uvs, uvs + cache_mesh.uvs.count),
+                            std::vector<TriangleDescription>(triangles, triangles + cache_mesh.triangles.count));
+    }
+
+    return meshes;
+}
+
+std::vector<Triangle> BVHCache::CreateTriangles(
+    const std::vector<Mesh>& meshes, const std::vector<std::shared_ptr<const Geometry::Transform>>& transforms,
+    const std::vector<std::shared_ptr<const MaterialInterface>>& materials) const
+{
+    if (meshes.size() != header->meshes.count || transforms.size() != meshes.size() ||
+        materials.size() != meshes.size())
+    {
+        throw std::runtime_error("The meshes do not match the ones of the BVH cache\n");
+    }
+
+    const BVHCacheTriangle* cache_triangles{ SectionData<BVHCacheTriangle>(header->triangles) };
+    std::vector<Triangle> triangles;
+    triangles.reserve(header->triangles.count);
+    for (uint64_t i = 0; i != header->triangles.count; i++)
+    {
+        const BVHCacheTriangle& cache_triangle{ cache_triangles[i] };
+        if (cache_triangle.mesh_index >= meshes.size() ||
+            cache_triangle.triangle_index >= meshes[cache_triangle.mesh_index].TriangleDescriptions().size())
+        {
+            throw std::runtime_error("The meshes do not match the ones of the BVH cache\n");
+        }
+        const Mesh& mesh{ meshes[cache_triangle.mesh_index] };
+        triangles.emplace_back(mesh.TriangleDescriptions()[cache_triangle.triangle_index], mesh,
+                               transforms[cache_triangle.mesh_index], materials[cache_triangle.mesh_index]);
+    }
+
+    return triangles;
+}
+
+unsigned int BVHCache::NumTriangles() const noexcept
+{
+    return static_cast<unsigned int>(header->triangles.count);
+}
+
+unsigned int BVHCache::NumNodes() const noexcept
+{
+    return static_cast<unsigned int>(header->nodes.count);
+}
+
+const LinearBVHNode* BVHCache::Nodes() const noexcept
+{
+    return SectionData<LinearBVHNode>(header->nodes);
+}
+
+BVHNodeLayout BVHCache::NodeLayout() const noexcept
+{
+    return static_cast<BVHNodeLayout>(header->node_layout);
+}
+
+unsigned int BVHCache::NumPrecomputedTriangles() const noexcept
+{
+    return static_cast<unsigned int>(header->precomputed_triangles.count);
+}
+
+const PrecomputedTriangle* BVHCache::PrecomputedTriangles() const noexcept
+{
+    return SectionData<PrecomputedTriangle>(header->precomputed_triangles);
+}
+
+const TrianglePacket4* BVHCache::TrianglePackets4() const noexcept
+{
+    return SectionData<TrianglePacket4>(header->triangle_packets4);
+}
+
+const TrianglePacket8* BVHCache::TrianglePackets8() const noexcept
+{
+    return SectionData<TrianglePacket8>(header->triangle_packets8);
+}
+
+const BVHBuildStatistics& BVHCache::BuildStatistics() const noexcept
+{
+    return header->build_statistics;
+}
+
+const std::vector<float> BVHCache::SubtreeBuildCosts() const
+{
+    const float* costs{ SectionData<float>(header->subtree_build_costs) };
+
+    return std::vector<float>(costs, costs + header->subtree_build_costs.count);
+}
+
+void BVHCache::Validate() const
+{
+    if (file.Size() < sizeof(BVHCacheHeader))
+    {
+        throw std::runtime_error("The file is not a BVH cache\n");
+    }
+    const BVHCacheHeader* file_header{ reinterpret_cast<const BVHCacheHeader*>(file.Data()) };
+    if (std::memcmp(file_header->magic, BVH_CACHE_MAGIC, sizeof(BVH_CACHE_MAGIC)) != 0)
+    {
+        throw std::runtime_error("The file is not a BVH cache\n");
+    }
+    if (file_header->version != BVH_CACHE_VERSION ||
+        file_header->node_layout > static_cast<uint32_t>(BVHNodeLayout::VAN_EMDE_BOAS))
+    {
+        throw std::runtime_error("The BVH cache was written with another version\n");
+    }
+
+    ValidateSection<BVHCacheMesh>(file_header->meshes);
+    const BVHCacheMesh* cache_meshes{ SectionData<BVHCacheMesh>(file_header->meshes) };
+    for (uint64_t mesh_index = 0; mesh_index != file_header->meshes.count; mesh_index++)
+    {
+        ValidateSection<Geometry::Point3f>(cache_meshes[mesh_index].vertices);
+        ValidateSection<Geometry::Vector3f>(cache_meshes[mesh_index].normals);
+        ValidateSection<Geometry::Vector2f>(cache_meshes[mesh_index].uvs);
+        ValidateSection<TriangleDescription>(cache_meshes[mesh_index].triangles);
+    }
+    ValidateSection<BVHCacheTriangle>(file_header->triangles);
+    ValidateSection<LinearBVHNode>(file_header->nodes);
+    ValidateSection<PrecomputedTriangle>(file_header->precomputed_triangles);
+    ValidateSection<TrianglePacket4>(file_header->triangle_packets4);
+    ValidateSection<TrianglePacket8>(file_header->triangle_packets8);
+    ValidateSection<float>(file_header->subtree_build_costs);
+    if (file_header->nodes.count == 0 || file_header->triangles.count == 0)
+    {
+        throw std::runtime_error("The BVH cache is empty\n");
+    }
+
+    // The traversal trusts the indices stored in the tree, so they have to reference elements of the sections
+    const uint64_t num_triangles{ file_header->triangles.count };
+    const uint64_t num_precomputed_triangles{ file_header->precomputed_triangles.count };
+    const uint64_t num_packets4{ file_header->triangle_packets4.count };
+    const uint64_t num_packets8{ file_header->triangle_packets8.count };
+    if ((num_packets4 != 0 && num_packets4 * 4 != num_precomputed_triangles) ||
+        (num_packets8 != 0 && num_packets8 * 8 != num_precomputed_triangles))
+    {
+        throw std::runtime_error("The BVH cache is corrupted\n");
+    }
+    const PrecomputedTriangle* precomputed_triangles{
+        SectionData<PrecomputedTriangle>(file_header->precomputed_triangles) };
+    for (uint64_t i = 0; i != num_precomputed_triangles; i++)
+    {
+        if (!ValidIndex(precomputed_triangles[i].triangle_index, num_triangles, PrecomputedTriangle::EMPTY_INDEX))
+        {
+            throw std::runtime_error("The BVH cache is corrupted\n");
+        }
+    }
+    const TrianglePacket4* packets4{ SectionData<TrianglePacket4>(file_header->triangle_packets4) };
+    for (uint64_t i = 0; i != num_packets4 * 4; i++)
+    {
+        if (!ValidIndex(packets4[i / 4].triangle_index[i % 4], num_triangles, PrecomputedTriangle::EMPTY_INDEX))
+        {
+            throw std::runtime_error("The BVH cache is corrupted\n");
+        }
+    }
+    const TrianglePacket8* packets8{ SectionData<TrianglePacket8>(file_header->triangle_packets8) };
+    for (uint64_t i = 0; i != num_packets8 * 8; i++)
+    {
+        if (!ValidIndex(packets8[i / 8].triangle_index[i % 8], num_triangles, PrecomputedTriangle::EMPTY_INDEX))
+        {
+            throw std::runtime_error("The BVH cache is corrupted\n");
+        }
+    }
+
+    // Children always follow their parent in all the layouts, which rules out cycles, and the depth of the tree
+    // has to fit the traversal stacks. The layouts can leave unused nodes, only the ones reached from the root are
+    // checked, their depth starts from one
+    const LinearBVHNode* nodes{ SectionData<LinearBVHNode>(file_header->nodes) };
+    const uint64_t num_nodes{ file_header->nodes.count };
+    const bool depth_first{ file_header->node_layout == static_cast<uint32_t>(BVHNodeLayout::DEPTH_FIRST) };
+    std::vector<unsigned int> node_depths(num_nodes, 0);
+    node_depths[0] = 1;
+    for (uint64_t i = 0; i != num_nodes; i++)
+    {
+        const LinearBVHNode& node{ nodes[i] };
+        if (node_depths[i] == 0)
+        {
+            continue;
+        }
+        if (node.num_triangles != 0)
+        {
+            const uint64_t first_triangle{ node.triangle_offset };
+            const uint64_t num_leaf_triangles{ node.num_triangles };
+            if (first_triangle + num_leaf_triangles > num_precomputed_triangles ||
+                (num_packets4 != 0 &&
+                 first_triangle / 4 + DivideUp(num_leaf_triangles, uint64_t{ 4 }) > num_packets4) ||
+                (num_packets8 != 0 &&
+                 first_triangle / 8 + DivideUp(num_leaf_triangles, uint64_t{ 8 }) > num_packets8))
+            {
+                throw std::runtime_error("The BVH cache is corrupted\n");
+            }
+        }
+        else
+        {
+            const uint64_t second_child{ node.second_child_offset };
+            const uint64_t first_child{ depth_first ? i + 1 : second_child - 1 };
+            if (first_child <= i || second_child <= first_child || second_child >= num_nodes ||
+                node.split_axis > 2 || node_depths[i] > BVH_STACK_SIZE)
+            {
+                throw std::runtime_error("The BVH cache is corrupted\n");
+            }
+            node_depths[first_child] = std::max(node_depths[first_child], node_depths[i] + 1);
+            node_depths[second_child] = std::max(node_depths[second_child], node_depths[i] + 1);
+        }
+    }
+}
+
+} // Rabbit namespace
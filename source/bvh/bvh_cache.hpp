@@ -0,0 +1,102 @@
+#ifndef RABBIT2_BVH_CACHE_HPP
+#define RABBIT2_BVH_CACHE_HPP
+
+#include "bvh.hpp"
+#include "utilities/mapped_file.hpp"
+
+#include <string>
+
+namespace Rabbit
+{
+
+// Version of the cache format, caches of other versions are ignored
+constexpr uint32_t BVH_CACHE_VERSION{ 1 };
+
+// Header of the cache file, defined with the format
+struct BVHCacheHeader;
+struct BVHCacheSection;
+
+// Built BVH stored on disk together with the buffers of the meshes its triangles come from. The file is mapped in
+// memory and the nodes, precomputed triangles and packets are used in place by the tree, so loading it does no
+// parsing and copies only the mesh buffers. The data is stored as it is in memory, so the cache is specific to the
+// machine and build that wrote it
+class BVHCache
+{
+public:
+    // Map the cache file, throws if it can not be read or is not a valid cache of the current version
+    explicit BVHCache(const std::string& filename);
+
+    // Disable copy
+    BVHCache(const BVHCache& other) = delete;
+
+    BVHCache& operator=(const BVHCache& rhs) = delete;
+
+    // Open the cache file if it is valid and was written for the given key, returns null otherwise
+    static std::shared_ptr<const BVHCache> Open(const std::string& filename, uint64_t key) noexcept;
+
+    // Write the tree and the meshes its triangles come from, all the triangles of a mesh must share the same
+    // transform and material. The file is first written next to the destination and then renamed over it
+    static void Write(const std::string& filename, uint64_t key, const std::vector<const Mesh*>& meshes,
+                      const BVH& bvh);
+
+    // Key of a cache for the given hash of the content of the meshes, includes the configuration, the format, the
+    // transform of each mesh and which meshes share a material. The materials themselves are not stored, so only
+    // their types and the way they are shared are part of the key
+    static uint64_t ComputeKey(const BVHConfig& config, uint64_t meshes_hash,
+                               const std::vector<std::shared_ptr<const Geometry::Transform>>& transforms,
+                               const std::vector<std::shared_ptr<const MaterialInterface>>& materials) noexcept;
+
+    uint64_t Key() const noexcept;
+
+    // Create the meshes stored in the cache, their buffers are copied from the file. Throws if a triangle references
+    // a vertex, normal or UV the mesh does not have
+    std::vector<Mesh> LoadMeshes() const;
+
+    // Create the triangles of the tree in its order, the triangles of each mesh get the transform and the material
+    // at the index of the mesh
+    std::vector<Triangle> CreateTriangles(const std::vector<Mesh>& meshes,
+                                          const std::vector<std::shared_ptr<const Geometry::Transform>>& transforms,
+                                          const std::vector<std::shared_ptr<const MaterialInterface>>& materials) const;
+
+    // Data of the tree used in place, the packets are null if the tree does not use them
+    unsigned int NumTriangles() const noexcept;
+
+    unsigned int NumNodes() const noexcept;
+
+    const LinearBVHNode* Nodes() const noexcept;
+
+    BVHNodeLayout NodeLayout() const noexcept;
+
+    unsigned int NumPrecomputedTriangles() const noexcept;
+
+    const PrecomputedTriangle* PrecomputedTriangles() const noexcept;
+
+    const TrianglePacket4* TrianglePackets4() const noexcept;
+
+    const TrianglePacket8* TrianglePackets8() const noexcept;
+
+    const BVHBuildStatistics& BuildStatistics() const noexcept;
+
+    const std::vector<float> SubtreeBuildCosts() const;
+
+private:
+    // Check the header, that the sections are inside the file and that the tree only references existing nodes and
+    // triangles, throws otherwise
+    void Validate() const;
+
+    // Access a section of the file, null if it is empty
+    template <typename T>
+    const T* SectionData(const BVHCacheSection& section) const noexcept;
+
+    // Check that a section is aligned and inside the file, throws otherwise
+    template <typename T>
+    void ValidateSection(const BVHCacheSection& section) const;
+
+    // Content of the file
+    MappedFile file;
+    const BVHCacheHeader* header;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_BVH_CACHE_HPP
@@ -0,0 +1,284 @@
+#include "compressed_wide_bvh.hpp"
+#include "utilities/memory.hpp"
+#include "utilities/utilities.hpp"
+
+#include <cmath>
+#include <cstring>
+
+namespace Rabbit
+{
+
+// Range of the exponents of the grid steps, such that the step is always a normal float
+constexpr int MIN_GRID_EXPONENT{ -126 };
+constexpr int MAX_GRID_EXPONENT{ 127 };
+
+namespace
+{
+
+// Grid step for the given exponent, built directly from the bits of the float
+float GridStep(int exponent) noexcept
+{
+    const uint32_t bits{ static_cast<uint32_t>(exponent + 127) << 23u };
+    float step;
+    std::memcpy(&step, &bits, sizeof(step));
+
+    return step;
+}
+
+} // anonymous namespace
+
+template <unsigned int Width>
+CompressedWideBVH<Width>::TraversalRay::TraversalRay(const Geometry::Ray& ray) noexcept
+{
+    const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        origin[axis] = SIMD::FloatVector<Width>{ ray.Origin()[axis] };
+        reciprocal_direction[axis] = SIMD::FloatVector<Width>{ reciprocal_dir[axis] };
+        // For negative directions the ray enters from the maximum plane
+        near_plane[axis] = reciprocal_dir[axis] < 0.f ? axis + 3 : axis;
+        far_plane[axis] = reciprocal_dir[axis] < 0.f ? axis : axis + 3;
+    }
+}
+
+template <unsigned int Width>
+CompressedWideBVH<Width>::CompressedWideBVH(const BVH& bvh)
+    : bvh{ bvh }, total_nodes{ 0 }, nodes{ nullptr }
+{
+    // Collapse the binary tree and quantize the nodes one by one, the indices of the children do not change. The
+    // topology is the same as the wide BVH, which already checked that its depth fits WIDE_BVH_STACK_SIZE
+    const WideBVH<Width> wide_bvh{ bvh };
+    total_nodes = wide_bvh.NumNodes();
+    nodes = AllocateAligned<CompressedWideBVHNode<Width>>(total_nodes);
+    for (unsigned int i = 0; i != total_nodes; i++)
+    {
+        CompressNode(wide_bvh.Nodes()[i], nodes[i]);
+    }
+}
+
+template <unsigned int Width>
+CompressedWideBVH<Width>::~CompressedWideBVH() noexcept
+{
+    FreeAligned(nodes);
+}
+
+template <unsigned int Width>
+void CompressedWideBVH<Width>::CompressNode(const WideBVHNode<Width>& wide_node,
+                                           CompressedWideBVHNode<Width>& node) noexcept
+{
+    // Compute bounds of the node from the non empty children
+    float node_min[3]{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max() };
+    float node_max[3]{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+                       std::numeric_limits<float>::lowest() };
+    node.child_mask = 0;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        node.children[i] = wide_node.children[i];
+        node.num_triangles[i] = wide_node.num_triangles[i];
+        if (wide_node.children[i] == WideBVHNode<Width>::EMPTY_CHILD)
+        {
+            continue;
+        }
+        node.child_mask |= 1u << i;
+        for (unsigned int axis = 0; axis != 3; axis++)
+        {
+            node_min[axis] = std::min(node_min[axis], wide_node.bounds[axis][i]);
+            node_max[axis] = std::max(node_max[axis], wide_node.bounds[axis + 3][i]);
+        }
+    }
+
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        // Smallest power of two step such that 255 steps cover the node
+        const float origin{ node_min[axis] };
+        int exponent{ MIN_GRID_EXPONENT };
+        if (node_max[axis] > origin)
+        {
+            std::frexp((node_max[axis] - origin) / 255.f, &exponent);
+            exponent = std::max(exponent, MIN_GRID_EXPONENT);
+        }
+        while (exponent < MAX_GRID_EXPONENT && origin + 255.f * GridStep(exponent) < node_max[axis])
+        {
+            exponent++;
+        }
+        const float step{ GridStep(exponent) };
+        node.origin[axis] = origin;
+        node.exponent[axis] = static_cast<int8_t>(exponent);
+
+        // Round the planes outwards, checking the decoded planes as the traversal computes them
+        for (unsigned int i = 0; i != Width; i++)
+        {
+            if (wide_node.children[i] == WideBVHNode<Width>::EMPTY_CHILD)
+            {
+                node.bounds[axis][i] = 0;
+                node.bounds[axis + 3][i] = 0;
+                continue;
+            }
+            const float child_min{ wide_node.bounds[axis][i] };
+            const float child_max{ wide_node.bounds[axis + 3][i] };
+            unsigned int quantized_min{ static_cast<unsigned int>(
+                Clamp(std::floor((child_min - origin) / step), 0.f, 255.f)) };
+            while (quantized_min > 0 && origin + static_cast<float>(quantized_min) * step > child_min)
+            {
+                quantized_min--;
+            }
+            unsigned int quantized_max{ static_cast<unsigned int>(
+                Clamp(std::ceil((child_max - origin) / step), 0.f, 255.f)) };
+            while (quantized_max < 255 && origin + static_cast<float>(quantized_max) * step < child_max)
+            {
+                quantized_max++;
+            }
+            node.bounds[axis][i] = static_cast<uint8_t>(quantized_min);
+            node.bounds[axis + 3][i] = static_cast<uint8_t>(quantized_max);
+        }
+    }
+}
+
+template <unsigned int Width>
+bool CompressedWideBVH<Width>::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                                         Geometry::TriangleIntersection& intersection) const noexcept
+{
+    // Entry on the traversal stack, with the distance at which the ray enters the child
+    struct StackEntry
+    {
+        uint32_t index;
+        uint32_t num_triangles;
+        float t;
+    };
+
+    const TraversalRay traversal_ray{ ray };
+    const WatertightRay watertight_ray{ ray };
+    alignas(32) float children_t[Width];
+    StackEntry stack[WIDE_BVH_STACK_SIZE];
+    unsigned int to_visit_offset{ 0 };
+    stack[to_visit_offset++] = StackEntry{ 0, 0, interval.Start() };
+
+    while (to_visit_offset != 0)
+    {
+        const StackEntry entry{ stack[--to_visit_offset] };
+        // Skip children that start after the closest hit found so far
+        if (entry.t > interval.End())
+        {
+            continue;
+        }
+
+        // Intersect triangles in leaf
+        if (entry.num_triangles != 0)
+        {
+            bvh.IntersectLeaf(watertight_ray, entry.index, entry.num_triangles, interval, intersection);
+            continue;
+        }
+
+        // Test all children and collect the ones we hit
+        const CompressedWideBVHNode<Width>& node{ nodes[entry.index] };
+        unsigned int hit_mask{ IntersectChildren(node, traversal_ray, interval, children_t) };
+        StackEntry hit_children[Width];
+        unsigned int num_hit_children{ 0 };
+        while (hit_mask != 0)
+        {
+            const unsigned int child{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+            hit_mask &= hit_mask - 1;
+
+            // Insertion sort by decreasing distance, such that the closest child is pushed last
+            const StackEntry child_entry{ node.children[child], node.num_triangles[child], children_t[child] };
+            unsigned int position{ num_hit_children++ };
+            while (position > 0 && hit_children[position - 1].t < child_entry.t)
+            {
+                hit_children[position] = hit_children[position - 1];
+                position--;
+            }
+            hit_children[position] = child_entry;
+        }
+
+        assert(to_visit_offset + num_hit_children <= WIDE_BVH_STACK_SIZE);
+        for (unsigned int i = 0; i != num_hit_children; i++)
+        {
+            stack[to_visit_offset++] = hit_children[i];
+        }
+    }
+
+    // If we did hit something, fill the intersection and return true
+    if (intersection.IsValid())
+    {
+        intersection.hit_triangle->ComputeIntersectionGeometry(ray, interval.End(), intersection);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+template <unsigned int Width>
+bool CompressedWideBVH<Width>::IntersectTest(const Geometry::Ray& ray,
+                                             const Geometry::Intervalf& interval) const noexcept
+{
+    const TraversalRay traversal_ray{ ray };
+    const WatertightRay watertight_ray{ ray };
+    alignas(32) float children_t[Width];
+    unsigned int nodes_to_visit[WIDE_BVH_STACK_SIZE];
+    unsigned int to_visit_offset{ 0 };
+    nodes_to_visit[to_visit_offset++] = 0;
+
+    while (to_visit_offset != 0)
+    {
+        const CompressedWideBVHNode<Width>& node{ nodes[nodes_to_visit[--to_visit_offset]] };
+        unsigned int hit_mask{ IntersectChildren(node, traversal_ray, interval, children_t) };
+        while (hit_mask != 0)
+        {
+            const unsigned int child{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+            hit_mask &= hit_mask - 1;
+
+            if (node.num_triangles[child] != 0)
+            {
+                if (bvh.IntersectLeafTest(watertight_ray, node.children[child], node.num_triangles[child], interval))
+                {
+                    // As soon as we hit something, return true
+                    return true;
+                }
+            }
+            else
+            {
+                assert(to_visit_offset < WIDE_BVH_STACK_SIZE);
+                nodes_to_visit[to_visit_offset++] = node.children[child];
+            }
+        }
+    }
+
+    // If we get here in this case, we did not hit anything
+    return false;
+}
+
+template <unsigned int Width>
+unsigned int CompressedWideBVH<Width>::IntersectChildren(const CompressedWideBVHNode<Width>& node,
+                                                         const TraversalRay& traversal_ray,
+                                                         const Geometry::Intervalf& interval,
+                                                         float* children_t) const noexcept
+{
+    using FloatVector = SIMD::FloatVector<Width>;
+
+    // Decode the planes on the grid of the node and run the slab test of the WideBVH on them
+    FloatVector t_near{ interval.Start() };
+    FloatVector t_far{ interval.End() };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        const FloatVector origin{ node.origin[axis] };
+        const FloatVector step{ GridStep(node.exponent[axis]) };
+        const FloatVector near_plane{
+            origin + FloatVector::LoadBytes(node.bounds[traversal_ray.near_plane[axis]]) * step };
+        const FloatVector far_plane{
+            origin + FloatVector::LoadBytes(node.bounds[traversal_ray.far_plane[axis]]) * step };
+        t_near = Max(t_near, (near_plane - traversal_ray.origin[axis]) * traversal_ray.reciprocal_direction[axis]);
+        t_far = Min(t_far, (far_plane - traversal_ray.origin[axis]) * traversal_ray.reciprocal_direction[axis]);
+    }
+
+    t_near.Store(children_t);
+    return (t_near <= t_far).Bits() & node.child_mask;
+}
+
+// Explicit instantiation for the supported widths
+template class CompressedWideBVH<4>;
+template class CompressedWideBVH<8>;
+
+} // Rabbit namespace
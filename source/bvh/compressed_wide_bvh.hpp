@@ -0,0 +1,91 @@
+#ifndef RABBIT2_COMPRESSED_WIDE_BVH_HPP
+#define RABBIT2_COMPRESSED_WIDE_BVH_HPP
+
+#include "wide_bvh.hpp"
+
+namespace Rabbit
+{
+
+// Node of a wide BVH with the bounds of the children quantized to 8 bits per plane. The planes lie on a grid starting
+// at the minimum of the node bounds, with a power of two step along each axis
+template <unsigned int Width>
+struct alignas(32) CompressedWideBVHNode
+{
+    // Origin of the quantization grid
+    float origin[3];
+    // Exponent of the grid step along each axis
+    int8_t exponent[3];
+    // Bit i is set if child i is not empty
+    uint8_t child_mask;
+    // Quantized bounds of the children, indices 0 to 2 are the minimum x, y, z and 3 to 5 the maximum x, y, z
+    uint8_t bounds[6][Width];
+    // Child index for interior children, first triangle for leafs and EMPTY_CHILD for empty slots
+    uint32_t children[Width];
+    // Number of triangles for leaf children, 0 for interior children
+    uint16_t num_triangles[Width];
+};
+
+// Wide BVH with compressed nodes, about half the size of the WideBVH ones. The quantized bounds always contain the
+// bounds of the children, so traversal finds the same hits of the WideBVH while testing a few more nodes
+template <unsigned int Width>
+class CompressedWideBVH
+{
+public:
+    // Build from binary BVH, the leafs are tested by the BVH which needs to outlive this one. Throws if the collapsed
+    // tree is too deep for the traversal stack
+    explicit CompressedWideBVH(const BVH& bvh);
+
+    // Disable copy
+    CompressedWideBVH(const CompressedWideBVH& other) = delete;
+
+    CompressedWideBVH& operator=(const CompressedWideBVH& rhs) = delete;
+
+    ~CompressedWideBVH() noexcept;
+
+    // Intersect Ray with BVH
+    bool Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                   Geometry::TriangleIntersection& intersection) const noexcept;
+
+    // Check for intersection
+    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
+
+    // Number of nodes in the tree
+    unsigned int NumNodes() const noexcept
+    {
+        return total_nodes;
+    }
+
+private:
+    // Ray data needed to test a node
+    struct TraversalRay
+    {
+        explicit TraversalRay(const Geometry::Ray& ray) noexcept;
+
+        // Ray origin and reciprocal direction broadcasted over the lanes
+        SIMD::FloatVector<Width> origin[3];
+        SIMD::FloatVector<Width> reciprocal_direction[3];
+        // Index in the bounds of the near and far planes for each axis
+        unsigned int near_plane[3];
+        unsigned int far_plane[3];
+    };
+
+    // Quantize the bounds of the children of a wide node
+    static void CompressNode(const WideBVHNode<Width>& wide_node, CompressedWideBVHNode<Width>& node) noexcept;
+
+    // Decode the children bounds and test them, returns the mask of the hit children and their entry distances
+    unsigned int IntersectChildren(const CompressedWideBVHNode<Width>& node, const TraversalRay& traversal_ray,
+                                   const Geometry::Intervalf& interval, float* children_t) const noexcept;
+
+    // Binary BVH, the leafs reference its triangles
+    const BVH& bvh;
+    // Nodes of the tree, the root is the first one
+    unsigned int total_nodes;
+    CompressedWideBVHNode<Width>* nodes;
+};
+
+using CompressedBVH4 = CompressedWideBVH<4>;
+using CompressedBVH8 = CompressedWideBVH<8>;
+
+} // Rabbit namespace
+
+#endif //RABBIT2_COMPRESSED_WIDE_BVH_HPP
@@ -0,0 +1,277 @@
+#include "instance_bvh.hpp"
+#include "utilities/memory.hpp"
+
+#include <array>
+#include <algorithm>
+
+namespace Rabbit
+{
+
+// Maximum number of instances in a leaf of the top level tree
+constexpr unsigned int MAX_INSTANCES_IN_LEAF{ 2 };
+
+InstancedMesh::InstancedMesh(const Mesh& mesh, const BVHConfig& config)
+    : bvh{ config, mesh.CreateTriangles(std::make_shared<const Geometry::Transform>(), nullptr) }
+{
+    for (unsigned int i = 0; i != bvh.NumPrecomputedTriangles(); i++)
+    {
+        const PrecomputedTriangle& triangle{ bvh.PrecomputedTriangles()[i] };
+        if (triangle.triangle_index != PrecomputedTriangle::EMPTY_INDEX)
+        {
+            bounds = Geometry::Union(bounds, Geometry::BBox{ triangle.v0, triangle.v1, triangle.v2 });
+        }
+    }
+}
+
+Instance::Instance(std::shared_ptr<const InstancedMesh> mesh, std::shared_ptr<const Geometry::Transform> transform,
+                   std::shared_ptr<const MaterialInterface> material) noexcept
+    : mesh{ std::move(mesh) }, transform{ std::move(transform) }, material{ std::move(material) }
+{
+    // Bounds of the transformed corners of the mesh bounds
+    const Geometry::BBox& local_bounds{ this->mesh->Bounds() };
+    for (unsigned int corner = 0; corner != 8; corner++)
+    {
+        const Geometry::Point3f local_corner{ local_bounds[corner & 1u].x,
+                                              local_bounds[(corner >> 1u) & 1u].y,
+                                              local_bounds[(corner >> 2u) & 1u].z };
+        bounds = Geometry::Union(bounds, this->transform->ToWorld(local_corner));
+    }
+}
+
+void Instance::ComputeIntersectionGeometry(const Geometry::Ray& ray, float intersection_parameter,
+                                           Geometry::TriangleIntersection& intersection) const noexcept
+{
+    // Compute geometry in local space and move it to world space
+    intersection.hit_triangle->ComputeIntersectionGeometry(ToLocal(ray), intersection_parameter, intersection);
+    intersection.hit_point = ray(intersection_parameter);
+    intersection.local_geometry = Geometry::Framef{
+        Geometry::Normalize(transform->NormalToWorld(intersection.local_geometry.n)) };
+    intersection.wo = Geometry::Normalize(-ray.Direction());
+    intersection.material = material.get();
+}
+
+InstanceBVH::InstanceBVH(std::vector<Instance>&& inst)
+    : total_nodes{ 0 }, nodes{ nullptr }
+{
+    if (inst.empty())
+    {
+        return;
+    }
+
+    // Build tree on the indices and store the instances in the order of the leafs
+    std::vector<unsigned int> instance_indices(inst.size());
+    for (unsigned int i = 0; i != inst.size(); i++)
+    {
+        instance_indices[i] = i;
+    }
+    nodes = AllocateAligned<LinearBVHNode>(2 * inst.size() - 1);
+    instances = std::move(inst);
+    total_nodes = RecursiveBuild(instance_indices, 0, static_cast<unsigned int>(instances.size()), 0);
+
+    std::vector<Instance> ordered_instances;
+    ordered_instances.reserve(instances.size());
+    for (const unsigned int instance_index : instance_indices)
+    {
+        ordered_instances.push_back(instances[instance_index]);
+    }
+    instances = std::move(ordered_instances);
+}
+
+InstanceBVH::InstanceBVH(InstanceBVH&& other) noexcept
+    : instances{ std::move(other.instances) }, total_nodes{ other.total_nodes }, nodes{ other.nodes }
+{
+    other.total_nodes = 0;
+    other.nodes = nullptr;
+}
+
+InstanceBVH::~InstanceBVH() noexcept
+{
+    FreeAligned(nodes);
+}
+
+unsigned int InstanceBVH::RecursiveBuild(std::vector<unsigned int>& instance_indices, unsigned int start,
+                                         unsigned int end, unsigned int node_index) noexcept
+{
+    LinearBVHNode& node{ nodes[node_index] };
+    Geometry::BBox centroid_bounds;
+    node.bounds = Geometry::BBox{};
+    for (unsigned int i = start; i != end; i++)
+    {
+        node.bounds = Geometry::Union(node.bounds, instances[instance_indices[i]].Bounds());
+        centroid_bounds = Geometry::Union(centroid_bounds, instances[instance_indices[i]].Bounds().Centroid());
+    }
+
+    // Create leaf
+    const unsigned int num_instances{ end - start };
+    const unsigned int split_axis{ centroid_bounds.LargestDimension() };
+    if (num_instances <= MAX_INSTANCES_IN_LEAF ||
+        centroid_bounds.PMax()[split_axis] == centroid_bounds.PMin()[split_axis])
+    {
+        if (num_instances <= std::numeric_limits<uint16_t>::max())
+        {
+            node.triangle_offset = start;
+            node.num_triangles = static_cast<uint16_t>(num_instances);
+            node.split_axis = 0;
+            return 1;
+        }
+    }
+
+    // Split at the median of the centroids along the largest axis
+    const unsigned int middle{ start + num_instances / 2 };
+    std::nth_element(instance_indices.begin() + start, instance_indices.begin() + middle,
+                     instance_indices.begin() + end,
+                     [this, split_axis](unsigned int a, unsigned int b) -> bool
+                     {
+                         return instances[a].Bounds().Centroid()[split_axis] <
+                                instances[b].Bounds().Centroid()[split_axis];
+                     });
+    const unsigned int first_child_nodes{ RecursiveBuild(instance_indices, start, middle, node_index + 1) };
+    const unsigned int second_child_nodes{ RecursiveBuild(instance_indices, middle, end,
+                                                          node_index + 1 + first_child_nodes) };
+    node.second_child_offset = node_index + 1 + first_child_nodes;
+    node.num_triangles = 0;
+    node.split_axis = static_cast<uint8_t>(split_axis);
+
+    return 1 + first_child_nodes + second_child_nodes;
+}
+
+bool InstanceBVH::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                            Geometry::TriangleIntersection& intersection) const noexcept
+{
+    if (instances.empty())
+    {
+        return false;
+    }
+
+    // Compute values needed for traversal
+    const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    const std::array<bool, 3> dir_is_neg{ reciprocal_dir.x < 0.f, reciprocal_dir.y < 0.f, reciprocal_dir.z < 0.f };
+
+    // Follow ray through the tree, the leafs shrink the interval on hit
+    const Instance* hit_instance{ nullptr };
+    Geometry::TriangleIntersection instance_intersection;
+    Geometry::TriangleIntersection candidate_intersection;
+    unsigned int to_visit_offset{ 0 };
+    unsigned int current_node_index{ 0 };
+    unsigned int nodes_to_visit[64];
+    while (true)
+    {
+        const LinearBVHNode& current_node{ nodes[current_node_index] };
+        if (current_node.bounds.Intersect(ray, interval, reciprocal_dir))
+        {
+            if (current_node.num_triangles > 0)
+            {
+                for (unsigned int i = 0; i != current_node.num_triangles; i++)
+                {
+                    // The BVH reports any valid intersection as a hit, so each instance starts from an empty one
+                    const Instance& instance{ instances[current_node.triangle_offset + i] };
+                    candidate_intersection.hit_triangle = nullptr;
+                    if (instance.IntersectClosest(ray, interval, candidate_intersection))
+                    {
+                        hit_instance = &instance;
+                        instance_intersection = candidate_intersection;
+                    }
+                }
+                if (to_visit_offset == 0)
+                {
+                    break;
+                }
+                current_node_index = nodes_to_visit[--to_visit_offset];
+            }
+            else
+            {
+                // Put far node on stack and visit closest one
+                if (dir_is_neg[current_node.split_axis])
+                {
+                    nodes_to_visit[to_visit_offset++] = current_node_index + 1;
+                    current_node_index = current_node.second_child_offset;
+                }
+                else
+                {
+                    nodes_to_visit[to_visit_offset++] = current_node.second_child_offset;
+                    current_node_index++;
+                }
+            }
+        }
+        else
+        {
+            if (to_visit_offset == 0)
+            {
+                break;
+            }
+            current_node_index = nodes_to_visit[--to_visit_offset];
+        }
+    }
+
+    if (hit_instance != nullptr)
+    {
+        intersection = instance_intersection;
+        hit_instance->ComputeIntersectionGeometry(ray, interval.End(), intersection);
+        return true;
+    }
+
+    return false;
+}
+
+bool InstanceBVH::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
+{
+    if (instances.empty())
+    {
+        return false;
+    }
+
+    // Compute values needed for traversal
+    const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    const std::array<bool, 3> dir_is_neg{ reciprocal_dir.x < 0.f, reciprocal_dir.y < 0.f, reciprocal_dir.z < 0.f };
+
+    unsigned int to_visit_offset{ 0 };
+    unsigned int current_node_index{ 0 };
+    unsigned int nodes_to_visit[64];
+    while (true)
+    {
+        const LinearBVHNode& current_node{ nodes[current_node_index] };
+        if (current_node.bounds.Intersect(ray, interval, reciprocal_dir))
+        {
+            if (current_node.num_triangles > 0)
+            {
+                for (unsigned int i = 0; i != current_node.num_triangles; i++)
+                {
+                    if (instances[current_node.triangle_offset + i].IntersectTest(ray, interval))
+                    {
+                        return true;
+                    }
+                }
+                if (to_visit_offset == 0)
+                {
+                    break;
+                }
+                current_node_index = nodes_to_visit[--to_visit_offset];
+            }
+            else
+            {
+                if (dir_is_neg[current_node.split_axis])
+                {
+                    nodes_to_visit[to_visit_offset++] = current_node_index + 1;
+                    current_node_index = current_node.second_child_offset;
+                }
+                else
+                {
+                    nodes_to_visit[to_visit_offset++] = current_node.second_child_offset;
+                    current_node_index++;
+                }
+            }
+        }
+        else
+        {
+            if (to_visit_offset == 0)
+            {
+                break;
+            }
+            current_node_index = nodes_to_visit[--to_visit_offset];
+        }
+    }
+
+    return false;
+}
+
+} // Rabbit namespace
@@ -0,0 +1,129 @@
+#ifndef RABBIT2_INSTANCE_BVH_HPP
+#define RABBIT2_INSTANCE_BVH_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Mesh shared by instances, its triangles are in the local space of the mesh and have their own BVH. The mesh needs
+// to outlive this object
+class InstancedMesh
+{
+public:
+    InstancedMesh(const Mesh& mesh, const BVHConfig& config);
+
+    // Bounds of the triangles in local space
+    const Geometry::BBox& Bounds() const noexcept
+    {
+        return bounds;
+    }
+
+    // Access BVH of the triangles
+    const BVH& Bvh() const noexcept
+    {
+        return bvh;
+    }
+
+private:
+    BVH bvh;
+    Geometry::BBox bounds;
+};
+
+// Placement of an InstancedMesh in the scene with its own transformation and material
+class Instance
+{
+public:
+    Instance(std::shared_ptr<const InstancedMesh> mesh, std::shared_ptr<const Geometry::Transform> transform,
+             std::shared_ptr<const MaterialInterface> material) noexcept;
+
+    // Bounds of the instance in world space
+    const Geometry::BBox& Bounds() const noexcept
+    {
+        return bounds;
+    }
+
+    // Find closest hit with the triangles of the instance, the ray is moved to the local space of the mesh once for
+    // all the triangles. The intersection geometry is not computed
+    bool IntersectClosest(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                          Geometry::TriangleIntersection& intersection) const noexcept
+    {
+        return mesh->Bvh().IntersectClosest(ToLocal(ray), interval, intersection);
+    }
+
+    // Check for intersection
+    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
+    {
+        return mesh->Bvh().IntersectTest(ToLocal(ray), interval);
+    }
+
+    // Fill world space geometry and material of an intersection found by IntersectClosest
+    void ComputeIntersectionGeometry(const Geometry::Ray& ray, float intersection_parameter,
+                                     Geometry::TriangleIntersection& intersection) const noexcept;
+
+private:
+    // Ray in the local space of the mesh, the direction is not normalized so distances along the ray are the same
+    const Geometry::Ray ToLocal(const Geometry::Ray& ray) const noexcept
+    {
+        return { transform->ToLocal(ray.Origin()), transform->ToLocal(ray.Direction()) };
+    }
+
+    std::shared_ptr<const InstancedMesh> mesh;
+    std::shared_ptr<const Geometry::Transform> transform;
+    std::shared_ptr<const MaterialInterface> material;
+    Geometry::BBox bounds;
+};
+
+// Top level BVH over instances, the leafs of the LinearBVHNode reference instances instead of triangles. Memory and
+// build time depend on the number of instances and not on the number of triangles they reference
+class InstanceBVH
+{
+public:
+    explicit InstanceBVH(std::vector<Instance>&& instances);
+
+    // Disable copy
+    InstanceBVH(const InstanceBVH& other) = delete;
+
+    InstanceBVH& operator=(const InstanceBVH& rhs) = delete;
+
+    InstanceBVH(InstanceBVH&& other) noexcept;
+
+    ~InstanceBVH() noexcept;
+
+    // Intersect Ray with the instances, updates the intersection only if a closer hit is found
+    bool Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                   Geometry::TriangleIntersection& intersection) const noexcept;
+
+    // Check for intersection
+    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
+
+    bool Empty() const noexcept
+    {
+        return instances.empty();
+    }
+
+    unsigned int NumNodes() const noexcept
+    {
+        return total_nodes;
+    }
+
+    // Access instances, in the order referenced by the leafs
+    const std::vector<Instance>& Instances() const noexcept
+    {
+        return instances;
+    }
+
+private:
+    // Build subtree for the instances in [start, end) in the nodes starting at node_index, returns the number of
+    // nodes used
+    unsigned int RecursiveBuild(std::vector<unsigned int>& instance_indices, unsigned int start, unsigned int end,
+                                unsigned int node_index) noexcept;
+
+    std::vector<Instance> instances;
+    unsigned int total_nodes;
+    LinearBVHNode* nodes;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_INSTANCE_BVH_HPP
@@ -0,0 +1,123 @@
+#include "leaf_benchmark.hpp"
+#include "sampling/pcg32.hpp"
+#include "utilities/memory.hpp"
+
+#include <chrono>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Intersect all the rays with the triangles in Width wide packets, returns the number of hits and the elapsed time
+template <unsigned int Width>
+unsigned int IntersectAllPackets(const std::vector<PrecomputedTriangle>& triangles,
+                                 const std::vector<Geometry::Ray>& rays, float& elapsed_ms)
+{
+    const unsigned int num_packets{ DivideUp(static_cast<unsigned int>(triangles.size()), Width) };
+    TrianglePacket<Width>* packets{ AllocateAligned<TrianglePacket<Width>>(num_packets) };
+    for (unsigned int p = 0; p != num_packets; p++)
+    {
+        packets[p].Fill(triangles.data() + p * Width,
+                        std::min(Width, static_cast<unsigned int>(triangles.size()) - p * Width));
+    }
+
+    unsigned int num_hits{ 0 };
+    const auto start{ std::chrono::high_resolution_clock::now() };
+    for (const Geometry::Ray& ray : rays)
+    {
+        const WatertightRay watertight_ray{ ray };
+        Geometry::Intervalf interval{ Geometry::Ray::DefaultInterval() };
+        Geometry::Point3f barycentric_coordinates;
+        bool hit{ false };
+        for (unsigned int p = 0; p != num_packets; p++)
+        {
+            hit |= packets[p].Intersect(watertight_ray, interval, barycentric_coordinates) != Width;
+        }
+        num_hits += hit;
+    }
+    const auto end{ std::chrono::high_resolution_clock::now() };
+    elapsed_ms = std::chrono::duration<float, std::milli>(end - start).count();
+    FreeAligned(packets);
+
+    return num_hits;
+}
+
+// Convert number of tests and time to millions of tests per second
+float MillionTestsPerSecond(size_t num_tests, float elapsed_ms) noexcept
+{
+    return elapsed_ms > 0.f ? num_tests / (elapsed_ms * 1000.f) : 0.f;
+}
+
+} // anonymous namespace
+
+const LeafBenchmarkResult BenchmarkLeafIntersection(const BVH& bvh, unsigned int num_rays, unsigned int max_triangles)
+{
+    // Collect a block of triangles, skipping the empty entries of packed leafs
+    std::vector<PrecomputedTriangle> triangles;
+    Geometry::BBox bounds;
+    for (unsigned int i = 0; i != bvh.NumPrecomputedTriangles(); i++)
+    {
+        const PrecomputedTriangle& triangle{ bvh.PrecomputedTriangles()[i] };
+        if (triangles.size() == max_triangles)
+        {
+            break;
+        }
+        if (triangle.triangle_index != PrecomputedTriangle::EMPTY_INDEX)
+        {
+            triangles.push_back(triangle);
+            bounds = Union(Union(Union(bounds, triangle.v0), triangle.v1), triangle.v2);
+        }
+    }
+
+    // Nothing to measure without triangles
+    LeafBenchmarkResult result;
+    if (triangles.empty())
+    {
+        return result;
+    }
+
+    // Generate rays from random points in the bounds towards random triangles of the block, so most of them hit
+    Sampling::PCG32 rng{ 17, 5 };
+    std::vector<Geometry::Ray> rays;
+    rays.reserve(num_rays);
+    for (unsigned int i = 0; i != num_rays; i++)
+    {
+        const Geometry::Point3f origin{ bounds.PMin() + Geometry::Vector3f{ rng.NextFloat(), rng.NextFloat(),
+                                                                            rng.NextFloat() } * bounds.Diagonal() };
+        const PrecomputedTriangle& target{ triangles[rng.NextUInt32(static_cast<uint32_t>(triangles.size()))] };
+        const Geometry::Point3f target_point{ target.v0 + ((target.v1 - target.v0) + (target.v2 - target.v0)) / 3.f };
+        rays.emplace_back(origin, Geometry::Normalize(target_point - origin));
+    }
+
+    // Single triangle kernel
+    const auto start{ std::chrono::high_resolution_clock::now() };
+    for (const Geometry::Ray& ray : rays)
+    {
+        const WatertightRay watertight_ray{ ray };
+        Geometry::Intervalf interval{ Geometry::Ray::DefaultInterval() };
+        Geometry::Point3f barycentric_coordinates;
+        bool hit{ false };
+        for (const PrecomputedTriangle& triangle : triangles)
+        {
+            hit |= triangle.Intersect(watertight_ray, interval, barycentric_coordinates);
+        }
+        result.triangles_hits += hit;
+    }
+    const auto end{ std::chrono::high_resolution_clock::now() };
+    const size_t num_tests{ rays.size() * triangles.size() };
+    result.triangles_mtps = MillionTestsPerSecond(num_tests,
+                                                  std::chrono::duration<float, std::milli>(end - start).count());
+
+    // Packed kernels
+    float elapsed_ms;
+    result.packets4_hits = IntersectAllPackets<4>(triangles, rays, elapsed_ms);
+    result.packets4_mtps = MillionTestsPerSecond(num_tests, elapsed_ms);
+    result.packets8_hits = IntersectAllPackets<8>(triangles, rays, elapsed_ms);
+    result.packets8_mtps = MillionTestsPerSecond(num_tests, elapsed_ms);
+
+    return result;
+}
+
+} // Rabbit namespace
@@ -0,0 +1,33 @@
+#ifndef RABBIT2_LEAF_BENCHMARK_HPP
+#define RABBIT2_LEAF_BENCHMARK_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Throughput of the triangle intersection kernels, in millions of ray triangle tests per second
+struct LeafBenchmarkResult
+{
+    LeafBenchmarkResult() noexcept
+        : triangles_mtps{ 0.f }, packets4_mtps{ 0.f }, packets8_mtps{ 0.f },
+          triangles_hits{ 0 }, packets4_hits{ 0 }, packets8_hits{ 0 }
+    {}
+
+    float triangles_mtps;
+    float packets4_mtps;
+    float packets8_mtps;
+    // Number of rays that hit something for each kernel, they should agree
+    unsigned int triangles_hits;
+    unsigned int packets4_hits;
+    unsigned int packets8_hits;
+};
+
+// Measure the kernels used for the leafs by intersecting rays with a cache resident block of the triangles of the
+// BVH, such that the measure is not dominated by the memory accesses. The result is all zeros for an empty BVH
+const LeafBenchmarkResult BenchmarkLeafIntersection(const BVH& bvh, unsigned int num_rays,
+                                                    unsigned int max_triangles = 4096);
+
+} // Rabbit namespace
+
+#endif //RABBIT2_LEAF_BENCHMARK_HPP
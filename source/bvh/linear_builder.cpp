@@ -0,0 +1,503 @@
+#include "linear_builder.hpp"
+#include "geometry/morton.hpp"
+#include "utilities/memory.hpp"
+#include "utilities/thread_pool.hpp"
+#include "utilities/utilities.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Number of elements processed by each task of the parallel passes
+constexpr unsigned int PARALLEL_PASS_GRAIN_SIZE{ 1u << 16u };
+// Scenes with more triangles use 63 bit codes, smaller ones 30 bit codes
+constexpr unsigned int LARGE_SCENE_TRIANGLES{ 1u << 20u };
+// Number of bits of the codes grouping the triangles in treelets, it is a multiple of 3 such that the bits of the
+// prefixes follow the same axis order of the codes
+constexpr unsigned int TREELET_BITS{ 12 };
+// Number of treelets processed by each task
+constexpr unsigned int TREELET_GRAIN_SIZE{ 64 };
+// Bits sorted by each pass of the radix sort
+constexpr unsigned int RADIX_BITS{ 8 };
+constexpr unsigned int RADIX_SIZE{ 1u << RADIX_BITS };
+// Depth reserved to the nodes above the treelets, the treelets use the rest of the traversal stack
+constexpr unsigned int TOP_NODES_MAX_DEPTH{ 24 };
+
+// Stable least significant digit radix sort of the triangles by code, the sorted triangles end either in the input
+// or in the buffer and the pointer to them is returned. Each pass counts the digits of chunks of the input in
+// parallel and scatters the chunks to the offsets given by the digit major prefix sum of the counts
+template <typename MortonCode>
+MortonTriangle<MortonCode>* RadixSort(MortonTriangle<MortonCode>* input, MortonTriangle<MortonCode>* buffer,
+                                      unsigned int num_triangles, unsigned int code_bits)
+{
+    const unsigned int num_chunks{ DivideUp(num_triangles, PARALLEL_PASS_GRAIN_SIZE) };
+    std::vector<unsigned int> chunk_offsets(num_chunks * RADIX_SIZE);
+    for (unsigned int shift = 0; shift < code_bits; shift += RADIX_BITS)
+    {
+        const auto digit = [shift](MortonCode code) -> unsigned int
+        {
+            return static_cast<unsigned int>(code >> shift) & (RADIX_SIZE - 1);
+        };
+
+        // Count the digits of each chunk
+        const auto count_digits = [input, num_triangles, &chunk_offsets, &digit](unsigned int chunk_start,
+                                                                                 unsigned int chunk_end) -> void
+        {
+            for (unsigned int chunk = chunk_start; chunk != chunk_end; chunk++)
+            {
+                unsigned int* counts{ chunk_offsets.data() + chunk * RADIX_SIZE };
+                const unsigned int end{ std::min(num_triangles, (chunk + 1) * PARALLEL_PASS_GRAIN_SIZE) };
+                for (unsigned int i = chunk * PARALLEL_PASS_GRAIN_SIZE; i != end; i++)
+                {
+                    counts[digit(input[i].code)]++;
+                }
+            }
+        };
+        std::fill(chunk_offsets.begin(), chunk_offsets.end(), 0);
+        ThreadPool::Global().ParallelFor(0, num_chunks, 1, count_digits);
+
+        // Turn the counts into offsets, all the chunks place their elements with a digit after the ones of the
+        // previous chunks with the same digit
+        unsigned int offset{ 0 };
+        bool single_digit{ false };
+        for (unsigned int d = 0; d != RADIX_SIZE; d++)
+        {
+            const unsigned int digit_start{ offset };
+            for (unsigned int chunk = 0; chunk != num_chunks; chunk++)
+            {
+                const unsigned int count{ chunk_offsets[chunk * RADIX_SIZE + d] };
+                chunk_offsets[chunk * RADIX_SIZE + d] = offset;
+                offset += count;
+            }
+            single_digit = single_digit || offset - digit_start == num_triangles;
+        }
+
+        // The pass would not move anything if all the triangles have the same digit
+        if (single_digit)
+        {
+            continue;
+        }
+
+        // Scatter the chunks
+        const auto scatter = [input, buffer, num_triangles, &chunk_offsets, &digit](unsigned int chunk_start,
+                                                                                    unsigned int chunk_end) -> void
+        {
+            for (unsigned int chunk = chunk_start; chunk != chunk_end; chunk++)
+            {
+                unsigned int* offsets{ chunk_offsets.data() + chunk * RADIX_SIZE };
+                const unsigned int end{ std::min(num_triangles, (chunk + 1) * PARALLEL_PASS_GRAIN_SIZE) };
+                for (unsigned int i = chunk * PARALLEL_PASS_GRAIN_SIZE; i != end; i++)
+                {
+                    buffer[offsets[digit(input[i].code)]++] = input[i];
+                }
+            }
+        };
+        ThreadPool::Global().ParallelFor(0, num_chunks, 1, scatter);
+        std::swap(input, buffer);
+    }
+
+    return input;
+}
+
+// Axis along which the bounds have the largest extent
+unsigned int LargestAxis(const Geometry::BBox& bounds) noexcept
+{
+    const Geometry::Vector3f diagonal{ bounds.Diagonal() };
+    unsigned int axis{ 0 };
+    for (unsigned int i = 1; i != 3; i++)
+    {
+        if (diagonal[i] > diagonal[axis])
+        {
+            axis = i;
+        }
+    }
+
+    return axis;
+}
+
+} // Anonymous namespace
+
+LinearBVHBuilder::LinearBVHBuilder(const BVHConfig& config)
+    : configuration{ config }, triangles_info{ nullptr }, peak_memory_bytes{ 0 }
+{}
+
+LinearBVHNode* LinearBVHBuilder::Build(std::vector<TriangleInfo>& triangle_info, unsigned int root_depth,
+                                       unsigned int& total_nodes)
+{
+    if (triangle_info.size() > LARGE_SCENE_TRIANGLES)
+    {
+        return BuildWithCodes<uint64_t>(triangle_info, 63, root_depth, total_nodes);
+    }
+
+    return BuildWithCodes<uint32_t>(triangle_info, 30, root_depth, total_nodes);
+}
+
+template <typename MortonCode>
+LinearBVHNode* LinearBVHBuilder::BuildWithCodes(std::vector<TriangleInfo>& triangle_info, unsigned int code_bits,
+                                                unsigned int root_depth, unsigned int& total_nodes)
+{
+    ThreadPool& thread_pool{ ThreadPool::Global() };
+    const unsigned int num_triangles{ static_cast<unsigned int>(triangle_info.size()) };
+
+    // Compute bounds of the centroids the codes are relative to
+    Geometry::BBox centroids_bounds;
+    std::mutex centroids_bounds_mutex;
+    const auto compute_centroids_bounds = [&triangle_info, &centroids_bounds,
+        &centroids_bounds_mutex](unsigned int start, unsigned int end) -> void
+    {
+        Geometry::BBox chunk_bounds;
+        for (unsigned int i = start; i != end; i++)
+        {
+            chunk_bounds = Union(chunk_bounds, triangle_info[i].centroid);
+        }
+        std::lock_guard<std::mutex> lock{ centroids_bounds_mutex };
+        centroids_bounds = Union(centroids_bounds, chunk_bounds);
+    };
+    thread_pool.ParallelFor(0, num_triangles, PARALLEL_PASS_GRAIN_SIZE, compute_centroids_bounds);
+
+    // Compute the codes and sort them
+    const auto inv_extent = [](float extent) -> float
+    {
+        return extent > 0.f ? 1.f / extent : 0.f;
+    };
+    const Geometry::Vector3f centroids_diagonal{ centroids_bounds.Diagonal() };
+    const Geometry::Vector3f inv_centroids_diagonal{ inv_extent(centroids_diagonal.x),
+                                                     inv_extent(centroids_diagonal.y),
+                                                     inv_extent(centroids_diagonal.z) };
+    const unsigned int bits_per_axis{ code_bits / 3 };
+    MortonTriangle<MortonCode>* codes{ AllocateAligned<MortonTriangle<MortonCode>>(num_triangles) };
+    MortonTriangle<MortonCode>* codes_buffer{ AllocateAligned<MortonTriangle<MortonCode>>(num_triangles) };
+    const auto compute_codes = [&triangle_info, codes, &centroids_bounds, &inv_centroids_diagonal,
+        bits_per_axis](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int i = start; i != end; i++)
+        {
+            const Geometry::Vector3f offset{ (triangle_info[i].centroid - centroids_bounds.PMin()) *
+                                             inv_centroids_diagonal };
+            codes[i].code = Geometry::EncodeMorton<MortonCode>(offset, bits_per_axis);
+            codes[i].triangle_index = i;
+        }
+    };
+    thread_pool.ParallelFor(0, num_triangles, PARALLEL_PASS_GRAIN_SIZE, compute_codes);
+    const MortonTriangle<MortonCode>* sorted_triangles{ RadixSort(codes, codes_buffer, num_triangles, code_bits) };
+
+    // Bring the triangle information in the order of the codes
+    std::vector<TriangleInfo> sorted_info(num_triangles);
+    const auto sort_triangle_info = [&triangle_info, &sorted_info, sorted_triangles](unsigned int start,
+                                                                                     unsigned int end) -> void
+    {
+        for (unsigned int i = start; i != end; i++)
+        {
+            sorted_info[i] = triangle_info[sorted_triangles[i].triangle_index];
+        }
+    };
+    thread_pool.ParallelFor(0, num_triangles, PARALLEL_PASS_GRAIN_SIZE, sort_triangle_info);
+    triangle_info.swap(sorted_info);
+    triangles_info = triangle_info.data();
+    peak_memory_bytes = 2 * num_triangles * sizeof(MortonTriangle<MortonCode>) +
+                        sorted_info.size() * sizeof(TriangleInfo);
+
+    // Build the treelets in parallel, each one in the scratch memory starting at twice its first triangle, which
+    // is enough to hold a tree with a triangle in each leaf. The treelets start below the depth reserved to the top
+    // nodes
+    FindTreelets(sorted_triangles, num_triangles, code_bits - TREELET_BITS);
+    const unsigned int num_treelets{ static_cast<unsigned int>(treelets.size()) };
+    LinearBVHNode* scratch_nodes{ AllocateAligned<LinearBVHNode>(2 * num_triangles) };
+    const int treelet_top_bit{ static_cast<int>(code_bits - TREELET_BITS) - 1 };
+    const unsigned int treelet_depth{ root_depth + TOP_NODES_MAX_DEPTH };
+    const auto build_treelets = [this, sorted_triangles, scratch_nodes, treelet_top_bit,
+        treelet_depth](unsigned int first, unsigned int last) -> void
+    {
+        for (unsigned int t = first; t != last; t++)
+        {
+            Treelet& treelet{ treelets[t] };
+            treelet.num_nodes = 0;
+            EmitTreeletNodes(sorted_triangles, treelet.start, treelet.end, treelet_top_bit, treelet_depth,
+                             scratch_nodes + 2 * treelet.start, treelet.num_nodes);
+        }
+    };
+    thread_pool.ParallelFor(0, num_treelets, TREELET_GRAIN_SIZE, build_treelets);
+
+    // Emit the nodes above the treelets, they take the first positions in the tree and are followed by the treelets
+    total_nodes = num_treelets - 1;
+    for (const Treelet& treelet : treelets)
+    {
+        total_nodes += treelet.num_nodes;
+    }
+    LinearBVHNode* nodes{ AllocateAligned<LinearBVHNode>(total_nodes) };
+    unsigned int node_offset{ 0 };
+    unsigned int triangle_offset{ 0 };
+    EmitTopNodes(0, num_treelets, 0, nodes, node_offset, triangle_offset);
+    peak_memory_bytes += (2 * num_triangles + total_nodes) * sizeof(LinearBVHNode) +
+                         treelets.capacity() * sizeof(Treelet);
+
+    // Copy the treelets moving the offsets of the nodes and of the triangles. The top levels built with SAH can
+    // visit the treelets in a different order than the codes, then the triangles are moved such that the leafs
+    // still reference them in depth first order
+    const bool move_triangles{ configuration.build_method == BVHBuildMethod::LINEAR_SAH };
+    const auto copy_treelets = [this, scratch_nodes, nodes, &triangle_info, &sorted_info,
+        move_triangles](unsigned int first, unsigned int last) -> void
+    {
+        for (unsigned int t = first; t != last; t++)
+        {
+            const Treelet& treelet{ treelets[t] };
+            const LinearBVHNode* treelet_nodes{ scratch_nodes + 2 * treelet.start };
+            for (unsigned int i = 0; i != treelet.num_nodes; i++)
+            {
+                LinearBVHNode& node{ nodes[treelet.node_offset + i] };
+                node = treelet_nodes[i];
+                if (node.num_triangles == 0)
+                {
+                    node.second_child_offset += treelet.node_offset;
+                }
+                else
+                {
+                    node.triangle_offset = node.triangle_offset - treelet.start + treelet.triangle_offset;
+                }
+            }
+            if (move_triangles)
+            {
+                std::copy(triangle_info.begin() + treelet.start, triangle_info.begin() + treelet.end,
+                          sorted_info.begin() + treelet.triangle_offset);
+            }
+        }
+    };
+    thread_pool.ParallelFor(0, num_treelets, TREELET_GRAIN_SIZE, copy_treelets);
+    if (move_triangles)
+    {
+        triangle_info.swap(sorted_info);
+    }
+
+    FreeAligned(scratch_nodes);
+    FreeAligned(codes);
+    FreeAligned(codes_buffer);
+    treelets.clear();
+    triangles_info = nullptr;
+
+    return nodes;
+}
+
+template <typename MortonCode>
+void LinearBVHBuilder::FindTreelets(const MortonTriangle<MortonCode>* sorted_triangles, unsigned int num_triangles,
+                                    unsigned int prefix_shift)
+{
+    // Find the ranges of triangles with the same prefix
+    treelets.clear();
+    unsigned int start{ 0 };
+    while (start != num_triangles)
+    {
+        const uint32_t prefix{ static_cast<uint32_t>(sorted_triangles[start].code >> prefix_shift) };
+        unsigned int end{ start + 1 };
+        while (end != num_triangles && static_cast<uint32_t>(sorted_triangles[end].code >> prefix_shift) == prefix)
+        {
+            end++;
+        }
+        treelets.push_back(Treelet{ start, end, prefix, 0, 0, 0, Geometry::BBox{} });
+        start = end;
+    }
+
+    // Compute the bounds of the treelets
+    const auto compute_treelets_bounds = [this](unsigned int first, unsigned int last) -> void
+    {
+        for (unsigned int t = first; t != last; t++)
+        {
+            Treelet& treelet{ treelets[t] };
+            for (unsigned int i = treelet.start; i != treelet.end; i++)
+            {
+                treelet.bounds = Union(treelet.bounds, triangles_info[i].bounds);
+            }
+        }
+    };
+    ThreadPool::Global().ParallelFor(0, static_cast<unsigned int>(treelets.size()), TREELET_GRAIN_SIZE,
+                                     compute_treelets_bounds);
+}
+
+template <typename MortonCode>
+unsigned int LinearBVHBuilder::EmitTreeletNodes(const MortonTriangle<MortonCode>* sorted_triangles,
+                                                unsigned int start, unsigned int end, int bit,
+                                                unsigned int depth, LinearBVHNode* nodes,
+                                                unsigned int& num_nodes) const
+{
+    const unsigned int node_index{ num_nodes++ };
+    LinearBVHNode& node{ nodes[node_index] };
+
+    // Create leaf if we have few enough triangles
+    if (end - start <= configuration.max_triangles_in_leaf)
+    {
+        node.bounds = Geometry::BBox{};
+        for (unsigned int i = start; i != end; i++)
+        {
+            node.bounds = Union(node.bounds, triangles_info[i].bounds);
+        }
+        node.triangle_offset = start;
+        node.num_triangles = static_cast<uint16_t>(end - start);
+        node.split_axis = 3;
+
+        return node_index;
+    }
+
+    // Skip the bits shared by all the codes of the range, the codes are sorted so it is enough to look at the first
+    // and the last one
+    const MortonCode different_bits{ sorted_triangles[start].code ^ sorted_triangles[end - 1].code };
+    while (bit >= 0 && ((different_bits >> bit) & 1u) == 0)
+    {
+        bit--;
+    }
+
+    // Split where the bit changes, triangles with the same code are split in the middle
+    unsigned int mid{ (start + end) / 2 };
+    if (bit >= 0)
+    {
+        const MortonTriangle<MortonCode>* split{
+            std::partition_point(sorted_triangles + start, sorted_triangles + end,
+                                 [bit](const MortonTriangle<MortonCode>& triangle) -> bool
+                                 {
+                                     return ((triangle.code >> bit) & 1u) == 0;
+                                 }) };
+        mid = static_cast<unsigned int>(split - sorted_triangles);
+    }
+
+    // Fall back to the middle if the larger side could not be split down to single triangles within the traversal
+    // stack, the children go on splitting on the same bits
+    const bool median_split{ depth + 1 + MedianSplitLevels(std::max(mid - start, end - mid)) >= BVH_STACK_SIZE };
+    if (median_split)
+    {
+        mid = (start + end) / 2;
+    }
+    const int children_bit{ median_split ? bit : bit - 1 };
+
+    // Create interior node, the first child is placed right after the node
+    EmitTreeletNodes(sorted_triangles, start, mid, children_bit, depth + 1, nodes, num_nodes);
+    const unsigned int second_child_offset{ EmitTreeletNodes(sorted_triangles, mid, end, children_bit, depth + 1,
+                                                             nodes, num_nodes) };
+    node.bounds = Union(nodes[node_index + 1].bounds, nodes[second_child_offset].bounds);
+    node.second_child_offset = second_child_offset;
+    node.num_triangles = 0;
+    node.split_axis = static_cast<uint8_t>(bit >= 0 && !median_split ? bit % 3 : LargestAxis(node.bounds));
+
+    return node_index;
+}
+
+unsigned int LinearBVHBuilder::EmitTopNodes(unsigned int first, unsigned int last, unsigned int depth,
+                                            LinearBVHNode* nodes, unsigned int& node_offset,
+                                            unsigned int& triangle_offset)
+{
+    // A single treelet is placed at the current offsets
+    if (last - first == 1)
+    {
+        Treelet& treelet{ treelets[first] };
+        treelet.node_offset = node_offset;
+        treelet.triangle_offset = triangle_offset;
+        node_offset += treelet.num_nodes;
+        triangle_offset += treelet.end - treelet.start;
+
+        return treelet.node_offset;
+    }
+
+    const unsigned int node_index{ node_offset++ };
+    unsigned int split_axis{ 0 };
+    unsigned int split{ configuration.build_method == BVHBuildMethod::LINEAR_SAH ?
+                        SplitTreeletsSAH(first, last, split_axis) :
+                        SplitTreeletsMorton(first, last, split_axis) };
+
+    // Fall back to the middle if the treelets could not be reached within the depth reserved to the top nodes
+    if (depth + 1 + MedianSplitLevels(std::max(split - first, last - split)) > TOP_NODES_MAX_DEPTH)
+    {
+        split = (first + last) / 2;
+    }
+
+    // Create interior node, the first child is placed right after the node
+    LinearBVHNode& node{ nodes[node_index] };
+    EmitTopNodes(first, split, depth + 1, nodes, node_offset, triangle_offset);
+    node.second_child_offset = EmitTopNodes(split, last, depth + 1, nodes, node_offset, triangle_offset);
+    node.bounds = Geometry::BBox{};
+    for (unsigned int t = first; t != last; t++)
+    {
+        node.bounds = Union(node.bounds, treelets[t].bounds);
+    }
+    node.num_triangles = 0;
+    node.split_axis = static_cast<uint8_t>(split_axis);
+
+    return node_index;
+}
+
+unsigned int LinearBVHBuilder::SplitTreeletsMorton(unsigned int first, unsigned int last,
+                                                   unsigned int& split_axis) const noexcept
+{
+    // Treelets are sorted by prefix, the highest bit where the first and the last one differ splits the range
+    const uint32_t different_bits{ treelets[first].prefix ^ treelets[last - 1].prefix };
+    const unsigned int bit{ 31u - static_cast<unsigned int>(__builtin_clz(different_bits)) };
+    split_axis = bit % 3;
+
+    const auto split{ std::partition_point(treelets.begin() + first, treelets.begin() + last,
+                                           [bit](const Treelet& treelet) -> bool
+                                           {
+                                               return ((treelet.prefix >> bit) & 1u) == 0;
+                                           }) };
+
+    return static_cast<unsigned int>(split - treelets.begin());
+}
+
+unsigned int LinearBVHBuilder::SplitTreeletsSAH(unsigned int first, unsigned int last, unsigned int& split_axis)
+{
+    // Sweep the treelets sorted by the centroid of their bounds along each axis, the cost of a side is the
+    // surface of its bounds times its number of triangles
+    const unsigned int num_treelets{ last - first };
+    std::vector<float> right_costs(num_treelets);
+    float best_cost{ std::numeric_limits<float>::max() };
+    unsigned int best_split{ first + num_treelets / 2 };
+    split_axis = 2;
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        std::sort(treelets.begin() + first, treelets.begin() + last,
+                  [axis](const Treelet& t0, const Treelet& t1) -> bool
+                  {
+                      return t0.bounds.Centroid()[axis] < t1.bounds.Centroid()[axis];
+                  });
+
+        // Entry i contains the cost of the treelets from i to the end
+        Geometry::BBox right_bounds;
+        unsigned int right_num_triangles{ 0 };
+        for (unsigned int i = num_treelets; i-- > 1;)
+        {
+            right_bounds = Union(right_bounds, treelets[first + i].bounds);
+            right_num_triangles += treelets[first + i].end - treelets[first + i].start;
+            right_costs[i] = right_num_triangles * right_bounds.Surface();
+        }
+
+        Geometry::BBox left_bounds;
+        unsigned int left_num_triangles{ 0 };
+        for (unsigned int i = 1; i != num_treelets; i++)
+        {
+            left_bounds = Union(left_bounds, treelets[first + i - 1].bounds);
+            left_num_triangles += treelets[first + i - 1].end - treelets[first + i - 1].start;
+            const float split_cost{ left_num_triangles * left_bounds.Surface() + right_costs[i] };
+            if (split_cost < best_cost)
+            {
+                best_cost = split_cost;
+                best_split = first + i;
+                split_axis = axis;
+            }
+        }
+    }
+
+    // Bring the treelets in the order of the best axis
+    if (split_axis != 2)
+    {
+        const unsigned int axis{ split_axis };
+        std::sort(treelets.begin() + first, treelets.begin() + last,
+                  [axis](const Treelet& t0, const Treelet& t1) -> bool
+                  {
+                      return t0.bounds.Centroid()[axis] < t1.bounds.Centroid()[axis];
+                  });
+    }
+
+    return best_split;
+}
+
+} // Rabbit namespace
@@ -0,0 +1,93 @@
+#ifndef RABBIT2_LINEAR_BUILDER_HPP
+#define RABBIT2_LINEAR_BUILDER_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Morton code of the centroid of a triangle with the index of its information
+template <typename MortonCode>
+struct MortonTriangle
+{
+    MortonCode code;
+    uint32_t triangle_index;
+};
+
+// Linear BVH builder, the triangles are sorted along the Morton curve of their centroids with a parallel radix sort
+// and the hierarchy follows the bits of the codes (LBVH). The sorted triangles are grouped in treelets sharing the
+// first bits of their codes, which are built in parallel, and the nodes above them are either split on the same bits
+// or built with SAH (HLBVH). Codes have 30 bits, or 63 bits for large scenes
+class LinearBVHBuilder
+{
+public:
+    explicit LinearBVHBuilder(const BVHConfig& config);
+
+    // Build tree for the given triangles with its root at the given depth, the triangle information is reordered
+    // such that leafs reference contiguous ranges. Returns the nodes allocated with AllocateAligned and sets the
+    // number of nodes
+    LinearBVHNode* Build(std::vector<TriangleInfo>& triangle_info, unsigned int root_depth, unsigned int& total_nodes);
+
+    // Peak of the memory allocated by the last build, without the triangle information
+    size_t PeakMemoryBytes() const noexcept
+    {
+        return peak_memory_bytes;
+    }
+
+private:
+    // Range of sorted triangles sharing the first bits of their codes
+    struct Treelet
+    {
+        // Range of sorted triangles and common bits of their codes
+        unsigned int start, end;
+        uint32_t prefix;
+        // Nodes of the treelet in the scratch memory, offset of its nodes and of its triangles in the final tree
+        unsigned int num_nodes;
+        unsigned int node_offset;
+        unsigned int triangle_offset;
+        // Bounds of the triangles
+        Geometry::BBox bounds;
+    };
+
+    // Sort triangles by Morton code and build the tree, code_bits is either 30 or 63
+    template <typename MortonCode>
+    LinearBVHNode* BuildWithCodes(std::vector<TriangleInfo>& triangle_info, unsigned int code_bits,
+                                  unsigned int root_depth, unsigned int& total_nodes);
+
+    // Group sorted triangles by the first bits of their codes and compute the bounds of the groups
+    template <typename MortonCode>
+    void FindTreelets(const MortonTriangle<MortonCode>* sorted_triangles, unsigned int num_triangles,
+                      unsigned int prefix_shift);
+
+    // Emit the nodes for a range of sorted triangles splitting them on the given bit and the ones below, nodes are
+    // written in depth first order. Ranges are split in the middle where needed to keep the tree within the
+    // traversal stack. Returns the index of the node
+    template <typename MortonCode>
+    unsigned int EmitTreeletNodes(const MortonTriangle<MortonCode>* sorted_triangles, unsigned int start,
+                                  unsigned int end, int bit, unsigned int depth, LinearBVHNode* nodes,
+                                  unsigned int& num_nodes) const;
+
+    // Emit the nodes above a range of treelets in depth first order and assign the offsets of the treelets, returns
+    // the index of the node
+    unsigned int EmitTopNodes(unsigned int first, unsigned int last, unsigned int depth, LinearBVHNode* nodes,
+                              unsigned int& node_offset, unsigned int& triangle_offset);
+
+    // Split range of treelets on the highest bit of the prefixes where they differ, returns the first treelet of the
+    // second half
+    unsigned int SplitTreeletsMorton(unsigned int first, unsigned int last, unsigned int& split_axis) const noexcept;
+
+    // Split range of treelets with the lowest SAH cost, the treelets are sorted along the split axis
+    unsigned int SplitTreeletsSAH(unsigned int first, unsigned int last, unsigned int& split_axis);
+
+    const BVHConfig configuration;
+    // Triangles information for the current build
+    const TriangleInfo* triangles_info;
+    // Treelets of the current build
+    std::vector<Treelet> treelets;
+    // Peak memory of the last build
+    size_t peak_memory_bytes;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_LINEAR_BUILDER_HPP
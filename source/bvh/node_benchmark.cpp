@@ -0,0 +1,124 @@
+#include "node_benchmark.hpp"
+#include "wide_bvh.hpp"
+#include "compressed_wide_bvh.hpp"
+#include "sampling/pcg32.hpp"
+#include "utilities/cache_counters.hpp"
+
+#include <chrono>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Trace all the rays with the given accelerator
+template <typename Accelerator>
+const NodeLayoutMeasure TraceAll(const Accelerator& accelerator, const std::vector<Geometry::Ray>& rays,
+                                 size_t nodes_bytes)
+{
+    NodeLayoutMeasure measure;
+    measure.nodes_bytes = nodes_bytes;
+    CacheCounters cache_counters;
+    cache_counters.Start();
+    const auto start{ std::chrono::high_resolution_clock::now() };
+    for (const Geometry::Ray& ray : rays)
+    {
+        Geometry::Intervalf interval{ Geometry::Ray::DefaultInterval() };
+        Geometry::TriangleIntersection intersection;
+        measure.hits += accelerator.Intersect(ray, interval, intersection);
+    }
+    const auto end{ std::chrono::high_resolution_clock::now() };
+    cache_counters.Stop();
+    const float elapsed_ms{ std::chrono::duration<float, std::milli>(end - start).count() };
+    measure.mrps = elapsed_ms > 0.f ? rays.size() / (elapsed_ms * 1000.f) : 0.f;
+    if (cache_counters.Available() && !rays.empty())
+    {
+        measure.l1_misses_per_ray = static_cast<float>(cache_counters.L1Misses()) / rays.size();
+        measure.last_level_misses_per_ray = static_cast<float>(cache_counters.LastLevelMisses()) / rays.size();
+        measure.last_level_miss_rate = cache_counters.LastLevelAccesses() != 0 ?
+                                       static_cast<float>(cache_counters.LastLevelMisses()) /
+                                       cache_counters.LastLevelAccesses() : 0.f;
+    }
+
+    return measure;
+}
+
+// Build wide layout and trace all the rays with it
+template <typename WideAccelerator, typename Node>
+const NodeLayoutMeasure TraceAllWide(const BVH& bvh, const std::vector<Geometry::Ray>& rays)
+{
+    const WideAccelerator accelerator{ bvh };
+
+    return TraceAll(accelerator, rays, accelerator.NumNodes() * sizeof(Node));
+}
+
+// Generate rays between random points of the bounds, they cross large parts of the tree in random order
+const std::vector<Geometry::Ray> GenerateRays(const Geometry::BBox& bounds, unsigned int num_rays)
+{
+    Sampling::PCG32 rng{ 23, 7 };
+    std::vector<Geometry::Ray> rays;
+    rays.reserve(num_rays);
+    for (unsigned int i = 0; i != num_rays; i++)
+    {
+        const Geometry::Point3f origin{ bounds.PMin() + Geometry::Vector3f{ rng.NextFloat(), rng.NextFloat(),
+                                                                            rng.NextFloat() } * bounds.Diagonal() };
+        const Geometry::Point3f target{ bounds.PMin() + Geometry::Vector3f{ rng.NextFloat(), rng.NextFloat(),
+                                                                            rng.NextFloat() } * bounds.Diagonal() };
+        rays.emplace_back(origin, Geometry::Normalize(target - origin));
+    }
+
+    return rays;
+}
+
+// Build binary BVH with the given node layout and trace all the rays with it
+const NodeLayoutMeasure TraceAllBinary(const BVHConfig& config, BVHNodeLayout node_layout,
+                                       const std::vector<Triangle>& triangles,
+                                       const std::vector<Geometry::Ray>& rays)
+{
+    const BVHConfig layout_config{ config.max_triangles_in_leaf, config.triangle_intersect_cost,
+                                   config.bbox_intersect_cost, config.num_buckets, config.parallel_build_threshold,
+                                   config.build_method, config.leaf_format, config.spatial_split_budget,
+                                   config.pre_split_budget, config.pre_split_surface_ratio,
+                                   config.optimization_time_budget_ms, node_layout };
+    const BVH bvh{ layout_config, triangles };
+
+    return TraceAll(bvh, rays, bvh.NumNodes() * sizeof(LinearBVHNode));
+}
+
+} // anonymous namespace
+
+const NodeBenchmarkResult BenchmarkNodeLayouts(const BVH& bvh, unsigned int num_rays)
+{
+    const std::vector<Geometry::Ray> rays{ GenerateRays(bvh.Nodes()[0].bounds, num_rays) };
+
+    NodeBenchmarkResult result;
+    result.bvh2 = TraceAll(bvh, rays, bvh.NumNodes() * sizeof(LinearBVHNode));
+    result.bvh4 = TraceAllWide<BVH4, WideBVHNode<4>>(bvh, rays);
+    result.bvh8 = TraceAllWide<BVH8, WideBVHNode<8>>(bvh, rays);
+    result.compressed_bvh4 = TraceAllWide<CompressedBVH4, CompressedWideBVHNode<4>>(bvh, rays);
+    result.compressed_bvh8 = TraceAllWide<CompressedBVH8, CompressedWideBVHNode<8>>(bvh, rays);
+
+    return result;
+}
+
+const BinaryLayoutBenchmarkResult BenchmarkBinaryNodeLayouts(const BVHConfig& config,
+                                                             const std::vector<Triangle>& triangles,
+                                                             unsigned int num_rays)
+{
+    Geometry::BBox bounds;
+    for (const Triangle& triangle : triangles)
+    {
+        bounds = Geometry::Union(bounds, triangle.Bounds());
+    }
+    const std::vector<Geometry::Ray> rays{ GenerateRays(bounds, num_rays) };
+
+    BinaryLayoutBenchmarkResult result;
+    result.depth_first = TraceAllBinary(config, BVHNodeLayout::DEPTH_FIRST, triangles, rays);
+    result.subtree_clusters = TraceAllBinary(config, BVHNodeLayout::SUBTREE_CLUSTERS, triangles, rays);
+    result.van_emde_boas = TraceAllBinary(config, BVHNodeLayout::VAN_EMDE_BOAS, triangles, rays);
+
+    return result;
+}
+
+} // Rabbit namespace
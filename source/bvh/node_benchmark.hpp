@@ -0,0 +1,61 @@
+#ifndef RABBIT2_NODE_BENCHMARK_HPP
+#define RABBIT2_NODE_BENCHMARK_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Memory and throughput of one node layout
+struct NodeLayoutMeasure
+{
+    NodeLayoutMeasure() noexcept
+        : nodes_bytes{ 0 }, mrps{ 0.f }, hits{ 0 }, l1_misses_per_ray{ -1.f }, last_level_misses_per_ray{ -1.f },
+          last_level_miss_rate{ -1.f }
+    {}
+
+    // Memory used by the nodes, the triangles are shared by all the layouts
+    size_t nodes_bytes;
+    // Millions of closest hit rays per second
+    float mrps;
+    // Number of rays that hit something, all the layouts should agree
+    unsigned int hits;
+    // Data cache read misses per ray, the first level misses are the accesses to L2. Negative when the hardware
+    // counters are not available
+    float l1_misses_per_ray;
+    float last_level_misses_per_ray;
+    // Fraction of the last level cache reads that missed
+    float last_level_miss_rate;
+};
+
+// Measures of the binary, wide and compressed wide layouts of the same tree
+struct NodeBenchmarkResult
+{
+    NodeLayoutMeasure bvh2;
+    NodeLayoutMeasure bvh4;
+    NodeLayoutMeasure bvh8;
+    NodeLayoutMeasure compressed_bvh4;
+    NodeLayoutMeasure compressed_bvh8;
+};
+
+// Measures of the binary BVH with each order of the nodes in memory
+struct BinaryLayoutBenchmarkResult
+{
+    NodeLayoutMeasure depth_first;
+    NodeLayoutMeasure subtree_clusters;
+    NodeLayoutMeasure van_emde_boas;
+};
+
+// Trace incoherent rays between random points of the bounds of the BVH with each node layout, such that the measure
+// is dominated by the accesses to the nodes
+const NodeBenchmarkResult BenchmarkNodeLayouts(const BVH& bvh, unsigned int num_rays);
+
+// Build a binary BVH for the triangles with each node order, the one in the configuration is ignored, and trace the
+// same kind of rays with them
+const BinaryLayoutBenchmarkResult BenchmarkBinaryNodeLayouts(const BVHConfig& config,
+                                                             const std::vector<Triangle>& triangles,
+                                                             unsigned int num_rays);
+
+} // Rabbit namespace
+
+#endif //RABBIT2_NODE_BENCHMARK_HPP
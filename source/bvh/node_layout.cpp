@@ -0,0 +1,183 @@
+#include "node_layout.hpp"
+#include "utilities/memory.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// A pair of siblings is identified by the index of their parent in the depth first nodes, append the pairs under the
+// children of the given one
+void AppendChildPairs(const LinearBVHNode* nodes, unsigned int pair, std::vector<unsigned int>& pairs)
+{
+    if (nodes[pair + 1].num_triangles == 0)
+    {
+        pairs.push_back(pair + 1);
+    }
+    if (nodes[nodes[pair].second_child_offset].num_triangles == 0)
+    {
+        pairs.push_back(nodes[pair].second_child_offset);
+    }
+}
+
+// Order the pairs in blocks, each block is filled from its root taking the pair with the largest parent surface,
+// which is the most likely to be visited, among the ones under the block. The pairs left under a block start new
+// blocks, the most likely first
+const std::vector<unsigned int> ClusterOrder(const LinearBVHNode* nodes)
+{
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> block_roots{ 0 };
+    std::vector<std::pair<float, unsigned int>> candidates;
+    std::vector<unsigned int> child_pairs;
+    for (size_t block = 0; block != block_roots.size(); block++)
+    {
+        candidates.assign(1, std::make_pair(nodes[block_roots[block]].bounds.Surface(), block_roots[block]));
+        for (unsigned int block_pairs = 0; block_pairs != CLUSTER_BLOCK_PAIRS && !candidates.empty(); block_pairs++)
+        {
+            std::pop_heap(candidates.begin(), candidates.end());
+            const unsigned int pair{ candidates.back().second };
+            candidates.pop_back();
+            order.push_back(pair);
+
+            child_pairs.clear();
+            AppendChildPairs(nodes, pair, child_pairs);
+            for (const unsigned int child_pair : child_pairs)
+            {
+                candidates.emplace_back(nodes[child_pair].bounds.Surface(), child_pair);
+                std::push_heap(candidates.begin(), candidates.end());
+            }
+        }
+        std::sort_heap(candidates.begin(), candidates.end());
+        for (auto candidate = candidates.rbegin(); candidate != candidates.rend(); candidate++)
+        {
+            block_roots.push_back(candidate->second);
+        }
+    }
+
+    return order;
+}
+
+// Append the pairs of the subtree under the given pair cut to the given number of levels in van Emde Boas order: the
+// top half of the levels is laid out first and then each subtree under it, both recursively. The pairs right under
+// the cut subtree are appended to frontier
+void VanEmdeBoasOrder(const LinearBVHNode* nodes, const std::vector<unsigned int>& heights, unsigned int pair,
+                      unsigned int levels, std::vector<unsigned int>& order, std::vector<unsigned int>& frontier)
+{
+    if (levels == 1)
+    {
+        order.push_back(pair);
+        AppendChildPairs(nodes, pair, frontier);
+        return;
+    }
+
+    const unsigned int top_levels{ levels / 2 };
+    std::vector<unsigned int> middle;
+    VanEmdeBoasOrder(nodes, heights, pair, top_levels, order, middle);
+    for (const unsigned int middle_pair : middle)
+    {
+        VanEmdeBoasOrder(nodes, heights, middle_pair, std::min(levels - top_levels, heights[middle_pair]), order,
+                         frontier);
+    }
+}
+
+// Copy subtree in depth first order, returns the index of the node
+unsigned int FlattenDepthFirst(const LinearBVHNode* nodes, unsigned int node_index,
+                               LinearBVHNode* depth_first_nodes, unsigned int& offset) noexcept
+{
+    const unsigned int flat_index{ offset++ };
+    LinearBVHNode& flat_node{ depth_first_nodes[flat_index] };
+    flat_node = nodes[node_index];
+    if (flat_node.num_triangles == 0)
+    {
+        FlattenDepthFirst(nodes, nodes[node_index].second_child_offset - 1, depth_first_nodes, offset);
+        flat_node.second_child_offset = FlattenDepthFirst(nodes, nodes[node_index].second_child_offset,
+                                                          depth_first_nodes, offset);
+    }
+
+    return flat_index;
+}
+
+} // anonymous namespace
+
+LinearBVHNode* LayoutNodes(const LinearBVHNode* nodes, unsigned int& num_nodes, BVHNodeLayout layout)
+{
+    assert(layout != BVHNodeLayout::DEPTH_FIRST);
+
+    // A single leaf has no pairs
+    if (nodes[0].num_triangles != 0)
+    {
+        LinearBVHNode* layout_nodes{ AllocateAligned<LinearBVHNode>(1) };
+        layout_nodes[0] = nodes[0];
+        num_nodes = 1;
+
+        return layout_nodes;
+    }
+
+    std::vector<unsigned int> order;
+    if (layout == BVHNodeLayout::SUBTREE_CLUSTERS)
+    {
+        order = ClusterOrder(nodes);
+    }
+    else
+    {
+        // Height of the tree of pairs under each interior node, children come after their parent
+        std::vector<unsigned int> heights(num_nodes, 0);
+        for (unsigned int node_index = num_nodes; node_index-- > 0;)
+        {
+            const LinearBVHNode& node{ nodes[node_index] };
+            if (node.num_triangles == 0)
+            {
+                heights[node_index] = 1 + std::max(heights[node_index + 1], heights[node.second_child_offset]);
+            }
+        }
+        std::vector<unsigned int> frontier;
+        VanEmdeBoasOrder(nodes, heights, 0, heights[0], order, frontier);
+    }
+
+    // The first child of the pair in position k is at 2 + 2k
+    std::vector<unsigned int> first_child_indices(num_nodes);
+    for (unsigned int k = 0; k != order.size(); k++)
+    {
+        first_child_indices[order[k]] = 2 + 2 * k;
+    }
+
+    num_nodes = 2 + 2 * static_cast<unsigned int>(order.size());
+    LinearBVHNode* layout_nodes{ AllocateAligned<LinearBVHNode>(num_nodes) };
+    layout_nodes[0] = nodes[0];
+    layout_nodes[0].second_child_offset = first_child_indices[0] + 1;
+    layout_nodes[1] = LinearBVHNode{};
+    for (unsigned int k = 0; k != order.size(); k++)
+    {
+        const unsigned int children[2]{ order[k] + 1, nodes[order[k]].second_child_offset };
+        for (unsigned int c = 0; c != 2; c++)
+        {
+            LinearBVHNode& child{ layout_nodes[2 + 2 * k + c] };
+            child = nodes[children[c]];
+            if (child.num_triangles == 0)
+            {
+                child.second_child_offset = first_child_indices[children[c]] + 1;
+            }
+        }
+    }
+
+    return layout_nodes;
+}
+
+LinearBVHNode* DepthFirstNodes(const LinearBVHNode* nodes, unsigned int& num_nodes)
+{
+    // Drop the unused node after the root
+    const unsigned int depth_first_num_nodes{ nodes[0].num_triangles != 0 ? 1 : num_nodes - 1 };
+    LinearBVHNode* depth_first_nodes{ AllocateAligned<LinearBVHNode>(depth_first_num_nodes) };
+    unsigned int offset{ 0 };
+    FlattenDepthFirst(nodes, 0, depth_first_nodes, offset);
+    assert(offset == depth_first_num_nodes);
+    num_nodes = depth_first_num_nodes;
+
+    return depth_first_nodes;
+}
+
+} // Rabbit namespace
@@ -0,0 +1,24 @@
+#ifndef RABBIT2_NODE_LAYOUT_HPP
+#define RABBIT2_NODE_LAYOUT_HPP
+
+#include "bvh.hpp"
+
+namespace Rabbit
+{
+
+// Pairs of siblings grouped in a block of the subtree clusters layout, one block fills a page
+constexpr unsigned int CLUSTER_BLOCK_PAIRS{ 4096 / (2 * sizeof(LinearBVHNode)) };
+
+// Reorder the nodes of a tree in depth first layout in one of the sibling pair layouts. The root is the first node
+// and is followed by an unused node such that each pair starts at a cache line, num_nodes is updated to count it.
+// Returns the new nodes allocated with AllocateAligned, the given ones are not freed
+LinearBVHNode* LayoutNodes(const LinearBVHNode* nodes, unsigned int& num_nodes, BVHNodeLayout layout);
+
+// Reorder the nodes of a tree in one of the sibling pair layouts back in depth first layout, the relative order of
+// the children is kept so the leafs are found in the same order. Returns the new nodes allocated with
+// AllocateAligned and updates num_nodes
+LinearBVHNode* DepthFirstNodes(const LinearBVHNode* nodes, unsigned int& num_nodes);
+
+} // Rabbit namespace
+
+#endif //RABBIT2_NODE_LAYOUT_HPP
@@ -0,0 +1,447 @@
+#include "treelet_optimizer.hpp"
+#include "utilities/memory.hpp"
+#include "utilities/thread_pool.hpp"
+
+#include <algorithm>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Number of treelets restructured by each task
+constexpr unsigned int TREELET_GRAIN_SIZE{ 64 };
+// Passes stop once the cost of the tree improves by less than this fraction
+constexpr float MIN_PASS_IMPROVEMENT{ 1e-3f };
+// A treelet is replaced only if the new topology is cheaper by this fraction, which avoids swapping topologies
+// with the same cost because of rounding
+constexpr float MIN_TREELET_IMPROVEMENT{ 1e-5f };
+
+// Axis along which the centroids of two bounds are further apart, swap is set if the second bounds come first along
+// it. The traversal visits the first child first for rays going in the positive direction of the split axis
+unsigned int SeparatingAxis(const Geometry::BBox& b0, const Geometry::BBox& b1, bool& swap) noexcept
+{
+    const Geometry::Vector3f distance{ b1.Centroid() - b0.Centroid() };
+    const Geometry::Vector3f abs_distance{ Abs(distance) };
+    unsigned int axis{ 0 };
+    for (unsigned int i = 1; i != 3; i++)
+    {
+        if (abs_distance[i] > abs_distance[axis])
+        {
+            axis = i;
+        }
+    }
+    swap = distance[axis] < 0.f;
+
+    return axis;
+}
+
+} // Anonymous namespace
+
+TreeletOptimizer::TreeletOptimizer(const BVHConfig& config)
+    : configuration{ config }, num_passes{ 0 }, peak_memory_bytes{ 0 }
+{}
+
+LinearBVHNode* TreeletOptimizer::Optimize(const LinearBVHNode* nodes, unsigned int& total_nodes,
+                                          std::vector<TriangleInfo>& triangle_info, float time_budget_ms)
+{
+    deadline = std::chrono::high_resolution_clock::now() +
+               std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                   std::chrono::duration<float, std::milli>(time_budget_ms));
+
+    // Copy the tree splitting the leafs, the nodes of the input tree keep their index and the ones created for the
+    // triangles of the leafs follow. In depth first order the children follow their parent so the costs are
+    // computed backwards
+    tree.clear();
+    tree.reserve(total_nodes + 2 * triangle_info.size());
+    tree.resize(total_nodes);
+    for (unsigned int i = total_nodes; i-- > 0;)
+    {
+        const LinearBVHNode& node{ nodes[i] };
+        if (node.num_triangles != 0)
+        {
+            SplitLeaf(i, node.triangle_offset, node.triangle_offset + node.num_triangles, triangle_info);
+        }
+        else
+        {
+            OptimizerNode& tree_node{ tree[i] };
+            tree_node.bounds = node.bounds;
+            tree_node.children[0] = i + 1;
+            tree_node.children[1] = node.second_child_offset;
+            tree_node.split_axis = node.split_axis;
+            UpdateCost(tree_node);
+        }
+    }
+
+    // Restructure the nodes bottom up, the nodes with the same height have disjoint subtrees
+    num_passes = 0;
+    size_t sorted_nodes_bytes{ 0 };
+    while (std::chrono::high_resolution_clock::now() < deadline)
+    {
+        const float pass_start_cost{ tree[0].cost };
+        std::vector<unsigned int> height_starts;
+        const std::vector<unsigned int> sorted_nodes{ SortByHeight(height_starts) };
+        sorted_nodes_bytes = std::max(sorted_nodes_bytes, (sorted_nodes.size() + height_starts.size()) *
+                                                          sizeof(unsigned int));
+        const auto restructure_treelets = [this, &sorted_nodes](unsigned int start, unsigned int end) -> void
+        {
+            for (unsigned int i = start; i != end; i++)
+            {
+                if (std::chrono::high_resolution_clock::now() >= deadline)
+                {
+                    return;
+                }
+                RestructureTreelet(sorted_nodes[i]);
+            }
+        };
+        for (unsigned int height = 0; height + 1 < height_starts.size(); height++)
+        {
+            ThreadPool::Global().ParallelFor(height_starts[height], height_starts[height + 1], TREELET_GRAIN_SIZE,
+                                             restructure_treelets);
+        }
+        num_passes++;
+
+        if (tree[0].cost > pass_start_cost * (1.f - MIN_PASS_IMPROVEMENT))
+        {
+            break;
+        }
+    }
+
+    // Count the nodes of the new tree and find its depth
+    unsigned int new_total_nodes{ 0 };
+    unsigned int max_depth{ 0 };
+    std::vector<std::pair<unsigned int, unsigned int>> visit_stack{ { 0, 0 } };
+    while (!visit_stack.empty())
+    {
+        const OptimizerNode& node{ tree[visit_stack.back().first] };
+        const unsigned int depth{ visit_stack.back().second };
+        visit_stack.pop_back();
+        new_total_nodes++;
+        max_depth = std::max(max_depth, depth);
+        if (!node.collapsed)
+        {
+            visit_stack.emplace_back(node.children[0], depth + 1);
+            visit_stack.emplace_back(node.children[1], depth + 1);
+        }
+    }
+
+    // The leafs split down to single triangles and the new topologies can make the tree deeper, the input tree is
+    // kept if the new one does not fit the traversal stack
+    if (max_depth >= BVH_STACK_SIZE)
+    {
+        LinearBVHNode* input_nodes{ AllocateAligned<LinearBVHNode>(total_nodes) };
+        std::copy(nodes, nodes + total_nodes, input_nodes);
+        peak_memory_bytes = tree.capacity() * sizeof(OptimizerNode) + sorted_nodes_bytes +
+                            total_nodes * sizeof(LinearBVHNode);
+        num_passes = 0;
+        tree = std::vector<OptimizerNode>{};
+
+        return input_nodes;
+    }
+
+    // Bring the tree back in depth first order, the triangles follow the new order of the leafs
+    LinearBVHNode* optimized_nodes{ AllocateAligned<LinearBVHNode>(new_total_nodes) };
+    std::vector<TriangleInfo> ordered_triangle_info;
+    ordered_triangle_info.reserve(triangle_info.size());
+    unsigned int node_offset{ 0 };
+    FlattenNode(0, triangle_info, optimized_nodes, node_offset, ordered_triangle_info);
+    assert(node_offset == new_total_nodes);
+    triangle_info.swap(ordered_triangle_info);
+
+    peak_memory_bytes = tree.capacity() * sizeof(OptimizerNode) + sorted_nodes_bytes +
+                        new_total_nodes * sizeof(LinearBVHNode) +
+                        ordered_triangle_info.size() * sizeof(TriangleInfo);
+    total_nodes = new_total_nodes;
+    tree = std::vector<OptimizerNode>{};
+
+    return optimized_nodes;
+}
+
+void TreeletOptimizer::UpdateCost(OptimizerNode& node) const noexcept
+{
+    const OptimizerNode& first_child{ tree[node.children[0]] };
+    const OptimizerNode& second_child{ tree[node.children[1]] };
+    node.num_triangles = first_child.num_triangles + second_child.num_triangles;
+    node.cost = configuration.bbox_intersect_cost * node.bounds.Surface() + first_child.cost + second_child.cost;
+    node.collapsed = false;
+    if (node.num_triangles <= configuration.max_triangles_in_leaf)
+    {
+        const float leaf_cost{ configuration.triangle_intersect_cost * node.num_triangles * node.bounds.Surface() };
+        if (leaf_cost <= node.cost)
+        {
+            node.cost = leaf_cost;
+            node.collapsed = true;
+        }
+    }
+}
+
+void TreeletOptimizer::SplitLeaf(unsigned int node_index, unsigned int start, unsigned int end,
+                                 const std::vector<TriangleInfo>& triangle_info)
+{
+    if (end - start == 1)
+    {
+        OptimizerNode& node{ tree[node_index] };
+        node.bounds = triangle_info[start].bounds;
+        node.cost = configuration.triangle_intersect_cost * node.bounds.Surface();
+        node.children[0] = OptimizerNode::NO_CHILD;
+        node.children[1] = OptimizerNode::NO_CHILD;
+        node.triangle_offset = start;
+        node.num_triangles = 1;
+        node.split_axis = 3;
+        node.collapsed = true;
+        return;
+    }
+
+    // Split the range in the middle, the capacity of the tree is reserved so the nodes are not moved
+    const unsigned int mid{ (start + end) / 2 };
+    const unsigned int first_child{ static_cast<unsigned int>(tree.size()) };
+    tree.resize(tree.size() + 2);
+    SplitLeaf(first_child, start, mid, triangle_info);
+    SplitLeaf(first_child + 1, mid, end, triangle_info);
+
+    OptimizerNode& node{ tree[node_index] };
+    node.bounds = Union(tree[first_child].bounds, tree[first_child + 1].bounds);
+    bool swap;
+    node.split_axis = SeparatingAxis(tree[first_child].bounds, tree[first_child + 1].bounds, swap);
+    node.children[0] = swap ? first_child + 1 : first_child;
+    node.children[1] = swap ? first_child : first_child + 1;
+    UpdateCost(node);
+}
+
+void TreeletOptimizer::RestructureTreelet(unsigned int node_index) noexcept
+{
+    // Form treelet expanding the leaf with the largest surface until there are enough leafs
+    unsigned int leaves[TREELET_LEAVES]{ tree[node_index].children[0], tree[node_index].children[1] };
+    unsigned int num_leaves{ 2 };
+    unsigned int interior_nodes[TREELET_LEAVES - 1]{ node_index };
+    unsigned int num_interior_nodes{ 1 };
+    while (num_leaves != TREELET_LEAVES)
+    {
+        unsigned int expanded_leaf{ TREELET_LEAVES };
+        float expanded_surface{ -1.f };
+        for (unsigned int i = 0; i != num_leaves; i++)
+        {
+            const OptimizerNode& leaf{ tree[leaves[i]] };
+            if (leaf.HasChildren() && leaf.bounds.Surface() > expanded_surface)
+            {
+                expanded_leaf = i;
+                expanded_surface = leaf.bounds.Surface();
+            }
+        }
+        if (expanded_leaf == TREELET_LEAVES)
+        {
+            break;
+        }
+
+        const OptimizerNode& expanded_node{ tree[leaves[expanded_leaf]] };
+        interior_nodes[num_interior_nodes++] = leaves[expanded_leaf];
+        leaves[expanded_leaf] = expanded_node.children[0];
+        leaves[num_leaves++] = expanded_node.children[1];
+    }
+
+    // Find the cheapest topology for each subset of the leafs, subsets are processed after all their subsets. A
+    // subset is split in two halves, only the halves with the lowest leaf of the subset are enumerated. The best
+    // split is kept also for the subsets collapsed in a leaf, it gives the nodes under the leaf
+    constexpr unsigned int MAX_SUBSETS{ 1u << TREELET_LEAVES };
+    Geometry::BBox subset_bounds[MAX_SUBSETS];
+    float subset_cost[MAX_SUBSETS];
+    unsigned int subset_split[MAX_SUBSETS];
+    unsigned int subset_triangles[MAX_SUBSETS];
+    bool subset_collapsed[MAX_SUBSETS];
+    const unsigned int full_set{ (1u << num_leaves) - 1 };
+    for (unsigned int subset = 1; subset <= full_set; subset++)
+    {
+        const unsigned int lowest_leaf{ static_cast<unsigned int>(__builtin_ctz(subset)) };
+        const unsigned int lowest_bit{ 1u << lowest_leaf };
+        const unsigned int others{ subset & (subset - 1) };
+        const OptimizerNode& leaf{ tree[leaves[lowest_leaf]] };
+        if (others == 0)
+        {
+            subset_bounds[subset] = leaf.bounds;
+            subset_cost[subset] = leaf.cost;
+            subset_triangles[subset] = leaf.num_triangles;
+            subset_collapsed[subset] = leaf.collapsed;
+            continue;
+        }
+        subset_bounds[subset] = Union(subset_bounds[others], leaf.bounds);
+        subset_triangles[subset] = subset_triangles[others] + leaf.num_triangles;
+
+        float best_cost{ std::numeric_limits<float>::max() };
+        unsigned int best_split{ lowest_bit };
+        for (unsigned int others_part = others; others_part != 0; others_part = (others_part - 1) & others)
+        {
+            // The half with the lowest leaf takes a proper subset of the others, the other half is not empty
+            const unsigned int half{ lowest_bit | (others & ~others_part) };
+            const float split_cost{ subset_cost[half] + subset_cost[subset & ~half] };
+            if (split_cost < best_cost)
+            {
+                best_cost = split_cost;
+                best_split = half;
+            }
+        }
+        subset_cost[subset] = configuration.bbox_intersect_cost * subset_bounds[subset].Surface() + best_cost;
+        subset_split[subset] = best_split;
+
+        // Check if a leaf with all the triangles is cheaper
+        subset_collapsed[subset] = false;
+        if (subset_triangles[subset] <= configuration.max_triangles_in_leaf)
+        {
+            const float leaf_cost{ configuration.triangle_intersect_cost * subset_triangles[subset] *
+                                   subset_bounds[subset].Surface() };
+            if (leaf_cost <= subset_cost[subset])
+            {
+                subset_cost[subset] = leaf_cost;
+                subset_collapsed[subset] = true;
+            }
+        }
+    }
+
+    // Keep the current topology unless the new one is cheaper, the cost of the root is updated from its children
+    OptimizerNode& root{ tree[node_index] };
+    UpdateCost(root);
+    if (subset_cost[full_set] >= root.cost * (1.f - MIN_TREELET_IMPROVEMENT))
+    {
+        return;
+    }
+
+    // Rebuild the treelet with the new topology reusing its interior nodes, the root keeps its index
+    unsigned int subset_stack[TREELET_LEAVES];
+    unsigned int node_stack[TREELET_LEAVES];
+    unsigned int stack_size{ 0 };
+    unsigned int next_interior_node{ 1 };
+    subset_stack[stack_size] = full_set;
+    node_stack[stack_size++] = node_index;
+    while (stack_size != 0)
+    {
+        stack_size--;
+        const unsigned int subset{ subset_stack[stack_size] };
+        OptimizerNode& node{ tree[node_stack[stack_size]] };
+        unsigned int halves[2]{ subset_split[subset], subset & ~subset_split[subset] };
+        bool swap;
+        node.split_axis = SeparatingAxis(subset_bounds[halves[0]], subset_bounds[halves[1]], swap);
+        if (swap)
+        {
+            std::swap(halves[0], halves[1]);
+        }
+        for (unsigned int c = 0; c != 2; c++)
+        {
+            if ((halves[c] & (halves[c] - 1)) == 0)
+            {
+                node.children[c] = leaves[__builtin_ctz(halves[c])];
+            }
+            else
+            {
+                node.children[c] = interior_nodes[next_interior_node++];
+                subset_stack[stack_size] = halves[c];
+                node_stack[stack_size++] = node.children[c];
+            }
+        }
+        node.bounds = subset_bounds[subset];
+        node.cost = subset_cost[subset];
+        node.num_triangles = subset_triangles[subset];
+        node.collapsed = subset_collapsed[subset];
+    }
+}
+
+const std::vector<unsigned int> TreeletOptimizer::SortByHeight(std::vector<unsigned int>& height_starts) const
+{
+    // Visit nodes in breadth first order, the children come after their parent
+    std::vector<unsigned int> visit_order;
+    visit_order.reserve(tree.size());
+    visit_order.push_back(0);
+    for (unsigned int i = 0; i != visit_order.size(); i++)
+    {
+        const OptimizerNode& node{ tree[visit_order[i]] };
+        if (node.HasChildren())
+        {
+            visit_order.push_back(node.children[0]);
+            visit_order.push_back(node.children[1]);
+        }
+    }
+
+    // Compute heights backwards and count the nodes with each height, nodes without children have height 0
+    std::vector<unsigned int> heights(tree.size(), 0);
+    for (unsigned int i = static_cast<unsigned int>(visit_order.size()); i-- > 0;)
+    {
+        const unsigned int node_index{ visit_order[i] };
+        const OptimizerNode& node{ tree[node_index] };
+        if (node.HasChildren())
+        {
+            const unsigned int height{ 1 + std::max(heights[node.children[0]], heights[node.children[1]]) };
+            heights[node_index] = height;
+            if (height_starts.size() < height + 1)
+            {
+                height_starts.resize(height + 1, 0);
+            }
+            height_starts[height]++;
+        }
+    }
+
+    // Sort the nodes by height, height_starts is offset by one such that nodes with height h + 1 are between
+    // entries h and h + 1
+    unsigned int offset{ 0 };
+    for (unsigned int& height_start : height_starts)
+    {
+        const unsigned int count{ height_start };
+        height_start = offset;
+        offset += count;
+    }
+    height_starts.erase(height_starts.begin());
+    height_starts.push_back(offset);
+    std::vector<unsigned int> sorted_nodes(offset);
+    std::vector<unsigned int> next_position(height_starts);
+    for (const unsigned int node_index : visit_order)
+    {
+        if (tree[node_index].HasChildren())
+        {
+            sorted_nodes[next_position[heights[node_index] - 1]++] = node_index;
+        }
+    }
+
+    return sorted_nodes;
+}
+
+unsigned int TreeletOptimizer::FlattenNode(unsigned int node_index, const std::vector<TriangleInfo>& triangle_info,
+                                           LinearBVHNode* nodes, unsigned int& node_offset,
+                                           std::vector<TriangleInfo>& ordered_triangle_info) const noexcept
+{
+    const OptimizerNode& node{ tree[node_index] };
+    const unsigned int flat_index{ node_offset++ };
+    LinearBVHNode& flat_node{ nodes[flat_index] };
+    flat_node.bounds = node.bounds;
+    if (node.collapsed)
+    {
+        flat_node.triangle_offset = static_cast<uint32_t>(ordered_triangle_info.size());
+        flat_node.num_triangles = static_cast<uint16_t>(node.num_triangles);
+        flat_node.split_axis = 3;
+        GatherTriangles(node_index, triangle_info, ordered_triangle_info);
+    }
+    else
+    {
+        flat_node.num_triangles = 0;
+        flat_node.split_axis = static_cast<uint8_t>(node.split_axis);
+        FlattenNode(node.children[0], triangle_info, nodes, node_offset, ordered_triangle_info);
+        flat_node.second_child_offset = FlattenNode(node.children[1], triangle_info, nodes, node_offset,
+                                                    ordered_triangle_info);
+    }
+
+    return flat_index;
+}
+
+void TreeletOptimizer::GatherTriangles(unsigned int node_index, const std::vector<TriangleInfo>& triangle_info,
+                                       std::vector<TriangleInfo>& ordered_triangle_info) const noexcept
+{
+    const OptimizerNode& node{ tree[node_index] };
+    if (!node.HasChildren())
+    {
+        ordered_triangle_info.push_back(triangle_info[node.triangle_offset]);
+    }
+    else
+    {
+        GatherTriangles(node.children[0], triangle_info, ordered_triangle_info);
+        GatherTriangles(node.children[1], triangle_info, ordered_triangle_info);
+    }
+}
+
+} // Rabbit namespace
@@ -0,0 +1,102 @@
+#ifndef RABBIT2_TREELET_OPTIMIZER_HPP
+#define RABBIT2_TREELET_OPTIMIZER_HPP
+
+#include "bvh.hpp"
+
+#include <chrono>
+
+namespace Rabbit
+{
+
+// Lower the SAH cost of a built tree by restructuring treelets (TRBVH). The leafs are first split down to single
+// triangles, then for each node a treelet is formed by expanding the children with the largest surface until it has
+// TREELET_LEAVES leafs. The topology of the treelet with the lowest cost is found over all the subsets of its leafs
+// and replaces the current one, subsets with few enough triangles can be collapsed in a single leaf. Nodes are
+// processed bottom up, the ones with the same height in parallel, and passes are repeated until the cost stops
+// improving or the time budget is used
+class TreeletOptimizer
+{
+public:
+    // Number of leafs of the restructured treelets, the search goes over all their subsets
+    static constexpr unsigned int TREELET_LEAVES{ 7 };
+
+    explicit TreeletOptimizer(const BVHConfig& config);
+
+    // Optimize tree whose leafs reference the triangle information, which is reordered to follow the new leafs.
+    // Returns the new nodes allocated with AllocateAligned, the given ones are not freed. If the optimized tree is
+    // too deep for the traversal stack, a copy of the given tree is returned and no pass is counted
+    LinearBVHNode* Optimize(const LinearBVHNode* nodes, unsigned int& total_nodes,
+                            std::vector<TriangleInfo>& triangle_info, float time_budget_ms);
+
+    // Number of passes over the tree done by the last optimization
+    unsigned int NumPasses() const noexcept
+    {
+        return num_passes;
+    }
+
+    // Peak of the memory allocated by the last optimization, without the triangle information
+    size_t PeakMemoryBytes() const noexcept
+    {
+        return peak_memory_bytes;
+    }
+
+private:
+    // Node of the tree while it is restructured, nodes without children hold a single triangle. The nodes that
+    // are cheaper as a leaf are collapsed but keep their children, which are used to find their triangles
+    struct OptimizerNode
+    {
+        static constexpr unsigned int NO_CHILD{ std::numeric_limits<unsigned int>::max() };
+
+        bool HasChildren() const noexcept
+        {
+            return children[0] != NO_CHILD;
+        }
+
+        Geometry::BBox bounds;
+        // SAH cost of the subtree, not divided by the surface of the root
+        float cost;
+        unsigned int children[2];
+        // Triangle of the nodes without children
+        unsigned int triangle_offset;
+        // Number of triangles in the subtree
+        unsigned int num_triangles;
+        unsigned int split_axis;
+        bool collapsed;
+    };
+
+    // Set cost of a node from the ones of its children, the node is collapsed if that is cheaper
+    void UpdateCost(OptimizerNode& node) const noexcept;
+
+    // Create the nodes for a range of triangles of a leaf of the input tree, the node at the given index is the root
+    void SplitLeaf(unsigned int node_index, unsigned int start, unsigned int end,
+                   const std::vector<TriangleInfo>& triangle_info);
+
+    // Restructure the treelet rooted at the given node if a topology with lower cost exists and update the cost of
+    // the node
+    void RestructureTreelet(unsigned int node_index) noexcept;
+
+    // Compute for each node with children its height, returns the nodes sorted by height
+    const std::vector<unsigned int> SortByHeight(std::vector<unsigned int>& height_starts) const;
+
+    // Copy subtree in depth first order with the triangles it references, returns the index of the node
+    unsigned int FlattenNode(unsigned int node_index, const std::vector<TriangleInfo>& triangle_info,
+                             LinearBVHNode* nodes, unsigned int& node_offset,
+                             std::vector<TriangleInfo>& ordered_triangle_info) const noexcept;
+
+    // Append the triangles under the given node
+    void GatherTriangles(unsigned int node_index, const std::vector<TriangleInfo>& triangle_info,
+                         std::vector<TriangleInfo>& ordered_triangle_info) const noexcept;
+
+    const BVHConfig configuration;
+    // Tree being restructured, the root is the first node
+    std::vector<OptimizerNode> tree;
+    // Time after which no more treelets are restructured
+    std::chrono::high_resolution_clock::time_point deadline;
+    // Statistics of the last optimization
+    unsigned int num_passes;
+    size_t peak_memory_bytes;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_TREELET_OPTIMIZER_HPP
@@ -0,0 +1,171 @@
+#ifndef RABBIT2_TRIANGLE_PACKET_HPP
+#define RABBIT2_TRIANGLE_PACKET_HPP
+
+#include "mesh/mesh.hpp"
+#include "utilities/simd.hpp"
+
+namespace Rabbit
+{
+
+// Width triangles stored in SoA form such that the watertight test runs on all of them at once. Unused lanes repeat a
+// triangle of the packet: degenerate triangles are not reliably rejected once the compiler contracts the edge
+// functions to fused multiply adds, while a repeated triangle can only report the same hit
+template <unsigned int Width>
+struct alignas(32) TrianglePacket
+{
+    // Store triangle in the given lane
+    void SetLane(unsigned int lane, const PrecomputedTriangle& triangle) noexcept
+    {
+        for (unsigned int axis = 0; axis != 3; axis++)
+        {
+            v0[axis][lane] = triangle.v0[axis];
+            v1[axis][lane] = triangle.v1[axis];
+            v2[axis][lane] = triangle.v2[axis];
+        }
+        triangle_index[lane] = triangle.triangle_index;
+    }
+
+    // Fill the packet with the given triangles, the lanes after the last one repeat the first triangle
+    void Fill(const PrecomputedTriangle* triangles, unsigned int num_triangles) noexcept
+    {
+        for (unsigned int lane = 0; lane != Width; lane++)
+        {
+            SetLane(lane, triangles[lane < num_triangles ? lane : 0]);
+        }
+    }
+
+    // Intersect ray with all the triangles, on hit moves the end of the interval to the closest hit, sets its
+    // barycentric coordinates and returns its lane, otherwise returns Width
+    unsigned int Intersect(const WatertightRay& ray, Geometry::Intervalf& interval,
+                           Geometry::Point3f& barycentric_coordinates) const noexcept;
+
+    // Check for intersection with any of the triangles
+    bool IntersectTest(const WatertightRay& ray, const Geometry::Intervalf& interval) const noexcept
+    {
+        SIMD::FloatVector<Width> e0, e1, e2, det, t_scaled;
+
+        return HitMask(ray, interval, e0, e1, e2, det, t_scaled) != 0;
+    }
+
+    // Vertices of the triangles, the first index is the axis and the second one the lane
+    float v0[3][Width];
+    float v1[3][Width];
+    float v2[3][Width];
+    // Index of the Triangle holding the shading data of each lane
+    uint32_t triangle_index[Width];
+
+private:
+    // Run the watertight test on all the lanes, returns the bitmask of the lanes hit inside the interval together
+    // with the edge functions, determinant and scaled distance needed to compute the hit
+    unsigned int HitMask(const WatertightRay& ray, const Geometry::Intervalf& interval,
+                         SIMD::FloatVector<Width>& e0, SIMD::FloatVector<Width>& e1, SIMD::FloatVector<Width>& e2,
+                         SIMD::FloatVector<Width>& det, SIMD::FloatVector<Width>& t_scaled) const noexcept;
+};
+
+template <unsigned int Width>
+inline unsigned int TrianglePacket<Width>::HitMask(const WatertightRay& ray, const Geometry::Intervalf& interval,
+                                                   SIMD::FloatVector<Width>& e0, SIMD::FloatVector<Width>& e1,
+                                                   SIMD::FloatVector<Width>& e2, SIMD::FloatVector<Width>& det,
+                                                   SIMD::FloatVector<Width>& t_scaled) const noexcept
+{
+    using Vector = SIMD::FloatVector<Width>;
+
+    // The permutation of the components only selects the rows of the packet
+    const Vector origin_x{ ray.origin[ray.kx] };
+    const Vector origin_y{ ray.origin[ray.ky] };
+    const Vector origin_z{ ray.origin[ray.kz] };
+    const Vector sx{ ray.sx };
+    const Vector sy{ ray.sy };
+    const Vector sz{ ray.sz };
+
+    // Translate vertices based on ray origin and apply shear transformation, same operations of IntersectTriangle
+    const Vector v0t_z{ Vector::Load(v0[ray.kz]) - origin_z };
+    const Vector v1t_z{ Vector::Load(v1[ray.kz]) - origin_z };
+    const Vector v2t_z{ Vector::Load(v2[ray.kz]) - origin_z };
+    const Vector v0t_x{ (Vector::Load(v0[ray.kx]) - origin_x) + sx * v0t_z };
+    const Vector v0t_y{ (Vector::Load(v0[ray.ky]) - origin_y) + sy * v0t_z };
+    const Vector v1t_x{ (Vector::Load(v1[ray.kx]) - origin_x) + sx * v1t_z };
+    const Vector v1t_y{ (Vector::Load(v1[ray.ky]) - origin_y) + sy * v1t_z };
+    const Vector v2t_x{ (Vector::Load(v2[ray.kx]) - origin_x) + sx * v2t_z };
+    const Vector v2t_y{ (Vector::Load(v2[ray.ky]) - origin_y) + sy * v2t_z };
+
+    // Compute edge function coefficients e0, e1, and e2
+    e0 = v1t_x * v2t_y - v1t_y * v2t_x;
+    e1 = v2t_x * v0t_y - v2t_y * v0t_x;
+    e2 = v0t_x * v1t_y - v0t_y * v1t_x;
+
+    // Perform triangle edge and determinant tests
+    const Vector zero{ 0.f };
+    const SIMD::MaskVector<Width> has_negative_edge{ (e0 < zero) | (e1 < zero) | (e2 < zero) };
+    const SIMD::MaskVector<Width> has_positive_edge{ (e0 > zero) | (e1 > zero) | (e2 > zero) };
+    det = e0 + e1 + e2;
+    SIMD::MaskVector<Width> valid{ AndNot(SIMD::MaskVector<Width>{ true }, det == zero) };
+    valid = AndNot(valid, has_negative_edge & has_positive_edge);
+    if (valid.Bits() == 0)
+    {
+        return 0;
+    }
+
+    // Compute scaled hit distance to triangle and test against ray range
+    t_scaled = e0 * (v0t_z * sz) + e1 * (v1t_z * sz) + e2 * (v2t_z * sz);
+    const Vector end_det{ Vector{ interval.End() } * det };
+    const Vector start_det{ Vector{ interval.Start() } * det };
+    const SIMD::MaskVector<Width> negative_det_outside{
+        (det < zero) & ((t_scaled >= zero) | (t_scaled < end_det) | (t_scaled > start_det)) };
+    const SIMD::MaskVector<Width> positive_det_outside{
+        (det > zero) & ((t_scaled <= zero) | (t_scaled > end_det) | (t_scaled < start_det)) };
+    valid = AndNot(AndNot(valid, negative_det_outside), positive_det_outside);
+
+    return valid.Bits();
+}
+
+template <unsigned int Width>
+inline unsigned int TrianglePacket<Width>::Intersect(const WatertightRay& ray, Geometry::Intervalf& interval,
+                                                     Geometry::Point3f& barycentric_coordinates) const noexcept
+{
+    SIMD::FloatVector<Width> e0, e1, e2, det, t_scaled;
+    unsigned int hit_mask{ HitMask(ray, interval, e0, e1, e2, det, t_scaled) };
+    if (hit_mask == 0)
+    {
+        return Width;
+    }
+
+    alignas(32) float e0_lanes[Width], e1_lanes[Width], e2_lanes[Width], det_lanes[Width], t_scaled_lanes[Width];
+    e0.Store(e0_lanes);
+    e1.Store(e1_lanes);
+    e2.Store(e2_lanes);
+    det.Store(det_lanes);
+    t_scaled.Store(t_scaled_lanes);
+
+    // Select closest hit, on ties the last lane wins as it would when testing the triangles one after the other
+    unsigned int closest_lane{ 0 };
+    float closest_t{ std::numeric_limits<float>::max() };
+    while (hit_mask != 0)
+    {
+        const unsigned int lane{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+        hit_mask &= hit_mask - 1;
+
+        const float t{ t_scaled_lanes[lane] * (1.f / det_lanes[lane]) };
+        if (t <= closest_t)
+        {
+            closest_t = t;
+            closest_lane = lane;
+        }
+    }
+
+    // Compute barycentric coordinates for the closest hit
+    const float inv_det{ 1.f / det_lanes[closest_lane] };
+    barycentric_coordinates = Geometry::Point3f{ e0_lanes[closest_lane] * inv_det,
+                                                 e1_lanes[closest_lane] * inv_det,
+                                                 e2_lanes[closest_lane] * inv_det };
+    interval.SetEnd(closest_t);
+
+    return closest_lane;
+}
+
+using TrianglePacket4 = TrianglePacket<4>;
+using TrianglePacket8 = TrianglePacket<8>;
+
+} // Rabbit namespace
+
+#endif //RABBIT2_TRIANGLE_PACKET_HPP
@@ -0,0 +1,280 @@
+#include "wide_bvh.hpp"
+#include "utilities/memory.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Rabbit
+{
+
+template <unsigned int Width>
+WideBVH<Width>::TraversalRay::TraversalRay(const Geometry::Ray& ray) noexcept
+{
+    const Geometry::Vector3f reciprocal_dir{ ray.ReciprocalDirection() };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        origin[axis] = SIMD::FloatVector<Width>{ ray.Origin()[axis] };
+        reciprocal_direction[axis] = SIMD::FloatVector<Width>{ reciprocal_dir[axis] };
+        // For negative directions the ray enters from the maximum plane
+        near_plane[axis] = reciprocal_dir[axis] < 0.f ? axis + 3 : axis;
+        far_plane[axis] = reciprocal_dir[axis] < 0.f ? axis : axis + 3;
+    }
+}
+
+template <unsigned int Width>
+WideBVH<Width>::WideBVH(const BVH& bvh)
+    : bvh{ bvh }, total_nodes{ 0 }, nodes{ nullptr }
+{
+    // Each wide node replaces at least one binary interior node, the root can also be a single leaf
+    const unsigned int max_nodes{ bvh.NumNodes() / 2 + 1 };
+    WideBVHNode<Width>* scratch_nodes{ AllocateAligned<WideBVHNode<Width>>(max_nodes) };
+
+    // Collapse binary tree starting from the root
+    total_nodes = 1;
+    const unsigned int depth{ CollapseNode(bvh.Nodes(), 0, 0, scratch_nodes) };
+    assert(total_nodes <= max_nodes);
+
+    // The stack holds the root plus at most Width - 1 entries for each level traversed
+    if (depth * (Width - 1) + 1 > WIDE_BVH_STACK_SIZE)
+    {
+        FreeAligned(scratch_nodes);
+        throw std::runtime_error("Wide BVH is too deep for the traversal stack\n");
+    }
+
+    // Copy nodes to an array of the right size
+    nodes = AllocateAligned<WideBVHNode<Width>>(total_nodes);
+    std::memcpy(nodes, scratch_nodes, total_nodes * sizeof(WideBVHNode<Width>));
+    FreeAligned(scratch_nodes);
+}
+
+template <unsigned int Width>
+WideBVH<Width>::~WideBVH() noexcept
+{
+    FreeAligned(nodes);
+}
+
+template <unsigned int Width>
+bool WideBVH<Width>::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                               Geometry::TriangleIntersection& intersection) const noexcept
+{
+    // Entry on the traversal stack, with the distance at which the ray enters the child
+    struct StackEntry
+    {
+        uint32_t index;
+        uint32_t num_triangles;
+        float t;
+    };
+
+    const TraversalRay traversal_ray{ ray };
+    const WatertightRay watertight_ray{ ray };
+    alignas(32) float children_t[Width];
+    StackEntry stack[WIDE_BVH_STACK_SIZE];
+    unsigned int to_visit_offset{ 0 };
+    stack[to_visit_offset++] = StackEntry{ 0, 0, interval.Start() };
+
+    while (to_visit_offset != 0)
+    {
+        const StackEntry entry{ stack[--to_visit_offset] };
+        // Skip children that start after the closest hit found so far
+        if (entry.t > interval.End())
+        {
+            continue;
+        }
+
+        // Intersect triangles in leaf
+        if (entry.num_triangles != 0)
+        {
+            bvh.IntersectLeaf(watertight_ray, entry.index, entry.num_triangles, interval, intersection);
+            continue;
+        }
+
+        // Test all children and collect the ones we hit
+        const WideBVHNode<Width>& node{ nodes[entry.index] };
+        unsigned int hit_mask{ IntersectChildren(node, traversal_ray, interval, children_t) };
+        StackEntry hit_children[Width];
+        unsigned int num_hit_children{ 0 };
+        while (hit_mask != 0)
+        {
+            const unsigned int child{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+            hit_mask &= hit_mask - 1;
+
+            // Insertion sort by decreasing distance, such that the closest child is pushed last
+            const StackEntry child_entry{ node.children[child], node.num_triangles[child], children_t[child] };
+            unsigned int position{ num_hit_children++ };
+            while (position > 0 && hit_children[position - 1].t < child_entry.t)
+            {
+                hit_children[position] = hit_children[position - 1];
+                position--;
+            }
+            hit_children[position] = child_entry;
+        }
+
+        assert(to_visit_offset + num_hit_children <= WIDE_BVH_STACK_SIZE);
+        for (unsigned int i = 0; i != num_hit_children; i++)
+        {
+            stack[to_visit_offset++] = hit_children[i];
+        }
+    }
+
+    // If we did hit something, fill the intersection and return true
+    if (intersection.IsValid())
+    {
+        intersection.hit_triangle->ComputeIntersectionGeometry(ray, interval.End(), intersection);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+template <unsigned int Width>
+bool WideBVH<Width>::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
+{
+    const TraversalRay traversal_ray{ ray };
+    const WatertightRay watertight_ray{ ray };
+    alignas(32) float children_t[Width];
+    unsigned int nodes_to_visit[WIDE_BVH_STACK_SIZE];
+    unsigned int to_visit_offset{ 0 };
+    nodes_to_visit[to_visit_offset++] = 0;
+
+    while (to_visit_offset != 0)
+    {
+        const WideBVHNode<Width>& node{ nodes[nodes_to_visit[--to_visit_offset]] };
+        unsigned int hit_mask{ IntersectChildren(node, traversal_ray, interval, children_t) };
+        while (hit_mask != 0)
+        {
+            const unsigned int child{ static_cast<unsigned int>(__builtin_ctz(hit_mask)) };
+            hit_mask &= hit_mask - 1;
+
+            if (node.num_triangles[child] != 0)
+            {
+                if (bvh.IntersectLeafTest(watertight_ray, node.children[child], node.num_triangles[child], interval))
+                {
+                    // As soon as we hit something, return true
+                    return true;
+                }
+            }
+            else
+            {
+                assert(to_visit_offset < WIDE_BVH_STACK_SIZE);
+                nodes_to_visit[to_visit_offset++] = node.children[child];
+            }
+        }
+    }
+
+    // If we get here in this case, we did not hit anything
+    return false;
+}
+
+template <unsigned int Width>
+unsigned int WideBVH<Width>::IntersectChildren(const WideBVHNode<Width>& node, const TraversalRay& traversal_ray,
+                                               const Geometry::Intervalf& interval,
+                                               float* children_t) const noexcept
+{
+    using FloatVector = SIMD::FloatVector<Width>;
+
+    // Slab test for all the children at once, selecting near and far planes based on the ray direction
+    FloatVector t_near{ interval.Start() };
+    FloatVector t_far{ interval.End() };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        const FloatVector near_plane{ FloatVector::Load(node.bounds[traversal_ray.near_plane[axis]]) };
+        const FloatVector far_plane{ FloatVector::Load(node.bounds[traversal_ray.far_plane[axis]]) };
+        t_near = Max(t_near, (near_plane - traversal_ray.origin[axis]) * traversal_ray.reciprocal_direction[axis]);
+        t_far = Min(t_far, (far_plane - traversal_ray.origin[axis]) * traversal_ray.reciprocal_direction[axis]);
+    }
+
+    t_near.Store(children_t);
+    return (t_near <= t_far).Bits();
+}
+
+template <unsigned int Width>
+unsigned int WideBVH<Width>::CollapseNode(const LinearBVHNode* binary_nodes, unsigned int binary_node_index,
+                                          unsigned int node_index, WideBVHNode<Width>* scratch_nodes) noexcept
+{
+    // Start from the children of the binary node, or from the node itself if the root is a leaf
+    unsigned int binary_children[Width];
+    unsigned int num_children{ 0 };
+    const LinearBVHNode& binary_node{ binary_nodes[binary_node_index] };
+    if (binary_node.num_triangles != 0)
+    {
+        binary_children[num_children++] = binary_node_index;
+    }
+    else
+    {
+        binary_children[num_children++] = bvh.FirstChildIndex(binary_node_index, binary_node);
+        binary_children[num_children++] = binary_node.second_child_offset;
+    }
+
+    // Open the interior child with the largest surface until we have Width children
+    while (num_children < Width)
+    {
+        unsigned int largest_child{ Width };
+        float largest_surface{ -1.f };
+        for (unsigned int i = 0; i != num_children; i++)
+        {
+            const LinearBVHNode& child{ binary_nodes[binary_children[i]] };
+            if (child.num_triangles == 0 && child.bounds.Surface() > largest_surface)
+            {
+                largest_child = i;
+                largest_surface = child.bounds.Surface();
+            }
+        }
+        if (largest_child == Width)
+        {
+            break;
+        }
+
+        const unsigned int opened_node_index{ binary_children[largest_child] };
+        binary_children[largest_child] = bvh.FirstChildIndex(opened_node_index, binary_nodes[opened_node_index]);
+        binary_children[num_children++] = binary_nodes[opened_node_index].second_child_offset;
+    }
+
+    // Fill node, interior children get a new node
+    WideBVHNode<Width>& node{ scratch_nodes[node_index] };
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        if (i < num_children)
+        {
+            const LinearBVHNode& child{ binary_nodes[binary_children[i]] };
+            for (unsigned int axis = 0; axis != 3; axis++)
+            {
+                node.bounds[axis][i] = child.bounds.PMin()[axis];
+                node.bounds[axis + 3][i] = child.bounds.PMax()[axis];
+            }
+            node.num_triangles[i] = child.num_triangles;
+            node.children[i] = child.num_triangles != 0 ? child.triangle_offset : total_nodes++;
+        }
+        else
+        {
+            for (unsigned int axis = 0; axis != 3; axis++)
+            {
+                node.bounds[axis][i] = std::numeric_limits<float>::infinity();
+                node.bounds[axis + 3][i] = -std::numeric_limits<float>::infinity();
+            }
+            node.num_triangles[i] = 0;
+            node.children[i] = WideBVHNode<Width>::EMPTY_CHILD;
+        }
+    }
+
+    // Collapse interior children
+    unsigned int children_depth{ 0 };
+    for (unsigned int i = 0; i != num_children; i++)
+    {
+        if (node.num_triangles[i] == 0)
+        {
+            children_depth = std::max(children_depth, CollapseNode(binary_nodes, binary_children[i],
+                                                                   node.children[i], scratch_nodes));
+        }
+    }
+
+    return children_depth + 1;
+}
+
+// Explicit instantiation for the supported widths
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+} // Rabbit namespace
@@ -0,0 +1,100 @@
+#ifndef RABBIT2_WIDE_BVH_HPP
+#define RABBIT2_WIDE_BVH_HPP
+
+#include "bvh.hpp"
+#include "utilities/simd.hpp"
+
+namespace Rabbit
+{
+
+// Size of the traversal stack, each level of the tree pushes at most Width - 1 entries. Building a tree deeper than
+// the stack can hold throws, so traversal never needs to check it
+constexpr unsigned int WIDE_BVH_STACK_SIZE{ 256 };
+
+// Node of a wide BVH, the bounds of the children are stored in SoA form such that they can be tested in one go
+template <unsigned int Width>
+struct alignas(32) WideBVHNode
+{
+    static constexpr uint32_t EMPTY_CHILD{ std::numeric_limits<uint32_t>::max() };
+
+    // Bounds of the children, indices 0 to 2 are the minimum x, y, z and 3 to 5 the maximum x, y, z. Empty children
+    // have inverted bounds so that they are never hit
+    alignas(32) float bounds[6][Width];
+    // Child index for interior children, first triangle for leafs and EMPTY_CHILD for empty slots
+    uint32_t children[Width];
+    // Number of triangles for leaf children, 0 for interior children
+    uint16_t num_triangles[Width];
+};
+
+// BVH with Width children per node, built by collapsing a binary BVH. Traversal tests all the children of a node at
+// once and visits them front to back
+template <unsigned int Width>
+class WideBVH
+{
+public:
+    // Build from binary BVH, the leafs are tested by the BVH which needs to outlive this one. Throws if the collapsed
+    // tree is too deep for the traversal stack
+    explicit WideBVH(const BVH& bvh);
+
+    // Disable copy
+    WideBVH(const WideBVH& other) = delete;
+
+    WideBVH& operator=(const WideBVH& rhs) = delete;
+
+    ~WideBVH() noexcept;
+
+    // Intersect Ray with BVH
+    bool Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                   Geometry::TriangleIntersection& intersection) const noexcept;
+
+    // Check for intersection
+    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
+
+    // Number of nodes in the tree
+    unsigned int NumNodes() const noexcept
+    {
+        return total_nodes;
+    }
+
+    // Access nodes of the tree, the root is the first one
+    const WideBVHNode<Width>* Nodes() const noexcept
+    {
+        return nodes;
+    }
+
+private:
+    // Ray data needed to test a node
+    struct TraversalRay
+    {
+        explicit TraversalRay(const Geometry::Ray& ray) noexcept;
+
+        // Ray origin and reciprocal direction broadcasted over the lanes
+        SIMD::FloatVector<Width> origin[3];
+        SIMD::FloatVector<Width> reciprocal_direction[3];
+        // Index in the bounds of the near and far planes for each axis
+        unsigned int near_plane[3];
+        unsigned int far_plane[3];
+    };
+
+    // Test ray against the children of a node, returns the mask of the hit children and their entry distances
+    unsigned int IntersectChildren(const WideBVHNode<Width>& node, const TraversalRay& traversal_ray,
+                                   const Geometry::Intervalf& interval, float* children_t) const noexcept;
+
+    // Collapse binary subtree rooted at binary_node_index into the node at the given index, returns the depth of the
+    // collapsed subtree
+    unsigned int CollapseNode(const LinearBVHNode* binary_nodes, unsigned int binary_node_index,
+                              unsigned int node_index, WideBVHNode<Width>* scratch_nodes) noexcept;
+
+    // Binary BVH, the leafs reference its triangles
+    const BVH& bvh;
+    // Nodes of the tree, the root is the first one
+    unsigned int total_nodes;
+    WideBVHNode<Width>* nodes;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+} // Rabbit namespace
+
+#endif //RABBIT2_WIDE_BVH_HPP
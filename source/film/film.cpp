@@ -7,6 +7,7 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <sstream>
 
@@ -14,7 +15,7 @@ namespace Rabbit
 {
 
 Film::Film(unsigned int width, unsigned int height)
-    : width{ width }, height{ height }, raster{ width * height }
+    : width{ width }, height{ height }, raster{ width * height }, statistics{ width * height }
 {}
 
 const Spectrumf& Film::operator()(unsigned int pixel_x, unsigned int pixel_y) const noexcept
@@ -29,6 +30,37 @@ Spectrumf& Film::operator()(unsigned int pixel_x, unsigned int pixel_y) noexcept
     return raster[pixel_y * Width() + pixel_x];
 }
 
+void Film::AddSamples(unsigned int pixel_x, unsigned int pixel_y, const Spectrumf& radiance_sum,
+                      const PixelStatistics& samples_statistics) noexcept
+{
+    assert(pixel_y < Height() && pixel_x < Width());
+    const unsigned int pixel_index{ pixel_y * Width() + pixel_x };
+    PixelStatistics& pixel_statistics{ statistics[pixel_index] };
+    const unsigned int total_samples{ pixel_statistics.num_samples + samples_statistics.num_samples };
+    if (total_samples == 0)
+    {
+        return;
+    }
+
+    // Update mean radiance
+    Spectrumf& pixel{ raster[pixel_index] };
+    pixel = (static_cast<float>(pixel_statistics.num_samples) / total_samples) * pixel;
+    pixel += radiance_sum / static_cast<float>(total_samples);
+    pixel_statistics.Merge(samples_statistics);
+}
+
+const PixelStatistics& Film::Statistics(unsigned int pixel_x, unsigned int pixel_y) const noexcept
+{
+    assert(pixel_y < Height() && pixel_x < Width());
+    return statistics[pixel_y * Width() + pixel_x];
+}
+
+void Film::Clear() noexcept
+{
+    std::fill(raster.begin(), raster.end(), Spectrumf{ 0.f });
+    std::fill(statistics.begin(), statistics.end(), PixelStatistics{});
+}
+
 void Film::WritePNG(const std::string& filename) const
 {
     std::vector<unsigned char> uchar_raster(Width() * Height() * 3, 0);
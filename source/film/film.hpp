@@ -9,10 +9,59 @@
 
 #include <vector>
 #include <string>
+#include <limits>
 
 namespace Rabbit
 {
 
+// Running statistics of the intensity of the samples of a pixel, used to estimate the error of its value
+struct PixelStatistics
+{
+    PixelStatistics() noexcept
+        : num_samples{ 0 }, mean_intensity{ 0.f }, m2_intensity{ 0.f }
+    {}
+
+    // Add sample with the given intensity
+    void Add(float intensity) noexcept
+    {
+        num_samples++;
+        const float delta{ intensity - mean_intensity };
+        mean_intensity += delta / num_samples;
+        m2_intensity += delta * (intensity - mean_intensity);
+    }
+
+    // Merge with the statistics of another set of samples
+    void Merge(const PixelStatistics& other) noexcept
+    {
+        if (other.num_samples == 0)
+        {
+            return;
+        }
+        const unsigned int total_samples{ num_samples + other.num_samples };
+        const float delta{ other.mean_intensity - mean_intensity };
+        const float other_weight{ static_cast<float>(other.num_samples) / total_samples };
+        mean_intensity += delta * other_weight;
+        m2_intensity += other.m2_intensity + delta * delta * num_samples * other_weight;
+        num_samples = total_samples;
+    }
+
+    // Variance of the intensity of the samples
+    float Variance() const noexcept
+    {
+        return num_samples > 1 ? m2_intensity / (num_samples - 1) : 0.f;
+    }
+
+    // Estimated variance of the pixel value, infinite until the pixel has two samples
+    float MeanVariance() const noexcept
+    {
+        return num_samples > 1 ? Variance() / num_samples : std::numeric_limits<float>::infinity();
+    }
+
+    unsigned int num_samples;
+    float mean_intensity;
+    float m2_intensity;
+};
+
 // Film storage class, pixel (0, 0) is bottom left
 class Film
 {
@@ -24,6 +73,17 @@ public:
 
     Spectrumf& operator()(unsigned int pixel_x, unsigned int pixel_y) noexcept;
 
+    // Add samples to the pixel given the sum of their radiance and their statistics, the pixel keeps the mean of all
+    // the samples added since the last Clear
+    void AddSamples(unsigned int pixel_x, unsigned int pixel_y, const Spectrumf& radiance_sum,
+                    const PixelStatistics& samples_statistics) noexcept;
+
+    // Statistics of the samples added to the pixel
+    const PixelStatistics& Statistics(unsigned int pixel_x, unsigned int pixel_y) const noexcept;
+
+    // Reset pixels and statistics
+    void Clear() noexcept;
+
     // Get size of the film
     unsigned int Width() const noexcept
     {
@@ -42,6 +102,7 @@ private:
     const unsigned int width;
     const unsigned int height;
     std::vector<Spectrumf> raster;
+    std::vector<PixelStatistics> statistics;
 };
 
 } // Rabbit namespace
@@ -11,8 +11,9 @@
 namespace Rabbit
 {
 
-// Forward declare triangle class
+// Forward declare triangle and material classes
 class Triangle;
+class MaterialInterface;
 
 namespace Geometry
 {
@@ -20,7 +21,7 @@ namespace Geometry
 struct TriangleIntersection
 {
     TriangleIntersection() noexcept
-        : hit_triangle{ nullptr }
+        : material{ nullptr }, hit_triangle{ nullptr }
     {}
 
     // Check if intersection represents and hit
@@ -44,6 +45,8 @@ struct TriangleIntersection
     Vector2f uv;
     // Barycentric coordinates
     Point3f barycentric_coordinates;
+    // Material at the hit point, the one of the triangle or the one bound to the instance that was hit
+    const MaterialInterface* material;
     // Pointer to triangle that generated the intersection
     const Triangle* hit_triangle;
 };
@@ -0,0 +1,57 @@
+#ifndef RABBIT2_MORTON_HPP
+#define RABBIT2_MORTON_HPP
+
+#include "geometry.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Rabbit
+{
+namespace Geometry
+{
+
+// Spread the lower 10 bits of the value such that there are two zero bits between each of them
+constexpr uint32_t ExpandBits(uint32_t v) noexcept
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+
+    return v;
+}
+
+// Spread the lower 21 bits of the value such that there are two zero bits between each of them
+constexpr uint64_t ExpandBits(uint64_t v) noexcept
+{
+    v = (v | v << 32u) & 0x001F00000000FFFFull;
+    v = (v | v << 16u) & 0x001F0000FF0000FFull;
+    v = (v | v << 8u) & 0x100F00F00F00F00Full;
+    v = (v | v << 4u) & 0x10C30C30C30C30C3ull;
+    v = (v | v << 2u) & 0x1249249249249249ull;
+
+    return v;
+}
+
+// Compute Morton code of a point with coordinates in [0, 1], the x coordinate takes the lowest bit of each triplet
+template <typename MortonCode>
+MortonCode EncodeMorton(const Vector3f& p, unsigned int bits_per_axis) noexcept
+{
+    const float scale{ static_cast<float>(1u << bits_per_axis) };
+    const MortonCode max_coordinate{ (MortonCode{ 1 } << bits_per_axis) - 1 };
+    MortonCode code{ 0 };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        const MortonCode coordinate{ std::min(static_cast<MortonCode>(std::max(p[axis] * scale, 0.f)),
+                                              max_coordinate) };
+        code |= ExpandBits(coordinate) << axis;
+    }
+
+    return code;
+}
+
+} // Geometry namespace
+} // Rabbit namespace
+
+#endif //RABBIT2_MORTON_HPP
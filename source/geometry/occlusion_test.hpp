@@ -34,6 +34,17 @@ public:
         return scene.IntersectTest(occlusion_ray, occlusion_interval);
     }
 
+    // Access ray and interval of the test, used to trace the tests in bulk
+    const Geometry::Ray& Ray() const noexcept
+    {
+        return occlusion_ray;
+    }
+
+    const Geometry::Intervalf& Interval() const noexcept
+    {
+        return occlusion_interval;
+    }
+
 private:
     // Ray for test and interval
     Geometry::Ray occlusion_ray;
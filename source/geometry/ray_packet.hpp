@@ -0,0 +1,37 @@
+#ifndef RABBIT2_RAY_PACKET_HPP
+#define RABBIT2_RAY_PACKET_HPP
+
+#include "intersection.hpp"
+#include "interval.hpp"
+
+#include <algorithm>
+
+namespace Rabbit
+{
+namespace Geometry
+{
+
+// Group of rays traced together, each ray has its own interval and intersection
+template <unsigned int Size>
+struct RayPacket
+{
+    static constexpr unsigned int SIZE{ Size };
+
+    // Intervals start as the default one for all the rays
+    RayPacket() noexcept
+    {
+        std::fill(intervals, intervals + Size, Ray::DefaultInterval());
+    }
+
+    Ray rays[Size];
+    Intervalf intervals[Size];
+    TriangleIntersection intersections[Size];
+};
+
+using RayPacket8 = RayPacket<8>;
+using RayPacket16 = RayPacket<16>;
+
+} // Geometry namespace
+} // Rabbit namespace
+
+#endif //RABBIT2_RAY_PACKET_HPP
@@ -47,6 +47,12 @@ public:
         return world_to_local.TransformNormal(n);
     }
 
+    // Access local to world matrix
+    const Matrixf& LocalToWorld() const noexcept
+    {
+        return local_to_world;
+    }
+
     // Compose transformation
     const Transform operator*(const Transform& other) const noexcept
     {
@@ -19,9 +19,9 @@ const Spectrumf DirectLightIntegrator::IncomingRadiance(const Geometry::Ray& ray
     if (scene.Intersect(ray, interval, intersection))
     {
         // Add emission from intersection, if any
-        if (intersection.hit_triangle->material->IsEmitting())
+        if (intersection.material->IsEmitting())
         {
-            L += intersection.hit_triangle->material->Le(intersection, intersection.wo);
+            L += intersection.material->Le(intersection, intersection.wo);
         }
 
         // Add contribution from direct illumination
@@ -6,57 +6,297 @@
 #include "sampling/sampler.hpp"
 #include "light/light.hpp"
 
-#include <thread>
 #include <atomic>
 #include <iostream>
+#include <condition_variable>
+#include <cmath>
+#include <algorithm>
 
 namespace Rabbit
 {
 
 ImageIntegrator::ImageIntegrator(std::unique_ptr<const RayIntegratorInterface> ray_integrator,
-                                 const Geometry::Point2ui& tile_size, unsigned int spp) noexcept
-    : ray_integrator{ std::move(ray_integrator) }, tile_size{ tile_size }, samples_per_pixel{ spp }
+                                 const Geometry::Point2ui& tile_size, unsigned int spp,
+                                 ThreadPool& thread_pool) noexcept
+    : ray_integrator{ std::move(ray_integrator) }, tile_size{ tile_size }, samples_per_pixel{ spp },
+      thread_pool{ thread_pool }
 {}
 
-void ImageIntegrator::RenderImage(const Scene& scene, const CameraInterface& camera, Film& film) const noexcept
+const RenderStatistics ImageIntegrator::RenderImage(const Scene& scene, const CameraInterface& camera,
+                                                   Film& film) const
 {
-    // Generate tiles
+    std::vector<float> frame_done_ms;
+
+    return RenderFrames(scene, std::vector<BatchFrame>{ BatchFrame{ camera, film } }, frame_done_ms);
+}
+
+const BatchStatistics ImageIntegrator::RenderBatch(const Scene& scene, const std::vector<BatchFrame>& frames,
+                                                   BatchMode mode) const
+{
+    BatchStatistics statistics;
+    if (mode == BatchMode::INTERLEAVED)
+    {
+        statistics.render_statistics = RenderFrames(scene, frames, statistics.frame_time_ms);
+        statistics.total_time_ms = statistics.render_statistics.render_time_ms;
+    }
+    else
+    {
+        std::vector<float> frame_done_ms;
+        for (const BatchFrame& frame : frames)
+        {
+            const RenderStatistics frame_statistics{ RenderFrames(scene, std::vector<BatchFrame>{ frame },
+                                                                  frame_done_ms) };
+            statistics.frame_time_ms.push_back(frame_statistics.render_time_ms);
+            statistics.total_time_ms += frame_statistics.render_time_ms;
+            // Accumulate the statistics of the threads over the frames
+            statistics.render_statistics.render_time_ms += frame_statistics.render_time_ms;
+            statistics.render_statistics.thread_idle_time_ms.resize(
+                std::max(statistics.render_statistics.thread_idle_time_ms.size(),
+                         frame_statistics.thread_idle_time_ms.size()), 0.f);
+            for (unsigned int thread = 0; thread != frame_statistics.thread_idle_time_ms.size(); thread++)
+            {
+                statistics.render_statistics.thread_idle_time_ms[thread] +=
+                    frame_statistics.thread_idle_time_ms[thread];
+            }
+            statistics.render_statistics.num_steals += frame_statistics.num_steals;
+            statistics.render_statistics.num_splits += frame_statistics.num_splits;
+        }
+    }
+
+    return statistics;
+}
+
+const RenderStatistics ImageIntegrator::RenderFrames(const Scene& scene, const std::vector<BatchFrame>& frames,
+                                                     std::vector<float>& frame_done_ms) const
+{
+    const auto render_start{ std::chrono::high_resolution_clock::now() };
+    const auto elapsed_ms = [&render_start]() -> float
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                        render_start).count();
+    };
+
+    // Generate the tiles of each frame. The frames are stacked vertically such that a single scheduler can distribute
+    // and split their tiles, frame_start_y holds the first row of each frame
+    std::vector<Tile> tiles;
+    std::vector<unsigned int> frame_start_y;
+    std::vector<unsigned int> frame_pixels_left;
+    unsigned int num_pixels{ 0 };
+    for (const BatchFrame& frame : frames)
+    {
+        const unsigned int start_y{ frame_start_y.empty() ? 0 :
+                                    frame_start_y.back() + frames[frame_start_y.size() - 1].film.Height() };
+        for (Tile tile : GenerateTiles(frame.film.Width(), frame.film.Height()))
+        {
+            tile.tile_start.y += start_y;
+            tile.tile_end.y += start_y;
+            tiles.push_back(tile);
+        }
+        frame_start_y.push_back(start_y);
+        frame_pixels_left.push_back(frame.film.Width() * frame.film.Height());
+        num_pixels += frame.film.Width() * frame.film.Height();
+    }
+    frame_done_ms.assign(frames.size(), 0.f);
+    std::mutex frame_done_mutex;
+
+    // The calling thread renders together with the threads of the pool
+#ifdef NDEBUG
+    const unsigned int num_threads{ std::max(1u, std::min(thread_pool.NumThreads() + 1,
+                                                          static_cast<unsigned int>(tiles.size()))) };
+#else
+    const unsigned int num_threads{ 1 };
+#endif
+
+    // Scheduler distributing the tiles between threads, tiles are split down to a quarter of their size
+    TileScheduler scheduler{ tiles, num_threads, Geometry::Point2ui{ std::max(1u, tile_size.x / 4),
+                                                                     std::max(1u, tile_size.y / 4) } };
+    // Number of pixels done and last percentage printed, the thread finishing a tile updates the progress
+    std::atomic_uint pixels_done{ 0 };
+    std::atomic_uint last_percentage_printed{ 0 };
+    // Time each thread spent rendering
+    std::vector<float> thread_busy_time_ms(num_threads, 0.f);
+
+    const auto render_tiles = [this, &scene, &frames, &frame_start_y, &frame_pixels_left, &frame_done_ms,
+                               &frame_done_mutex, &elapsed_ms, &scheduler, num_pixels, &pixels_done,
+                               &last_percentage_printed, &thread_busy_time_ms](unsigned int thread_id) -> void
+    {
+        // Random number generator
+        Sampling::Sampler sampler{ thread_id };
+
+        // Compute samples per dimension after rounding to perfect square
+        const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(samples_per_pixel))) };
+        const unsigned int spp{ spp_dim * spp_dim };
+        std::vector<Geometry::Point2f> pixel_samples(spp);
+        const float inv_num_samples{ 1.f / spp };
+
+        // Get next tile to render
+        Tile current_tile{ Geometry::Point2ui{}, Geometry::Point2ui{} };
+        while (scheduler.Next(thread_id, current_tile))
+        {
+            const auto tile_start{ std::chrono::high_resolution_clock::now() };
+
+            // Find the frame of the tile
+            const unsigned int frame_index{ static_cast<unsigned int>(
+                std::upper_bound(frame_start_y.begin(), frame_start_y.end(), current_tile.tile_start.y) -
+                frame_start_y.begin() - 1) };
+            const CameraInterface& camera{ frames[frame_index].camera };
+            Film& film{ frames[frame_index].film };
+            const unsigned int start_y{ frame_start_y[frame_index] };
+
+            // Loop over tile domain
+            for (unsigned int pixel_y = current_tile.tile_start.y - start_y;
+                 pixel_y != current_tile.tile_end.y - start_y; pixel_y++)
+            {
+                for (unsigned int pixel_x = current_tile.tile_start.x; pixel_x != current_tile.tile_end.x; pixel_x++)
+                {
+                    // Generate stratified samples for pixel
+                    sampler.StratifiedSamples(pixel_samples, spp_dim);
+
+                    // Compute pixel radiance
+                    Spectrumf pixel_radiance{ 0.f };
+                    for (const Geometry::Point2f& sample : pixel_samples)
+                    {
+                        // Generate ray
+                        Geometry::Intervalf ray_interval{ Geometry::Ray::DefaultInterval() };
+                        const Geometry::Ray ray{ camera.GenerateRayWorldSpace(
+                            Geometry::Point2ui{ pixel_x, pixel_y }, sample) };
+
+                        // Compute incoming radiance
+                        pixel_radiance += ray_integrator->IncomingRadiance(ray, ray_interval, scene, sampler, 0);
+                    }
+
+                    // Set pixel radiance in film
+                    film(pixel_x, pixel_y) = inv_num_samples * pixel_radiance;
+                }
+            }
+            thread_busy_time_ms[thread_id] += std::chrono::duration<float, std::milli>(
+                std::chrono::high_resolution_clock::now() - tile_start).count();
+
+            // Record when the last tile of the frame is done
+            const unsigned int tile_pixels{ (current_tile.tile_end.x - current_tile.tile_start.x) *
+                                            (current_tile.tile_end.y - current_tile.tile_start.y) };
+            {
+                std::lock_guard<std::mutex> frame_done_lock{ frame_done_mutex };
+                frame_pixels_left[frame_index] -= tile_pixels;
+                if (frame_pixels_left[frame_index] == 0)
+                {
+                    frame_done_ms[frame_index] = elapsed_ms();
+                }
+            }
+
+            // Print progress if the percentage changed since the last print
+            const unsigned int percentage{ static_cast<unsigned int>(
+                (100ull * (pixels_done += tile_pixels)) / num_pixels) };
+            unsigned int last_percentage{ last_percentage_printed };
+            while (percentage > last_percentage &&
+                   !last_percentage_printed.compare_exchange_weak(last_percentage, percentage))
+            {}
+            if (percentage > last_percentage)
+            {
+                std::cout << "Done " << percentage << "% of the pixels" << (percentage == 100 ? "\n" : "\r");
+                std::cout.flush();
+            }
+        }
+    };
+
+    // Submit the other threads to the pool, render on the calling thread and wait for the others to complete
+    std::vector<std::future<void>> threads;
+    threads.reserve(num_threads - 1);
+    for (unsigned int thread_id = 1; thread_id < num_threads; thread_id++)
+    {
+        threads.push_back(thread_pool.Submit([&render_tiles, thread_id]() -> void
+                                             {
+                                                 render_tiles(thread_id);
+                                             }));
+    }
+    render_tiles(0);
+    for (auto& thread : threads)
+    {
+        thread_pool.Wait(thread);
+    }
+
+    // Collect statistics
+    RenderStatistics statistics;
+    statistics.render_time_ms = elapsed_ms();
+    for (const float busy_time_ms : thread_busy_time_ms)
+    {
+        statistics.thread_idle_time_ms.push_back(std::max(0.f, statistics.render_time_ms - busy_time_ms));
+    }
+    statistics.num_steals = scheduler.NumSteals();
+    statistics.num_splits = scheduler.NumSplits();
+
+    return statistics;
+}
+
+const ProgressiveStatistics ImageIntegrator::RenderProgressive(const Scene& scene, const CameraInterface& camera,
+                                                              Film& film, const ProgressiveConfig& config) const
+{
+    const auto render_start{ std::chrono::high_resolution_clock::now() };
+    const auto elapsed_ms = [&render_start]() -> float
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                        render_start).count();
+    };
+
+    // Generate tiles, each tile of each pass is a work item and a lock protects the pixels of a tile in the film
     const std::vector<Tile> tiles{ GenerateTiles(film.Width(), film.Height()) };
+    const unsigned int num_tiles{ static_cast<unsigned int>(tiles.size()) };
+    const uint64_t num_items{ static_cast<uint64_t>(num_tiles) * config.max_passes };
+    std::vector<std::mutex> tile_locks(num_tiles);
+    film.Clear();
 
-    // Count how many threads we have to launch
+    // The threads of the pool render while the calling thread checks the noise and writes the snapshots
 #ifdef NDEBUG
-    const unsigned int num_threads{ std::min(std::thread::hardware_concurrency(),
-                                             static_cast<unsigned int>(tiles.size())) };
+    const unsigned int num_threads{ std::max(1u, thread_pool.NumThreads()) };
 #else
     const unsigned int num_threads{ 1 };
 #endif
 
-    // Atomic tile counter to synchronize access to tiles between threads
-    std::atomic_uint next_tile_index{ 0 };
+    // Work distribution and stop flag, set when the time budget is over or the target noise is reached
+    std::atomic<uint64_t> next_item{ 0 };
+    std::atomic_bool stop{ false };
+    std::atomic<uint64_t> num_samples{ 0 };
+    // Number of threads still running, used to wake up the calling thread when the render is over
+    unsigned int running_threads{ num_threads };
+    std::mutex running_mutex;
+    std::condition_variable running_condition;
 
-    // Launch threads
-    std::vector<std::thread> threads;
+    // Submit threads to the pool
+    std::vector<std::future<void>> threads;
     for (unsigned int thread_id = 0; thread_id != num_threads; thread_id++)
     {
-        threads.emplace_back(
-            [thread_id, &scene, &camera, &film, &tiles, &next_tile_index](const RayIntegratorInterface* integrator,
-                                                                          unsigned int spp) -> void
+        threads.push_back(thread_pool.Submit(
+            [&, thread_id]() -> void
             {
                 // Random number generator
                 Sampling::Sampler sampler{ thread_id };
 
                 // Compute samples per dimension after rounding to perfect square
-                const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(spp))) };
-                spp = spp_dim * spp_dim;
-                std::vector<Geometry::Point2f> pixel_samples(spp);
-                const float inv_num_samples{ 1.f / spp };
-
-                // Get next tile to render
-                unsigned int tile_to_render{ next_tile_index++ };
-                while (tile_to_render < tiles.size())
+                const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(samples_per_pixel))) };
+                std::vector<Geometry::Point2f> pixel_samples(spp_dim * spp_dim);
+
+                // Samples of the tile, added to the film at once when the tile is done
+                std::vector<Spectrumf> tile_radiance(tile_size.x * tile_size.y);
+                std::vector<PixelStatistics> tile_statistics(tile_size.x * tile_size.y);
+                uint64_t thread_samples{ 0 };
+
+                while (!stop)
                 {
-                    // Get reference to the tile for the thread
-                    const Tile& current_tile{ tiles[tile_to_render] };
+                    // Do not start new tiles once the time budget is over
+                    if (config.time_budget_ms > 0.f && elapsed_ms() >= config.time_budget_ms)
+                    {
+                        stop = true;
+                        break;
+                    }
+                    const uint64_t item{ next_item++ };
+                    if (item >= num_items)
+                    {
+                        break;
+                    }
+                    const unsigned int tile_index{ static_cast<unsigned int>(item % num_tiles) };
+                    const Tile& current_tile{ tiles[tile_index] };
+                    const unsigned int current_tile_width{ current_tile.tile_end.x - current_tile.tile_start.x };
+
                     // Loop over tile domain
                     for (unsigned int pixel_y = current_tile.tile_start.y;
                          pixel_y != current_tile.tile_end.y; pixel_y++)
@@ -67,8 +307,9 @@ void ImageIntegrator::RenderImage(const Scene& scene, const CameraInterface& cam
                             // Generate stratified samples for pixel
                             sampler.StratifiedSamples(pixel_samples, spp_dim);
 
-                            // Compute pixel radiance
+                            // Compute pixel radiance and statistics of the samples
                             Spectrumf pixel_radiance{ 0.f };
+                            PixelStatistics pixel_statistics;
                             for (const Geometry::Point2f& sample : pixel_samples)
                             {
                                 // Generate ray
@@ -77,67 +318,302 @@ void ImageIntegrator::RenderImage(const Scene& scene, const CameraInterface& cam
                                     Geometry::Point2ui{ pixel_x, pixel_y }, sample) };
 
                                 // Compute incoming radiance
-                                pixel_radiance += integrator->IncomingRadiance(ray, ray_interval, scene, sampler, 0);
+                                const Spectrumf L{ ray_integrator->IncomingRadiance(ray, ray_interval, scene,
+                                                                                    sampler, 0) };
+                                pixel_radiance += L;
+                                pixel_statistics.Add(AverageIntensity(L));
                             }
 
-                            // Set pixel radiance in film
-                            film(pixel_x, pixel_y) = inv_num_samples * pixel_radiance;
+                            const unsigned int local_index{ (pixel_y - current_tile.tile_start.y) *
+                                                            current_tile_width +
+                                                            pixel_x - current_tile.tile_start.x };
+                            tile_radiance[local_index] = pixel_radiance;
+                            tile_statistics[local_index] = pixel_statistics;
                         }
                     }
 
-                    // Go to next tile
-                    tile_to_render = next_tile_index++;
+                    // Accumulate samples in the film
+                    {
+                        std::lock_guard<std::mutex> tile_lock{ tile_locks[tile_index] };
+                        for (unsigned int pixel_y = current_tile.tile_start.y;
+                             pixel_y != current_tile.tile_end.y; pixel_y++)
+                        {
+                            for (unsigned int pixel_x = current_tile.tile_start.x;
+                                 pixel_x != current_tile.tile_end.x; pixel_x++)
+                            {
+                                const unsigned int local_index{ (pixel_y - current_tile.tile_start.y) *
+                                                                current_tile_width +
+                                                                pixel_x - current_tile.tile_start.x };
+                                film.AddSamples(pixel_x, pixel_y, tile_radiance[local_index],
+                                                tile_statistics[local_index]);
+                            }
+                        }
+                    }
+                    thread_samples += static_cast<uint64_t>(pixel_samples.size()) * current_tile_width *
+                                      (current_tile.tile_end.y - current_tile.tile_start.y);
                 }
-            }, ray_integrator.get(), samples_per_pixel);
-    }
+                num_samples += thread_samples;
 
-    // Simple progress
-    unsigned int current_tile{ next_tile_index };
-    unsigned int last_tile_done{ current_tile };
+                // Wake up calling thread if this is the last one
+                std::lock_guard<std::mutex> running_lock{ running_mutex };
+                if (--running_threads == 0)
+                {
+                    running_condition.notify_all();
+                }
+            }));
+    }
 
-    while (current_tile < tiles.size())
+    // Check the noise and write the snapshots while the threads render
+    ProgressiveStatistics statistics;
+    float last_snapshot_ms{ 0.f };
+    while (true)
     {
-        current_tile = next_tile_index;
-        if (current_tile != last_tile_done)
         {
-            std::cout << "Done " << std::min(current_tile, static_cast<unsigned int>(tiles.size())) << "/"
-                      << tiles.size() << " tiles\r";
-            std::cout.flush();
-            last_tile_done = current_tile;
+            std::unique_lock<std::mutex> running_lock{ running_mutex };
+            if (running_condition.wait_for(running_lock, std::chrono::milliseconds(50),
+                                           [&running_threads]() -> bool
+                                           {
+                                               return running_threads == 0;
+                                           }))
+            {
+                break;
+            }
+        }
+
+        if (config.target_noise > 0.f && EstimateNoise(film, tiles, tile_locks) <= config.target_noise)
+        {
+            stop = true;
+        }
+
+        if (config.snapshot_interval_ms > 0.f && elapsed_ms() - last_snapshot_ms >= config.snapshot_interval_ms)
+        {
+            // Copy the film one tile at a time and write it without holding any lock
+            Film snapshot{ film.Width(), film.Height() };
+            for (unsigned int tile_index = 0; tile_index != num_tiles; tile_index++)
+            {
+                const Tile& tile{ tiles[tile_index] };
+                std::lock_guard<std::mutex> tile_lock{ tile_locks[tile_index] };
+                for (unsigned int pixel_y = tile.tile_start.y; pixel_y != tile.tile_end.y; pixel_y++)
+                {
+                    for (unsigned int pixel_x = tile.tile_start.x; pixel_x != tile.tile_end.x; pixel_x++)
+                    {
+                        snapshot(pixel_x, pixel_y) = film(pixel_x, pixel_y);
+                    }
+                }
+            }
+            snapshot.WritePNG(config.snapshot_filename);
+            statistics.num_snapshots++;
+            last_snapshot_ms = elapsed_ms();
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
     }
-    std::cout << "\n";
 
-    // Join for all threads
+    // Wait for all threads
     for (auto& thread : threads)
     {
-        thread.join();
+        thread_pool.Wait(thread);
+    }
+
+    // Collect statistics
+    unsigned int min_pixel_samples{ std::numeric_limits<unsigned int>::max() };
+    for (unsigned int pixel_y = 0; pixel_y != film.Height(); pixel_y++)
+    {
+        for (unsigned int pixel_x = 0; pixel_x != film.Width(); pixel_x++)
+        {
+            min_pixel_samples = std::min(min_pixel_samples, film.Statistics(pixel_x, pixel_y).num_samples);
+        }
     }
+    const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(samples_per_pixel))) };
+    statistics.completed_passes = min_pixel_samples / std::max(1u, spp_dim * spp_dim);
+    statistics.num_samples = num_samples;
+    statistics.render_time_ms = elapsed_ms();
+    statistics.estimated_noise = EstimateNoise(film, tiles, tile_locks);
+
+    return statistics;
 }
 
-const std::vector<Tile> ImageIntegrator::GenerateTiles(unsigned int image_width,
-                                                       unsigned int image_height) const noexcept
+float ImageIntegrator::EstimateNoise(const Film& film, const std::vector<Tile>& tiles,
+                                     std::vector<std::mutex>& tile_locks)
 {
-    // Compute number of tiles
-    const unsigned int num_tiles_width{ DivideUp(image_width, tile_size.x) };
-    const unsigned int num_tiles_height{ DivideUp(image_height, tile_size.y) };
+    double variance_sum{ 0. };
+    double intensity_sum{ 0. };
+    for (unsigned int tile_index = 0; tile_index != tiles.size(); tile_index++)
+    {
+        const Tile& tile{ tiles[tile_index] };
+        std::lock_guard<std::mutex> tile_lock{ tile_locks[tile_index] };
+        for (unsigned int pixel_y = tile.tile_start.y; pixel_y != tile.tile_end.y; pixel_y++)
+        {
+            for (unsigned int pixel_x = tile.tile_start.x; pixel_x != tile.tile_end.x; pixel_x++)
+            {
+                const PixelStatistics& pixel_statistics{ film.Statistics(pixel_x, pixel_y) };
+                if (pixel_statistics.num_samples < 2)
+                {
+                    return std::numeric_limits<float>::infinity();
+                }
+                variance_sum += pixel_statistics.MeanVariance();
+                intensity_sum += pixel_statistics.mean_intensity;
+            }
+        }
+    }
 
-    // Generate tiles
-    std::vector<Tile> tiles;
-    tiles.reserve(num_tiles_width * num_tiles_height);
-    for (unsigned int tile_h = 0; tile_h != num_tiles_height; tile_h++)
+    // Error of the pixels relative to the mean intensity of the image
+    if (intensity_sum == 0.)
+    {
+        return variance_sum == 0. ? 0.f : std::numeric_limits<float>::infinity();
+    }
+    const double num_pixels{ static_cast<double>(film.Width()) * film.Height() };
+
+    return static_cast<float>(std::sqrt(variance_sum / num_pixels) / (intensity_sum / num_pixels));
+}
+
+const AdaptiveStatistics ImageIntegrator::RenderAdaptive(const Scene& scene, const CameraInterface& camera,
+                                                        Film& film, const AdaptiveConfig& config) const
+{
+    const auto render_start{ std::chrono::high_resolution_clock::now() };
+
+    const std::vector<Tile> tiles{ GenerateTiles(film.Width(), film.Height()) };
+    const unsigned int num_pixels{ film.Width() * film.Height() };
+    const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(samples_per_pixel))) };
+    const unsigned int pass_samples{ std::max(1u, spp_dim * spp_dim) };
+    film.Clear();
+
+    // The base pass samples all the pixels
+    std::vector<uint8_t> active_pixels(num_pixels, 1);
+    std::vector<std::pair<float, unsigned int>> candidates;
+    uint64_t remaining_budget{ config.sample_budget };
+    AdaptiveStatistics statistics;
+    while (true)
     {
-        for (unsigned int tile_w = 0; tile_w != num_tiles_width; tile_w++)
+        statistics.num_samples += RenderAdaptivePass(scene, camera, film, tiles, active_pixels,
+                                                     statistics.num_passes++);
+
+        // Find the pixels above the threshold that can still take samples. The error of a pixel is estimated over its
+        // 3x3 neighbourhood, a pixel whose few samples all missed the light would otherwise look converged
+        candidates.clear();
+        statistics.pixels_above_threshold = 0;
+        for (unsigned int pixel_y = 0; pixel_y != film.Height(); pixel_y++)
         {
-            const Geometry::Point2ui start{ tile_w * tile_size.x, tile_h * tile_size.y };
-            const Geometry::Point2ui end{ std::min(start.x + tile_size.x, image_width),
-                                          std::min(start.y + tile_size.y, image_height) };
-            tiles.emplace_back(start, end);
+            for (unsigned int pixel_x = 0; pixel_x != film.Width(); pixel_x++)
+            {
+                float mean_variance{ 0.f };
+                float mean_intensity{ 0.f };
+                unsigned int num_neighbours{ 0 };
+                for (unsigned int y = std::max(pixel_y, 1u) - 1; y != std::min(pixel_y + 2, film.Height()); y++)
+                {
+                    for (unsigned int x = std::max(pixel_x, 1u) - 1; x != std::min(pixel_x + 2, film.Width()); x++)
+                    {
+                        mean_variance += film.Statistics(x, y).MeanVariance();
+                        mean_intensity += film.Statistics(x, y).mean_intensity;
+                        num_neighbours++;
+                    }
+                }
+                const float error{ std::sqrt(mean_variance / num_neighbours) /
+                                   std::max(mean_intensity / num_neighbours, config.min_intensity) };
+                if (error > config.error_threshold)
+                {
+                    statistics.pixels_above_threshold++;
+                    if (film.Statistics(pixel_x, pixel_y).num_samples + pass_samples <= config.max_samples_per_pixel)
+                    {
+                        candidates.emplace_back(error, pixel_y * film.Width() + pixel_x);
+                    }
+                }
+            }
+        }
+
+        // Keep the pixels with the highest error if the budget is not enough for all of them
+        if (config.sample_budget != 0)
+        {
+            const uint64_t max_candidates{ remaining_budget / pass_samples };
+            if (candidates.size() > max_candidates)
+            {
+                std::nth_element(candidates.begin(), candidates.begin() + max_candidates, candidates.end(),
+                                 [](const std::pair<float, unsigned int>& a,
+                                    const std::pair<float, unsigned int>& b) -> bool
+                                 {
+                                     return a.first > b.first;
+                                 });
+                candidates.resize(max_candidates);
+            }
+            remaining_budget -= candidates.size() * pass_samples;
+        }
+        if (candidates.empty())
+        {
+            break;
+        }
+
+        std::fill(active_pixels.begin(), active_pixels.end(), 0);
+        for (const auto& candidate : candidates)
+        {
+            active_pixels[candidate.second] = 1;
         }
     }
 
-    return tiles;
+    statistics.render_time_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() -
+                                                                         render_start).count();
+
+    return statistics;
+}
+
+uint64_t ImageIntegrator::RenderAdaptivePass(const Scene& scene, const CameraInterface& camera, Film& film,
+                                             const std::vector<Tile>& tiles,
+                                             const std::vector<uint8_t>& active_pixels, unsigned int pass) const
+{
+    const unsigned int spp_dim{ static_cast<unsigned int>(std::round(std::sqrt(samples_per_pixel))) };
+    std::atomic<uint64_t> num_samples{ 0 };
+
+    // Tiles do not overlap so they can update the film concurrently
+    thread_pool.ParallelFor(
+        0, static_cast<unsigned int>(tiles.size()), 1,
+        [&, spp_dim, pass](unsigned int tile_start, unsigned int tile_end) -> void
+        {
+            std::vector<Geometry::Point2f> pixel_samples(spp_dim * spp_dim);
+            uint64_t chunk_samples{ 0 };
+            for (unsigned int tile_index = tile_start; tile_index != tile_end; tile_index++)
+            {
+                // Each tile of each pass has its own random sequence
+                Sampling::Sampler sampler{ pass, tile_index };
+                const Tile& current_tile{ tiles[tile_index] };
+                for (unsigned int pixel_y = current_tile.tile_start.y; pixel_y != current_tile.tile_end.y; pixel_y++)
+                {
+                    for (unsigned int pixel_x = current_tile.tile_start.x;
+                         pixel_x != current_tile.tile_end.x; pixel_x++)
+                    {
+                        if (!active_pixels[pixel_y * film.Width() + pixel_x])
+                        {
+                            continue;
+                        }
+
+                        // Generate stratified samples for pixel
+                        sampler.StratifiedSamples(pixel_samples, spp_dim);
+
+                        // Compute pixel radiance and statistics of the samples
+                        Spectrumf pixel_radiance{ 0.f };
+                        PixelStatistics pixel_statistics;
+                        for (const Geometry::Point2f& sample : pixel_samples)
+                        {
+                            Geometry::Intervalf ray_interval{ Geometry::Ray::DefaultInterval() };
+                            const Geometry::Ray ray{ camera.GenerateRayWorldSpace(
+                                Geometry::Point2ui{ pixel_x, pixel_y }, sample) };
+
+                            const Spectrumf L{ ray_integrator->IncomingRadiance(ray, ray_interval, scene, sampler,
+                                                                                0) };
+                            pixel_radiance += L;
+                            pixel_statistics.Add(AverageIntensity(L));
+                        }
+                        film.AddSamples(pixel_x, pixel_y, pixel_radiance, pixel_statistics);
+                        chunk_samples += pixel_samples.size();
+                    }
+                }
+            }
+            num_samples += chunk_samples;
+        });
+
+    return num_samples;
+}
+
+const std::vector<Tile> ImageIntegrator::GenerateTiles(unsigned int image_width,
+                                                       unsigned int image_height) const noexcept
+{
+    return GenerateHilbertTiles(image_width, image_height, tile_size);
 }
 
 } // Rabbit namespace
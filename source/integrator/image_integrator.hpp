@@ -8,37 +8,202 @@
 #include "camera/camera.hpp"
 #include "film/film.hpp"
 #include "ray_integrator.hpp"
+#include "tile_scheduler.hpp"
+#include "utilities/thread_pool.hpp"
+
+#include <mutex>
 
 namespace Rabbit
 {
 
-// Tile in the image to render for a thread
-struct Tile
+// Statistics of a render
+struct RenderStatistics
+{
+    RenderStatistics() noexcept
+        : render_time_ms{ 0.f }, num_steals{ 0 }, num_splits{ 0 }
+    {}
+
+    float render_time_ms;
+    // Time each thread spent without work, from its start to the end of the render
+    std::vector<float> thread_idle_time_ms;
+    // Tiles stolen from other threads and split at the end of the render
+    unsigned int num_steals;
+    unsigned int num_splits;
+};
+
+// Configuration of a progressive render, a zero budget, target or interval disables the corresponding feature
+struct ProgressiveConfig
+{
+    explicit ProgressiveConfig(unsigned int max_passes,
+                               float time_budget_ms = 0.f,
+                               float target_noise = 0.f,
+                               float snapshot_interval_ms = 0.f,
+                               std::string snapshot_filename = "snapshot.png") noexcept
+        : max_passes{ max_passes },
+          time_budget_ms{ time_budget_ms },
+          target_noise{ target_noise },
+          snapshot_interval_ms{ snapshot_interval_ms },
+          snapshot_filename{ std::move(snapshot_filename) }
+    {}
+
+    // Maximum number of passes over the image, each pass adds samples_per_pixel samples to all the pixels
+    const unsigned int max_passes;
+    // Wall clock time after which no new tile is started
+    const float time_budget_ms;
+    // Stop when the relative RMS error of the image estimated from the pixel variances goes below this value
+    const float target_noise;
+    // Interval between snapshots of the film and file they are written to
+    const float snapshot_interval_ms;
+    const std::string snapshot_filename;
+};
+
+// Statistics of a progressive render
+struct ProgressiveStatistics
+{
+    ProgressiveStatistics() noexcept
+        : completed_passes{ 0 }, num_samples{ 0 }, render_time_ms{ 0.f }, estimated_noise{ 0.f }, num_snapshots{ 0 }
+    {}
+
+    // Number of passes completed by all the tiles, tiles of the last pass may have one more
+    unsigned int completed_passes;
+    // Total number of samples taken
+    uint64_t num_samples;
+    float render_time_ms;
+    // Relative RMS error of the final image
+    float estimated_noise;
+    unsigned int num_snapshots;
+};
+
+// Configuration of an adaptive render. After a base pass with samples_per_pixel samples for all the pixels, each pass
+// adds samples_per_pixel samples to the pixels whose relative error is above the threshold
+struct AdaptiveConfig
+{
+    explicit AdaptiveConfig(float error_threshold,
+                            unsigned int max_samples_per_pixel,
+                            uint64_t sample_budget = 0,
+                            float min_intensity = 0.01f) noexcept
+        : error_threshold{ error_threshold },
+          max_samples_per_pixel{ max_samples_per_pixel },
+          sample_budget{ sample_budget },
+          min_intensity{ min_intensity }
+    {}
+
+    // Relative standard error a pixel needs to reach to stop receiving samples
+    const float error_threshold;
+    // Maximum number of samples of a pixel
+    const unsigned int max_samples_per_pixel;
+    // Samples available after the base pass, when it is not enough for all the pixels above the threshold the ones
+    // with the highest error are sampled first. Zero means no limit
+    const uint64_t sample_budget;
+    // Intensity below which the error is measured in absolute terms
+    const float min_intensity;
+};
+
+// Statistics of an adaptive render
+struct AdaptiveStatistics
 {
-    constexpr Tile(const Geometry::Point2ui& start, const Geometry::Point2ui& end) noexcept
-        : tile_start{ start }, tile_end{ end }
+    AdaptiveStatistics() noexcept
+        : num_passes{ 0 }, num_samples{ 0 }, pixels_above_threshold{ 0 }, render_time_ms{ 0.f }
     {}
 
-    const Geometry::Point2ui tile_start;
-    const Geometry::Point2ui tile_end;
+    // Number of passes including the base one
+    unsigned int num_passes;
+    // Total number of samples taken
+    uint64_t num_samples;
+    // Pixels still above the error threshold at the end of the render
+    unsigned int pixels_above_threshold;
+    float render_time_ms;
+};
+
+// Camera and film of a frame rendered in a batch
+struct BatchFrame
+{
+    BatchFrame(const CameraInterface& camera, Film& film) noexcept
+        : camera{ camera }, film{ film }
+    {}
+
+    const CameraInterface& camera;
+    Film& film;
+};
+
+// Order in which the frames of a batch are rendered
+enum class BatchMode
+{
+    // One frame after the other
+    SEQUENTIAL,
+    // The tiles of all the frames are scheduled together, threads never wait for the end of a frame
+    INTERLEAVED
+};
+
+// Statistics of a batch render
+struct BatchStatistics
+{
+    BatchStatistics() noexcept
+        : total_time_ms{ 0.f }
+    {}
+
+    // Mean time per frame
+    float AmortisedFrameTimeMs() const noexcept
+    {
+        return frame_time_ms.empty() ? 0.f : total_time_ms / frame_time_ms.size();
+    }
+
+    // Render time of each frame for sequential batches, time from the start of the batch to the end of the frame for
+    // interleaved ones
+    std::vector<float> frame_time_ms;
+    float total_time_ms;
+    // Statistics of the threads summed over the batch
+    RenderStatistics render_statistics;
 };
 
 class ImageIntegrator
 {
 public:
+    // Renders run on the given pool, which needs to outlive the integrator
     ImageIntegrator(std::unique_ptr<const RayIntegratorInterface> ray_integrator,
-                    const Geometry::Point2ui& tile_size, unsigned int spp) noexcept;
+                    const Geometry::Point2ui& tile_size, unsigned int spp,
+                    ThreadPool& thread_pool = ThreadPool::Global()) noexcept;
+
+    // Render image with the threads of the pool and the calling thread, returns once all the tiles are done
+    const RenderStatistics RenderImage(const Scene& scene, const CameraInterface& camera, Film& film) const;
 
-    void RenderImage(const Scene& scene, const CameraInterface& camera, Film& film) const noexcept;
+    // Render the frames of a batch reusing the scene and the threads of the pool
+    const BatchStatistics RenderBatch(const Scene& scene, const std::vector<BatchFrame>& frames,
+                                      BatchMode mode = BatchMode::SEQUENTIAL) const;
+
+    // Render in passes over all the tiles accumulating samples in the film until one of the stop conditions of the
+    // configuration is met. The film always holds the mean of the samples taken so far, snapshots are written by the
+    // calling thread while the threads of the pool keep working
+    const ProgressiveStatistics RenderProgressive(const Scene& scene, const CameraInterface& camera, Film& film,
+                                                  const ProgressiveConfig& config) const;
+
+    // Render with samples distributed to the pixels with the highest estimated error
+    const AdaptiveStatistics RenderAdaptive(const Scene& scene, const CameraInterface& camera, Film& film,
+                                            const AdaptiveConfig& config) const;
 
 private:
+    // Generate tiles ordered along a Hilbert curve
     const std::vector<Tile> GenerateTiles(unsigned int image_width, unsigned int image_height) const noexcept;
 
+    // Render all the tiles of the frames at once, sets the time at which each frame was completed
+    const RenderStatistics RenderFrames(const Scene& scene, const std::vector<BatchFrame>& frames,
+                                        std::vector<float>& frame_done_ms) const;
+
+    // Relative RMS error of the tiles of the film, the lock of each tile is held while reading its pixels
+    static float EstimateNoise(const Film& film, const std::vector<Tile>& tiles, std::vector<std::mutex>& tile_locks);
+
+    // Add samples_per_pixel samples to the active pixels of the film, returns the number of samples taken
+    uint64_t RenderAdaptivePass(const Scene& scene, const CameraInterface& camera, Film& film,
+                                const std::vector<Tile>& tiles, const std::vector<uint8_t>& active_pixels,
+                                unsigned int pass) const;
+
     std::unique_ptr<const RayIntegratorInterface> ray_integrator;
     // Size of tiles to render
     const Geometry::Point2ui tile_size;
     // Number of samples for each pixel
     const unsigned int samples_per_pixel;
+    // Pool running the renders
+    ThreadPool& thread_pool;
 };
 
 } // Rabbit namespace
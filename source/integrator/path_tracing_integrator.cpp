@@ -33,9 +33,9 @@ const Spectrumf PathTracingIntegrator::IncomingRadiance(const Geometry::Ray& ray
         if (bounce == 0 || specular_bounce)
         {
             // If we hit something, add emitted radiance if any
-            if (intersection_found && intersection.hit_triangle->material->IsEmitting())
+            if (intersection_found && intersection.material->IsEmitting())
             {
-                L += beta * intersection.hit_triangle->material->Le(intersection, intersection.wo);
+                L += beta * intersection.material->Le(intersection, intersection.wo);
             }
             else
             {
@@ -58,15 +58,15 @@ const Spectrumf PathTracingIntegrator::IncomingRadiance(const Geometry::Ray& ray
 
         // Sample material to get new direction
         MaterialSample material_sample;
-        const Spectrumf f{ intersection.hit_triangle->material->SampleF(intersection, intersection.wo,
-                                                                        sampler.Next2D(), material_sample) };
+        const Spectrumf f{ intersection.material->SampleF(intersection, intersection.wo, sampler.Next2D(),
+                                                          material_sample) };
         // Check if it makes sense to continue tracing
         if (f.IsBlack() || material_sample.sampled_wi_pdf == 0.f)
         {
             break;
         }
         // Check if BRDF is specular
-        specular_bounce = intersection.hit_triangle->material->IsSpecular();
+        specular_bounce = intersection.material->IsSpecular();
 
         // Update path throughput, special care is taken if the BRDF is specular
         const float n_dot_wi{ specular_bounce ?
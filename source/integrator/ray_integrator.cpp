@@ -34,7 +34,7 @@ const Spectrumf RayIntegratorInterface::ComputeDirectIllumination(const Geometry
             // Check if we need to add contribution
             if (!Li.IsBlack() && light_sample.sampled_wi_pdf != 0.f && !occlusion_tester.IsOccluded(scene))
             {
-                Ld += intersection.hit_triangle->material->F(intersection, intersection.wo, light_sample.sampled_wi) *
+                Ld += intersection.material->F(intersection, intersection.wo, light_sample.sampled_wi) *
                       Li * Clamp(Geometry::Dot(intersection.local_geometry.n, light_sample.sampled_wi), 0.f, 1.f) /
                       light_sample.sampled_wi_pdf;
             }
@@ -51,8 +51,8 @@ const Spectrumf RayIntegratorInterface::ComputeSpecularIllumination(const Geomet
 {
     // Sample specular material
     MaterialSample sample;
-    const Spectrumf specular{ intersection.hit_triangle->material->SampleF(intersection, intersection.wo,
-                                                                           sampler.Next2D(), sample) };
+    const Spectrumf specular{ intersection.material->SampleF(intersection, intersection.wo,
+                                                             sampler.Next2D(), sample) };
 
     // Check if we need to continue
     if (!specular.IsBlack() && sample.sampled_wi_pdf > 0.f)
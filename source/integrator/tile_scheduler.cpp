@@ -0,0 +1,205 @@
+#include "tile_scheduler.hpp"
+#include "utilities/utilities.hpp"
+
+#include <algorithm>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Distance along the Hilbert curve covering a grid of side n, a power of two, of the cell (x, y)
+uint64_t HilbertIndex(uint32_t n, uint32_t x, uint32_t y) noexcept
+{
+    uint64_t index{ 0 };
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        const uint32_t rx{ (x & s) > 0 ? 1u : 0u };
+        const uint32_t ry{ (y & s) > 0 ? 1u : 0u };
+        index += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // Rotate quadrant
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+
+    return index;
+}
+
+} // anonymous namespace
+
+const std::vector<Tile> GenerateHilbertTiles(unsigned int image_width, unsigned int image_height,
+                                             const Geometry::Point2ui& tile_size)
+{
+    // Compute number of tiles
+    const unsigned int num_tiles_width{ DivideUp(image_width, tile_size.x) };
+    const unsigned int num_tiles_height{ DivideUp(image_height, tile_size.y) };
+
+    // Sort tile grid cells along the curve of the smallest power of two grid containing them
+    uint32_t curve_size{ 1 };
+    while (curve_size < std::max(num_tiles_width, num_tiles_height))
+    {
+        curve_size *= 2;
+    }
+    std::vector<std::pair<uint64_t, Geometry::Point2ui>> cells;
+    cells.reserve(num_tiles_width * num_tiles_height);
+    for (unsigned int tile_h = 0; tile_h != num_tiles_height; tile_h++)
+    {
+        for (unsigned int tile_w = 0; tile_w != num_tiles_width; tile_w++)
+        {
+            cells.emplace_back(HilbertIndex(curve_size, tile_w, tile_h), Geometry::Point2ui{ tile_w, tile_h });
+        }
+    }
+    std::sort(cells.begin(), cells.end(),
+              [](const std::pair<uint64_t, Geometry::Point2ui>& a,
+                 const std::pair<uint64_t, Geometry::Point2ui>& b) -> bool
+              {
+                  return a.first < b.first;
+              });
+
+    // Generate tiles
+    std::vector<Tile> tiles;
+    tiles.reserve(cells.size());
+    for (const auto& cell : cells)
+    {
+        const Geometry::Point2ui start{ cell.second.x * tile_size.x, cell.second.y * tile_size.y };
+        const Geometry::Point2ui end{ std::min(start.x + tile_size.x, image_width),
+                                      std::min(start.y + tile_size.y, image_height) };
+        tiles.emplace_back(start, end);
+    }
+
+    return tiles;
+}
+
+TileScheduler::TileScheduler(const std::vector<Tile>& tiles, unsigned int num_workers,
+                             const Geometry::Point2ui& min_tile_size) noexcept
+    : queues{ new WorkerQueue[std::max(1u, num_workers)] }, num_workers{ std::max(1u, num_workers) },
+      min_tile_size{ min_tile_size }, num_queued{ static_cast<unsigned int>(tiles.size()) }, num_in_flight{ 0 },
+      num_steals{ 0 }, num_splits{ 0 }
+{
+    // Give each worker a contiguous run of the curve
+    const unsigned int num_tiles{ static_cast<unsigned int>(tiles.size()) };
+    for (unsigned int worker = 0; worker != this->num_workers; worker++)
+    {
+        const unsigned int run_start{ static_cast<unsigned int>(static_cast<uint64_t>(num_tiles) * worker /
+                                                                this->num_workers) };
+        const unsigned int run_end{ static_cast<unsigned int>(static_cast<uint64_t>(num_tiles) * (worker + 1) /
+                                                              this->num_workers) };
+        queues[worker].tiles.assign(tiles.begin() + run_start, tiles.begin() + run_end);
+    }
+}
+
+bool TileScheduler::Next(unsigned int worker_id, Tile& tile) noexcept
+{
+    WorkerQueue& own_queue{ queues[worker_id] };
+
+    // The previous tile of the worker is done, the last one wakes up the waiting workers so they can exit
+    if (own_queue.has_tile)
+    {
+        own_queue.has_tile = false;
+        if (--num_in_flight == 0)
+        {
+            NotifyWaiting();
+        }
+    }
+
+    while (!Take(worker_id, tile))
+    {
+        // Tiles being rendered can still be split, only exit once nothing is queued or in flight
+        std::unique_lock<std::mutex> lock{ waiting_mutex };
+        waiting_condition.wait(lock, [this]() -> bool
+                               {
+                                   return num_queued != 0 || num_in_flight == 0;
+                               });
+        if (num_queued == 0 && num_in_flight == 0)
+        {
+            return false;
+        }
+    }
+    own_queue.has_tile = true;
+
+    // Near the end of the image split the tile such that the other workers can take part of it
+    const unsigned int queued{ --num_queued };
+    if (num_workers > 1 && queued < num_workers)
+    {
+        Split(own_queue, tile);
+    }
+
+    return true;
+}
+
+bool TileScheduler::Take(unsigned int worker_id, Tile& tile) noexcept
+{
+    // Take the next tile along the curve from the own queue. The tile is counted in flight before it leaves the
+    // queued count, such that the two are never both zero while a tile is left
+    WorkerQueue& own_queue{ queues[worker_id] };
+    {
+        std::lock_guard<std::mutex> lock{ own_queue.mutex };
+        if (!own_queue.tiles.empty())
+        {
+            tile = own_queue.tiles.front();
+            own_queue.tiles.pop_front();
+            num_in_flight++;
+            return true;
+        }
+    }
+
+    // Otherwise steal the last tile of another worker, the one furthest from where it is working
+    for (unsigned int offset = 1; offset != num_workers; offset++)
+    {
+        WorkerQueue& victim_queue{ queues[(worker_id + offset) % num_workers] };
+        std::lock_guard<std::mutex> lock{ victim_queue.mutex };
+        if (!victim_queue.tiles.empty())
+        {
+            tile = victim_queue.tiles.back();
+            victim_queue.tiles.pop_back();
+            num_in_flight++;
+            num_steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TileScheduler::Split(WorkerQueue& queue, Tile& tile) noexcept
+{
+    const Geometry::Point2ui size{ tile.tile_end.x - tile.tile_start.x, tile.tile_end.y - tile.tile_start.y };
+    if (size.x < 2 * min_tile_size.x || size.y < 2 * min_tile_size.y)
+    {
+        return;
+    }
+
+    // Keep the first quarter and queue the others
+    const Geometry::Point2ui middle{ tile.tile_start.x + size.x / 2, tile.tile_start.y + size.y / 2 };
+    {
+        std::lock_guard<std::mutex> lock{ queue.mutex };
+        queue.tiles.emplace_front(Geometry::Point2ui{ middle.x, tile.tile_start.y },
+                                  Geometry::Point2ui{ tile.tile_end.x, middle.y });
+        queue.tiles.emplace_front(middle, tile.tile_end);
+        queue.tiles.emplace_front(Geometry::Point2ui{ tile.tile_start.x, middle.y },
+                                  Geometry::Point2ui{ middle.x, tile.tile_end.y });
+        num_queued += 3;
+    }
+    tile.tile_end = middle;
+    num_splits++;
+    NotifyWaiting();
+}
+
+void TileScheduler::NotifyWaiting() noexcept
+{
+    // Lock such that a worker checking the counters cannot miss the notification
+    {
+        std::lock_guard<std::mutex> lock{ waiting_mutex };
+    }
+    waiting_condition.notify_all();
+}
+
+} // Rabbit namespace
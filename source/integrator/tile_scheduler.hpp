@@ -0,0 +1,94 @@
+#ifndef RABBIT2_TILE_SCHEDULER_HPP
+#define RABBIT2_TILE_SCHEDULER_HPP
+
+#include "geometry/geometry.hpp"
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+namespace Rabbit
+{
+
+// Tile in the image to render for a thread
+struct Tile
+{
+    constexpr Tile(const Geometry::Point2ui& start, const Geometry::Point2ui& end) noexcept
+        : tile_start{ start }, tile_end{ end }
+    {}
+
+    Geometry::Point2ui tile_start;
+    Geometry::Point2ui tile_end;
+};
+
+// Generate tiles covering the image ordered along a Hilbert curve, consecutive tiles are neighbours in the image
+const std::vector<Tile> GenerateHilbertTiles(unsigned int image_width, unsigned int image_height,
+                                             const Geometry::Point2ui& tile_size);
+
+// Distributes tiles to workers. Each worker gets a contiguous run of the tiles in its own queue and takes them from
+// the front, workers with an empty queue steal from the back of the others. When fewer tiles than workers are left
+// the tiles taken are split in four so that the last tiles do not leave workers idle. Workers without tiles wait for
+// the split ones until no tile is queued or being rendered
+class TileScheduler
+{
+public:
+    TileScheduler(const std::vector<Tile>& tiles, unsigned int num_workers,
+                  const Geometry::Point2ui& min_tile_size) noexcept;
+
+    // Get next tile for the worker, the previous tile of the worker is considered done. Returns false when no tile is
+    // left
+    bool Next(unsigned int worker_id, Tile& tile) noexcept;
+
+    // Number of tiles stolen from other workers and split
+    unsigned int NumSteals() const noexcept
+    {
+        return num_steals;
+    }
+
+    unsigned int NumSplits() const noexcept
+    {
+        return num_splits;
+    }
+
+private:
+    // Queue of tiles of a worker
+    struct WorkerQueue
+    {
+        WorkerQueue() noexcept
+            : has_tile{ false }
+        {}
+
+        std::mutex mutex;
+        std::deque<Tile> tiles;
+        // If the worker is rendering a tile, only accessed by the worker itself
+        bool has_tile;
+    };
+
+    // Take a tile from the own queue or steal one from the others
+    bool Take(unsigned int worker_id, Tile& tile) noexcept;
+
+    // Split tile in four and push the other three in the queue of the worker if it is still big enough
+    void Split(WorkerQueue& queue, Tile& tile) noexcept;
+
+    // Wake up the workers waiting for tiles
+    void NotifyWaiting() noexcept;
+
+    std::unique_ptr<WorkerQueue[]> queues;
+    const unsigned int num_workers;
+    const Geometry::Point2ui min_tile_size;
+    // Number of tiles in all the queues and being rendered
+    std::atomic_uint num_queued;
+    std::atomic_uint num_in_flight;
+    // Workers without tiles wait here for split tiles or for the end of the rendering
+    std::mutex waiting_mutex;
+    std::condition_variable waiting_condition;
+    std::atomic_uint num_steals;
+    std::atomic_uint num_splits;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_TILE_SCHEDULER_HPP
@@ -0,0 +1,387 @@
+#include "wavefront_integrator.hpp"
+#include "geometry/morton.hpp"
+#include "geometry/occlusion_test.hpp"
+#include "light/light.hpp"
+#include "utilities/thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+namespace Rabbit
+{
+
+// Number of pixels handed to a worker at once, all the samples of a pixel are generated by the same worker
+constexpr unsigned int WAVEFRONT_CHUNK_PIXELS{ 1024 };
+// Bits for each axis of the Morton code of the ray origins used to sort the paths
+constexpr unsigned int SORT_BITS_PER_AXIS{ 10 };
+
+PathStates::PathStates(unsigned int pool_size)
+    : rays(pool_size), intervals(pool_size, Geometry::Ray::DefaultInterval()), intersections(pool_size),
+      beta(pool_size), L(pool_size), pixel(pool_size), bounce(pool_size),
+      specular_bounce(pool_size), finished(pool_size), num_active{ 0 }
+{}
+
+void PathStates::Move(unsigned int from, unsigned int to) noexcept
+{
+    CopyFrom(*this, from, to);
+}
+
+void PathStates::CopyFrom(const PathStates& other, unsigned int from, unsigned int to) noexcept
+{
+    rays[to] = other.rays[from];
+    intervals[to] = other.intervals[from];
+    intersections[to] = other.intersections[from];
+    beta[to] = other.beta[from];
+    L[to] = other.L[from];
+    pixel[to] = other.pixel[from];
+    bounce[to] = other.bounce[from];
+    specular_bounce[to] = other.specular_bounce[from];
+    finished[to] = other.finished[from];
+}
+
+struct WavefrontIntegrator::PathGenerator
+{
+    explicit PathGenerator(unsigned int samples_per_pixel)
+        : pixel{ 0 }, chunk_end{ 0 }, sample{ 0 }, pixel_samples(samples_per_pixel)
+    {}
+
+    // Current pixel, end of the current chunk and next sample of the pixel
+    unsigned int pixel;
+    unsigned int chunk_end;
+    unsigned int sample;
+    // Stratified samples of the current pixel
+    std::vector<Geometry::Point2f> pixel_samples;
+};
+
+WavefrontIntegrator::WavefrontIntegrator(unsigned int max_depth, unsigned int spp, unsigned int pool_size,
+                                         bool sort_rays) noexcept
+    : max_depth{ max_depth },
+      samples_per_pixel_dim{ std::max(1u, static_cast<unsigned int>(std::round(std::sqrt(spp)))) },
+      samples_per_pixel{ samples_per_pixel_dim * samples_per_pixel_dim },
+      pool_size{ std::max(1u, pool_size) }, sort_rays{ sort_rays }
+{}
+
+const WavefrontStatistics WavefrontIntegrator::RenderImage(const Scene& scene, const CameraInterface& camera,
+                                                           Film& film) const
+{
+    const auto render_start{ std::chrono::high_resolution_clock::now() };
+
+    // Launch one worker for each thread of the pool, each worker takes chunks of pixels until none is left
+    ThreadPool& thread_pool{ ThreadPool::Global() };
+    const unsigned int num_workers{ std::max(1u, thread_pool.NumThreads()) };
+    std::atomic_uint next_chunk{ 0 };
+    std::vector<std::future<WavefrontStatistics>> workers;
+    workers.reserve(num_workers);
+    for (unsigned int worker_id = 0; worker_id != num_workers; worker_id++)
+    {
+        workers.push_back(thread_pool.Submit([this, &scene, &camera, &film, &next_chunk, worker_id]()
+                                             {
+                                                 return RenderChunks(scene, camera, film, next_chunk, worker_id);
+                                             }));
+    }
+
+    // Collect statistics
+    WavefrontStatistics statistics;
+    for (auto& worker : workers)
+    {
+        const WavefrontStatistics worker_statistics{ thread_pool.Wait(worker) };
+        statistics.num_extension_rays += worker_statistics.num_extension_rays;
+        statistics.num_shadow_rays += worker_statistics.num_shadow_rays;
+        statistics.extension_time_ms += worker_statistics.extension_time_ms;
+        statistics.sort_time_ms += worker_statistics.sort_time_ms;
+    }
+    const auto render_end{ std::chrono::high_resolution_clock::now() };
+    statistics.render_time_ms = std::chrono::duration<float, std::milli>(render_end - render_start).count();
+
+    return statistics;
+}
+
+const WavefrontStatistics WavefrontIntegrator::RenderChunks(const Scene& scene, const CameraInterface& camera,
+                                                            Film& film, std::atomic_uint& next_chunk,
+                                                            unsigned int worker_id) const
+{
+    Sampling::Sampler sampler{ worker_id };
+    PathGenerator generator{ samples_per_pixel };
+    PathStates paths{ pool_size };
+    // The pool the paths are sorted into, it is swapped with the current one after sorting
+    PathStates sorted_paths{ sort_rays ? pool_size : 0 };
+    std::vector<std::pair<uint64_t, unsigned int>> sort_keys;
+    ShadowRayQueue shadow_rays;
+    std::vector<unsigned int> shading_order;
+    WavefrontStatistics statistics;
+
+    while (true)
+    {
+        // Fill the free slots of the pool with new camera paths, stop when no path is left
+        GeneratePaths(generator, camera, film, next_chunk, sampler, paths);
+        if (paths.num_active == 0)
+        {
+            break;
+        }
+
+        // Run the stages on the whole pool
+        const auto sort_start{ std::chrono::high_resolution_clock::now() };
+        if (sort_rays)
+        {
+            SortPaths(paths, sorted_paths, sort_keys);
+        }
+        const auto extension_start{ std::chrono::high_resolution_clock::now() };
+        ExtendPaths(scene, paths);
+        const auto extension_end{ std::chrono::high_resolution_clock::now() };
+        statistics.sort_time_ms += std::chrono::duration<float, std::milli>(extension_start - sort_start).count();
+        statistics.extension_time_ms +=
+            std::chrono::duration<float, std::milli>(extension_end - extension_start).count();
+        statistics.num_extension_rays += paths.num_active;
+        ShadePaths(scene, sampler, paths, shading_order, shadow_rays);
+        TraceShadowRays(scene, shadow_rays, paths);
+        statistics.num_shadow_rays += shadow_rays.rays.size();
+        AccumulatePaths(film, paths);
+    }
+
+    return statistics;
+}
+
+void WavefrontIntegrator::GeneratePaths(PathGenerator& generator, const CameraInterface& camera, Film& film,
+                                        std::atomic_uint& next_chunk, Sampling::Sampler& sampler,
+                                        PathStates& paths) const
+{
+    const unsigned int num_pixels{ film.Width() * film.Height() };
+    while (paths.num_active != pool_size)
+    {
+        // Move to the next pixel, taking a new chunk when the current one is done
+        if (generator.sample == samples_per_pixel || generator.pixel == generator.chunk_end)
+        {
+            if (generator.pixel != generator.chunk_end)
+            {
+                generator.pixel++;
+            }
+            if (generator.pixel == generator.chunk_end)
+            {
+                const unsigned int chunk{ next_chunk++ };
+                if (chunk * WAVEFRONT_CHUNK_PIXELS >= num_pixels)
+                {
+                    return;
+                }
+                generator.pixel = chunk * WAVEFRONT_CHUNK_PIXELS;
+                generator.chunk_end = std::min(generator.pixel + WAVEFRONT_CHUNK_PIXELS, num_pixels);
+                // The pixels of the chunk are only written by this worker, clear them before accumulating
+                for (unsigned int pixel = generator.pixel; pixel != generator.chunk_end; pixel++)
+                {
+                    film(pixel % film.Width(), pixel / film.Width()) = Spectrumf{ 0.f };
+                }
+            }
+            generator.sample = 0;
+            sampler.StratifiedSamples(generator.pixel_samples, samples_per_pixel_dim);
+        }
+
+        // Start path from the camera
+        const unsigned int slot{ paths.num_active++ };
+        const Geometry::Point2ui pixel_coordinates{ generator.pixel % film.Width(), generator.pixel / film.Width() };
+        paths.rays[slot] = camera.GenerateRayWorldSpace(pixel_coordinates,
+                                                        generator.pixel_samples[generator.sample++]);
+        paths.intervals[slot] = Geometry::Ray::DefaultInterval();
+        paths.beta[slot] = Spectrumf{ 1.f };
+        paths.L[slot] = Spectrumf{ 0.f };
+        paths.pixel[slot] = generator.pixel;
+        paths.bounce[slot] = 0;
+        paths.specular_bounce[slot] = false;
+        paths.finished[slot] = false;
+    }
+}
+
+void WavefrontIntegrator::SortPaths(PathStates& paths, PathStates& sorted_paths,
+                                    std::vector<std::pair<uint64_t, unsigned int>>& sort_keys)
+{
+    // Normalise the origins to their bounds in the pool, the paths are spread over a small part of the scene
+    Geometry::BBox origins_bounds;
+    for (unsigned int path = 0; path != paths.num_active; path++)
+    {
+        origins_bounds = Union(origins_bounds, paths.rays[path].Origin());
+    }
+    const auto inv_extent = [](float extent) -> float
+    {
+        return extent > 0.f ? 1.f / extent : 0.f;
+    };
+    const Geometry::Vector3f origins_diagonal{ origins_bounds.Diagonal() };
+    const Geometry::Vector3f inv_origins_diagonal{ inv_extent(origins_diagonal.x),
+                                                   inv_extent(origins_diagonal.y),
+                                                   inv_extent(origins_diagonal.z) };
+
+    // The octant of the direction is above the Morton code of the origin, equal keys keep the order of the pool
+    sort_keys.resize(paths.num_active);
+    for (unsigned int path = 0; path != paths.num_active; path++)
+    {
+        const Geometry::Ray& ray{ paths.rays[path] };
+        const uint64_t octant{ (ray.Direction().x < 0.f ? 1u : 0u) | (ray.Direction().y < 0.f ? 2u : 0u) |
+                               (ray.Direction().z < 0.f ? 4u : 0u) };
+        const uint32_t origin_code{
+            Geometry::EncodeMorton<uint32_t>((ray.Origin() - origins_bounds.PMin()) * inv_origins_diagonal,
+                                             SORT_BITS_PER_AXIS) };
+        sort_keys[path] = std::make_pair(octant << (3 * SORT_BITS_PER_AXIS) | origin_code, path);
+    }
+    std::sort(sort_keys.begin(), sort_keys.end());
+
+    for (unsigned int path = 0; path != paths.num_active; path++)
+    {
+        sorted_paths.CopyFrom(paths, sort_keys[path].second, path);
+    }
+    sorted_paths.num_active = paths.num_active;
+    std::swap(paths, sorted_paths);
+}
+
+void WavefrontIntegrator::ExtendPaths(const Scene& scene, PathStates& paths) noexcept
+{
+    std::fill(paths.intersections.begin(), paths.intersections.begin() + paths.num_active,
+              Geometry::TriangleIntersection{});
+    scene.Intersect(paths.rays.data(), paths.intervals.data(), paths.intersections.data(), paths.num_active);
+}
+
+void WavefrontIntegrator::ShadePaths(const Scene& scene, Sampling::Sampler& sampler, PathStates& paths,
+                                     std::vector<unsigned int>& shading_order, ShadowRayQueue& shadow_rays) const
+{
+    // Group paths by the material they hit, the ones that escaped come first
+    const auto path_material = [&paths](unsigned int path) -> const MaterialInterface*
+    {
+        return paths.intersections[path].IsValid() ? paths.intersections[path].material : nullptr;
+    };
+    shading_order.resize(paths.num_active);
+    std::iota(shading_order.begin(), shading_order.end(), 0);
+    std::sort(shading_order.begin(), shading_order.end(),
+              [&path_material](unsigned int a, unsigned int b) -> bool
+              {
+                  return path_material(a) < path_material(b);
+              });
+
+    shadow_rays.Clear();
+    LightSample light_sample;
+    OcclusionTester occlusion_tester;
+    for (const unsigned int path : shading_order)
+    {
+        const Geometry::TriangleIntersection& intersection{ paths.intersections[path] };
+        const bool intersection_found{ intersection.IsValid() };
+        Spectrumf& beta{ paths.beta[path] };
+
+        // Add emitted light if needed
+        if (paths.bounce[path] == 0 || paths.specular_bounce[path])
+        {
+            if (intersection_found && intersection.material->IsEmitting())
+            {
+                paths.L[path] += beta * intersection.material->Le(intersection, intersection.wo);
+            }
+            else
+            {
+                for (const auto& light : scene.Lights())
+                {
+                    paths.L[path] += beta * light->L(paths.rays[path]);
+                }
+            }
+        }
+
+        // Terminate path if we escaped
+        if (!intersection_found)
+        {
+            paths.finished[path] = true;
+            continue;
+        }
+
+        // Queue shadow rays for the direct light contribution
+        const MaterialInterface* material{ intersection.material };
+        for (const auto& light : scene.Lights())
+        {
+            for (unsigned int sample = 0; sample != light->NumSamples(); sample++)
+            {
+                Geometry::Point2f u{ 0.f };
+                if (!light->IsDeltaLight())
+                {
+                    u = sampler.Next2D();
+                }
+                const Spectrumf Li{ light->SampleLi(intersection, u, light_sample, occlusion_tester) };
+                if (!Li.IsBlack() && light_sample.sampled_wi_pdf != 0.f)
+                {
+                    shadow_rays.Push(occlusion_tester.Ray(), occlusion_tester.Interval(),
+                                     beta * material->F(intersection, intersection.wo, light_sample.sampled_wi) * Li *
+                                     Clamp(Geometry::Dot(intersection.local_geometry.n, light_sample.sampled_wi),
+                                           0.f, 1.f) / light_sample.sampled_wi_pdf /
+                                     static_cast<float>(light->NumSamples()),
+                                     path);
+                }
+            }
+        }
+
+        // Sample material to get new direction
+        MaterialSample material_sample;
+        const Spectrumf f{ material->SampleF(intersection, intersection.wo, sampler.Next2D(), material_sample) };
+        if (f.IsBlack() || material_sample.sampled_wi_pdf == 0.f)
+        {
+            paths.finished[path] = true;
+            continue;
+        }
+        paths.specular_bounce[path] = material->IsSpecular();
+
+        // Update path throughput, special care is taken if the BRDF is specular
+        const float n_dot_wi{ paths.specular_bounce[path] ?
+                              1.f :
+                              Clamp(Geometry::Dot(material_sample.sampled_wi, intersection.local_geometry.n), 0.f, 1.f)
+        };
+        beta *= f * n_dot_wi / material_sample.sampled_wi_pdf;
+
+        // Set ray to new one
+        paths.rays[path] = intersection.SpawnRay(material_sample.sampled_wi);
+        paths.intervals[path] = Geometry::Ray::DefaultInterval();
+
+        // Possibly terminate using Russian roulette, or after the maximum number of bounces
+        if (paths.bounce[path] > 3)
+        {
+            const float q{ std::max(0.05f, 1.f - AverageIntensity(beta)) };
+            if (sampler.Next1D() < q)
+            {
+                paths.finished[path] = true;
+                continue;
+            }
+            beta /= 1.f - q;
+        }
+        paths.finished[path] = ++paths.bounce[path] == max_depth;
+    }
+}
+
+void WavefrontIntegrator::TraceShadowRays(const Scene& scene, ShadowRayQueue& shadow_rays, PathStates& paths)
+{
+    const unsigned int num_shadow_rays{ static_cast<unsigned int>(shadow_rays.rays.size()) };
+    std::unique_ptr<bool[]> occluded{ new bool[num_shadow_rays] };
+    scene.IntersectTest(shadow_rays.rays.data(), shadow_rays.intervals.data(), occluded.get(), num_shadow_rays);
+
+    for (unsigned int i = 0; i != num_shadow_rays; i++)
+    {
+        if (!occluded[i])
+        {
+            paths.L[shadow_rays.path_indices[i]] += shadow_rays.contributions[i];
+        }
+    }
+}
+
+void WavefrontIntegrator::AccumulatePaths(Film& film, PathStates& paths) const noexcept
+{
+    // Add finished paths to their pixel and compact the active ones at the beginning of the pool
+    const float inv_num_samples{ 1.f / samples_per_pixel };
+    unsigned int num_active{ 0 };
+    for (unsigned int path = 0; path != paths.num_active; path++)
+    {
+        if (paths.finished[path])
+        {
+            film(paths.pixel[path] % film.Width(), paths.pixel[path] / film.Width()) += inv_num_samples * paths.L[path];
+        }
+        else
+        {
+            if (path != num_active)
+            {
+                paths.Move(path, num_active);
+            }
+            num_active++;
+        }
+    }
+    paths.num_active = num_active;
+}
+
+} // Rabbit namespace
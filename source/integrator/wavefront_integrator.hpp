@@ -0,0 +1,144 @@
+#ifndef RABBIT2_WAVEFRONT_INTEGRATOR_HPP
+#define RABBIT2_WAVEFRONT_INTEGRATOR_HPP
+
+#include "camera/camera.hpp"
+#include "film/film.hpp"
+#include "scene/scene.hpp"
+#include "sampling/sampler.hpp"
+
+#include <atomic>
+
+namespace Rabbit
+{
+
+// Statistics of a wavefront render
+struct WavefrontStatistics
+{
+    WavefrontStatistics() noexcept
+        : num_extension_rays{ 0 }, num_shadow_rays{ 0 }, render_time_ms{ 0.f }, extension_time_ms{ 0.f },
+          sort_time_ms{ 0.f }
+    {}
+
+    // Rays traced per second, counting both extension and shadow rays
+    float MRaysPerSecond() const noexcept
+    {
+        return render_time_ms > 0.f ? (num_extension_rays + num_shadow_rays) / (render_time_ms * 1000.f) : 0.f;
+    }
+
+    // Number of rays traced to extend the paths, including the camera rays
+    uint64_t num_extension_rays;
+    // Number of shadow rays traced for direct lighting
+    uint64_t num_shadow_rays;
+    // Total render time
+    float render_time_ms;
+    // Time spent tracing the extension rays and sorting them, summed over the workers
+    float extension_time_ms;
+    float sort_time_ms;
+};
+
+// State of a pool of paths in SoA form, the active paths are always the first ones
+struct PathStates
+{
+    explicit PathStates(unsigned int pool_size);
+
+    // Move path from one slot to another
+    void Move(unsigned int from, unsigned int to) noexcept;
+
+    // Copy path from a slot of another pool
+    void CopyFrom(const PathStates& other, unsigned int from, unsigned int to) noexcept;
+
+    // Ray to trace next for each path with its interval and the found intersection
+    std::vector<Geometry::Ray> rays;
+    std::vector<Geometry::Intervalf> intervals;
+    std::vector<Geometry::TriangleIntersection> intersections;
+    // Throughput and accumulated radiance
+    std::vector<Spectrumf> beta;
+    std::vector<Spectrumf> L;
+    // Pixel of the path, number of bounces done and flags
+    std::vector<unsigned int> pixel;
+    std::vector<unsigned int> bounce;
+    std::vector<uint8_t> specular_bounce;
+    std::vector<uint8_t> finished;
+    // Number of active paths
+    unsigned int num_active;
+};
+
+// Shadow rays generated by the shading stage, with the contribution to add to the path if the ray is not occluded
+struct ShadowRayQueue
+{
+    // Add shadow ray to the queue
+    void Push(const Geometry::Ray& ray, const Geometry::Intervalf& interval, const Spectrumf& contribution,
+              unsigned int path_index)
+    {
+        rays.push_back(ray);
+        intervals.push_back(interval);
+        contributions.push_back(contribution);
+        path_indices.push_back(path_index);
+    }
+
+    void Clear() noexcept
+    {
+        rays.clear();
+        intervals.clear();
+        contributions.clear();
+        path_indices.clear();
+    }
+
+    std::vector<Geometry::Ray> rays;
+    std::vector<Geometry::Intervalf> intervals;
+    std::vector<Spectrumf> contributions;
+    std::vector<unsigned int> path_indices;
+};
+
+// Path tracer working on large pools of paths in stages instead of one path at a time. Each thread keeps a pool of
+// paths, traces all their rays as a stream, shades them grouped by material, traces the shadow rays as a second
+// stream and accumulates the paths that ended in the film. The estimator is the one of PathTracingIntegrator.
+// Optionally the paths are sorted by the octant of their ray direction and the Morton code of the origin before
+// tracing, such that the bounce rays traced together visit the same nodes
+class WavefrontIntegrator
+{
+public:
+    WavefrontIntegrator(unsigned int max_depth, unsigned int spp, unsigned int pool_size = 1u << 14u,
+                        bool sort_rays = false) noexcept;
+
+    // Render image, returns the statistics of the render
+    const WavefrontStatistics RenderImage(const Scene& scene, const CameraInterface& camera, Film& film) const;
+
+private:
+    // Camera samples still to generate for the pixels of a worker
+    struct PathGenerator;
+
+    // Render chunks of pixels until none is left
+    const WavefrontStatistics RenderChunks(const Scene& scene, const CameraInterface& camera, Film& film,
+                                           std::atomic_uint& next_chunk, unsigned int worker_id) const;
+
+    // Stages
+    void GeneratePaths(PathGenerator& generator, const CameraInterface& camera, Film& film,
+                       std::atomic_uint& next_chunk, Sampling::Sampler& sampler, PathStates& paths) const;
+
+    static void SortPaths(PathStates& paths, PathStates& sorted_paths,
+                          std::vector<std::pair<uint64_t, unsigned int>>& sort_keys);
+
+    static void ExtendPaths(const Scene& scene, PathStates& paths) noexcept;
+
+    void ShadePaths(const Scene& scene, Sampling::Sampler& sampler, PathStates& paths,
+                    std::vector<unsigned int>& shading_order, ShadowRayQueue& shadow_rays) const;
+
+    static void TraceShadowRays(const Scene& scene, ShadowRayQueue& shadow_rays, PathStates& paths);
+
+    void AccumulatePaths(Film& film, PathStates& paths) const noexcept;
+
+    // Maximum number of bounces of a path
+    const unsigned int max_depth;
+    // Samples for each pixel, rounded to a perfect square for stratification
+    const unsigned int samples_per_pixel_dim;
+    const unsigned int samples_per_pixel;
+    // Number of paths in the pool of each thread
+    const unsigned int pool_size;
+    // Sort the paths before tracing the extension rays
+    const bool sort_rays;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_WAVEFRONT_INTEGRATOR_HPP
@@ -9,33 +9,66 @@
 #include "integrator/debug_integrator.hpp"
 #include "integrator/direct_light_integrator.hpp"
 #include "integrator/path_tracing_integrator.hpp"
+#include "integrator/wavefront_integrator.hpp"
 #include "camera/perspective_camera.hpp"
 #include "camera/orthographic_camera.hpp"
 #include "light/point_light.hpp"
 #include "light/infinite_light.hpp"
+#include "bvh/leaf_benchmark.hpp"
+#include "bvh/node_benchmark.hpp"
+#include "bvh/bvh_cache.hpp"
+#include "scene/visibility_benchmark.hpp"
+#include "utilities/content_hash.hpp"
 
 #include <iostream>
 #include <chrono>
+#include <cmath>
+#include <string>
 
-int main()
+int main(int argc, char* argv[])
 {
     using namespace Rabbit;
     using namespace Rabbit::Geometry;
 
-    try
+    // The benchmarks of the kernels and of the acceleration structures only run when asked with --benchmark, the
+    // image is rendered with the wavefront integrator in place of the tiled one when asked with --wavefront, which
+    // sorts its bounce rays before tracing them when also asked with --sort-rays. A batch of frames is rendered
+    // after the image when asked with --turntable
+    bool run_benchmarks{ false };
+    bool use_wavefront{ false };
+    bool sort_rays{ false };
+    bool render_turntable{ false };
+    for (int i = 1; i != argc; i++)
     {
-        // Load bunny mesh
-        const auto mesh_read_start{ std::chrono::high_resolution_clock::now() };
-        const Mesh cornell_box{ LoadMesh("../models/cornell/cornell_box.ply", true, false) };
-        const Mesh cornell_cube{ LoadMesh("../models/cornell/cornell_cube.ply", true, true) };
-        const Mesh cornell_sphere{ LoadMesh("../models/cornell/cornell_sphere.ply", false, true) };
-        const Mesh cornell_light{ LoadMesh("../models/cornell/cornell_light.ply", true, true) };
-        const Mesh cornell_dragon{ LoadMesh("../models/cornell/cornell_dragon.ply", false, false) };
-        const auto mesh_read_end{ std::chrono::high_resolution_clock::now() };
+        const std::string argument{ argv[i] };
+        if (argument == "--benchmark")
+        {
+            run_benchmarks = true;
+        }
+        else if (argument == "--wavefront")
+        {
+            use_wavefront = true;
+        }
+        else if (argument == "--sort-rays")
+        {
+            sort_rays = true;
+        }
+        else if (argument == "--turntable")
+        {
+            render_turntable = true;
+        }
+    }
 
-        std::cout << "Read meshes in "
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(mesh_read_end - mesh_read_start).count()
-                  << " ms\n";
+    try
+    {
+        // Meshes of the scene with the normals and UVs flags they are loaded with
+        const std::vector<std::string> mesh_filenames{ "../models/cornell/cornell_box.ply",
+                                                       "../models/cornell/cornell_cube.ply",
+                                                       "../models/cornell/cornell_sphere.ply",
+                                                       "../models/cornell/cornell_light.ply",
+                                                       "../models/cornell/cornell_dragon.ply" };
+        const std::vector<std::pair<bool, bool>> mesh_load_flags{ { true, false }, { true, true }, { false, true },
+                                                                  { true, true }, { false, false } };
 
         // Transform
         const auto identity_tr{ std::make_shared<const Transform>() };
@@ -52,27 +85,137 @@ int main()
         const auto emitting_material{ std::make_shared<const EmittingMaterial>(
             std::make_shared<const ConstantTexture<const Spectrumf>>(Spectrumf{ 10.f })) };
 
+        // Transform and material of the triangles of each mesh
+        const std::vector<std::shared_ptr<const Transform>> mesh_transforms(mesh_filenames.size(), identity_tr);
+        const std::vector<std::shared_ptr<const MaterialInterface>> mesh_materials{
+            diffuse_white_material, diffuse_green_material, diffuse_white_material, emitting_material,
+            diffuse_red_material };
 
-        std::vector<Triangle> scene_triangles;
-        cornell_box.CreateTriangles(identity_tr, diffuse_white_material, scene_triangles);
-        cornell_cube.CreateTriangles(identity_tr, diffuse_green_material, scene_triangles);
-        cornell_sphere.CreateTriangles(identity_tr, diffuse_white_material, scene_triangles);
-        cornell_light.CreateTriangles(identity_tr, emitting_material, scene_triangles);
-        cornell_dragon.CreateTriangles(identity_tr, diffuse_red_material, scene_triangles);
+        // The cached BVH is used if the mesh files, their flags, transforms and materials and the configuration did
+        // not change
+        const auto mesh_read_start{ std::chrono::high_resolution_clock::now() };
+        const BVHConfig bvh_config{ 4, 1.f, 0.2f, 128, 1u << 14u, BVHBuildMethod::RECURSIVE, BVHLeafFormat::PACKETS4 };
+        const std::string bvh_cache_filename{ "cornell.bvhcache" };
+        ContentHash meshes_hash;
+        for (size_t i = 0; i != mesh_filenames.size(); i++)
+        {
+            meshes_hash.AddFile(mesh_filenames[i]);
+            meshes_hash.Add(mesh_load_flags[i].first);
+            meshes_hash.Add(mesh_load_flags[i].second);
+        }
+        const uint64_t bvh_cache_key{ BVHCache::ComputeKey(bvh_config, meshes_hash.Value(), mesh_transforms,
+                                                           mesh_materials) };
+        const std::shared_ptr<const BVHCache> bvh_cache{ BVHCache::Open(bvh_cache_filename, bvh_cache_key) };
+
+        // Load meshes
+        std::vector<Mesh> meshes;
+        if (bvh_cache != nullptr)
+        {
+            meshes = bvh_cache->LoadMeshes();
+        }
+        else
+        {
+            // All the meshes are submitted before waiting so they are loaded concurrently
+            std::vector<std::future<Mesh>> loading_meshes;
+            loading_meshes.reserve(mesh_filenames.size());
+            for (size_t i = 0; i != mesh_filenames.size(); i++)
+            {
+                loading_meshes.push_back(LoadMeshAsync(mesh_filenames[i], mesh_load_flags[i].first,
+                                                       mesh_load_flags[i].second));
+            }
+            meshes.reserve(mesh_filenames.size());
+            for (auto& loading_mesh : loading_meshes)
+            {
+                meshes.push_back(ThreadPool::Global().Wait(loading_mesh));
+            }
+        }
+        const auto mesh_read_end{ std::chrono::high_resolution_clock::now() };
+
+        std::cout << "Read meshes " << (bvh_cache != nullptr ? "from the BVH cache " : "") << "in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(mesh_read_end - mesh_read_start).count()
+                  << " ms\n";
 
-        // Create BVH
+        // Create BVH, the cached one is used in place
         const auto bvh_start{ std::chrono::high_resolution_clock::now() };
-        BVH bvh{ BVHConfig{ 4, 1.f, 0.2f, 128 }, std::move(scene_triangles) };
+        std::vector<Triangle> scene_triangles;
+        if (bvh_cache != nullptr)
+        {
+            scene_triangles = bvh_cache->CreateTriangles(meshes, mesh_transforms, mesh_materials);
+        }
+        else
+        {
+            for (size_t i = 0; i != meshes.size(); i++)
+            {
+                meshes[i].CreateTriangles(mesh_transforms[i], mesh_materials[i], scene_triangles);
+            }
+        }
+        BVH bvh{ bvh_cache != nullptr ? BVH{ bvh_config, std::move(scene_triangles), bvh_cache } :
+                 BVH{ bvh_config, std::move(scene_triangles) } };
         const auto bvh_end{ std::chrono::high_resolution_clock::now() };
 
-        std::cout << "Built BVH in "
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(bvh_end - bvh_start).count() << " ms\n";
+        std::cout << (bvh_cache != nullptr ? "Loaded BVH in " : "Built BVH in ")
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(bvh_end - bvh_start).count() << " ms, "
+                  << bvh.NumNodes() << " nodes, peak build memory "
+                  << bvh.BuildStatistics().peak_memory_bytes / (1024 * 1024) << " MB\n";
+
+        // Store the BVH for the next runs
+        if (bvh_cache == nullptr)
+        {
+            std::vector<const Mesh*> cached_meshes;
+            for (const Mesh& mesh : meshes)
+            {
+                cached_meshes.push_back(&mesh);
+            }
+            try
+            {
+                BVHCache::Write(bvh_cache_filename, bvh_cache_key, cached_meshes, bvh);
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << ex.what();
+            }
+        }
+
+        if (run_benchmarks)
+        {
+            // Measure the triangle intersection kernels
+            const LeafBenchmarkResult leaf_benchmark{ BenchmarkLeafIntersection(bvh, 1u << 12u) };
+            std::cout << "Triangle tests per second: " << leaf_benchmark.triangles_mtps << " M single, "
+                      << leaf_benchmark.packets4_mtps << " M SSE packets, "
+                      << leaf_benchmark.packets8_mtps << " M AVX packets\n";
+
+            // Compare the node layouts
+            const NodeBenchmarkResult node_benchmark{ BenchmarkNodeLayouts(bvh, 1u << 16u) };
+            std::cout << "Nodes memory and rays per second: BVH2 " << node_benchmark.bvh2.nodes_bytes / 1024
+                      << " KB " << node_benchmark.bvh2.mrps << " M, BVH8 " << node_benchmark.bvh8.nodes_bytes / 1024
+                      << " KB " << node_benchmark.bvh8.mrps << " M, compressed BVH8 "
+                      << node_benchmark.compressed_bvh8.nodes_bytes / 1024 << " KB "
+                      << node_benchmark.compressed_bvh8.mrps << " M\n";
+
+            // Compare the orders of the binary nodes in memory
+            const BinaryLayoutBenchmarkResult layout_benchmark{
+                BenchmarkBinaryNodeLayouts(bvh_config, bvh.Triangles(), 1u << 16u) };
+            std::cout << "Binary node orders rays per second: depth first " << layout_benchmark.depth_first.mrps
+                      << " M, subtree clusters " << layout_benchmark.subtree_clusters.mrps << " M, van Emde Boas "
+                      << layout_benchmark.van_emde_boas.mrps << " M\n";
+            if (layout_benchmark.depth_first.l1_misses_per_ray >= 0.f)
+            {
+                std::cout << "L1 and LLC misses per ray: depth first "
+                          << layout_benchmark.depth_first.l1_misses_per_ray << " "
+                          << layout_benchmark.depth_first.last_level_misses_per_ray << ", subtree clusters "
+                          << layout_benchmark.subtree_clusters.l1_misses_per_ray << " "
+                          << layout_benchmark.subtree_clusters.last_level_misses_per_ray << ", van Emde Boas "
+                          << layout_benchmark.van_emde_boas.l1_misses_per_ray << " "
+                          << layout_benchmark.van_emde_boas.last_level_misses_per_ray << "\n";
+            }
+        }
 
         // Create scene
-        Scene scene{ std::move(bvh) };
+        Scene scene{ std::move(bvh), SceneAccelerator::BVH4 };
 
         // Add lights
         scene.SetupAreaLights(36);
+        const auto scene_ready{ std::chrono::high_resolution_clock::now() };
 
         // Create film
         constexpr unsigned int WIDTH{ 256 };
@@ -84,19 +227,75 @@ int main()
         const PerspectiveCamera perspective_camera{ Point3f{ 0.f, 0.f, 30.f }, Point3f{}, Vector3f{ 0.f, 1.f, 0.f },
                                                     60.f, WIDTH, HEIGHT };
 
+        // Measure primary visibility with single rays and coherent packets
+        if (run_benchmarks)
+        {
+            const VisibilityBenchmarkResult visibility_benchmark{
+                BenchmarkPrimaryVisibility(scene, perspective_camera, WIDTH, HEIGHT) };
+            std::cout << "Primary rays per second: " << visibility_benchmark.single_mrps << " M single, "
+                      << visibility_benchmark.packet8_mrps << " M packets of 8, "
+                      << visibility_benchmark.packet16_mrps << " M packets of 16\n";
+        }
+
         // Create integrator
-        const ImageIntegrator image_integrator{ std::make_unique<const PathTracingIntegrator>(10),
-                                                Geometry::Point2ui{ 16, 16 }, NUM_SAMPLES };
+        if (use_wavefront)
+        {
+            const WavefrontIntegrator wavefront_integrator{ 10, NUM_SAMPLES, 1u << 14u, sort_rays };
 
-        const auto start{ std::chrono::high_resolution_clock::now() };
-        image_integrator.RenderImage(scene, perspective_camera, film);
-        const auto end{ std::chrono::high_resolution_clock::now() };
+            const WavefrontStatistics statistics{ wavefront_integrator.RenderImage(scene, perspective_camera, film) };
 
-        std::cout << "Rendering time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
-                  << " ms\n";
+            std::cout << "Rendering time: " << statistics.render_time_ms << " ms, "
+                      << statistics.MRaysPerSecond() << " M rays per second, extension rays traced in "
+                      << statistics.extension_time_ms << " ms and sorted in " << statistics.sort_time_ms << " ms\n";
+        }
+        else
+        {
+            const ImageIntegrator image_integrator{ std::make_unique<const PathTracingIntegrator>(10),
+                                                    Geometry::Point2ui{ 16, 16 }, NUM_SAMPLES };
+
+            const RenderStatistics statistics{ image_integrator.RenderImage(scene, perspective_camera, film) };
+
+            std::cout << "Rendering time: " << statistics.render_time_ms << " ms\n";
+        }
 
         // Write out image
         film.WritePNG("render.png");
+
+        // Render a turntable of the scene, meshes, BVH and lights are set up once for all the frames. The cameras
+        // swing in front of the box since its back is open
+        if (render_turntable)
+        {
+            constexpr unsigned int NUM_FRAMES{ 8 };
+            constexpr float TURNTABLE_ANGLE{ Radians(30.f) };
+            std::vector<PerspectiveCamera> turntable_cameras;
+            std::vector<Film> turntable_films;
+            turntable_cameras.reserve(NUM_FRAMES);
+            turntable_films.reserve(NUM_FRAMES);
+            std::vector<BatchFrame> turntable_frames;
+            for (unsigned int frame = 0; frame != NUM_FRAMES; frame++)
+            {
+                const float angle{ TURNTABLE_ANGLE * (2.f * frame / (NUM_FRAMES - 1) - 1.f) };
+                turntable_cameras.emplace_back(Point3f{ 30.f * std::sin(angle), 0.f, 30.f * std::cos(angle) },
+                                               Point3f{}, Vector3f{ 0.f, 1.f, 0.f }, 60.f, WIDTH, HEIGHT);
+                turntable_films.emplace_back(WIDTH, HEIGHT);
+                turntable_frames.emplace_back(turntable_cameras.back(), turntable_films.back());
+            }
+
+            const ImageIntegrator image_integrator{ std::make_unique<const PathTracingIntegrator>(10),
+                                                    Geometry::Point2ui{ 16, 16 }, NUM_SAMPLES / 4 };
+            const BatchStatistics batch_statistics{ image_integrator.RenderBatch(scene, turntable_frames,
+                                                                                 BatchMode::INTERLEAVED) };
+            for (unsigned int frame = 0; frame != NUM_FRAMES; frame++)
+            {
+                std::cout << "Frame " << frame << " done after " << batch_statistics.frame_time_ms[frame] << " ms\n";
+                turntable_films[frame].WritePNG("turntable_" + std::to_string(frame) + ".png");
+            }
+            const auto setup_time_ms{ std::chrono::duration<float, std::milli>(scene_ready - mesh_read_start).count() };
+            std::cout << "Turntable time: " << batch_statistics.total_time_ms << " ms, "
+                      << batch_statistics.AmortisedFrameTimeMs() << " ms per frame, "
+                      << (setup_time_ms + batch_statistics.total_time_ms) / NUM_FRAMES
+                      << " ms per frame including the scene setup\n";
+        }
     }
     catch (const std::exception& ex)
     {
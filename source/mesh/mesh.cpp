@@ -54,6 +54,7 @@ const Geometry::TriangleIntersection Triangle::Sample(const Geometry::TriangleIn
     // Sample point
     Geometry::TriangleIntersection sampled_intersection;
     sampled_intersection.hit_triangle = this;
+    sampled_intersection.material = material.get();
     sampled_intersection.barycentric_coordinates = Sampling::UniformSampleTriangle(u);
     sampled_intersection.hit_point = sampled_intersection.barycentric_coordinates.x * p0 +
                                      sampled_intersection.barycentric_coordinates.y * p1 +
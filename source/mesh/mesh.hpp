@@ -63,6 +63,18 @@ public:
         return vertices[vertex_index];
     }
 
+    // Move a vertex, the BVHs built on the mesh need to be refitted afterwards
+    void SetVertexAt(unsigned int vertex_index, const Geometry::Point3f& vertex) noexcept
+    {
+        assert(vertex_index < vertices.size());
+        vertices[vertex_index] = vertex;
+    }
+
+    unsigned int NumVertices() const noexcept
+    {
+        return static_cast<unsigned int>(vertices.size());
+    }
+
     bool HasNormals() const
     {
         return !normals.empty();
@@ -85,6 +97,27 @@ public:
         return uvs[uv_index];
     }
 
+    // Access the buffers of the mesh
+    const std::vector<Geometry::Point3f>& Vertices() const noexcept
+    {
+        return vertices;
+    }
+
+    const std::vector<Geometry::Vector3f>& Normals() const noexcept
+    {
+        return normals;
+    }
+
+    const std::vector<Geometry::Vector2f>& UVs() const noexcept
+    {
+        return uvs;
+    }
+
+    const std::vector<TriangleDescription>& TriangleDescriptions() const noexcept
+    {
+        return triangles;
+    }
+
     // Create list of triangles for the mesh
     std::vector<Triangle> CreateTriangles(const std::shared_ptr<const Geometry::Transform>& transform,
                                           const std::shared_ptr<const MaterialInterface>& material) const noexcept;
@@ -102,88 +135,56 @@ private:
     std::vector<TriangleDescription> triangles;
 };
 
-class Triangle
+// Ray data needed by the watertight triangle test, computed once per ray and shared by all the tested triangles
+struct WatertightRay
 {
-public:
-    Triangle(const TriangleDescription& description, const Mesh& m,
-             const std::shared_ptr<const Geometry::Transform>& transform,
-             const std::shared_ptr<const MaterialInterface>& material) noexcept;
+    WatertightRay() noexcept = default;
 
-    // Compute triangle BBox in world space
-    const Geometry::BBox Bounds() const noexcept
+    explicit WatertightRay(const Geometry::Ray& ray) noexcept
+        : origin{ ray.Origin() }
     {
-        return { transformation->ToWorld(mesh.VertexAt(description.v0)),
-                 transformation->ToWorld(mesh.VertexAt(description.v1)),
-                 transformation->ToWorld(mesh.VertexAt(description.v2)) };
+        // Permute components such that the largest dimension of the direction is the z one
+        kz = Abs(ray.Direction()).LargestDimension();
+        kx = kz + 1;
+        if (kx == 3)
+        {
+            kx = 0;
+        }
+        ky = kx + 1;
+        if (ky == 3)
+        {
+            ky = 0;
+        }
+        const Geometry::Vector3f d{ Permute(ray.Direction(), kx, ky, kz) };
+
+        // Shear transformation aligning the direction with the z axis
+        sz = 1.f / d.z;
+        sx = -d.x * sz;
+        sy = -d.y * sz;
     }
 
-    // Intersect ray with triangle
-    void Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
-                   Geometry::TriangleIntersection& intersection) const noexcept;
-
-    // Check for intersection
-    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
-
-    // Fill geometry information, ray is assumed to be in world space so we can compute the hit point directly
-    void ComputeIntersectionGeometry(const Geometry::Ray& ray,
-                                     float intersection_parameter,
-                                     Geometry::TriangleIntersection& intersection) const noexcept;
-
-    // Sample TriangleIntersection on the triangle from a given reference intersection
-    const Geometry::TriangleIntersection Sample(const Geometry::TriangleIntersection& reference_intersection,
-                                                const Geometry::Point2f& u,
-                                                float& sampled_intersection_pdf) const noexcept;
-
-    // Pointer to the material
-    std::shared_ptr<const MaterialInterface> material;
-
-private:
-    // Reference to the triangle description
-    const TriangleDescription& description;
-    // Mesh associated
-    const Mesh& mesh;
-    // Transformation for the triangle
-    std::shared_ptr<const Geometry::Transform> transformation;
+    Geometry::Point3f origin;
+    unsigned int kx, ky, kz;
+    float sx, sy, sz;
 };
 
-inline void Triangle::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
-                                Geometry::TriangleIntersection& intersection) const noexcept
+// Watertight ray triangle intersection test, on hit returns true and sets the distance and barycentric coordinates
+inline bool IntersectTriangle(const Geometry::Point3f& p0, const Geometry::Point3f& p1, const Geometry::Point3f& p2,
+                              const WatertightRay& ray, const Geometry::Intervalf& interval,
+                              float& t, Geometry::Point3f& barycentric_coordinates) noexcept
 {
-    const Geometry::Point3f local_origin{ transformation->ToLocal(ray.Origin()) };
-    const Geometry::Vector3f local_direction{ transformation->ToLocal(ray.Direction()) };
-
-    // Translate vertices based on ray origin
-    Geometry::Vector3f v0t{ mesh.VertexAt(description.v0) - local_origin };
-    Geometry::Vector3f v1t{ mesh.VertexAt(description.v1) - local_origin };
-    Geometry::Vector3f v2t{ mesh.VertexAt(description.v2) - local_origin };
-
-    // Permute components of triangle vertices and ray direction
-    const unsigned int kz{ Abs(local_direction).LargestDimension() };
-    unsigned int kx = kz + 1;
-    if (kx == 3)
-    {
-        kx = 0;
-    }
-    unsigned int ky = kx + 1;
-    if (ky == 3)
-    {
-        ky = 0;
-    }
-    const Geometry::Vector3f d{ Permute(local_direction, kx, ky, kz) };
-    v0t = Permute(v0t, kx, ky, kz);
-    v1t = Permute(v1t, kx, ky, kz);
-    v2t = Permute(v2t, kx, ky, kz);
+    // Translate and permute vertices based on ray
+    Geometry::Vector3f v0t{ Permute(p0 - ray.origin, ray.kx, ray.ky, ray.kz) };
+    Geometry::Vector3f v1t{ Permute(p1 - ray.origin, ray.kx, ray.ky, ray.kz) };
+    Geometry::Vector3f v2t{ Permute(p2 - ray.origin, ray.kx, ray.ky, ray.kz) };
 
     // Apply shear transformation to translated vertex positions
-    const float sz{ 1.f / d.z };
-    const float sx{ -d.x * sz };
-    const float sy{ -d.y * sz };
-    v0t.x += sx * v0t.z;
-    v0t.y += sy * v0t.z;
-    v1t.x += sx * v1t.z;
-    v1t.y += sy * v1t.z;
-    v2t.x += sx * v2t.z;
-    v2t.y += sy * v2t.z;
+    v0t.x += ray.sx * v0t.z;
+    v0t.y += ray.sy * v0t.z;
+    v1t.x += ray.sx * v1t.z;
+    v1t.y += ray.sy * v1t.z;
+    v2t.x += ray.sx * v2t.z;
+    v2t.y += ray.sy * v2t.z;
 
     // Compute edge function coefficients e0, e1, and e2
     const float e0{ v1t.x * v2t.y - v1t.y * v2t.x };
@@ -193,106 +194,161 @@ inline void Triangle::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& i
     // Perform triangle edge and determinant tests
     if ((e0 < 0.f || e1 < 0.f || e2 < 0.f) && (e0 > 0.f || e1 > 0.f || e2 > 0.f))
     {
-        return;
+        return false;
     }
     const float det{ e0 + e1 + e2 };
     if (det == 0.f)
     {
-        return;
+        return false;
     }
 
     // Compute scaled hit distance to triangle and test against ray range
-    v0t.z *= sz;
-    v1t.z *= sz;
-    v2t.z *= sz;
-    const float t_scaled{ e0 * v0t.z + e1 * v1t.z + e2 * v2t.z };
+    const float t_scaled{ e0 * (v0t.z * ray.sz) + e1 * (v1t.z * ray.sz) + e2 * (v2t.z * ray.sz) };
     if (det < 0.f && (t_scaled >= 0.f || t_scaled < interval.End() * det || t_scaled > interval.Start() * det))
     {
-        return;
+        return false;
     }
     else if (det > 0.f && (t_scaled <= 0.f || t_scaled > interval.End() * det || t_scaled < interval.Start() * det))
     {
-        return;
+        return false;
     }
 
     // Compute barycentric coordinates and value for triangle intersection
     const float inv_det{ 1.f / det };
-    intersection.barycentric_coordinates = Geometry::Point3f{ e0 * inv_det, e1 * inv_det, e2 * inv_det };
-    interval.SetEnd(t_scaled * inv_det);
+    barycentric_coordinates = Geometry::Point3f{ e0 * inv_det, e1 * inv_det, e2 * inv_det };
+    t = t_scaled * inv_det;
 
-    // Set pointer
-    intersection.hit_triangle = this;
+    return true;
 }
 
-inline bool Triangle::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
+// Intersection ready triangle, vertices are already in world space so testing it needs no transformation and no
+// access to the mesh. The index references the Triangle holding the shading data
+struct PrecomputedTriangle
+{
+    // Index of the entries not referencing any triangle
+    static constexpr uint32_t EMPTY_INDEX{ std::numeric_limits<uint32_t>::max() };
+
+    // Intersect ray with triangle, on hit the end of the interval is moved to the hit distance
+    bool Intersect(const WatertightRay& ray, Geometry::Intervalf& interval,
+                   Geometry::Point3f& barycentric_coordinates) const noexcept
+    {
+        float t;
+        if (IntersectTriangle(v0, v1, v2, ray, interval, t, barycentric_coordinates))
+        {
+            interval.SetEnd(t);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Check for intersection
+    bool IntersectTest(const WatertightRay& ray, const Geometry::Intervalf& interval) const noexcept
+    {
+        float t;
+        Geometry::Point3f barycentric_coordinates;
+
+        return IntersectTriangle(v0, v1, v2, ray, interval, t, barycentric_coordinates);
+    }
+
+    Geometry::Point3f v0, v1, v2;   // 36 bytes
+    uint32_t triangle_index;        // 4 bytes
+};
+
+class Triangle
 {
-    const Geometry::Point3f local_origin{ transformation->ToLocal(ray.Origin()) };
-    const Geometry::Vector3f local_direction{ transformation->ToLocal(ray.Direction()) };
-
-    // Translate vertices based on ray origin
-    Geometry::Vector3f v0t{ mesh.VertexAt(description.v0) - local_origin };
-    Geometry::Vector3f v1t{ mesh.VertexAt(description.v1) - local_origin };
-    Geometry::Vector3f v2t{ mesh.VertexAt(description.v2) - local_origin };
-
-    // Permute components of triangle vertices and ray direction
-    const unsigned int kz{ Abs(local_direction).LargestDimension() };
-    unsigned int kx = kz + 1;
-    if (kx == 3)
+public:
+    Triangle(const TriangleDescription& description, const Mesh& m,
+             const std::shared_ptr<const Geometry::Transform>& transform,
+             const std::shared_ptr<const MaterialInterface>& material) noexcept;
+
+    // Compute triangle BBox in world space
+    const Geometry::BBox Bounds() const noexcept
     {
-        kx = 0;
+        return { transformation->ToWorld(mesh.VertexAt(description.v0)),
+                 transformation->ToWorld(mesh.VertexAt(description.v1)),
+                 transformation->ToWorld(mesh.VertexAt(description.v2)) };
     }
-    unsigned int ky = kx + 1;
-    if (ky == 3)
+
+    // Compute intersection ready data for the triangle, index is the position of the triangle in its list
+    const PrecomputedTriangle Precompute(uint32_t index) const noexcept
     {
-        ky = 0;
+        return { transformation->ToWorld(mesh.VertexAt(description.v0)),
+                 transformation->ToWorld(mesh.VertexAt(description.v1)),
+                 transformation->ToWorld(mesh.VertexAt(description.v2)),
+                 index };
     }
-    const Geometry::Vector3f d{ Permute(local_direction, kx, ky, kz) };
-    v0t = Permute(v0t, kx, ky, kz);
-    v1t = Permute(v1t, kx, ky, kz);
-    v2t = Permute(v2t, kx, ky, kz);
 
-    // Apply shear transformation to translated vertex positions
-    const float sz{ 1.f / d.z };
-    const float sx{ -d.x * sz };
-    const float sy{ -d.y * sz };
-    v0t.x += sx * v0t.z;
-    v0t.y += sy * v0t.z;
-    v1t.x += sx * v1t.z;
-    v1t.y += sy * v1t.z;
-    v2t.x += sx * v2t.z;
-    v2t.y += sy * v2t.z;
+    // Intersect ray with triangle
+    void Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                   Geometry::TriangleIntersection& intersection) const noexcept;
 
-    // Compute edge function coefficients e0, e1, and e2
-    const float e0{ v1t.x * v2t.y - v1t.y * v2t.x };
-    const float e1{ v2t.x * v0t.y - v2t.y * v0t.x };
-    const float e2{ v0t.x * v1t.y - v0t.y * v1t.x };
+    // Check for intersection
+    bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept;
 
-    // Perform triangle edge and determinant tests
-    if ((e0 < 0.f || e1 < 0.f || e2 < 0.f) && (e0 > 0.f || e1 > 0.f || e2 > 0.f))
+    // Fill geometry information, ray is assumed to be in world space so we can compute the hit point directly
+    void ComputeIntersectionGeometry(const Geometry::Ray& ray,
+                                     float intersection_parameter,
+                                     Geometry::TriangleIntersection& intersection) const noexcept;
+
+    // Sample TriangleIntersection on the triangle from a given reference intersection
+    const Geometry::TriangleIntersection Sample(const Geometry::TriangleIntersection& reference_intersection,
+                                                const Geometry::Point2f& u,
+                                                float& sampled_intersection_pdf) const noexcept;
+
+    // Access the mesh of the triangle, its description in the mesh and its transformation
+    const Mesh& TriangleMesh() const noexcept
     {
-        return false;
+        return mesh;
     }
-    const float det{ e0 + e1 + e2 };
-    if (det == 0.f)
+
+    const TriangleDescription& Description() const noexcept
     {
-        return false;
+        return description;
     }
 
-    // Compute scaled hit distance to triangle and test against ray  range
-    v0t.z *= sz;
-    v1t.z *= sz;
-    v2t.z *= sz;
-    const float t_scaled{ e0 * v0t.z + e1 * v1t.z + e2 * v2t.z };
-    if (det < 0.f && (t_scaled >= 0.f || t_scaled < interval.End() * det || t_scaled > interval.Start() * det))
+    const std::shared_ptr<const Geometry::Transform>& Transformation() const noexcept
     {
-        return false;
+        return transformation;
     }
-    else if (det > 0.f && (t_scaled <= 0.f || t_scaled > interval.End() * det || t_scaled < interval.Start() * det))
+
+    // Pointer to the material
+    std::shared_ptr<const MaterialInterface> material;
+
+private:
+    // Reference to the triangle description
+    const TriangleDescription& description;
+    // Mesh associated
+    const Mesh& mesh;
+    // Transformation for the triangle
+    std::shared_ptr<const Geometry::Transform> transformation;
+};
+
+inline void Triangle::Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
+                                Geometry::TriangleIntersection& intersection) const noexcept
+{
+    const WatertightRay local_ray{ Geometry::Ray{ transformation->ToLocal(ray.Origin()),
+                                                  transformation->ToLocal(ray.Direction()) } };
+    float t;
+    if (IntersectTriangle(mesh.VertexAt(description.v0), mesh.VertexAt(description.v1),
+                          mesh.VertexAt(description.v2), local_ray, interval,
+                          t, intersection.barycentric_coordinates))
     {
-        return false;
+        interval.SetEnd(t);
+        // Set pointer
+        intersection.hit_triangle = this;
     }
+}
 
-    return true;
+inline bool Triangle::IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
+{
+    const WatertightRay local_ray{ Geometry::Ray{ transformation->ToLocal(ray.Origin()),
+                                                  transformation->ToLocal(ray.Direction()) } };
+    float t;
+    Geometry::Point3f barycentric_coordinates;
+
+    return IntersectTriangle(mesh.VertexAt(description.v0), mesh.VertexAt(description.v1),
+                             mesh.VertexAt(description.v2), local_ray, interval, t, barycentric_coordinates);
 }
 
 inline void Triangle::ComputeIntersectionGeometry(const Geometry::Ray& ray,
@@ -323,8 +379,9 @@ inline void Triangle::ComputeIntersectionGeometry(const Geometry::Ray& ray,
             Geometry::Normalize(transformation->NormalToWorld(Geometry::Cross(p1 - p0, p2 - p0))) };
     }
 
-    // Set outgoing direction
+    // Set outgoing direction and material
     intersection.wo = Geometry::Normalize(-ray.Direction());
+    intersection.material = material.get();
 
     // Check if we have UV coordinates
     if (mesh.HasUVs())
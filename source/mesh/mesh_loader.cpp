@@ -3,13 +3,14 @@
 //
 
 #include "mesh_loader.hpp"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tinyobj.hpp"
+#include "utilities/mapped_file.hpp"
 
 #define TINYPLY_IMPLEMENTATION
 #include "tinyply.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 
@@ -18,84 +19,489 @@ namespace Rabbit
 namespace MeshLoader
 {
 
-// FIXME
-const Mesh LoadOBJ(const std::string& filename, bool load_normal, bool load_uv)
+namespace
 {
-    using namespace tinyobj;
 
-    attrib_t attrib;
-    std::vector<shape_t> shapes;
-    std::vector<material_t> materials;
+// Size of the blocks of the mapped file that are copied before being dropped from memory
+constexpr size_t PLY_BLOCK_SIZE{ 16u << 20u };
+// Minimum number of triangles or vertices processed by a task when computing smooth normals
+constexpr unsigned int SMOOTH_NORMALS_GRAIN_SIZE{ 1u << 16u };
+// Size of the chunks an OBJ file is split in to be parsed in parallel, they are extended to the end of their last line
+constexpr size_t OBJ_CHUNK_SIZE{ 4u << 20u };
 
-    // Read file
-    std::string warn, err;
-    const bool tinyobj_result{ LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str()) };
+// Type of a property of a PLY file
+enum class PLYType
+{
+    INT8,
+    UINT8,
+    INT16,
+    UINT16,
+    INT32,
+    UINT32,
+    FLOAT32,
+    FLOAT64,
+    INVALID
+};
+
+struct PLYProperty
+{
+    std::string name;
+    PLYType type;
+    // Lists store the number of elements with the count type followed by the elements
+    bool is_list;
+    PLYType count_type;
+};
 
-    // Check for errors
-    if (!err.empty())
+struct PLYElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> properties;
+};
+
+struct PLYHeader
+{
+    bool binary_little_endian;
+    std::vector<PLYElement> elements;
+    // Offset of the first element after the header
+    size_t data_offset;
+};
+
+PLYType ParsePLYType(const std::string& name) noexcept
+{
+    if (name == "char" || name == "int8")
     {
-        throw std::runtime_error(err);
+        return PLYType::INT8;
     }
-    if (!tinyobj_result)
+    if (name == "uchar" || name == "uint8")
     {
-        std::ostringstream error_string;
-        error_string << "Error in loading .obj file: " << filename << "\n";
-        throw std::runtime_error(error_string.str());
+        return PLYType::UINT8;
+    }
+    if (name == "short" || name == "int16")
+    {
+        return PLYType::INT16;
+    }
+    if (name == "ushort" || name == "uint16")
+    {
+        return PLYType::UINT16;
+    }
+    if (name == "int" || name == "int32")
+    {
+        return PLYType::INT32;
+    }
+    if (name == "uint" || name == "uint32")
+    {
+        return PLYType::UINT32;
     }
+    if (name == "float" || name == "float32")
+    {
+        return PLYType::FLOAT32;
+    }
+    if (name == "double" || name == "float64")
+    {
+        return PLYType::FLOAT64;
+    }
+
+    return PLYType::INVALID;
+}
 
-    // Store vertices
-    std::vector<Geometry::Point3f> vertices(attrib.vertices.size() / 3);
-    if (std::is_same<float, real_t>::value)
+size_t PLYTypeSize(PLYType type) noexcept
+{
+    switch (type)
     {
-        std::memcpy(&(vertices[0].x), attrib.vertices.data(), attrib.vertices.size() * sizeof(float));
+        case PLYType::INT8:
+        case PLYType::UINT8:
+            return 1;
+        case PLYType::INT16:
+        case PLYType::UINT16:
+            return 2;
+        case PLYType::INT32:
+        case PLYType::UINT32:
+        case PLYType::FLOAT32:
+            return 4;
+        case PLYType::FLOAT64:
+            return 8;
+        default:
+            return 0;
     }
-    else
+}
+
+bool IsLittleEndian() noexcept
+{
+    const uint32_t one{ 1 };
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &one, 1);
+
+    return first_byte == 1;
+}
+
+// Parse the header at the start of the file, returns false if it is not a valid PLY header
+bool ParsePLYHeader(const MappedFile& file, PLYHeader& header)
+{
+    header.binary_little_endian = false;
+    size_t line_start{ 0 };
+    bool first_line{ true };
+    while (line_start < file.Size())
     {
-        for (size_t v = 0; v != vertices.size(); v++)
+        const char* line_begin{ file.Data() + line_start };
+        const char* line_end{ static_cast<const char*>(std::memchr(line_begin, '\n', file.Size() - line_start)) };
+        if (line_end == nullptr)
         {
-            vertices[v] = Geometry::Point3f{ attrib.vertices[3 * v], attrib.vertices[3 * v + 1],
-                                             attrib.vertices[3 * v + 2] };
+            return false;
+        }
+        line_start += static_cast<size_t>(line_end - line_begin) + 1;
+
+        std::istringstream line{ std::string{ line_begin, line_end } };
+        std::string keyword;
+        line >> keyword;
+        if (first_line)
+        {
+            if (keyword != "ply")
+            {
+                return false;
+            }
+            first_line = false;
+        }
+        else if (keyword == "format")
+        {
+            std::string format;
+            line >> format;
+            header.binary_little_endian = format == "binary_little_endian";
+        }
+        else if (keyword == "element")
+        {
+            PLYElement element;
+            line >> element.name >> element.count;
+            if (!line)
+            {
+                return false;
+            }
+            header.elements.push_back(std::move(element));
+        }
+        else if (keyword == "property")
+        {
+            if (header.elements.empty())
+            {
+                return false;
+            }
+            PLYProperty property;
+            std::string type;
+            line >> type;
+            property.is_list = type == "list";
+            property.count_type = PLYType::INVALID;
+            if (property.is_list)
+            {
+                std::string count_type;
+                line >> count_type >> type;
+                property.count_type = ParsePLYType(count_type);
+            }
+            property.type = ParsePLYType(type);
+            line >> property.name;
+            if (!line || property.type == PLYType::INVALID ||
+                (property.is_list && property.count_type == PLYType::INVALID))
+            {
+                return false;
+            }
+            header.elements.back().properties.push_back(std::move(property));
+        }
+        else if (keyword == "end_header")
+        {
+            header.data_offset = line_start;
+            return true;
         }
     }
 
-    // Store indices
-    std::vector<unsigned int> indices;
+    return false;
+}
 
-    // Add all triangles from all shapes to a single list
-    size_t index_offset{ 0 };
-    for (const auto& shape : shapes)
+// Size of an element with only scalar properties, 0 if it contains lists
+size_t PLYElementStride(const PLYElement& element) noexcept
+{
+    size_t stride{ 0 };
+    for (const PLYProperty& property : element.properties)
     {
-        // Loop over faces
-        for (size_t f = 0; f != shape.mesh.num_face_vertices.size(); f++)
+        if (property.is_list)
         {
-            // Check that the face is a triangle
-            if (shape.mesh.num_face_vertices[f] != 3)
+            return 0;
+        }
+        stride += PLYTypeSize(property.type);
+    }
+
+    return stride;
+}
+
+// Find the offsets of float properties in the element, returns false if one of them is missing or is not a float
+template <size_t N>
+bool FindFloatProperties(const PLYElement& element, const std::string (&names)[N], size_t (&offsets)[N]) noexcept
+{
+    for (size_t i = 0; i != N; i++)
+    {
+        size_t offset{ 0 };
+        bool found{ false };
+        for (const PLYProperty& property : element.properties)
+        {
+            if (property.name == names[i])
             {
-                throw std::runtime_error("Face is not a triangle\n");
+                found = property.type == PLYType::FLOAT32;
+                break;
+            }
+            offset += PLYTypeSize(property.type);
+        }
+        if (!found)
+        {
+            return false;
+        }
+        offsets[i] = offset;
+    }
+
+    return true;
+}
+
+// Copy the float properties at the given offsets of consecutive elements to the output, when the properties are
+// consecutive they are copied together and when they are the whole element the range is copied at once
+template <typename T, size_t N>
+void GatherFloatProperties(const char* elements, size_t stride, size_t count, const size_t (&offsets)[N],
+                           T* output) noexcept
+{
+    static_assert(sizeof(T) == N * sizeof(float), "The properties must fill the output");
+
+    bool consecutive{ true };
+    for (size_t i = 1; i != N; i++)
+    {
+        consecutive = consecutive && offsets[i] == offsets[0] + i * sizeof(float);
+    }
+    if (consecutive && stride == sizeof(T))
+    {
+        std::memcpy(output, elements, count * sizeof(T));
+    }
+    else if (consecutive)
+    {
+        for (size_t e = 0; e != count; e++)
+        {
+            std::memcpy(output + e, elements + e * stride + offsets[0], sizeof(T));
+        }
+    }
+    else
+    {
+        for (size_t e = 0; e != count; e++)
+        {
+            float values[N];
+            for (size_t i = 0; i != N; i++)
+            {
+                std::memcpy(values + i, elements + e * stride + offsets[i], sizeof(float));
             }
+            std::memcpy(output + e, values, sizeof(T));
+        }
+    }
+}
+
+// Read a binary little endian file whose vertices have float properties and whose faces are only a list of int
+// indices with one byte counts. The data is copied once from the mapped file, which is dropped from memory as it
+// is consumed. Returns false if the file has another layout
+bool ReadBinaryPLY(const MappedFile& file, bool load_normal, bool load_uv,
+                   std::vector<Geometry::Point3f>& vertices, std::vector<Geometry::Vector3f>& normals,
+                   std::vector<Geometry::Vector2f>& uvs, std::vector<unsigned int>& indices)
+{
+    PLYHeader header;
+    if (!IsLittleEndian() || !ParsePLYHeader(file, header) || !header.binary_little_endian)
+    {
+        return false;
+    }
 
-            // Loop over the vertices in the face
-            for (int vertex = 0; vertex != 3; vertex++)
+    // Find the vertices and the faces, the other elements are skipped and need to have a fixed size
+    const PLYElement* vertex_element{ nullptr };
+    const PLYElement* face_element{ nullptr };
+    size_t vertex_offset{ 0 };
+    size_t face_offset{ 0 };
+    size_t offset{ header.data_offset };
+    for (const PLYElement& element : header.elements)
+    {
+        size_t stride{ PLYElementStride(element) };
+        if (element.name == "face")
+        {
+            // All the faces are triangles, so a face is the count followed by three indices
+            if (element.properties.size() != 1 || element.properties[0].name != "vertex_indices" ||
+                PLYTypeSize(element.properties[0].count_type) != 1 ||
+                (element.properties[0].type != PLYType::INT32 && element.properties[0].type != PLYType::UINT32))
             {
-                // Access the vertex data
-                const index_t& idx = shape.mesh.indices[index_offset + vertex];
-                // Add index of the vertices
-                indices.emplace_back(idx.vertex_index);
+                return false;
             }
+            face_element = &element;
+            face_offset = offset;
+            stride = 1 + 3 * sizeof(uint32_t);
+        }
+        else if (stride == 0)
+        {
+            return false;
+        }
+        else if (element.name == "vertex")
+        {
+            vertex_element = &element;
+            vertex_offset = offset;
+        }
+        if (element.count > (file.Size() - offset) / stride)
+        {
+            throw std::runtime_error("PLY file is truncated\n");
+        }
+        offset += element.count * stride;
+    }
+    if (vertex_element == nullptr || face_element == nullptr)
+    {
+        return false;
+    }
+
+    // Find the vertex properties
+    const std::string position_names[3]{ "x", "y", "z" };
+    const std::string normal_names[3]{ "nx", "ny", "nz" };
+    const std::string uv_names[2]{ "s", "t" };
+    size_t position_offsets[3];
+    size_t normal_offsets[3];
+    size_t uv_offsets[2];
+    if (!FindFloatProperties(*vertex_element, position_names, position_offsets) ||
+        (load_normal && !FindFloatProperties(*vertex_element, normal_names, normal_offsets)) ||
+        (load_uv && !FindFloatProperties(*vertex_element, uv_names, uv_offsets)))
+    {
+        return false;
+    }
+
+    file.AdviseSequential();
 
-            // Go to next triangle
-            index_offset += 3;
+    // Copy the vertices a block at a time
+    const size_t vertex_stride{ PLYElementStride(*vertex_element) };
+    const size_t num_vertices{ vertex_element->count };
+    const size_t vertices_per_block{ std::max<size_t>(PLY_BLOCK_SIZE / vertex_stride, 1) };
+    vertices.resize(num_vertices);
+    normals.resize(load_normal ? num_vertices : 0);
+    uvs.resize(load_uv ? num_vertices : 0);
+    for (size_t first = 0; first < num_vertices; first += vertices_per_block)
+    {
+        const size_t count{ std::min(vertices_per_block, num_vertices - first) };
+        const size_t block_offset{ vertex_offset + first * vertex_stride };
+        const char* block{ file.Data() + block_offset };
+        GatherFloatProperties(block, vertex_stride, count, position_offsets, vertices.data() + first);
+        if (load_normal)
+        {
+            GatherFloatProperties(block, vertex_stride, count, normal_offsets, normals.data() + first);
         }
+        if (load_uv)
+        {
+            GatherFloatProperties(block, vertex_stride, count, uv_offsets, uvs.data() + first);
+        }
+        file.Evict(block_offset, count * vertex_stride);
     }
 
-    // Now that we have our vertices and indices, we can compute the normals
-    std::vector<Geometry::Vector3f> smooth_normals = SmoothNormals(vertices, indices);
+    // Copy the indices a block at a time, checking that the faces are triangles of existing vertices
+    const size_t face_stride{ 1 + 3 * sizeof(uint32_t) };
+    const size_t num_faces{ face_element->count };
+    const size_t faces_per_block{ PLY_BLOCK_SIZE / face_stride };
+    indices.resize(3 * num_faces);
+    uint32_t max_index{ 0 };
+    for (size_t first = 0; first < num_faces; first += faces_per_block)
+    {
+        const size_t count{ std::min(faces_per_block, num_faces - first) };
+        const size_t block_offset{ face_offset + first * face_stride };
+        const char* block{ file.Data() + block_offset };
+        for (size_t f = 0; f != count; f++)
+        {
+            const char* face{ block + f * face_stride };
+            if (static_cast<unsigned char>(face[0]) != 3)
+            {
+                throw std::runtime_error("Face is not a triangle\n");
+            }
+            uint32_t face_indices[3];
+            std::memcpy(face_indices, face + 1, sizeof(face_indices));
+            max_index = std::max(max_index, std::max(face_indices[0], std::max(face_indices[1], face_indices[2])));
+            std::copy(face_indices, face_indices + 3, indices.data() + 3 * (first + f));
+        }
+        file.Evict(block_offset, count * face_stride);
+    }
+    if (num_faces != 0 && max_index >= num_vertices)
+    {
+        throw std::runtime_error("Face references a vertex that does not exist\n");
+    }
 
-    return { std::vector<Geometry::Point3f>{}, std::vector<Geometry::Vector3f>{},
-             std::vector<Geometry::Vector2f>{}, std::vector<TriangleDescription>{}};
+    return true;
 }
 
-const Mesh LoadPLY(const std::string& filename, bool load_normal, bool load_uv)
+// Convert values of the given type to the output type, the output is written through bytes since it is a buffer of
+// geometric types
+template <typename Source, typename Value>
+void ConvertValues(const uint8_t* values, size_t num_values, void* output) noexcept
+{
+    for (size_t i = 0; i != num_values; i++)
+    {
+        Source source;
+        std::memcpy(&source, values + i * sizeof(Source), sizeof(Source));
+        const Value value{ static_cast<Value>(source) };
+        std::memcpy(static_cast<unsigned char*>(output) + i * sizeof(Value), &value, sizeof(Value));
+    }
+}
+
+// Copy the values read by tinyply to the output converting them from the type they are stored with in the file
+template <typename Value>
+void CopyPLYData(tinyply::PlyData& ply_data, size_t num_values, void* output)
+{
+    const uint8_t* values{ ply_data.buffer.get() };
+    switch (ply_data.t)
+    {
+        case tinyply::Type::INT8:
+            ConvertValues<int8_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::UINT8:
+            ConvertValues<uint8_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::INT16:
+            ConvertValues<int16_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::UINT16:
+            ConvertValues<uint16_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::INT32:
+            ConvertValues<int32_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::UINT32:
+            ConvertValues<uint32_t, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::FLOAT32:
+            ConvertValues<float, Value>(values, num_values, output);
+            break;
+        case tinyply::Type::FLOAT64:
+            ConvertValues<double, Value>(values, num_values, output);
+            break;
+        default:
+            throw std::runtime_error("Invalid PLY property type\n");
+    }
+}
+
+// Add the normal of the triangles in [first_triangle, last_triangle) to the normals of their vertices, the normals
+// buffer starts at the given vertex
+void AccumulateFaceNormals(const std::vector<Geometry::Point3f>& vertices, const std::vector<unsigned int>& indices,
+                           unsigned int first_triangle, unsigned int last_triangle, unsigned int first_vertex,
+                           Geometry::Vector3f* normals) noexcept
+{
+    for (size_t f = 3 * static_cast<size_t>(first_triangle); f != 3 * static_cast<size_t>(last_triangle); f += 3)
+    {
+        const unsigned int i0{ indices[f] };
+        const unsigned int i1{ indices[f + 1] };
+        const unsigned int i2{ indices[f + 2] };
+
+        const Geometry::Point3f& v0{ vertices[i0] };
+        const Geometry::Point3f& v1{ vertices[i1] };
+        const Geometry::Point3f& v2{ vertices[i2] };
+
+        // We avoid normalisation here to give a weight to the normal proportional to the triangle size
+        const Geometry::Vector3f normal{ Cross(v1 - v0, v2 - v0) };
+
+        normals[i0 - first_vertex] += normal;
+        normals[i1 - first_vertex] += normal;
+        normals[i2 - first_vertex] += normal;
+    }
+}
+
+// Read any PLY file with tinyply
+void ReadPLY(const std::string& filename, bool load_normal, bool load_uv,
+             std::vector<Geometry::Point3f>& vertices, std::vector<Geometry::Vector3f>& normals,
+             std::vector<Geometry::Vector2f>& uvs, std::vector<unsigned int>& indices)
 {
     using namespace tinyply;
 
@@ -139,38 +545,543 @@ const Mesh LoadPLY(const std::string& filename, bool load_normal, bool load_uv)
     // Read file
     ply_file.read(file);
 
-    // Allocate space for vertices / indices and copy
-    std::vector<Geometry::Point3f> vertices(ply_vertices->count);
-    std::memcpy(vertices.data(), ply_vertices->buffer.get(), ply_vertices->buffer.size_bytes());
+    // Allocate space for vertices / indices and copy, the properties can be stored with any type
+    vertices.resize(ply_vertices->count);
+    CopyPLYData<float>(*ply_vertices, 3 * vertices.size(), vertices.data());
 
-    // Create faces
-    std::vector<unsigned int> indices(ply_indices->count * 3);
-    std::memcpy(indices.data(), ply_indices->buffer.get(), ply_indices->buffer.size_bytes());
+    indices.resize(ply_indices->count * 3);
+    CopyPLYData<unsigned int>(*ply_indices, indices.size(), indices.data());
 
-    // Store normals
-    std::vector<Geometry::Vector3f> normals;
     if (load_normal)
     {
         normals.resize(ply_normals->count);
-        std::memcpy(normals.data(), ply_normals->buffer.get(), ply_normals->buffer.size_bytes());
+        CopyPLYData<float>(*ply_normals, 3 * normals.size(), normals.data());
     }
-    else
+
+    if (load_uv)
+    {
+        uvs.resize(ply_uvs->count);
+        CopyPLYData<float>(*ply_uvs, 2 * uvs.size(), uvs.data());
+    }
+}
+
+// Powers of ten exactly represented by a double
+constexpr double EXACT_POWERS_OF_TEN[]{ 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// Kind of the lines of an OBJ file we read, all the other lines are ignored
+enum class OBJKeyword
+{
+    POSITION,
+    NORMAL,
+    UV,
+    FACE,
+    OTHER
+};
+
+// Number of positions, normals and UVs of a chunk of an OBJ file, they become the offsets of the chunk elements
+struct OBJCounts
+{
+    size_t positions;
+    size_t normals;
+    size_t uvs;
+};
+
+constexpr bool IsSpace(char c) noexcept
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+constexpr bool IsDigit(char c) noexcept
+{
+    return c >= '0' && c <= '9';
+}
+
+const char* SkipSpaces(const char* cursor, const char* end) noexcept
+{
+    while (cursor != end && IsSpace(*cursor))
     {
+        cursor++;
+    }
+
+    return cursor;
+}
+
+// Call function(line_begin, line_end) for each line in the range, the line end excludes the new line
+template <typename Function>
+void ForEachLine(const char* begin, const char* end, Function&& function)
+{
+    while (begin < end)
+    {
+        const char* line_end{ static_cast<const char*>(std::memchr(begin, '\n', static_cast<size_t>(end - begin))) };
+        if (line_end == nullptr)
+        {
+            line_end = end;
+        }
+        function(begin, line_end);
+        begin = line_end + 1;
+    }
+}
+
+// Read the keyword at the start of the line and move the cursor after it
+OBJKeyword ParseOBJKeyword(const char*& cursor, const char* end) noexcept
+{
+    cursor = SkipSpaces(cursor, end);
+    const char* keyword_end{ cursor };
+    while (keyword_end != end && !IsSpace(*keyword_end))
+    {
+        keyword_end++;
+    }
+    const size_t keyword_length{ static_cast<size_t>(keyword_end - cursor) };
+    OBJKeyword keyword{ OBJKeyword::OTHER };
+    if (keyword_length == 1 && cursor[0] == 'v')
+    {
+        keyword = OBJKeyword::POSITION;
+    }
+    else if (keyword_length == 2 && cursor[0] == 'v' && cursor[1] == 'n')
+    {
+        keyword = OBJKeyword::NORMAL;
+    }
+    else if (keyword_length == 2 && cursor[0] == 'v' && cursor[1] == 't')
+    {
+        keyword = OBJKeyword::UV;
+    }
+    else if (keyword_length == 1 && cursor[0] == 'f')
+    {
+        keyword = OBJKeyword::FACE;
+    }
+    cursor = keyword_end;
+
+    return keyword;
+}
+
+// Parse the float at the cursor and move the cursor after it, returns false if there is no valid number. The digits
+// are accumulated in an integer scaled once by an exact power of ten, which is exact up to the final rounding for
+// numbers with at most 19 significant digits and small exponents. The other numbers are parsed by strtof
+bool ParseFloat(const char*& cursor, const char* end, float& value) noexcept
+{
+    const char* c{ cursor };
+    const bool negative{ c != end && *c == '-' };
+    if (c != end && (*c == '-' || *c == '+'))
+    {
+        c++;
+    }
+
+    uint64_t mantissa{ 0 };
+    int exponent{ 0 };
+    unsigned int num_digits{ 0 };
+    unsigned int num_significant_digits{ 0 };
+    for (; c != end && IsDigit(*c); c++)
+    {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*c - '0');
+        num_significant_digits += mantissa != 0;
+        num_digits++;
+        if (num_significant_digits > 19)
+        {
+            break;
+        }
+    }
+    if (c != end && *c == '.')
+    {
+        for (c++; c != end && IsDigit(*c); c++)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*c - '0');
+            num_significant_digits += mantissa != 0;
+            num_digits++;
+            exponent--;
+            if (num_significant_digits > 19)
+            {
+                break;
+            }
+        }
+    }
+    if (num_digits != 0 && c != end && (*c == 'e' || *c == 'E'))
+    {
+        c++;
+        const bool negative_exponent{ c != end && *c == '-' };
+        if (c != end && (*c == '-' || *c == '+'))
+        {
+            c++;
+        }
+        int exponent_value{ 0 };
+        const char* exponent_start{ c };
+        for (; c != end && IsDigit(*c); c++)
+        {
+            exponent_value = std::min(exponent_value * 10 + (*c - '0'), 10000);
+        }
+        exponent += exponent_start != c ? (negative_exponent ? -exponent_value : exponent_value) : 10000;
+    }
+
+    if (num_digits != 0 && num_significant_digits <= 19 && (c == end || IsSpace(*c)) &&
+        mantissa <= (uint64_t{ 1 } << 53u) && exponent >= -22 && exponent <= 22)
+    {
+        double result{ static_cast<double>(mantissa) };
+        result = exponent < 0 ? result / EXACT_POWERS_OF_TEN[-exponent] : result * EXACT_POWERS_OF_TEN[exponent];
+        value = static_cast<float>(negative ? -result : result);
+        cursor = c;
+
+        return true;
+    }
+
+    // Parse the whole token with strtof, the file is not null terminated so it is copied first
+    const char* token_end{ cursor };
+    while (token_end != end && !IsSpace(*token_end))
+    {
+        token_end++;
+    }
+    char token[64];
+    const size_t token_length{ static_cast<size_t>(token_end - cursor) };
+    if (token_length == 0 || token_length >= sizeof(token))
+    {
+        return false;
+    }
+    std::memcpy(token, cursor, token_length);
+    token[token_length] = '\0';
+    char* parsed_end;
+    value = std::strtof(token, &parsed_end);
+    if (parsed_end != token + token_length)
+    {
+        return false;
+    }
+    cursor = token_end;
+
+    return true;
+}
+
+// Parse an index of a face at the cursor and move the cursor after it, returns false if there is no index
+bool ParseIndex(const char*& cursor, const char* end, long long& index) noexcept
+{
+    const char* c{ cursor };
+    const bool negative{ c != end && *c == '-' };
+    if (c != end && (*c == '-' || *c == '+'))
+    {
+        c++;
+    }
+    if (c == end || !IsDigit(*c))
+    {
+        return false;
+    }
+    index = 0;
+    for (; c != end && IsDigit(*c); c++)
+    {
+        index = std::min(index * 10 + (*c - '0'), static_cast<long long>(std::numeric_limits<unsigned int>::max()));
+    }
+    index = negative ? -index : index;
+    cursor = c;
+
+    return true;
+}
+
+// Convert an OBJ index to an index in the list of elements, negative indices count back from the last element
+// defined before the face. Throws if the index is not in the list
+unsigned int ResolveOBJIndex(long long index, size_t num_defined, size_t num_elements)
+{
+    const long long resolved{ index > 0 ? index - 1 : static_cast<long long>(num_defined) + index };
+    if (index == 0 || resolved < 0 || static_cast<size_t>(resolved) >= num_elements)
+    {
+        throw std::runtime_error("Face references an element that does not exist\n");
+    }
+
+    return static_cast<unsigned int>(resolved);
+}
+
+// Read the floats of an element, missing optional components are left unchanged
+template <size_t N>
+void ParseOBJElement(const char* cursor, const char* end, size_t num_required, float (&components)[N])
+{
+    for (size_t i = 0; i != N; i++)
+    {
+        cursor = SkipSpaces(cursor, end);
+        if (cursor == end && i >= num_required)
+        {
+            return;
+        }
+        if (!ParseFloat(cursor, end, components[i]))
+        {
+            throw std::runtime_error("Invalid element in .obj file\n");
+        }
+    }
+}
+
+// Count the positions, normals and UVs in a range of lines
+OBJCounts CountOBJElements(const char* begin, const char* end) noexcept
+{
+    OBJCounts counts{ 0, 0, 0 };
+    ForEachLine(begin, end, [&counts](const char* line, const char* line_end) -> void
+    {
+        switch (ParseOBJKeyword(line, line_end))
+        {
+            case OBJKeyword::POSITION:
+                counts.positions++;
+                break;
+            case OBJKeyword::NORMAL:
+                counts.normals++;
+                break;
+            case OBJKeyword::UV:
+                counts.uvs++;
+                break;
+            default:
+                break;
+        }
+    });
+
+    return counts;
+}
+
+// Parse a range of lines, the elements are written starting at the offsets of the range and the faces are split
+// in fans of triangles. Normal and UV indices are used only if requested, every face needs to have them in that case
+void ParseOBJLines(const char* begin, const char* end, OBJCounts offsets, const OBJCounts& totals,
+                   bool use_normals, bool use_uvs, std::vector<Geometry::Point3f>& vertices,
+                   std::vector<Geometry::Vector3f>& normals, std::vector<Geometry::Vector2f>& uvs,
+                   std::vector<TriangleDescription>& triangles)
+{
+    // Indices of the corners of the current face
+    std::vector<unsigned int> face_indices;
+    ForEachLine(begin, end, [&](const char* line, const char* line_end) -> void
+    {
+        switch (ParseOBJKeyword(line, line_end))
+        {
+            case OBJKeyword::POSITION:
+            {
+                float components[3];
+                ParseOBJElement(line, line_end, 3, components);
+                vertices[offsets.positions++] = Geometry::Point3f{ components[0], components[1], components[2] };
+                break;
+            }
+            case OBJKeyword::NORMAL:
+            {
+                float components[3];
+                ParseOBJElement(line, line_end, 3, components);
+                if (use_normals)
+                {
+                    normals[offsets.normals] = Geometry::Vector3f{ components[0], components[1], components[2] };
+                }
+                offsets.normals++;
+                break;
+            }
+            case OBJKeyword::UV:
+            {
+                float components[2]{ 0.f, 0.f };
+                ParseOBJElement(line, line_end, 1, components);
+                if (use_uvs)
+                {
+                    uvs[offsets.uvs] = Geometry::Vector2f{ components[0], components[1] };
+                }
+                offsets.uvs++;
+                break;
+            }
+            case OBJKeyword::FACE:
+            {
+                // Corners are stored as position, normal and UV indices
+                face_indices.clear();
+                for (line = SkipSpaces(line, line_end); line != line_end; line = SkipSpaces(line, line_end))
+                {
+                    long long position_index;
+                    long long uv_index{ 0 };
+                    long long normal_index{ 0 };
+                    bool has_uv{ false };
+                    bool has_normal{ false };
+                    if (!ParseIndex(line, line_end, position_index))
+                    {
+                        throw std::runtime_error("Invalid face in .obj file\n");
+                    }
+                    if (line != line_end && *line == '/')
+                    {
+                        line++;
+                        has_uv = ParseIndex(line, line_end, uv_index);
+                        if (line != line_end && *line == '/')
+                        {
+                            line++;
+                            has_normal = ParseIndex(line, line_end, normal_index);
+                            if (!has_normal)
+                            {
+                                throw std::runtime_error("Invalid face in .obj file\n");
+                            }
+                        }
+                    }
+                    if (line != line_end && !IsSpace(*line))
+                    {
+                        throw std::runtime_error("Invalid face in .obj file\n");
+                    }
+                    if ((use_normals && !has_normal) || (use_uvs && !has_uv))
+                    {
+                        throw std::runtime_error("Face without the normal or UV indices of the other faces\n");
+                    }
+
+                    const unsigned int position{ ResolveOBJIndex(position_index, offsets.positions,
+                                                                 totals.positions) };
+                    face_indices.push_back(position);
+                    face_indices.push_back(use_normals ? ResolveOBJIndex(normal_index, offsets.normals, totals.normals)
+                                                       : position);
+                    face_indices.push_back(use_uvs ? ResolveOBJIndex(uv_index, offsets.uvs, totals.uvs)
+                                                   : TriangleDescription::INVALID_INDEX);
+                }
+                if (face_indices.size() < 9)
+                {
+                    throw std::runtime_error("Face with less than three vertices in .obj file\n");
+                }
+
+                // Split the polygon in a fan of triangles around its first corner
+                for (size_t corner = 3; corner + 3 < face_indices.size(); corner += 3)
+                {
+                    const unsigned int* c0{ face_indices.data() };
+                    const unsigned int* c1{ face_indices.data() + corner };
+                    const unsigned int* c2{ face_indices.data() + corner + 3 };
+                    triangles.emplace_back(c0[0], c1[0], c2[0], c0[1], c1[1], c2[1], c0[2], c1[2], c2[2]);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    });
+}
+
+} // anonymous namespace
+
+const Mesh LoadOBJ(const std::string& filename, bool load_normal, bool load_uv)
+{
+    ThreadPool& thread_pool{ ThreadPool::Global() };
+    const MappedFile file{ filename };
+
+    // Split the file in chunks of whole lines
+    std::vector<size_t> chunk_starts{ 0 };
+    while (file.Size() - chunk_starts.back() > OBJ_CHUNK_SIZE)
+    {
+        const size_t search_start{ chunk_starts.back() + OBJ_CHUNK_SIZE };
+        const char* line_end{ static_cast<const char*>(std::memchr(file.Data() + search_start, '\n',
+                                                                   file.Size() - search_start)) };
+        if (line_end == nullptr || line_end + 1 == file.Data() + file.Size())
+        {
+            break;
+        }
+        chunk_starts.push_back(static_cast<size_t>(line_end + 1 - file.Data()));
+    }
+    chunk_starts.push_back(file.Size());
+    const unsigned int num_chunks{ static_cast<unsigned int>(chunk_starts.size() - 1) };
+
+    // Count the elements of each chunk to know where the elements of each chunk start and resolve relative indices
+    std::vector<OBJCounts> chunk_offsets(num_chunks);
+    const auto count_elements = [&file, &chunk_starts, &chunk_offsets](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int chunk = start; chunk != end; chunk++)
+        {
+            chunk_offsets[chunk] = CountOBJElements(file.Data() + chunk_starts[chunk],
+                                                    file.Data() + chunk_starts[chunk + 1]);
+        }
+    };
+    thread_pool.ParallelFor(0, num_chunks, 1, count_elements);
+    OBJCounts totals{ 0, 0, 0 };
+    for (OBJCounts& offsets : chunk_offsets)
+    {
+        const OBJCounts chunk_counts{ offsets };
+        offsets = totals;
+        totals.positions += chunk_counts.positions;
+        totals.normals += chunk_counts.normals;
+        totals.uvs += chunk_counts.uvs;
+    }
+    if (totals.positions > std::numeric_limits<unsigned int>::max() ||
+        totals.normals > std::numeric_limits<unsigned int>::max() ||
+        totals.uvs > std::numeric_limits<unsigned int>::max())
+    {
+        throw std::runtime_error("Too many elements in .obj file\n");
+    }
+
+    // Normals are computed if they are not requested or the file does not have them
+    const bool use_normals{ load_normal && totals.normals != 0 };
+    const bool use_uvs{ load_uv && totals.uvs != 0 };
+    std::vector<Geometry::Point3f> vertices(totals.positions);
+    std::vector<Geometry::Vector3f> normals(use_normals ? totals.normals : 0);
+    std::vector<Geometry::Vector2f> uvs(use_uvs ? totals.uvs : 0);
+
+    // Parse the chunks, the errors are collected and thrown once all the chunks are done
+    std::vector<std::vector<TriangleDescription>> chunk_triangles(num_chunks);
+    std::vector<std::string> chunk_errors(num_chunks);
+    const auto parse_chunks = [&](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int chunk = start; chunk != end; chunk++)
+        {
+            try
+            {
+                ParseOBJLines(file.Data() + chunk_starts[chunk], file.Data() + chunk_starts[chunk + 1],
+                              chunk_offsets[chunk], totals, use_normals, use_uvs, vertices, normals, uvs,
+                              chunk_triangles[chunk]);
+            }
+            catch (const std::exception& exception)
+            {
+                chunk_errors[chunk] = exception.what();
+            }
+            file.Evict(chunk_starts[chunk], chunk_starts[chunk + 1] - chunk_starts[chunk]);
+        }
+    };
+    thread_pool.ParallelFor(0, num_chunks, 1, parse_chunks);
+    for (const std::string& error : chunk_errors)
+    {
+        if (!error.empty())
+        {
+            std::ostringstream error_string;
+            error_string << "Error in loading .obj file " << filename << ": " << error;
+            throw std::runtime_error(error_string.str());
+        }
+    }
+
+    // Merge the triangles of the chunks
+    size_t num_triangles{ 0 };
+    for (const std::vector<TriangleDescription>& triangles : chunk_triangles)
+    {
+        num_triangles += triangles.size();
+    }
+    std::vector<TriangleDescription> triangles;
+    triangles.reserve(num_triangles);
+    for (std::vector<TriangleDescription>& chunk : chunk_triangles)
+    {
+        for (const TriangleDescription& triangle : chunk)
+        {
+            triangles.push_back(triangle);
+        }
+        std::vector<TriangleDescription>{}.swap(chunk);
+    }
+
+    if (!use_normals)
+    {
+        std::vector<unsigned int> indices(3 * triangles.size());
+        for (size_t t = 0; t != triangles.size(); t++)
+        {
+            indices[3 * t] = triangles[t].v0;
+            indices[3 * t + 1] = triangles[t].v1;
+            indices[3 * t + 2] = triangles[t].v2;
+        }
         normals = SmoothNormals(vertices, indices);
     }
 
-    // Store uvs
+    return { std::move(vertices), std::move(normals), std::move(uvs), std::move(triangles) };
+}
+
+const Mesh LoadPLY(const std::string& filename, bool load_normal, bool load_uv)
+{
+    std::vector<Geometry::Point3f> vertices;
+    std::vector<Geometry::Vector3f> normals;
     std::vector<Geometry::Vector2f> uvs;
-    if (load_uv)
+    std::vector<unsigned int> indices;
+
+    // Binary files with float vertices and int indices are copied directly from the mapped file, all the other
+    // layouts are read by tinyply
+    const MappedFile file{ filename };
+    if (!ReadBinaryPLY(file, load_normal, load_uv, vertices, normals, uvs, indices))
     {
-        uvs.resize(ply_uvs->count);
-        std::memcpy(uvs.data(), ply_uvs->buffer.get(), ply_uvs->buffer.size_bytes());
+        ReadPLY(filename, load_normal, load_uv, vertices, normals, uvs, indices);
+    }
+
+    if (!load_normal)
+    {
+        normals = SmoothNormals(vertices, indices);
     }
 
     // Generate triangles description
+    const size_t num_triangles{ indices.size() / 3 };
     std::vector<TriangleDescription> triangles;
-    triangles.reserve(ply_indices->count);
-    for (unsigned int i = 0; i != ply_indices->count; i++)
+    triangles.reserve(num_triangles);
+    for (size_t i = 0; i != num_triangles; i++)
     {
         const unsigned int i0{ indices[3 * i] };
         const unsigned int i1{ indices[3 * i + 1] };
@@ -192,31 +1103,90 @@ const Mesh LoadPLY(const std::string& filename, bool load_normal, bool load_uv)
 std::vector<Geometry::Vector3f> SmoothNormals(const std::vector<Geometry::Point3f>& vertices,
                                               const std::vector<unsigned int>& indices)
 {
-    std::vector<Geometry::Vector3f> normals(vertices.size(), Geometry::Vector3f{ 0.f });
+    ThreadPool& thread_pool{ ThreadPool::Global() };
+    const unsigned int num_vertices{ static_cast<unsigned int>(vertices.size()) };
+    const unsigned int num_triangles{ static_cast<unsigned int>(indices.size() / 3) };
+    const unsigned int num_chunks{ std::min(thread_pool.NumThreads(),
+                                            DivideUp(num_triangles, SMOOTH_NORMALS_GRAIN_SIZE)) };
 
-    for (size_t f = 0; f != indices.size(); f += 3)
+    std::vector<Geometry::Vector3f> normals(vertices.size(), Geometry::Vector3f{ 0.f });
+    if (num_chunks <= 1)
     {
-        const unsigned int i0{ indices[f] };
-        const unsigned int i1{ indices[f + 1] };
-        const unsigned int i2{ indices[f + 2] };
-
-        const Geometry::Point3f& v0{ vertices[i0] };
-        const Geometry::Point3f& v1{ vertices[i1] };
-        const Geometry::Point3f& v2{ vertices[i2] };
-
-        // We avoid normalisation here to give a weight to the normal proportional to the triangle size
-        const Geometry::Vector3f normal{ Cross(v1 - v0, v2 - v0) };
+        AccumulateFaceNormals(vertices, indices, 0, num_triangles, 0, normals.data());
+        for (Geometry::Vector3f& n : normals)
+        {
+            Geometry::NormalizeInPlace(n);
+        }
 
-        normals[i0] += normal;
-        normals[i1] += normal;
-        normals[i2] += normal;
+        return normals;
     }
 
-    for (Geometry::Vector3f& n : normals)
+    // The first chunk of triangles accumulates in the normals, every other chunk accumulates the normals of the
+    // range of vertices it references in its own buffer. Close triangles are usually stored close to each other, so
+    // the ranges are small and mostly disjoint. Chunks whose range is larger than twice their share of the vertices
+    // get no buffer and are accumulated afterwards, such that the buffers never take more than twice the normals
+    const unsigned int chunk_size{ DivideUp(num_triangles, num_chunks) };
+    const unsigned int max_chunk_vertices{ 2 * DivideUp(num_vertices, num_chunks) };
+    std::vector<unsigned int> chunk_first_vertices(num_chunks, 0);
+    std::vector<std::vector<Geometry::Vector3f>> chunk_normals(num_chunks);
+    const auto accumulate_chunks = [&vertices, &indices, num_triangles, chunk_size, max_chunk_vertices, &normals,
+        &chunk_first_vertices, &chunk_normals](unsigned int start, unsigned int end) -> void
+    {
+        for (unsigned int chunk = start; chunk != end; chunk++)
+        {
+            const unsigned int first_triangle{ std::min(num_triangles, chunk * chunk_size) };
+            const unsigned int last_triangle{ std::min(num_triangles, first_triangle + chunk_size) };
+            if (chunk == 0)
+            {
+                AccumulateFaceNormals(vertices, indices, first_triangle, last_triangle, 0, normals.data());
+            }
+            else if (first_triangle != last_triangle)
+            {
+                const auto vertex_range = std::minmax_element(indices.begin() + 3 * first_triangle,
+                                                              indices.begin() + 3 * last_triangle);
+                if (*vertex_range.second - *vertex_range.first >= max_chunk_vertices)
+                {
+                    continue;
+                }
+                chunk_first_vertices[chunk] = *vertex_range.first;
+                chunk_normals[chunk].assign(*vertex_range.second - *vertex_range.first + 1, Geometry::Vector3f{ 0.f });
+                AccumulateFaceNormals(vertices, indices, first_triangle, last_triangle, chunk_first_vertices[chunk],
+                                      chunk_normals[chunk].data());
+            }
+        }
+    };
+    thread_pool.ParallelFor(0, num_chunks, 1, accumulate_chunks);
+    for (unsigned int chunk = 1; chunk != num_chunks; chunk++)
     {
-        Geometry::NormalizeInPlace(n);
+        if (chunk_normals[chunk].empty())
+        {
+            const unsigned int first_triangle{ std::min(num_triangles, chunk * chunk_size) };
+            const unsigned int last_triangle{ std::min(num_triangles, first_triangle + chunk_size) };
+            AccumulateFaceNormals(vertices, indices, first_triangle, last_triangle, 0, normals.data());
+        }
     }
 
+    // Sum the buffers of the other chunks for each vertex and normalize
+    const auto sum_chunks = [&normals, &chunk_first_vertices, &chunk_normals](unsigned int start,
+                                                                              unsigned int end) -> void
+    {
+        for (unsigned int chunk = 1; chunk != chunk_normals.size(); chunk++)
+        {
+            const unsigned int chunk_start{ std::max(start, chunk_first_vertices[chunk]) };
+            const unsigned int chunk_end{ std::min(end, chunk_first_vertices[chunk] +
+                                                        static_cast<unsigned int>(chunk_normals[chunk].size())) };
+            for (unsigned int v = chunk_start; v < chunk_end; v++)
+            {
+                normals[v] += chunk_normals[chunk][v - chunk_first_vertices[chunk]];
+            }
+        }
+        for (unsigned int v = start; v != end; v++)
+        {
+            Geometry::NormalizeInPlace(normals[v]);
+        }
+    };
+    thread_pool.ParallelFor(0, num_vertices, SMOOTH_NORMALS_GRAIN_SIZE, sum_chunks);
+
     return normals;
 }
 
@@ -251,5 +1221,13 @@ const Mesh LoadMesh(const std::string& filename, bool load_normal, bool load_uv)
     }
 }
 
+std::future<Mesh> LoadMeshAsync(const std::string& filename, bool load_normal, bool load_uv, ThreadPool& thread_pool)
+{
+    return thread_pool.Submit([filename, load_normal, load_uv]() -> Mesh
+                              {
+                                  return LoadMesh(filename, load_normal, load_uv);
+                              });
+}
+
 } // Rabbit namespace
 
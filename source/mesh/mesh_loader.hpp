@@ -6,6 +6,9 @@
 #define RABBIT2_MESH_LOADER_HPP
 
 #include "mesh.hpp"
+#include "utilities/thread_pool.hpp"
+
+#include <future>
 
 namespace Rabbit
 {
@@ -24,6 +27,11 @@ std::vector<Geometry::Vector3f> SmoothNormals(const std::vector<Geometry::Point3
 // Load mesh from file
 const Mesh LoadMesh(const std::string& filename, bool load_normal = true, bool load_uv = true);
 
+// Load mesh from file on the thread pool, many meshes can be loaded concurrently by submitting them all before
+// waiting. The future holds the exception thrown loading the mesh if any
+std::future<Mesh> LoadMeshAsync(const std::string& filename, bool load_normal = true, bool load_uv = true,
+                                ThreadPool& thread_pool = ThreadPool::Global());
+
 } // Rabbit namespace
 
 #endif //RABBIT2_MESH_LOADER_HPP
@@ -5,16 +5,112 @@
 #include "scene.hpp"
 #include "light/area_light.hpp"
 
+#include <stdexcept>
+
 namespace Rabbit
 {
 
-Scene::Scene(Rabbit::BVH&& bvh) noexcept
-    : bvh{ std::move(bvh) }
+// Number of rays traced together when intersecting a stream
+constexpr unsigned int STREAM_PACKET_SIZE{ 16 };
+
+Scene::Scene(Rabbit::BVH&& bvh, SceneAccelerator accelerator)
+    : Scene{ std::move(bvh), std::vector<Instance>{}, accelerator }
 {}
 
+Scene::Scene(Rabbit::BVH&& bvh, std::vector<Instance>&& instances, SceneAccelerator accelerator)
+    : bvh{ std::make_unique<BVH>(std::move(bvh)) }, accelerator{ accelerator }, instance_bvh{ std::move(instances) }
+{
+    CollapseBVH();
+}
+
+Scene::Scene(std::vector<Instance>&& instances)
+    : accelerator{ SceneAccelerator::BVH2 }, instance_bvh{ std::move(instances) }
+{
+    if (instance_bvh.Empty())
+    {
+        throw std::runtime_error("Building empty scene\n");
+    }
+}
+
+void Scene::Intersect(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                      Geometry::TriangleIntersection* intersections, unsigned int num_rays) const noexcept
+{
+    for (unsigned int first = 0; first < num_rays; first += STREAM_PACKET_SIZE)
+    {
+        const unsigned int packet_rays{ std::min(STREAM_PACKET_SIZE, num_rays - first) };
+        const unsigned int hit_mask{ bvh != nullptr ?
+                                     bvh->IntersectPacket<STREAM_PACKET_SIZE>(rays + first, intervals + first,
+                                                                              intersections + first, packet_rays) :
+                                     0u };
+        IntersectInstances(rays + first, intervals + first, intersections + first, packet_rays, hit_mask);
+    }
+}
+
+void Scene::IntersectTest(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                          bool* occluded, unsigned int num_rays) const noexcept
+{
+    for (unsigned int first = 0; first < num_rays; first += STREAM_PACKET_SIZE)
+    {
+        const unsigned int packet_rays{ std::min(STREAM_PACKET_SIZE, num_rays - first) };
+        const unsigned int triangles_occluded_mask{
+            bvh != nullptr ? bvh->IntersectPacketTest<STREAM_PACKET_SIZE>(rays + first, intervals + first,
+                                                                          packet_rays) : 0u };
+        const unsigned int occluded_mask{ IntersectInstancesTest(rays + first, intervals + first, packet_rays,
+                                                                 triangles_occluded_mask) };
+        for (unsigned int i = 0; i != packet_rays; i++)
+        {
+            occluded[first + i] = (occluded_mask >> i) & 1u;
+        }
+    }
+}
+
+const BVHRefitStatistics Scene::Refit(const BVHRefitConfig& config)
+{
+    if (bvh == nullptr)
+    {
+        return BVHRefitStatistics{};
+    }
+
+    const BVHRefitStatistics statistics{ bvh->Refit(config) };
+    CollapseBVH();
+
+    return statistics;
+}
+
+void Scene::CollapseBVH()
+{
+    if (bvh == nullptr)
+    {
+        return;
+    }
+
+    switch (accelerator)
+    {
+        case SceneAccelerator::BVH4:
+            bvh4 = std::make_unique<const BVH4>(*bvh);
+            break;
+        case SceneAccelerator::BVH8:
+            bvh8 = std::make_unique<const BVH8>(*bvh);
+            break;
+        case SceneAccelerator::BVH4_COMPRESSED:
+            compressed_bvh4 = std::make_unique<const CompressedBVH4>(*bvh);
+            break;
+        case SceneAccelerator::BVH8_COMPRESSED:
+            compressed_bvh8 = std::make_unique<const CompressedBVH8>(*bvh);
+            break;
+        default:
+            break;
+    }
+}
+
 void Scene::SetupAreaLights(unsigned int num_samples) noexcept
 {
-    for (const Triangle& triangle : bvh.Triangles())
+    if (bvh == nullptr)
+    {
+        return;
+    }
+
+    for (const Triangle& triangle : bvh->Triangles())
     {
         if (triangle.material->IsEmitting())
         {
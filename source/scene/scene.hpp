@@ -6,29 +6,120 @@
 #define RABBIT2_SCENE_HPP
 
 #include "bvh/bvh.hpp"
+#include "bvh/wide_bvh.hpp"
+#include "bvh/compressed_wide_bvh.hpp"
+#include "bvh/instance_bvh.hpp"
+#include "geometry/ray_packet.hpp"
 #include "light/light.hpp"
 
 namespace Rabbit
 {
 
+// Accelerator used to trace rays in the scene
+enum class SceneAccelerator
+{
+    BVH2,
+    BVH4,
+    BVH8,
+    // Wide BVHs with the child bounds quantized to 8 bits, smaller nodes for scenes whose tree does not fit in cache
+    BVH4_COMPRESSED,
+    BVH8_COMPRESSED
+};
+
 class Scene
 {
 public:
-    explicit Scene(BVH&& bvh) noexcept;
+    explicit Scene(BVH&& bvh, SceneAccelerator accelerator = SceneAccelerator::BVH2);
+
+    // Scene with instanced meshes on top of the triangles of the BVH, the instances are traced with a two level BVH
+    Scene(BVH&& bvh, std::vector<Instance>&& instances, SceneAccelerator accelerator = SceneAccelerator::BVH2);
+
+    // Scene made only of instanced meshes, throws if there are no instances
+    explicit Scene(std::vector<Instance>&& instances);
 
     // Intersect Ray with Scene
     bool Intersect(const Geometry::Ray& ray, Geometry::Intervalf& interval,
                    Geometry::TriangleIntersection& intersection) const noexcept
     {
-        return bvh.Intersect(ray, interval, intersection);
+        bool hit{ false };
+        if (bvh != nullptr)
+        {
+            switch (accelerator)
+            {
+                case SceneAccelerator::BVH4:
+                    hit = bvh4->Intersect(ray, interval, intersection);
+                    break;
+                case SceneAccelerator::BVH8:
+                    hit = bvh8->Intersect(ray, interval, intersection);
+                    break;
+                case SceneAccelerator::BVH4_COMPRESSED:
+                    hit = compressed_bvh4->Intersect(ray, interval, intersection);
+                    break;
+                case SceneAccelerator::BVH8_COMPRESSED:
+                    hit = compressed_bvh8->Intersect(ray, interval, intersection);
+                    break;
+                default:
+                    hit = bvh->Intersect(ray, interval, intersection);
+                    break;
+            }
+        }
+
+        // Instances only need to be closer than the hit found so far
+        return instance_bvh.Intersect(ray, interval, intersection) || hit;
     }
 
     // Check for intersection
     bool IntersectTest(const Geometry::Ray& ray, const Geometry::Intervalf& interval) const noexcept
     {
-        return bvh.IntersectTest(ray, interval);
+        if (bvh == nullptr)
+        {
+            return instance_bvh.IntersectTest(ray, interval);
+        }
+
+        switch (accelerator)
+        {
+            case SceneAccelerator::BVH4:
+                return bvh4->IntersectTest(ray, interval) || instance_bvh.IntersectTest(ray, interval);
+            case SceneAccelerator::BVH8:
+                return bvh8->IntersectTest(ray, interval) || instance_bvh.IntersectTest(ray, interval);
+            case SceneAccelerator::BVH4_COMPRESSED:
+                return compressed_bvh4->IntersectTest(ray, interval) || instance_bvh.IntersectTest(ray, interval);
+            case SceneAccelerator::BVH8_COMPRESSED:
+                return compressed_bvh8->IntersectTest(ray, interval) || instance_bvh.IntersectTest(ray, interval);
+            default:
+                return bvh->IntersectTest(ray, interval) || instance_bvh.IntersectTest(ray, interval);
+        }
+    }
+
+    // Intersect packet of rays, the rays traverse the binary BVH together and the instances one by one. Returns the
+    // mask of the rays that hit
+    template <unsigned int Size>
+    unsigned int Intersect(Geometry::RayPacket<Size>& packet) const noexcept
+    {
+        const unsigned int hit_mask{ bvh != nullptr ?
+                                     bvh->IntersectPacket<Size>(packet.rays, packet.intervals, packet.intersections,
+                                                                Size) : 0u };
+        return IntersectInstances(packet.rays, packet.intervals, packet.intersections, Size, hit_mask);
     }
 
+    // Check for intersection for a packet of rays, returns the mask of the occluded rays
+    template <unsigned int Size>
+    unsigned int IntersectTest(const Geometry::RayPacket<Size>& packet) const noexcept
+    {
+        const unsigned int occluded_mask{ bvh != nullptr ?
+                                          bvh->IntersectPacketTest<Size>(packet.rays, packet.intervals, Size) : 0u };
+        return IntersectInstancesTest(packet.rays, packet.intervals, Size, occluded_mask);
+    }
+
+    // Intersect stream of rays, consecutive rays are traced together so the stream should be ordered by coherence.
+    // Ray i hit something if intersections[i] is valid
+    void Intersect(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                   Geometry::TriangleIntersection* intersections, unsigned int num_rays) const noexcept;
+
+    // Check for intersection for a stream of rays, sets occluded[i] for each ray
+    void IntersectTest(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                       bool* occluded, unsigned int num_rays) const noexcept;
+
     // Add light to the scene
     void AddLight(std::unique_ptr<const LightInterface> light) noexcept
     {
@@ -44,9 +135,68 @@ public:
     // Setup area lights
     void SetupAreaLights(unsigned int num_samples) noexcept;
 
+    // Update the accelerators after the vertices of the meshes in the BVH moved, the wide BVHs are collapsed again
+    // from the refitted one. The instanced meshes are not updated
+    const BVHRefitStatistics Refit(const BVHRefitConfig& config = BVHRefitConfig{});
+
+    // Access instances of the scene
+    const std::vector<Instance>& Instances() const noexcept
+    {
+        return instance_bvh.Instances();
+    }
+
 private:
-    // Accelerator for triangles
-    const BVH bvh;
+    // Collapse the binary BVH into the selected wide one, if any
+    void CollapseBVH();
+
+    // Trace rays of a packet against the instances, hit_mask has the rays that already hit the triangles. Returns
+    // the updated mask
+    unsigned int IntersectInstances(const Geometry::Ray* rays, Geometry::Intervalf* intervals,
+                                    Geometry::TriangleIntersection* intersections, unsigned int num_rays,
+                                    unsigned int hit_mask) const noexcept
+    {
+        if (!instance_bvh.Empty())
+        {
+            for (unsigned int i = 0; i != num_rays; i++)
+            {
+                if (instance_bvh.Intersect(rays[i], intervals[i], intersections[i]))
+                {
+                    hit_mask |= 1u << i;
+                }
+            }
+        }
+
+        return hit_mask;
+    }
+
+    // Test the rays of a packet that are not occluded yet against the instances, returns the updated mask
+    unsigned int IntersectInstancesTest(const Geometry::Ray* rays, const Geometry::Intervalf* intervals,
+                                        unsigned int num_rays, unsigned int occluded_mask) const noexcept
+    {
+        if (!instance_bvh.Empty())
+        {
+            for (unsigned int i = 0; i != num_rays; i++)
+            {
+                if (!((occluded_mask >> i) & 1u) && instance_bvh.IntersectTest(rays[i], intervals[i]))
+                {
+                    occluded_mask |= 1u << i;
+                }
+            }
+        }
+
+        return occluded_mask;
+    }
+
+    // Accelerator for triangles, null if the scene only has instances. The wide BVHs are built from the binary one
+    // when selected
+    std::unique_ptr<BVH> bvh;
+    const SceneAccelerator accelerator;
+    std::unique_ptr<const BVH4> bvh4;
+    std::unique_ptr<const BVH8> bvh8;
+    std::unique_ptr<const CompressedBVH4> compressed_bvh4;
+    std::unique_ptr<const CompressedBVH8> compressed_bvh8;
+    // Top level BVH over the instances, empty if the scene has none
+    const InstanceBVH instance_bvh;
     // List of lights
     std::vector<std::unique_ptr<const LightInterface>> lights;
 };
@@ -0,0 +1,81 @@
+#include "visibility_benchmark.hpp"
+
+#include <chrono>
+
+namespace Rabbit
+{
+
+namespace
+{
+
+// Trace the rays in packets of Size, rays are ordered such that each packet covers a block of pixels
+template <unsigned int Size>
+unsigned int TracePackets(const Scene& scene, const std::vector<Geometry::Ray>& rays, float& elapsed_ms)
+{
+    unsigned int num_hits{ 0 };
+    const auto start{ std::chrono::high_resolution_clock::now() };
+    for (size_t first = 0; first < rays.size(); first += Size)
+    {
+        Geometry::RayPacket<Size> packet;
+        std::copy(rays.begin() + first, rays.begin() + first + Size, packet.rays);
+        num_hits += __builtin_popcount(scene.Intersect(packet));
+    }
+    const auto end{ std::chrono::high_resolution_clock::now() };
+    elapsed_ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+    return num_hits;
+}
+
+// Convert number of rays and time to millions of rays per second
+float MillionRaysPerSecond(size_t num_rays, float elapsed_ms) noexcept
+{
+    return elapsed_ms > 0.f ? num_rays / (elapsed_ms * 1000.f) : 0.f;
+}
+
+} // anonymous namespace
+
+const VisibilityBenchmarkResult BenchmarkPrimaryVisibility(const Scene& scene, const CameraInterface& camera,
+                                                           unsigned int width, unsigned int height)
+{
+    // Generate rays in 4x4 blocks, each block is split in two 4x2 blocks so the same order works for both sizes
+    std::vector<Geometry::Ray> rays;
+    rays.reserve(width * height);
+    for (unsigned int block_y = 0; block_y + 4 <= height; block_y += 4)
+    {
+        for (unsigned int block_x = 0; block_x + 4 <= width; block_x += 4)
+        {
+            for (unsigned int y = block_y; y != block_y + 4; y++)
+            {
+                for (unsigned int x = block_x; x != block_x + 4; x++)
+                {
+                    rays.push_back(camera.GenerateRayWorldSpace(Geometry::Point2ui{ x, y },
+                                                                Geometry::Point2f{ 0.5f, 0.5f }));
+                }
+            }
+        }
+    }
+
+    // Single rays
+    VisibilityBenchmarkResult result;
+    const auto start{ std::chrono::high_resolution_clock::now() };
+    for (const Geometry::Ray& ray : rays)
+    {
+        Geometry::Intervalf interval{ Geometry::Ray::DefaultInterval() };
+        Geometry::TriangleIntersection intersection;
+        result.single_hits += scene.Intersect(ray, interval, intersection);
+    }
+    const auto end{ std::chrono::high_resolution_clock::now() };
+    result.single_mrps = MillionRaysPerSecond(rays.size(),
+                                              std::chrono::duration<float, std::milli>(end - start).count());
+
+    // Packets
+    float elapsed_ms;
+    result.packet8_hits = TracePackets<8>(scene, rays, elapsed_ms);
+    result.packet8_mrps = MillionRaysPerSecond(rays.size(), elapsed_ms);
+    result.packet16_hits = TracePackets<16>(scene, rays, elapsed_ms);
+    result.packet16_mrps = MillionRaysPerSecond(rays.size(), elapsed_ms);
+
+    return result;
+}
+
+} // Rabbit namespace
@@ -0,0 +1,34 @@
+#ifndef RABBIT2_VISIBILITY_BENCHMARK_HPP
+#define RABBIT2_VISIBILITY_BENCHMARK_HPP
+
+#include "scene.hpp"
+#include "camera/camera.hpp"
+
+namespace Rabbit
+{
+
+// Throughput of primary visibility for single rays and coherent packets, in millions of rays per second
+struct VisibilityBenchmarkResult
+{
+    VisibilityBenchmarkResult() noexcept
+        : single_mrps{ 0.f }, packet8_mrps{ 0.f }, packet16_mrps{ 0.f },
+          single_hits{ 0 }, packet8_hits{ 0 }, packet16_hits{ 0 }
+    {}
+
+    float single_mrps;
+    float packet8_mrps;
+    float packet16_mrps;
+    // Number of rays that hit something for each method, they should agree
+    unsigned int single_hits;
+    unsigned int packet8_hits;
+    unsigned int packet16_hits;
+};
+
+// Trace one ray through the center of each pixel of a width x height image, one ray at a time and in packets built
+// from 4x2 and 4x4 pixel blocks. Pixels outside of full 4x4 blocks are skipped
+const VisibilityBenchmarkResult BenchmarkPrimaryVisibility(const Scene& scene, const CameraInterface& camera,
+                                                           unsigned int width, unsigned int height);
+
+} // Rabbit namespace
+
+#endif //RABBIT2_VISIBILITY_BENCHMARK_HPP
@@ -0,0 +1,103 @@
+#include "cache_counters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace Rabbit
+{
+
+namespace
+{
+
+#ifdef __linux__
+// Open counter of the data reads of the calling thread in user space for the given cache and result
+int OpenCacheCounter(uint64_t cache, uint64_t result) noexcept
+{
+    perf_event_attr attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_HW_CACHE;
+    attributes.size = sizeof(attributes);
+    attributes.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8u) | (result << 16u);
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+
+    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+#endif
+
+} // anonymous namespace
+
+CacheCounters::CacheCounters() noexcept
+    : descriptors{ -1, -1, -1 }, values{ 0, 0, 0 }
+{
+#ifdef __linux__
+    descriptors[L1_MISSES] = OpenCacheCounter(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS);
+    descriptors[LAST_LEVEL_ACCESSES] = OpenCacheCounter(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+    descriptors[LAST_LEVEL_MISSES] = OpenCacheCounter(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS);
+#endif
+}
+
+CacheCounters::~CacheCounters() noexcept
+{
+#ifdef __linux__
+    for (const int descriptor : descriptors)
+    {
+        if (descriptor != -1)
+        {
+            close(descriptor);
+        }
+    }
+#endif
+}
+
+bool CacheCounters::Available() const noexcept
+{
+    for (const int descriptor : descriptors)
+    {
+        if (descriptor == -1)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void CacheCounters::Start() noexcept
+{
+#ifdef __linux__
+    if (Available())
+    {
+        for (const int descriptor : descriptors)
+        {
+            ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void CacheCounters::Stop() noexcept
+{
+#ifdef __linux__
+    if (Available())
+    {
+        for (unsigned int i = 0; i != NUM_COUNTERS; i++)
+        {
+            ioctl(descriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(descriptors[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+            {
+                values[i] = 0;
+            }
+        }
+    }
+#endif
+}
+
+} // Rabbit namespace
@@ -0,0 +1,64 @@
+#ifndef RABBIT2_CACHE_COUNTERS_HPP
+#define RABBIT2_CACHE_COUNTERS_HPP
+
+#include <cstdint>
+
+namespace Rabbit
+{
+
+// Hardware counters of the data cache reads of the calling thread between Start and Stop, read through perf events.
+// They are available only on Linux and when the processor exposes them, the misses of the first level are the
+// accesses that go to L2
+class CacheCounters
+{
+public:
+    CacheCounters() noexcept;
+
+    // Disable copy
+    CacheCounters(const CacheCounters& other) = delete;
+
+    CacheCounters& operator=(const CacheCounters& rhs) = delete;
+
+    ~CacheCounters() noexcept;
+
+    // Check if the counters could be opened, the measures are 0 otherwise
+    bool Available() const noexcept;
+
+    // Reset and start counting
+    void Start() noexcept;
+
+    // Stop counting and read the counters
+    void Stop() noexcept;
+
+    uint64_t L1Misses() const noexcept
+    {
+        return values[L1_MISSES];
+    }
+
+    uint64_t LastLevelAccesses() const noexcept
+    {
+        return values[LAST_LEVEL_ACCESSES];
+    }
+
+    uint64_t LastLevelMisses() const noexcept
+    {
+        return values[LAST_LEVEL_MISSES];
+    }
+
+private:
+    enum Counter
+    {
+        L1_MISSES,
+        LAST_LEVEL_ACCESSES,
+        LAST_LEVEL_MISSES,
+        NUM_COUNTERS
+    };
+
+    // File descriptors of the perf events, -1 if not opened
+    int descriptors[NUM_COUNTERS];
+    uint64_t values[NUM_COUNTERS];
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_CACHE_COUNTERS_HPP
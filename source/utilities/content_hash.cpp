@@ -0,0 +1,71 @@
+#include "content_hash.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace Rabbit
+{
+
+// Size of the blocks a file is read in
+constexpr size_t HASH_FILE_BLOCK_SIZE{ 1u << 20u };
+
+ContentHash::ContentHash() noexcept
+    : state{ 0xCBF29CE484222325ull }
+{}
+
+void ContentHash::AddBytes(const void* data, size_t size) noexcept
+{
+    Mix(size);
+
+    // Mix whole words, the last bytes are padded with zeros
+    const unsigned char* bytes{ static_cast<const unsigned char*>(data) };
+    const size_t num_words{ size / sizeof(uint64_t) };
+    for (size_t i = 0; i != num_words; i++)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(uint64_t));
+        Mix(word);
+    }
+    const size_t tail_size{ size - num_words * sizeof(uint64_t) };
+    if (tail_size != 0)
+    {
+        uint64_t word{ 0 };
+        std::memcpy(&word, bytes + num_words * sizeof(uint64_t), tail_size);
+        Mix(word);
+    }
+}
+
+void ContentHash::AddFile(const std::string& filename)
+{
+    std::ifstream file{ filename, std::ios::binary };
+    if (!file.is_open())
+    {
+        std::ostringstream error_string;
+        error_string << "Could not open file: " << filename << "\n";
+        throw std::runtime_error(error_string.str());
+    }
+
+    std::vector<char> block(HASH_FILE_BLOCK_SIZE);
+    while (file)
+    {
+        file.read(block.data(), block.size());
+        AddBytes(block.data(), static_cast<size_t>(file.gcount()));
+    }
+    if (!file.eof())
+    {
+        std::ostringstream error_string;
+        error_string << "Error reading file: " << filename << "\n";
+        throw std::runtime_error(error_string.str());
+    }
+}
+
+void ContentHash::Mix(uint64_t word) noexcept
+{
+    state = (state ^ word) * 0x9E3779B97F4A7C15ull;
+    state ^= state >> 32u;
+}
+
+} // Rabbit namespace
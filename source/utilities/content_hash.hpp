@@ -0,0 +1,46 @@
+#ifndef RABBIT2_CONTENT_HASH_HPP
+#define RABBIT2_CONTENT_HASH_HPP
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+namespace Rabbit
+{
+
+// Hash of a sequence of values and files, used to detect when the content a cache was built from changed. It is fast
+// but not meant to resist collisions built on purpose
+class ContentHash
+{
+public:
+    ContentHash() noexcept;
+
+    // Add bytes to the hash, the size is included such that consecutive buffers are not confused
+    void AddBytes(const void* data, size_t size) noexcept;
+
+    // Add the bytes of a value
+    template <typename T>
+    void Add(const T& value) noexcept
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values can be hashed");
+        AddBytes(&value, sizeof(T));
+    }
+
+    // Add the content of a file, throws if it can not be read
+    void AddFile(const std::string& filename);
+
+    uint64_t Value() const noexcept
+    {
+        return state;
+    }
+
+private:
+    // Mix a word in the state
+    void Mix(uint64_t word) noexcept;
+
+    uint64_t state;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_CONTENT_HASH_HPP
@@ -0,0 +1,115 @@
+#include "mapped_file.hpp"
+#include "memory.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rabbit
+{
+
+MappedFile::MappedFile(const std::string& filename)
+    : data{ nullptr }, size{ 0 }
+{
+#if defined(__linux__) || defined(__APPLE__)
+    const int descriptor{ open(filename.c_str(), O_RDONLY) };
+    struct stat file_status;
+    if (descriptor == -1 || fstat(descriptor, &file_status) != 0)
+    {
+        if (descriptor != -1)
+        {
+            close(descriptor);
+        }
+        std::ostringstream error_string;
+        error_string << "Could not open file: " << filename << "\n";
+        throw std::runtime_error(error_string.str());
+    }
+    size = static_cast<size_t>(file_status.st_size);
+    if (size != 0)
+    {
+        void* mapping{ mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0) };
+        if (mapping == MAP_FAILED)
+        {
+            close(descriptor);
+            std::ostringstream error_string;
+            error_string << "Could not map file: " << filename << "\n";
+            throw std::runtime_error(error_string.str());
+        }
+        data = static_cast<const char*>(mapping);
+    }
+    close(descriptor);
+#else
+    std::ifstream file{ filename, std::ios::binary | std::ios::ate };
+    if (!file.is_open())
+    {
+        std::ostringstream error_string;
+        error_string << "Could not open file: " << filename << "\n";
+        throw std::runtime_error(error_string.str());
+    }
+    size = static_cast<size_t>(file.tellg());
+    if (size != 0)
+    {
+        char* buffer{ AllocateAligned<char>(size) };
+        file.seekg(0);
+        file.read(buffer, size);
+        if (!file)
+        {
+            FreeAligned(buffer);
+            std::ostringstream error_string;
+            error_string << "Error reading file: " << filename << "\n";
+            throw std::runtime_error(error_string.str());
+        }
+        data = buffer;
+    }
+#endif
+}
+
+MappedFile::~MappedFile() noexcept
+{
+#if defined(__linux__) || defined(__APPLE__)
+    if (data != nullptr)
+    {
+        munmap(const_cast<char*>(data), size);
+    }
+#else
+    FreeAligned(const_cast<char*>(data));
+#endif
+}
+
+void MappedFile::AdviseSequential() const noexcept
+{
+#if defined(__linux__) || defined(__APPLE__)
+    if (data != nullptr)
+    {
+        madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+    }
+#endif
+}
+
+void MappedFile::Evict(size_t offset, size_t length) const noexcept
+{
+#if defined(__linux__) || defined(__APPLE__)
+    // The mapping is read only, so the dropped pages are never dirty and are read back from the file
+    const size_t page_size{ static_cast<size_t>(sysconf(_SC_PAGESIZE)) };
+    const size_t end{ std::min(offset + length, size) };
+    const size_t first_page{ (offset + page_size - 1) / page_size * page_size };
+    const size_t last_page{ end / page_size * page_size };
+    if (data != nullptr && first_page < last_page)
+    {
+        madvise(const_cast<char*>(data) + first_page, last_page - first_page, MADV_DONTNEED);
+    }
+#else
+    static_cast<void>(offset);
+    static_cast<void>(length);
+#endif
+}
+
+} // Rabbit namespace
@@ -0,0 +1,50 @@
+#ifndef RABBIT2_MAPPED_FILE_HPP
+#define RABBIT2_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace Rabbit
+{
+
+// Read only content of a file. The file is mapped in memory where mapping is available and read in aligned memory
+// otherwise, in both cases the content starts at an address aligned at least to the cache line size
+class MappedFile
+{
+public:
+    // Map the file, throws if it can not be opened or mapped
+    explicit MappedFile(const std::string& filename);
+
+    // Disable copy
+    MappedFile(const MappedFile& other) = delete;
+
+    MappedFile& operator=(const MappedFile& rhs) = delete;
+
+    ~MappedFile() noexcept;
+
+    // Content of the file, null if the file is empty
+    const char* Data() const noexcept
+    {
+        return data;
+    }
+
+    size_t Size() const noexcept
+    {
+        return size;
+    }
+
+    // Hint that the content is going to be read from start to end
+    void AdviseSequential() const noexcept;
+
+    // Drop the pages of a range that has been consumed from the memory of the process, they are read again from the
+    // file if accessed. Only the pages fully inside the range are dropped
+    void Evict(size_t offset, size_t length) const noexcept;
+
+private:
+    const char* data;
+    size_t size;
+};
+
+} // Rabbit namespace
+
+#endif //RABBIT2_MAPPED_FILE_HPP
@@ -7,6 +7,7 @@
 
 #include "utilities.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 
 namespace Rabbit
@@ -40,6 +41,16 @@ inline void FreeAligned(void* mem)
     std::free(mem);
 }
 
+// Copy an array in new memory allocated with AllocateAligned
+template <typename T>
+T* CopyAligned(const T* data, size_t num_elements)
+{
+    T* copy{ AllocateAligned<T>(num_elements) };
+    std::copy(data, data + num_elements, copy);
+
+    return copy;
+}
+
 } // Rabbit namespace
 
 #endif //RABBIT2_MEMORY_HPP
@@ -0,0 +1,525 @@
+#ifndef RABBIT2_SIMD_HPP
+#define RABBIT2_SIMD_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace Rabbit
+{
+namespace SIMD
+{
+
+// Number of lanes of the widest vector with a specialized implementation
+#if defined(__AVX__)
+constexpr unsigned int NATIVE_WIDTH{ 8 };
+#else
+constexpr unsigned int NATIVE_WIDTH{ 4 };
+#endif
+
+// Generic implementation of a vector of Width floats and of the masks produced by comparisons, specializations using
+// SSE for 4 lanes and AVX for 8 lanes are provided when the instruction sets are enabled at compile time
+template <unsigned int Width>
+class MaskVector
+{
+public:
+    MaskVector() noexcept = default;
+
+    explicit MaskVector(bool v) noexcept
+    {
+        std::fill(lanes, lanes + Width, v);
+    }
+
+    bool operator[](unsigned int i) const noexcept
+    {
+        return lanes[i];
+    }
+
+    bool& operator[](unsigned int i) noexcept
+    {
+        return lanes[i];
+    }
+
+    // Bitmask with bit i set if lane i is set
+    unsigned int Bits() const noexcept
+    {
+        unsigned int bits{ 0 };
+        for (unsigned int i = 0; i != Width; i++)
+        {
+            bits |= static_cast<unsigned int>(lanes[i]) << i;
+        }
+        return bits;
+    }
+
+private:
+    bool lanes[Width];
+};
+
+template <unsigned int Width>
+class FloatVector
+{
+public:
+    FloatVector() noexcept = default;
+
+    explicit FloatVector(float v) noexcept
+    {
+        std::fill(lanes, lanes + Width, v);
+    }
+
+    // Load from memory aligned to the vector size
+    static FloatVector Load(const float* p) noexcept
+    {
+        FloatVector r;
+        std::memcpy(r.lanes, p, Width * sizeof(float));
+        return r;
+    }
+
+    // Load Width unsigned bytes converted to floats
+    static FloatVector LoadBytes(const uint8_t* p) noexcept
+    {
+        FloatVector r;
+        std::copy(p, p + Width, r.lanes);
+        return r;
+    }
+
+    void Store(float* p) const noexcept
+    {
+        std::memcpy(p, lanes, Width * sizeof(float));
+    }
+
+    float operator[](unsigned int i) const noexcept
+    {
+        return lanes[i];
+    }
+
+    float& operator[](unsigned int i) noexcept
+    {
+        return lanes[i];
+    }
+
+private:
+    float lanes[Width];
+};
+
+// Generic operations, applied lane by lane
+template <unsigned int Width, typename Function>
+inline FloatVector<Width> Apply(const FloatVector<Width>& a, const FloatVector<Width>& b, Function&& f) noexcept
+{
+    FloatVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = f(a[i], b[i]);
+    }
+    return r;
+}
+
+template <unsigned int Width, typename Function>
+inline MaskVector<Width> Compare(const FloatVector<Width>& a, const FloatVector<Width>& b, Function&& f) noexcept
+{
+    MaskVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = f(a[i], b[i]);
+    }
+    return r;
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> operator+(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x + y; });
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> operator-(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x - y; });
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> operator*(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x * y; });
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> operator/(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x / y; });
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> Min(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x < y ? x : y; });
+}
+
+template <unsigned int Width>
+inline FloatVector<Width> Max(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Apply(a, b, [](float x, float y) -> float { return x > y ? x : y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator<(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Compare(a, b, [](float x, float y) -> bool { return x < y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator<=(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Compare(a, b, [](float x, float y) -> bool { return x <= y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator>(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Compare(a, b, [](float x, float y) -> bool { return x > y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator>=(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Compare(a, b, [](float x, float y) -> bool { return x >= y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator==(const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    return Compare(a, b, [](float x, float y) -> bool { return x == y; });
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator&(const MaskVector<Width>& a, const MaskVector<Width>& b) noexcept
+{
+    MaskVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = a[i] && b[i];
+    }
+    return r;
+}
+
+template <unsigned int Width>
+inline MaskVector<Width> operator|(const MaskVector<Width>& a, const MaskVector<Width>& b) noexcept
+{
+    MaskVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = a[i] || b[i];
+    }
+    return r;
+}
+
+// Compute a & ~b
+template <unsigned int Width>
+inline MaskVector<Width> AndNot(const MaskVector<Width>& a, const MaskVector<Width>& b) noexcept
+{
+    MaskVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = a[i] && !b[i];
+    }
+    return r;
+}
+
+// Select lanes from a where the mask is set and from b otherwise
+template <unsigned int Width>
+inline FloatVector<Width> Select(const MaskVector<Width>& mask,
+                                 const FloatVector<Width>& a, const FloatVector<Width>& b) noexcept
+{
+    FloatVector<Width> r;
+    for (unsigned int i = 0; i != Width; i++)
+    {
+        r[i] = mask[i] ? a[i] : b[i];
+    }
+    return r;
+}
+
+#if defined(__SSE2__)
+
+template <>
+class MaskVector<4>
+{
+public:
+    MaskVector() noexcept = default;
+
+    explicit MaskVector(__m128 m) noexcept
+        : m{ m }
+    {}
+
+    explicit MaskVector(bool v) noexcept
+        : m{ _mm_castsi128_ps(_mm_set1_epi32(v ? -1 : 0)) }
+    {}
+
+    unsigned int Bits() const noexcept
+    {
+        return static_cast<unsigned int>(_mm_movemask_ps(m));
+    }
+
+    __m128 m;
+};
+
+template <>
+class FloatVector<4>
+{
+public:
+    FloatVector() noexcept = default;
+
+    explicit FloatVector(__m128 v) noexcept
+        : v{ v }
+    {}
+
+    explicit FloatVector(float f) noexcept
+        : v{ _mm_set1_ps(f) }
+    {}
+
+    static FloatVector Load(const float* p) noexcept
+    {
+        return FloatVector{ _mm_load_ps(p) };
+    }
+
+    static FloatVector LoadBytes(const uint8_t* p) noexcept
+    {
+#if defined(__SSE4_1__)
+        int32_t bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        return FloatVector{ _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes))) };
+#else
+        return FloatVector{ _mm_set_ps(p[3], p[2], p[1], p[0]) };
+#endif
+    }
+
+    void Store(float* p) const noexcept
+    {
+        _mm_store_ps(p, v);
+    }
+
+    __m128 v;
+};
+
+inline FloatVector<4> operator+(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_add_ps(a.v, b.v) };
+}
+
+inline FloatVector<4> operator-(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_sub_ps(a.v, b.v) };
+}
+
+inline FloatVector<4> operator*(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_mul_ps(a.v, b.v) };
+}
+
+inline FloatVector<4> operator/(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_div_ps(a.v, b.v) };
+}
+
+inline FloatVector<4> Min(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_min_ps(a.v, b.v) };
+}
+
+inline FloatVector<4> Max(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_max_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator<(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_cmplt_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator<=(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_cmple_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator>(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_cmpgt_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator>=(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_cmpge_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator==(const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_cmpeq_ps(a.v, b.v) };
+}
+
+inline MaskVector<4> operator&(const MaskVector<4>& a, const MaskVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_and_ps(a.m, b.m) };
+}
+
+inline MaskVector<4> operator|(const MaskVector<4>& a, const MaskVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_or_ps(a.m, b.m) };
+}
+
+inline MaskVector<4> AndNot(const MaskVector<4>& a, const MaskVector<4>& b) noexcept
+{
+    return MaskVector<4>{ _mm_andnot_ps(b.m, a.m) };
+}
+
+inline FloatVector<4> Select(const MaskVector<4>& mask, const FloatVector<4>& a, const FloatVector<4>& b) noexcept
+{
+    return FloatVector<4>{ _mm_or_ps(_mm_and_ps(mask.m, a.v), _mm_andnot_ps(mask.m, b.v)) };
+}
+
+#endif // __SSE2__
+
+#if defined(__AVX__)
+
+template <>
+class MaskVector<8>
+{
+public:
+    MaskVector() noexcept = default;
+
+    explicit MaskVector(__m256 m) noexcept
+        : m{ m }
+    {}
+
+    explicit MaskVector(bool v) noexcept
+        : m{ _mm256_castsi256_ps(_mm256_set1_epi32(v ? -1 : 0)) }
+    {}
+
+    unsigned int Bits() const noexcept
+    {
+        return static_cast<unsigned int>(_mm256_movemask_ps(m));
+    }
+
+    __m256 m;
+};
+
+template <>
+class FloatVector<8>
+{
+public:
+    FloatVector() noexcept = default;
+
+    explicit FloatVector(__m256 v) noexcept
+        : v{ v }
+    {}
+
+    explicit FloatVector(float f) noexcept
+        : v{ _mm256_set1_ps(f) }
+    {}
+
+    static FloatVector Load(const float* p) noexcept
+    {
+        return FloatVector{ _mm256_load_ps(p) };
+    }
+
+    static FloatVector LoadBytes(const uint8_t* p) noexcept
+    {
+#if defined(__AVX2__)
+        int64_t bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        return FloatVector{ _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(bytes))) };
+#else
+        return FloatVector{ _mm256_set_ps(p[7], p[6], p[5], p[4], p[3], p[2], p[1], p[0]) };
+#endif
+    }
+
+    void Store(float* p) const noexcept
+    {
+        _mm256_store_ps(p, v);
+    }
+
+    __m256 v;
+};
+
+inline FloatVector<8> operator+(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_add_ps(a.v, b.v) };
+}
+
+inline FloatVector<8> operator-(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_sub_ps(a.v, b.v) };
+}
+
+inline FloatVector<8> operator*(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_mul_ps(a.v, b.v) };
+}
+
+inline FloatVector<8> operator/(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_div_ps(a.v, b.v) };
+}
+
+inline FloatVector<8> Min(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_min_ps(a.v, b.v) };
+}
+
+inline FloatVector<8> Max(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_max_ps(a.v, b.v) };
+}
+
+inline MaskVector<8> operator<(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) };
+}
+
+inline MaskVector<8> operator<=(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) };
+}
+
+inline MaskVector<8> operator>(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) };
+}
+
+inline MaskVector<8> operator>=(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) };
+}
+
+inline MaskVector<8> operator==(const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ) };
+}
+
+inline MaskVector<8> operator&(const MaskVector<8>& a, const MaskVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_and_ps(a.m, b.m) };
+}
+
+inline MaskVector<8> operator|(const MaskVector<8>& a, const MaskVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_or_ps(a.m, b.m) };
+}
+
+inline MaskVector<8> AndNot(const MaskVector<8>& a, const MaskVector<8>& b) noexcept
+{
+    return MaskVector<8>{ _mm256_andnot_ps(b.m, a.m) };
+}
+
+inline FloatVector<8> Select(const MaskVector<8>& mask, const FloatVector<8>& a, const FloatVector<8>& b) noexcept
+{
+    return FloatVector<8>{ _mm256_blendv_ps(b.v, a.v, mask.m) };
+}
+
+#endif // __AVX__
+
+} // SIMD namespace
+} // Rabbit namespace
+
+#endif //RABBIT2_SIMD_HPP
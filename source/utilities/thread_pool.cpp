@@ -0,0 +1,92 @@
+#include "thread_pool.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace Rabbit
+{
+
+ThreadPool::ThreadPool(unsigned int num_threads, bool pin_threads)
+    : shutdown{ false }
+{
+    workers.reserve(num_threads);
+    for (unsigned int thread_id = 0; thread_id != num_threads; thread_id++)
+    {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this);
+#ifdef __linux__
+        if (pin_threads)
+        {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(thread_id % std::max(1u, std::thread::hardware_concurrency()), &cpu_set);
+            pthread_setaffinity_np(workers.back().native_handle(), sizeof(cpu_set_t), &cpu_set);
+        }
+#else
+        static_cast<void>(pin_threads);
+#endif
+    }
+}
+
+ThreadPool::~ThreadPool() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock{ tasks_mutex };
+        shutdown = true;
+    }
+    tasks_condition.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::Global()
+{
+    static ThreadPool global_pool;
+
+    return global_pool;
+}
+
+void ThreadPool::WorkerLoop() noexcept
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock{ tasks_mutex };
+            tasks_condition.wait(lock, [this]() -> bool
+                                 {
+                                     return shutdown || !tasks.empty();
+                                 });
+            // Pending tasks are still executed before leaving
+            if (tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock{ tasks_mutex };
+        if (tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+    }
+    task();
+
+    return true;
+}
+
+} // Rabbit namespace
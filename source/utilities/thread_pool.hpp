@@ -0,0 +1,147 @@
+#ifndef RABBIT2_THREAD_POOL_HPP
+#define RABBIT2_THREAD_POOL_HPP
+
+#include "utilities.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+namespace Rabbit
+{
+
+// Simple pool of worker threads processing tasks from a shared queue. Threads waiting for the result of a task can
+// help executing pending tasks, this allows tasks to spawn other tasks and wait for them without deadlocking. The
+// threads live as long as the pool so it can be reused across renders
+class ThreadPool
+{
+public:
+    // Worker i is pinned to core i modulo the number of hardware threads if requested, supported only on Linux
+    explicit ThreadPool(unsigned int num_threads = std::thread::hardware_concurrency(), bool pin_threads = false);
+
+    // Disable copy and move
+    ThreadPool(const ThreadPool& other) = delete;
+
+    ThreadPool& operator=(const ThreadPool& rhs) = delete;
+
+    ~ThreadPool() noexcept;
+
+    // Number of worker threads in the pool
+    unsigned int NumThreads() const noexcept
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    // Submit task to the pool, returns a future to the result
+    template <typename Function>
+    auto Submit(Function&& function) -> std::future<decltype(function())>;
+
+    // Wait for the given future to be ready, executing pending tasks in the meantime and blocking on the future once
+    // the queue is empty
+    template <typename T>
+    T Wait(std::future<T>& future);
+
+    // Call function(chunk_start, chunk_end) for chunks of at most grain_size elements covering [start, end), the
+    // calling thread takes part in the processing and the function returns when all chunks are done
+    template <typename Function>
+    void ParallelFor(unsigned int start, unsigned int end, unsigned int grain_size, Function&& function);
+
+    // Access global pool, created at first use with one thread per hardware thread
+    static ThreadPool& Global();
+
+private:
+    // Worker thread main loop
+    void WorkerLoop() noexcept;
+
+    // Run a pending task if any, returns false if the queue was empty
+    bool RunPendingTask();
+
+    // Worker threads
+    std::vector<std::thread> workers;
+    // Queue of tasks to execute and synchronization
+    std::deque<std::function<void()>> tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_condition;
+    // Flag set when the pool is being destroyed
+    bool shutdown;
+};
+
+template <typename Function>
+auto ThreadPool::Submit(Function&& function) -> std::future<decltype(function())>
+{
+    using ResultType = decltype(function());
+
+    // Packaged task are move only, std::function requires a copyable callable so we share it
+    const auto task{ std::make_shared<std::packaged_task<ResultType()>>(std::forward<Function>(function)) };
+    std::future<ResultType> result{ task->get_future() };
+    {
+        std::lock_guard<std::mutex> lock{ tasks_mutex };
+        tasks.emplace_back([task]() -> void
+                           {
+                               (*task)();
+                           });
+    }
+    tasks_condition.notify_one();
+
+    return result;
+}
+
+template <typename T>
+T ThreadPool::Wait(std::future<T>& future)
+{
+    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        // All the pending tasks were taken, the one we wait for is running on another thread
+        if (!RunPendingTask())
+        {
+            future.wait();
+        }
+    }
+
+    return future.get();
+}
+
+template <typename Function>
+void ThreadPool::ParallelFor(unsigned int start, unsigned int end, unsigned int grain_size, Function&& function)
+{
+    if (start >= end)
+    {
+        return;
+    }
+
+    // Submit all chunks but the first one, which is processed by the calling thread
+    const unsigned int num_chunks{ DivideUp(end - start, std::max(1u, grain_size)) };
+    const unsigned int chunk_size{ DivideUp(end - start, num_chunks) };
+    std::vector<std::future<void>> chunks;
+    chunks.reserve(num_chunks - 1);
+    for (unsigned int chunk = 1; chunk < num_chunks; chunk++)
+    {
+        const unsigned int chunk_start{ start + chunk * chunk_size };
+        if (chunk_start >= end)
+        {
+            break;
+        }
+        const unsigned int chunk_end{ std::min(end, chunk_start + chunk_size) };
+        chunks.push_back(Submit([&function, chunk_start, chunk_end]() -> void
+                                {
+                                    function(chunk_start, chunk_end);
+                                }));
+    }
+    function(start, std::min(end, start + chunk_size));
+
+    // Wait for the other chunks
+    for (auto& chunk : chunks)
+    {
+        Wait(chunk);
+    }
+}
+
+} // Rabbit namespace
+
+#endif //RABBIT2_THREAD_POOL_HPP